@@ -0,0 +1,224 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#include <math.h>
+#include <quadmath.h>
+#include "Arithmetic.h"
+#include "Exception.h"
+
+
+using namespace hnrt;
+
+
+//
+// Divides value1 by value2.
+// If the remainder is zero, true is returned with the quotient.
+// Otherwise, false is returned and the caller needs to divide them as real numbers.
+// If value2 is zero, DivideByZeroException is thrown.
+//
+bool Arithmetic::divide(__int128 value1, __int128 value2, __int128& quotient)
+{
+    if (value2 == 0)
+    {
+        throw DivideByZeroException();
+    }
+    else if (value2 == -1)
+    {
+        // The minimum divided by -1 overflows; the processor would raise SIGFPE.
+        return subtract(0, value1, quotient);
+    }
+    else if (value1 % value2)
+    {
+        return false;
+    }
+    quotient = value1 / value2;
+    return true;
+}
+
+
+//
+// Returns the number of the bits of the given value but the leading zeros.
+//
+static int getBitLength(unsigned __int128 value)
+{
+    unsigned long high = (unsigned long)(value >> 64);
+    if (high)
+    {
+        return 128 - __builtin_clzl(high);
+    }
+    return value ? 64 - __builtin_clzl((unsigned long)value) : 0;
+}
+
+
+//
+// Raises value1 to the power of value2 that is not negative.
+//
+// The exponent is taken bit by bit from the lowest, squaring the base at each bit, so that
+// it takes no more multiplications than twice the bit length of the exponent.
+// As the result has (n - 1) * value2 + 1 bits at least for the base of n bits,
+// the one too large for 128 bits is told before any multiplication.
+//
+bool Arithmetic::power(__int128 value1, __int128 value2, __int128& value)
+{
+    if (value2 == 0)
+    {
+        value = 1;
+        return true;
+    }
+    else if (value1 == 0)
+    {
+        value = 0;
+        return true;
+    }
+    else if (value1 == 1)
+    {
+        value = 1;
+        return true;
+    }
+    else if (value1 == -1)
+    {
+        value = (value2 & 1) ? -1 : 1;
+        return true;
+    }
+    int bits = getBitLength(value1 < 0 ? -(unsigned __int128)value1 : (unsigned __int128)value1);
+    if (value2 > 127 / (bits - 1))
+    {
+        return false;
+    }
+    // The base is not squared after the highest bit, where the square might overflow.
+    __int128 base = value1;
+    value = 1;
+    while (1)
+    {
+        if ((value2 & 1) && !multiply(value, base, value))
+        {
+            return false;
+        }
+        value2 >>= 1;
+        if (!value2)
+        {
+            return true;
+        }
+        else if (!multiply(base, base, base))
+        {
+            return false;
+        }
+    }
+}
+
+
+//
+// Returns value1 + value2 modulo the given modulus, where both of the values are less than it.
+//
+static unsigned __int128 addModulo(unsigned __int128 value1, unsigned __int128 value2, unsigned __int128 modulus)
+{
+    // The sum is not computed as it is, which might overflow.
+    return value1 >= modulus - value2 ? value1 - (modulus - value2) : value1 + value2;
+}
+
+
+//
+// Returns value1 * value2 modulo the given modulus, where both of the values are less than it.
+// If the modulus fits in 64 bits, so does each of the values, and the product does in 128 bits.
+// Otherwise the product is accumulated from the highest bit of value2 by doubling and adding.
+//
+static unsigned __int128 multiplyModulo(unsigned __int128 value1, unsigned __int128 value2, unsigned __int128 modulus)
+{
+    if (modulus <= ((unsigned __int128)1 << 64))
+    {
+        return value1 * value2 % modulus;
+    }
+    unsigned __int128 value = 0;
+    for (int i = getBitLength(value2) - 1; i >= 0; i--)
+    {
+        value = addModulo(value, value, modulus);
+        if ((value2 >> i) & 1)
+        {
+            value = addModulo(value, value1, modulus);
+        }
+    }
+    return value;
+}
+
+
+//
+// Raises value1 to the power of value2 that is not negative modulo value3,
+// and returns the remainder, which is not negative and less than the absolute value of value3.
+// If value3 is zero, DivideByZeroException is thrown.
+//
+// The power is taken by squaring and multiplying in the same way as power does,
+// each product of which is reduced by the modulus, so that nothing overflows.
+//
+__int128 Arithmetic::powerModulo(__int128 value1, __int128 value2, __int128 value3)
+{
+    if (value3 == 0)
+    {
+        throw DivideByZeroException();
+    }
+    unsigned __int128 modulus = value3 < 0 ? -(unsigned __int128)value3 : (unsigned __int128)value3;
+    unsigned __int128 base;
+    if (value1 < 0)
+    {
+        unsigned __int128 remainder = -(unsigned __int128)value1 % modulus;
+        base = remainder ? modulus - remainder : 0;
+    }
+    else
+    {
+        base = (unsigned __int128)value1 % modulus;
+    }
+    unsigned __int128 exponent = (unsigned __int128)value2;
+    unsigned __int128 value = 1 % modulus;
+    while (exponent)
+    {
+        if (exponent & 1)
+        {
+            value = multiplyModulo(value, base, modulus);
+        }
+        exponent >>= 1;
+        if (exponent)
+        {
+            base = multiplyModulo(base, base, modulus);
+        }
+    }
+    return (__int128)value;
+}
+
+
+//
+// Checks if the given floating point number is valid or not.
+// If not, it throws an Exception accordingly.
+//
+void Arithmetic::validate(long double value)
+{
+    int c = fpclassify(value);
+    if (c == FP_INFINITE)
+    {
+        throw OverflowException();
+    }
+    else if (c == FP_SUBNORMAL)
+    {
+        throw UnderflowException();
+    }
+    else if (c == FP_NAN)
+    {
+        throw EvaluationInabilityException();
+    }
+}
+
+
+void Arithmetic::validate(__float128 value)
+{
+    // fpclassify does not take __float128.
+    if (isinfq(value))
+    {
+        throw OverflowException();
+    }
+    else if (value != 0 && fabsq(value) < FLT128_MIN)
+    {
+        throw UnderflowException();
+    }
+    else if (isnanq(value))
+    {
+        throw EvaluationInabilityException();
+    }
+}
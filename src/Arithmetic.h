@@ -0,0 +1,55 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#ifndef IKURA_ARITHMETIC_H
+#define IKURA_ARITHMETIC_H
+
+
+namespace hnrt
+{
+    //
+    // Arithmetic kernels shared by the tree-walking evaluator and the bytecode interpreter
+    //
+    // Integer operations are done in 128 bits, into which Number widens the operations on long
+    // that overflow. Instead of letting the resulting value wrap around, they return false
+    // if it does not fit in 128 bits, and the caller needs to compute it in BigInteger.
+    //
+    class Arithmetic
+    {
+    public:
+
+        static bool add(__int128 value1, __int128 value2, __int128& value) { return !__builtin_add_overflow(value1, value2, &value); }
+        static bool subtract(__int128 value1, __int128 value2, __int128& value) { return !__builtin_sub_overflow(value1, value2, &value); }
+        static bool multiply(__int128 value1, __int128 value2, __int128& value) { return !__builtin_mul_overflow(value1, value2, &value); }
+
+        //
+        // Divides value1 by value2.
+        // If the remainder is zero, true is returned with the quotient.
+        // Otherwise, false is returned and the caller needs to divide them as real numbers.
+        // If value2 is zero, DivideByZeroException is thrown.
+        //
+        static bool divide(__int128 value1, __int128 value2, __int128& quotient);
+
+        //
+        // Raises value1 to the power of value2 that is not negative.
+        //
+        static bool power(__int128 value1, __int128 value2, __int128& value);
+
+        //
+        // Raises value1 to the power of value2 that is not negative modulo value3,
+        // and returns the remainder, which is not negative and less than the absolute value of value3.
+        // If value3 is zero, DivideByZeroException is thrown.
+        //
+        static __int128 powerModulo(__int128 value1, __int128 value2, __int128 value3);
+
+        //
+        // Checks if the given floating point number is valid or not.
+        // If not, it throws an Exception accordingly.
+        //
+        static void validate(long double value);
+        static void validate(__float128 value);
+    };
+}
+
+
+#endif //!IKURA_ARITHMETIC_H
@@ -0,0 +1,1316 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include "BigInteger.h"
+#include "Exception.h"
+
+
+using namespace hnrt;
+
+
+typedef BigInteger::Limb Limb;
+typedef std::vector<Limb> Limbs;
+typedef unsigned __int128 DoubleLimb;
+
+
+static const size_t LIMB_BITS = 64;
+static const size_t MAX_LIMBS = BigInteger::MAX_BITS / LIMB_BITS;
+
+
+// The sizes in limbs from which the faster algorithms pay off, found by measurement.
+static const size_t KARATSUBA_THRESHOLD = 32;
+static const size_t TOOM3_THRESHOLD = 160;
+static const size_t DIVISION_THRESHOLD = 64;
+static const size_t CONVERSION_THRESHOLD = 32;
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Limb kernels
+//
+// They work on the magnitudes in arrays of limbs from the lowest.
+// Unless noted otherwise, the result may be one of the operands.
+//
+//////////////////////////////////////////////////////////////////////
+
+
+static inline Limb* data(Limbs& x)
+{
+    return x.empty() ? NULL : &x[0];
+}
+
+
+static inline const Limb* data(const Limbs& x)
+{
+    return x.empty() ? NULL : &x[0];
+}
+
+
+//
+// Returns the size of the given limbs but the leading zeros.
+//
+static inline size_t trim(const Limb* x, size_t n)
+{
+    while (n && !x[n - 1])
+    {
+        n--;
+    }
+    return n;
+}
+
+
+static inline void trim(Limbs& x)
+{
+    x.resize(trim(data(x), x.size()));
+}
+
+
+static size_t getBitLength(const Limb* x, size_t n)
+{
+    n = trim(x, n);
+    return n ? n * LIMB_BITS - __builtin_clzl(x[n - 1]) : 0;
+}
+
+
+static int compare(const Limb* x, size_t xn, const Limb* y, size_t yn)
+{
+    xn = trim(x, xn);
+    yn = trim(y, yn);
+    if (xn != yn)
+    {
+        return xn < yn ? -1 : 1;
+    }
+    while (xn-- > 0)
+    {
+        if (x[xn] != y[xn])
+        {
+            return x[xn] < y[xn] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+
+//
+// r = x + y, where xn >= yn and r has xn limbs; the carry is returned.
+//
+static Limb add(Limb* r, const Limb* x, size_t xn, const Limb* y, size_t yn)
+{
+    Limb carry = 0;
+    size_t i = 0;
+    for (; i < yn; i++)
+    {
+        Limb s = x[i] + carry;
+        carry = s < carry;
+        Limb t = s + y[i];
+        carry += t < s;
+        r[i] = t;
+    }
+    for (; i < xn; i++)
+    {
+        Limb t = x[i] + carry;
+        carry = t < carry;
+        r[i] = t;
+    }
+    return carry;
+}
+
+
+//
+// r = x - y, where xn >= yn and r has xn limbs; the borrow is returned.
+//
+static Limb subtract(Limb* r, const Limb* x, size_t xn, const Limb* y, size_t yn)
+{
+    Limb borrow = 0;
+    size_t i = 0;
+    for (; i < yn; i++)
+    {
+        Limb s = x[i] - y[i];
+        Limb b = x[i] < y[i];
+        r[i] = s - borrow;
+        borrow = b + (s < borrow);
+    }
+    for (; i < xn; i++)
+    {
+        Limb t = x[i];
+        r[i] = t - borrow;
+        borrow = t < borrow;
+    }
+    return borrow;
+}
+
+
+//
+// r += x, where rn >= xn and the sum fits in rn limbs.
+// The carry stops as soon as it is absorbed, so that adding a short one to a long one is cheap.
+//
+static void addInto(Limb* r, size_t rn, const Limb* x, size_t xn)
+{
+    Limb carry = add(r, r, xn, x, xn);
+    for (size_t i = xn; carry && i < rn; i++)
+    {
+        carry = !++r[i];
+    }
+}
+
+
+//
+// r -= x, where rn >= xn and the difference is not negative.
+//
+static void subtractFrom(Limb* r, size_t rn, const Limb* x, size_t xn)
+{
+    Limb borrow = subtract(r, r, xn, x, xn);
+    for (size_t i = xn; borrow && i < rn; i++)
+    {
+        borrow = !r[i]--;
+    }
+}
+
+
+//
+// r += x * m over n limbs; the carry limb is returned.
+//
+static Limb multiplyAddLimb(Limb* r, const Limb* x, size_t n, Limb m)
+{
+    Limb carry = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        DoubleLimb p = (DoubleLimb)x[i] * m + r[i] + carry;
+        r[i] = (Limb)p;
+        carry = (Limb)(p >> LIMB_BITS);
+    }
+    return carry;
+}
+
+
+//
+// r -= x * m over n limbs; the borrow limb is returned.
+//
+static Limb multiplySubtractLimb(Limb* r, const Limb* x, size_t n, Limb m)
+{
+    Limb carry = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        DoubleLimb p = (DoubleLimb)x[i] * m + carry;
+        Limb low = (Limb)p;
+        carry = (Limb)(p >> LIMB_BITS) + (r[i] < low);
+        r[i] -= low;
+    }
+    return carry;
+}
+
+
+//
+// r = x / d, where r has n limbs; the remainder is returned.
+//
+static Limb divideLimb(Limb* r, const Limb* x, size_t n, Limb d)
+{
+    Limb remainder = 0;
+    for (size_t i = n; i-- > 0;)
+    {
+        DoubleLimb t = ((DoubleLimb)remainder << LIMB_BITS) | x[i];
+        r[i] = (Limb)(t / d);
+        remainder = (Limb)(t % d);
+    }
+    return remainder;
+}
+
+
+//
+// r = x << bits, where r gets as many limbs as needed.
+//
+static void shiftLeft(Limbs& r, const Limb* x, size_t n, size_t bits)
+{
+    size_t offset = bits / LIMB_BITS;
+    unsigned int s = bits % LIMB_BITS;
+    r.assign(n + offset + 1, 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        r[i + offset] |= x[i] << s;
+        if (s)
+        {
+            r[i + offset + 1] = x[i] >> (LIMB_BITS - s);
+        }
+    }
+    trim(r);
+}
+
+
+//
+// r = x >> bits, where r gets as many limbs as needed.
+//
+static void shiftRight(Limbs& r, const Limb* x, size_t n, size_t bits)
+{
+    size_t offset = bits / LIMB_BITS;
+    unsigned int s = bits % LIMB_BITS;
+    if (n <= offset)
+    {
+        r.clear();
+        return;
+    }
+    r.resize(n - offset);
+    for (size_t i = 0; i < n - offset; i++)
+    {
+        Limb high = i + offset + 1 < n && s ? x[i + offset + 1] << (LIMB_BITS - s) : 0;
+        r[i] = (x[i + offset] >> s) | high;
+    }
+    trim(r);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Multiplication
+//
+//////////////////////////////////////////////////////////////////////
+
+
+static void multiply(Limb* r, const Limb* x, size_t xn, const Limb* y, size_t yn);
+
+
+//
+// r = x * y, where xn >= yn > 0 and r has xn + yn limbs not overlapping either of them.
+//
+static void multiplySchoolbook(Limb* r, const Limb* x, size_t xn, const Limb* y, size_t yn)
+{
+    memset(r, 0, xn * sizeof(Limb));
+    for (size_t j = 0; j < yn; j++)
+    {
+        r[xn + j] = multiplyAddLimb(r + j, x, xn, y[j]);
+    }
+}
+
+
+//
+// r = x * y, where both have n limbs and r has 2n.
+//
+// With x = x1 * B + x0 and y = y1 * B + y0, the middle term x1 * y0 + x0 * y1 is got from
+// (x1 + x0) * (y1 + y0) minus the other two, so that it takes three half-size products instead of four.
+//
+static void multiplyKaratsuba(Limb* r, const Limb* x, const Limb* y, size_t n)
+{
+    size_t h = n / 2; // of the lower halves
+    size_t k = n - h; // of the upper halves, which are not shorter
+    multiply(r, x, h, y, h);
+    multiply(r + 2 * h, x + h, k, y + h, k);
+    Limbs sx(k + 1);
+    Limbs sy(k + 1);
+    sx[k] = add(&sx[0], x + h, k, x, h);
+    sy[k] = add(&sy[0], y + h, k, y, h);
+    Limbs z(2 * k + 2);
+    multiply(&z[0], &sx[0], k + 1, &sy[0], k + 1);
+    subtractFrom(&z[0], z.size(), r, 2 * h);
+    subtractFrom(&z[0], z.size(), r + 2 * h, 2 * k);
+    addInto(r + h, 2 * n - h, &z[0], trim(&z[0], z.size()));
+}
+
+
+//
+// Signed intermediate value of Toom-Cook multiplication
+//
+struct SignedLimbs
+{
+    Limbs limbs; // magnitude without the leading zeros
+    bool negative;
+
+    SignedLimbs() : negative(false) {}
+
+    SignedLimbs(const Limb* x, size_t n)
+        : limbs(x, x + trim(x, n))
+        , negative(false)
+    {
+    }
+};
+
+
+//
+// r = x + y, or x - y if subtracting is true.
+//
+static void add(SignedLimbs& r, const SignedLimbs& x, const SignedLimbs& y, bool subtracting)
+{
+    bool negative = y.negative != subtracting;
+    Limbs t;
+    if (x.negative == negative)
+    {
+        const Limbs& a = x.limbs.size() >= y.limbs.size() ? x.limbs : y.limbs;
+        const Limbs& b = x.limbs.size() >= y.limbs.size() ? y.limbs : x.limbs;
+        t.resize(a.size() + 1);
+        t[a.size()] = add(&t[0], data(a), a.size(), data(b), b.size());
+        negative = x.negative;
+    }
+    else if (compare(data(x.limbs), x.limbs.size(), data(y.limbs), y.limbs.size()) >= 0)
+    {
+        t.resize(x.limbs.size());
+        subtract(data(t), data(x.limbs), x.limbs.size(), data(y.limbs), y.limbs.size());
+        negative = x.negative;
+    }
+    else
+    {
+        t.resize(y.limbs.size());
+        subtract(data(t), data(y.limbs), y.limbs.size(), data(x.limbs), x.limbs.size());
+    }
+    trim(t);
+    r.limbs.swap(t);
+    r.negative = negative && !r.limbs.empty();
+}
+
+
+static void multiply(SignedLimbs& r, const SignedLimbs& x, const SignedLimbs& y)
+{
+    Limbs t(x.limbs.size() + y.limbs.size());
+    if (!x.limbs.empty() && !y.limbs.empty())
+    {
+        multiply(&t[0], &x.limbs[0], x.limbs.size(), &y.limbs[0], y.limbs.size());
+    }
+    trim(t);
+    r.limbs.swap(t);
+    r.negative = x.negative != y.negative && !r.limbs.empty();
+}
+
+
+//
+// x /= d, where x is divisible by d.
+//
+static void divideExactly(SignedLimbs& x, Limb d)
+{
+    divideLimb(data(x.limbs), data(x.limbs), x.limbs.size(), d);
+    trim(x.limbs);
+}
+
+
+//
+// r = x * y, where both have n limbs and r has 2n.
+//
+// Both are split into three parts as the polynomials of degree 2 in B, which are evaluated
+// at 0, 1, -1, -2 and infinity and multiplied there, and the product of degree 4 is
+// interpolated from the five values in Bodrato's sequence, which divides only by 2 and 3.
+//
+static void multiplyToom3(Limb* r, const Limb* x, const Limb* y, size_t n)
+{
+    size_t k = (n + 2) / 3; // of the lower two parts
+    size_t m = n - 2 * k; // of the upper part
+    SignedLimbs values[2][3]; // at 1, -1 and -2 of x and y
+    for (int i = 0; i < 2; i++)
+    {
+        const Limb* z = i ? y : x;
+        SignedLimbs z0(z, k);
+        SignedLimbs z1(z + k, k);
+        SignedLimbs z2(z + 2 * k, m);
+        SignedLimbs p;
+        add(p, z0, z2, false);
+        add(values[i][0], p, z1, false);
+        add(values[i][1], p, z1, true);
+        add(p, values[i][1], z2, false);
+        add(p, p, p, false);
+        add(values[i][2], p, z0, true);
+    }
+    multiply(r, x, k, y, k);
+    multiply(r + 4 * k, x + 2 * k, m, y + 2 * k, m);
+    SignedLimbs r0(r, 2 * k);
+    SignedLimbs rInf(r + 4 * k, 2 * m);
+    SignedLimbs r1;
+    SignedLimbs r2;
+    SignedLimbs r3;
+    SignedLimbs rm1;
+    multiply(r1, values[0][0], values[1][0]);
+    multiply(rm1, values[0][1], values[1][1]);
+    multiply(r3, values[0][2], values[1][2]);
+    add(r3, r3, r1, true);
+    divideExactly(r3, 3);
+    add(r1, r1, rm1, true);
+    divideExactly(r1, 2);
+    add(r2, rm1, r0, true);
+    add(r3, r2, r3, true);
+    divideExactly(r3, 2);
+    add(r3, r3, rInf, false);
+    add(r3, r3, rInf, false);
+    add(r2, r2, r1, false);
+    add(r2, r2, rInf, true);
+    add(r1, r1, r3, true);
+    // r0 and rInf are already in place, and the coefficients in between are not negative.
+    memset(r + 2 * k, 0, 2 * k * sizeof(Limb));
+    addInto(r + k, 2 * n - k, data(r1.limbs), r1.limbs.size());
+    addInto(r + 2 * k, 2 * n - 2 * k, data(r2.limbs), r2.limbs.size());
+    addInto(r + 3 * k, 2 * n - 3 * k, data(r3.limbs), r3.limbs.size());
+}
+
+
+//
+// r = x * y, where r has xn + yn limbs not overlapping either of them.
+// The leading zeros of the operands are allowed.
+//
+static void multiply(Limb* r, const Limb* x, size_t xn, const Limb* y, size_t yn)
+{
+    if (xn < yn)
+    {
+        std::swap(x, y);
+        std::swap(xn, yn);
+    }
+    if (!yn)
+    {
+        // r is NULL if x has no limbs either, which memset must not be given even for nothing.
+        if (xn)
+        {
+            memset(r, 0, xn * sizeof(Limb));
+        }
+    }
+    else if (yn < KARATSUBA_THRESHOLD)
+    {
+        multiplySchoolbook(r, x, xn, y, yn);
+    }
+    else if (xn > yn)
+    {
+        // The longer one is cut into the pieces as long as the shorter one.
+        memset(r, 0, (xn + yn) * sizeof(Limb));
+        Limbs t(2 * yn);
+        for (size_t i = 0; i < xn; i += yn)
+        {
+            size_t n = std::min(yn, xn - i);
+            multiply(&t[0], x + i, n, y, yn);
+            addInto(r + i, xn + yn - i, &t[0], n + yn);
+        }
+    }
+    else if (yn < TOOM3_THRESHOLD)
+    {
+        multiplyKaratsuba(r, x, y, yn);
+    }
+    else
+    {
+        multiplyToom3(r, x, y, yn);
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Division
+//
+//////////////////////////////////////////////////////////////////////
+
+
+//
+// Divides u of n + m limbs, which has the room of one more limb on top, by v of n >= 2 limbs
+// whose top bit is set, in Knuth's algorithm D.
+// q gets m + 1 limbs, and the remainder is left in the lower n limbs of u.
+//
+static void divideSchoolbook(Limb* q, Limb* u, size_t m, const Limb* v, size_t n)
+{
+    Limb v1 = v[n - 1];
+    Limb v2 = v[n - 2];
+    for (size_t j = m + 1; j-- > 0;)
+    {
+        DoubleLimb dividend = ((DoubleLimb)u[j + n] << LIMB_BITS) | u[j + n - 1];
+        DoubleLimb qhat = dividend / v1;
+        DoubleLimb rhat = dividend % v1;
+        // The estimate from the top two limbs is too large by two at most.
+        while ((qhat >> LIMB_BITS) || qhat * v2 > ((rhat << LIMB_BITS) | u[j + n - 2]))
+        {
+            qhat--;
+            rhat += v1;
+            if (rhat >> LIMB_BITS)
+            {
+                break;
+            }
+        }
+        Limb borrow = multiplySubtractLimb(u + j, v, n, (Limb)qhat);
+        Limb top = u[j + n];
+        u[j + n] = top - borrow;
+        if (top < borrow)
+        {
+            // It was still too large by one.
+            qhat--;
+            u[j + n] += add(u + j, u + j, n, v, n);
+        }
+        q[j] = (Limb)qhat;
+    }
+}
+
+
+static void divide32(Limb* q, Limb* r, const Limb* a, const Limb* b, size_t h);
+
+
+//
+// Divides a of 2n limbs by b of n limbs whose top bit is set, where a < b * B^n,
+// into q of n limbs and r of n limbs.
+//
+// The dividend is divided by halves as the digits of B^(n/2) in the long division,
+// each of which is a division of 3 by 2 digits that is reduced to the one of 2 by 1 digit
+// and a multiplication.
+//
+static void divide21(Limb* q, Limb* r, const Limb* a, const Limb* b, size_t n)
+{
+    if ((n & 1) || n < DIVISION_THRESHOLD)
+    {
+        Limbs u(2 * n + 1);
+        memcpy(&u[0], a, 2 * n * sizeof(Limb));
+        Limbs t(n + 1);
+        divideSchoolbook(&t[0], &u[0], n, b, n);
+        memcpy(q, &t[0], n * sizeof(Limb));
+        memcpy(r, &u[0], n * sizeof(Limb));
+        return;
+    }
+    size_t h = n / 2;
+    Limbs t(3 * h);
+    memcpy(&t[0], a, h * sizeof(Limb));
+    divide32(q + h, &t[h], a + h, b, h);
+    divide32(q, r, &t[0], b, h);
+}
+
+
+//
+// Divides a of 3h limbs by b of 2h limbs whose top bit is set, where a < b * B^h,
+// into q of h limbs and r of 2h limbs.
+//
+static void divide32(Limb* q, Limb* r, const Limb* a, const Limb* b, size_t h)
+{
+    const Limb* b1 = b + h;
+    // The quotient is estimated from the upper parts, and the remainder of them is put above a3.
+    Limbs x(2 * h + 1);
+    memcpy(&x[0], a, h * sizeof(Limb));
+    if (compare(a + 2 * h, h, b1, h) < 0)
+    {
+        divide21(q, &x[h], a + h, b1, h);
+    }
+    else
+    {
+        // a1 equals b1; the estimate is B^h - 1, and the remainder is a2 + b1.
+        memset(q, 0xff, h * sizeof(Limb));
+        x[2 * h] = add(&x[h], a + h, h, b1, h);
+    }
+    Limbs d(2 * h);
+    multiply(&d[0], q, h, b, h);
+    // The estimate is too large by two at most.
+    while (compare(&x[0], x.size(), &d[0], d.size()) < 0)
+    {
+        for (size_t i = 0; i < h && !q[i]--; i++)
+        {
+        }
+        x[2 * h] += add(&x[0], &x[0], 2 * h, b, 2 * h);
+    }
+    subtract(&x[0], &x[0], x.size(), &d[0], d.size());
+    memcpy(r, &x[0], 2 * h * sizeof(Limb));
+}
+
+
+//
+// Divides x by y, where y is not zero, into the quotient and the remainder without the leading zeros.
+//
+static void divide(const Limb* x, size_t xn, const Limb* y, size_t yn, Limbs& q, Limbs& r)
+{
+    xn = trim(x, xn);
+    yn = trim(y, yn);
+    if (compare(x, xn, y, yn) < 0)
+    {
+        q.clear();
+        r.assign(x, x + xn);
+        return;
+    }
+    if (yn == 1)
+    {
+        q.resize(xn);
+        r.assign(1, divideLimb(&q[0], x, xn, y[0]));
+        trim(q);
+        trim(r);
+        return;
+    }
+    if (yn < DIVISION_THRESHOLD || xn - yn < DIVISION_THRESHOLD)
+    {
+        unsigned int s = __builtin_clzl(y[yn - 1]);
+        Limbs v;
+        Limbs u;
+        shiftLeft(v, y, yn, s);
+        shiftLeft(u, x, xn, s);
+        u.resize(xn + 1);
+        q.resize(xn - yn + 1);
+        divideSchoolbook(&q[0], &u[0], xn - yn, &v[0], yn);
+        shiftRight(r, &u[0], yn, s);
+        trim(q);
+        return;
+    }
+    // Burnikel and Ziegler's; the divisor is shifted to n = j * 2^k limbs with j < DIVISION_THRESHOLD
+    // and the top bit set, so that it can be halved down to the schoolbook method.
+    size_t m = 1;
+    while (m * DIVISION_THRESHOLD <= yn)
+    {
+        m <<= 1;
+    }
+    size_t n = (yn + m - 1) / m * m;
+    size_t shift = n * LIMB_BITS - getBitLength(y, yn);
+    Limbs b;
+    Limbs a;
+    shiftLeft(b, y, yn, shift);
+    shiftLeft(a, x, xn, shift);
+    // The top block has its top bit cleared so that it is less than the divisor.
+    size_t t = std::max((getBitLength(&a[0], a.size()) + 1 + n * LIMB_BITS - 1) / (n * LIMB_BITS), (size_t)2);
+    a.resize(t * n);
+    q.assign((t - 1) * n, 0);
+    Limbs z(a.begin() + (t - 2) * n, a.end());
+    Limbs s(n);
+    for (size_t i = t - 1; i-- > 0;)
+    {
+        divide21(&q[i * n], &s[0], &z[0], &b[0], n);
+        if (i > 0)
+        {
+            memcpy(&z[0], &a[(i - 1) * n], n * sizeof(Limb));
+            memcpy(&z[n], &s[0], n * sizeof(Limb));
+        }
+    }
+    shiftRight(r, &s[0], n, shift);
+    trim(q);
+}
+
+
+//
+// x = x mod y, where y is not zero.
+//
+static void reduce(Limbs& x, const Limbs& y)
+{
+    Limbs q;
+    Limbs r;
+    divide(data(x), x.size(), data(y), y.size(), q, r);
+    x.swap(r);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Square root
+//
+//////////////////////////////////////////////////////////////////////
+
+
+//
+// s = floor(sqrt(x)).
+//
+// The root of the upper half of the bits gives the upper half of the root, which is made
+// larger than the root and refined in Newton's method; from above, the iteration goes down
+// to the root in a step or two, and stops as soon as it does not go down any longer.
+//
+static void squareRoot(Limbs& s, const Limb* x, size_t n)
+{
+    n = trim(x, n);
+    if (n <= 2)
+    {
+        unsigned __int128 value = n > 1 ? ((unsigned __int128)x[1] << LIMB_BITS) | x[0] : n ? x[0] : 0;
+        Limb r = (Limb)std::min(sqrtl((long double)value), (long double)~0UL);
+        while ((unsigned __int128)r * r > value)
+        {
+            r--;
+        }
+        while (r != ~0UL && (unsigned __int128)(r + 1) * (r + 1) <= value)
+        {
+            r++;
+        }
+        s.assign(1, r);
+        trim(s);
+        return;
+    }
+    size_t k = getBitLength(x, n) / 4;
+    Limbs h;
+    shiftRight(h, x, n, 2 * k);
+    Limbs t;
+    squareRoot(t, data(h), h.size());
+    t.push_back(0);
+    Limb one = 1;
+    addInto(&t[0], t.size(), &one, 1);
+    trim(t);
+    shiftLeft(s, data(t), t.size(), k);
+    for (;;)
+    {
+        Limbs q;
+        Limbs r;
+        divide(x, n, data(s), s.size(), q, r);
+        Limbs u(std::max(s.size(), q.size()) + 1, 0);
+        if (s.size() >= q.size())
+        {
+            u[s.size()] = add(&u[0], data(s), s.size(), data(q), q.size());
+        }
+        else
+        {
+            u[q.size()] = add(&u[0], data(q), q.size(), data(s), s.size());
+        }
+        shiftRight(r, &u[0], u.size(), 1);
+        if (compare(data(r), r.size(), data(s), s.size()) >= 0)
+        {
+            return;
+        }
+        s.swap(r);
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Radix conversion
+//
+// The decimal digits are split in halves of 19 * 2^k digits, which are converted recursively
+// and joined by multiplying or dividing by 10^(19 * 2^k), so that the conversion runs as fast
+// as the multiplication and the division do. The powers are computed once and kept for all.
+//
+//////////////////////////////////////////////////////////////////////
+
+
+static const Limb CHUNK = 10000000000000000000UL; // 10^19, the largest power of 10 in a limb
+static const size_t CHUNK_DIGITS = 19;
+
+
+static pthread_mutex_t powersMutex = PTHREAD_MUTEX_INITIALIZER;
+static std::deque<Limbs> powers; // whose elements stay in place as it grows
+
+
+//
+// Returns 10^(19 * 2^k).
+//
+static const Limbs& getPowerOf10(size_t k)
+{
+    pthread_mutex_lock(&powersMutex);
+    if (powers.empty())
+    {
+        powers.push_back(Limbs(1, CHUNK));
+    }
+    while (powers.size() <= k)
+    {
+        const Limbs& p = powers.back();
+        Limbs square(2 * p.size());
+        multiply(&square[0], &p[0], p.size(), &p[0], p.size());
+        trim(square);
+        powers.push_back(Limbs());
+        powers.back().swap(square);
+    }
+    const Limbs& power = powers[k];
+    pthread_mutex_unlock(&powersMutex);
+    return power;
+}
+
+
+//
+// x = the value of the n decimal digits.
+//
+static void parseDecimal(Limbs& x, const char* s, size_t n)
+{
+    if (n <= CONVERSION_THRESHOLD * CHUNK_DIGITS)
+    {
+        // The digits are read by 19 from the top, each of which multiplies the value by 10^19.
+        x.assign(n / CHUNK_DIGITS + 1, 0);
+        size_t size = 0;
+        size_t m = n % CHUNK_DIGITS ? n % CHUNK_DIGITS : CHUNK_DIGITS; // of the first chunk
+        for (size_t i = 0; i < n; i += m, m = CHUNK_DIGITS)
+        {
+            Limb scale = 1;
+            Limb carry = 0;
+            for (size_t j = 0; j < m; j++)
+            {
+                scale *= 10;
+                carry = carry * 10 + (s[i + j] - '0');
+            }
+            for (size_t j = 0; j < size; j++)
+            {
+                DoubleLimb p = (DoubleLimb)x[j] * scale + carry;
+                x[j] = (Limb)p;
+                carry = (Limb)(p >> LIMB_BITS);
+            }
+            if (carry)
+            {
+                x[size++] = carry;
+            }
+        }
+        x.resize(size);
+        return;
+    }
+    // The lower part has the most digits of 19 * 2^k less than n.
+    size_t k = 0;
+    while ((CHUNK_DIGITS << (k + 1)) < n)
+    {
+        k++;
+    }
+    size_t m = CHUNK_DIGITS << k;
+    Limbs high;
+    Limbs low;
+    parseDecimal(high, s, n - m);
+    parseDecimal(low, s + n - m, m);
+    const Limbs& p = getPowerOf10(k);
+    x.assign(high.size() + p.size(), 0);
+    multiply(&x[0], data(high), high.size(), &p[0], p.size());
+    addInto(&x[0], x.size(), data(low), low.size());
+    trim(x);
+}
+
+
+//
+// Writes the value of x, which is less than 10^(19 * 2^k), in 19 * 2^k digits padded with zeros.
+//
+static void formatDecimal(char* s, const Limb* x, size_t n, size_t k)
+{
+    n = trim(x, n);
+    size_t m = CHUNK_DIGITS << k;
+    if (n <= CONVERSION_THRESHOLD)
+    {
+        // The limbs are divided by 10^19, and the remainders give the digits from the lowest.
+        Limbs y(x, x + n);
+        char* p = s + m;
+        while (n)
+        {
+            Limb r = divideLimb(&y[0], &y[0], n, CHUNK);
+            n = trim(&y[0], n);
+            for (size_t i = 0; i < CHUNK_DIGITS; i++)
+            {
+                *--p = (char)('0' + r % 10);
+                r /= 10;
+            }
+        }
+        memset(s, '0', p - s);
+        return;
+    }
+    const Limbs& p = getPowerOf10(k - 1);
+    Limbs q;
+    Limbs r;
+    divide(x, n, &p[0], p.size(), q, r);
+    formatDecimal(s, data(q), q.size(), k - 1);
+    formatDecimal(s + m / 2, data(r), r.size(), k - 1);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Operands
+//
+//////////////////////////////////////////////////////////////////////
+
+
+void BigInteger::Operand::set(__int128 value)
+{
+    unsigned __int128 magnitude = value < 0 ? -(unsigned __int128)value : (unsigned __int128)value;
+    negative = value < 0;
+    local[0] = (Limb)magnitude;
+    local[1] = (Limb)(magnitude >> LIMB_BITS);
+    limbs = local;
+    size = trim(local, 2);
+}
+
+
+void BigInteger::Operand::set(const BigInteger& value)
+{
+    negative = value.negative;
+    size = value.size;
+    limbs = value.limbs;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Allocation
+//
+//////////////////////////////////////////////////////////////////////
+
+
+//
+// Returns a new BigInteger of the given limbs, or NULL if it has more than MAX_BITS bits.
+//
+BigInteger* BigInteger::create(bool negative, const Limb* limbs, size_t size)
+{
+    size = trim(limbs, size);
+    if (::getBitLength(limbs, size) > MAX_BITS)
+    {
+        return NULL;
+    }
+    char* block = new char[offsetof(BigInteger, limbs) + (size ? size : 1) * sizeof(Limb)];
+    BigInteger* x = (BigInteger*)block;
+    x->refs = 1;
+    x->negative = negative && size;
+    x->size = size;
+    if (size)
+    {
+        // limbs can be NULL for zero.
+        memcpy(x->limbs, limbs, size * sizeof(Limb));
+    }
+    return x;
+}
+
+
+void BigInteger::destroy(BigInteger* x)
+{
+    delete[] (char*)x;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Conversion
+//
+//////////////////////////////////////////////////////////////////////
+
+
+bool BigInteger::toInteger128(__int128& value) const
+{
+    if (size > 2)
+    {
+        return false;
+    }
+    unsigned __int128 magnitude = size > 1 ? ((unsigned __int128)limbs[1] << LIMB_BITS) | limbs[0] : size ? limbs[0] : 0;
+    if (magnitude > ((unsigned __int128)1 << 127) - (negative ? 0 : 1))
+    {
+        return false;
+    }
+    value = negative ? (__int128)-magnitude : (__int128)magnitude;
+    return true;
+}
+
+
+long double BigInteger::toRealNumber() const
+{
+    long exponent;
+    long double mantissa = toRealNumber(Operand(*this), exponent);
+    return ldexpl(mantissa, (int)exponent);
+}
+
+
+long double BigInteger::toRealNumber(const Operand& x, long& exponent)
+{
+    size_t n = x.getSize();
+    const Limb* limbs = x.getLimbs();
+    if (!n)
+    {
+        exponent = 0;
+        return 0;
+    }
+    // The top two limbs are enough for the 64-bit mantissa; the ones below are made a sticky bit
+    // so that the top ones are rounded to the nearest just as the whole.
+    unsigned __int128 top = limbs[n - 1];
+    size_t shift = 0;
+    if (n > 1)
+    {
+        top = (top << LIMB_BITS) | limbs[n - 2];
+        shift = (n - 2) * LIMB_BITS;
+        if (trim(limbs, n - 2))
+        {
+            top |= 1;
+        }
+    }
+    int e;
+    long double mantissa = frexpl((long double)top, &e);
+    exponent = (long)shift + e;
+    return x.isNegative() ? -mantissa : mantissa;
+}
+
+
+void BigInteger::formatDecimal(std::vector<char>& buffer) const
+{
+    // The digits are written in 19 * 2^k columns enough for the value, and the leading zeros are dropped.
+    // log10(2) < 0.30103
+    size_t n = ::getBitLength(limbs, size) * 30103 / 100000 + 1;
+    size_t k = 0;
+    while ((CHUNK_DIGITS << k) < n)
+    {
+        k++;
+    }
+    std::vector<char> digits(CHUNK_DIGITS << k);
+    ::formatDecimal(&digits[0], limbs, size, k);
+    size_t start = 0;
+    while (start < digits.size() - 1 && digits[start] == '0')
+    {
+        start++;
+    }
+    buffer.insert(buffer.end(), digits.begin() + start, digits.end());
+}
+
+
+void BigInteger::formatHexadecimal(std::vector<char>& buffer) const
+{
+    // The sign needs one more bit than the magnitude.
+    size_t n = (::getBitLength(limbs, size) + LIMB_BITS) / LIMB_BITS;
+    Limbs x(limbs, limbs + size);
+    x.resize(n);
+    if (negative)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            x[i] = ~x[i];
+        }
+        Limb one = 1;
+        addInto(&x[0], n, &one, 1);
+    }
+    buffer.push_back('0');
+    buffer.push_back('x');
+    char tmp[24];
+    for (size_t i = n; i-- > 0;)
+    {
+        sprintf(tmp, "%016lx", x[i]);
+        buffer.insert(buffer.end(), tmp, tmp + 16);
+    }
+}
+
+
+BigInteger* BigInteger::parseDecimal(const char* s, size_t n)
+{
+    while (n > 1 && *s == '0')
+    {
+        s++;
+        n--;
+    }
+    // log2(10) > 3.32
+    if ((n - 1) / 100 * 332 > MAX_BITS)
+    {
+        throw OverflowException();
+    }
+    Limbs x;
+    ::parseDecimal(x, s, n);
+    BigInteger* value = create(false, data(x), x.size());
+    if (!value)
+    {
+        throw OverflowException();
+    }
+    return value;
+}
+
+
+BigInteger* BigInteger::parseHexadecimal(const char* s, size_t n)
+{
+    size_t size = (n + 15) / 16;
+    if (size > MAX_LIMBS + 1)
+    {
+        throw OverflowException();
+    }
+    Limbs x(size, 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        int c = s[n - 1 - i];
+        Limb digit = isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+        x[i / 16] |= digit << (i % 16 * 4);
+    }
+    bool negative = (x[size - 1] >> (LIMB_BITS - 1)) ? true : false;
+    if (negative)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            x[i] = ~x[i];
+        }
+        Limb one = 1;
+        addInto(&x[0], size, &one, 1);
+        if (!trim(&x[0], size))
+        {
+            // -2^(64 * size - 1) complemented back into its magnitude overflows into zero.
+            x.push_back(1);
+        }
+    }
+    BigInteger* value = create(negative, &x[0], x.size());
+    if (!value)
+    {
+        throw OverflowException();
+    }
+    return value;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Operations
+//
+//////////////////////////////////////////////////////////////////////
+
+
+size_t BigInteger::getBitLength(const Operand& x)
+{
+    return ::getBitLength(x.getLimbs(), x.getSize());
+}
+
+
+BigInteger* BigInteger::copy(const Operand& x)
+{
+    return create(x.isNegative(), x.getLimbs(), x.getSize());
+}
+
+
+BigInteger* BigInteger::add(const Operand& x, const Operand& y)
+{
+    SignedLimbs sx(x.getLimbs(), x.getSize());
+    SignedLimbs sy(y.getLimbs(), y.getSize());
+    sx.negative = x.isNegative();
+    sy.negative = y.isNegative();
+    ::add(sx, sx, sy, false);
+    return create(sx.negative, data(sx.limbs), sx.limbs.size());
+}
+
+
+BigInteger* BigInteger::subtract(const Operand& x, const Operand& y)
+{
+    SignedLimbs sx(x.getLimbs(), x.getSize());
+    SignedLimbs sy(y.getLimbs(), y.getSize());
+    sx.negative = x.isNegative();
+    sy.negative = y.isNegative();
+    ::add(sx, sx, sy, true);
+    return create(sx.negative, data(sx.limbs), sx.limbs.size());
+}
+
+
+BigInteger* BigInteger::multiply(const Operand& x, const Operand& y)
+{
+    if (::getBitLength(x.getLimbs(), x.getSize()) + ::getBitLength(y.getLimbs(), y.getSize()) > MAX_BITS + 1)
+    {
+        return NULL;
+    }
+    Limbs r(x.getSize() + y.getSize());
+    ::multiply(data(r), x.getLimbs(), x.getSize(), y.getLimbs(), y.getSize());
+    return create(x.isNegative() != y.isNegative(), data(r), r.size());
+}
+
+
+bool BigInteger::divide(const Operand& x, const Operand& y, BigInteger*& quotient)
+{
+    if (y.isZero())
+    {
+        throw DivideByZeroException();
+    }
+    Limbs q;
+    Limbs r;
+    ::divide(x.getLimbs(), x.getSize(), y.getLimbs(), y.getSize(), q, r);
+    if (!r.empty())
+    {
+        return false;
+    }
+    quotient = create(x.isNegative() != y.isNegative(), data(q), q.size());
+    return true;
+}
+
+
+BigInteger* BigInteger::divideTruncated(const Operand& x, const Operand& y, bool& inexact)
+{
+    if (y.isZero())
+    {
+        throw DivideByZeroException();
+    }
+    Limbs q;
+    Limbs r;
+    ::divide(x.getLimbs(), x.getSize(), y.getLimbs(), y.getSize(), q, r);
+    inexact = !r.empty();
+    return create(x.isNegative() != y.isNegative(), data(q), q.size());
+}
+
+
+BigInteger* BigInteger::shiftLeft(const Operand& x, size_t bits)
+{
+    if (!x.isZero() && bits > MAX_BITS)
+    {
+        return NULL;
+    }
+    Limbs r;
+    ::shiftLeft(r, x.getLimbs(), x.getSize(), bits);
+    return create(x.isNegative(), data(r), r.size());
+}
+
+
+BigInteger* BigInteger::shiftRight(const Operand& x, size_t bits)
+{
+    Limbs r;
+    ::shiftRight(r, x.getLimbs(), x.getSize(), bits);
+    return create(x.isNegative(), data(r), r.size());
+}
+
+
+BigInteger* BigInteger::squareRoot(const Operand& x, bool& inexact)
+{
+    Limbs s;
+    ::squareRoot(s, x.getLimbs(), x.getSize());
+    Limbs t(2 * s.size());
+    ::multiply(data(t), data(s), s.size(), data(s), s.size());
+    inexact = compare(data(t), t.size(), x.getLimbs(), x.getSize()) != 0;
+    return create(false, data(s), s.size());
+}
+
+
+//
+// The exponent is taken bit by bit from the highest, so that the growing value is always
+// multiplied by the base, which is shorter than the square.
+//
+BigInteger* BigInteger::power(const Operand& x, unsigned long y)
+{
+    size_t bits = ::getBitLength(x.getLimbs(), x.getSize());
+    if (!y)
+    {
+        Limb one = 1;
+        return create(false, &one, 1);
+    }
+    if (bits > 1 && (bits - 1) > (MAX_BITS - 1) / y)
+    {
+        // It would have (bits - 1) * y + 1 bits at least.
+        return NULL;
+    }
+    Limbs r(x.getLimbs(), x.getLimbs() + x.getSize());
+    Limbs t;
+    for (int i = 62 - __builtin_clzl(y); i >= 0; i--)
+    {
+        t.resize(2 * r.size());
+        ::multiply(data(t), data(r), r.size(), data(r), r.size());
+        trim(t);
+        if ((y >> i) & 1)
+        {
+            r.resize(t.size() + x.getSize());
+            ::multiply(data(r), data(t), t.size(), x.getLimbs(), x.getSize());
+            trim(r);
+        }
+        else
+        {
+            r.swap(t);
+        }
+        if (r.size() > MAX_LIMBS + 1)
+        {
+            return NULL;
+        }
+    }
+    return create(x.isNegative() && (y & 1), data(r), r.size());
+}
+
+
+BigInteger* BigInteger::powerModulo(const Operand& x, const Operand& y, const Operand& z)
+{
+    if (z.isZero())
+    {
+        throw DivideByZeroException();
+    }
+    Limbs modulus(z.getLimbs(), z.getLimbs() + z.getSize());
+    Limbs base(x.getLimbs(), x.getLimbs() + x.getSize());
+    reduce(base, modulus);
+    if (x.isNegative() && !base.empty())
+    {
+        // The remainder is made not negative.
+        Limbs t(modulus.size());
+        ::subtract(&t[0], &modulus[0], modulus.size(), &base[0], base.size());
+        trim(t);
+        base.swap(t);
+    }
+    Limbs r(1, 1);
+    reduce(r, modulus);
+    Limbs t;
+    size_t bits = ::getBitLength(y.getLimbs(), y.getSize());
+    for (size_t i = bits; i-- > 0;)
+    {
+        t.resize(2 * r.size());
+        ::multiply(data(t), data(r), r.size(), data(r), r.size());
+        trim(t);
+        reduce(t, modulus);
+        if ((y.getLimbs()[i / LIMB_BITS] >> (i % LIMB_BITS)) & 1)
+        {
+            r.resize(t.size() + base.size());
+            ::multiply(data(r), data(t), t.size(), data(base), base.size());
+            trim(r);
+            reduce(r, modulus);
+        }
+        else
+        {
+            r.swap(t);
+        }
+    }
+    return create(false, data(r), r.size());
+}
+
+
+BigInteger* BigInteger::negate(const Operand& x)
+{
+    return create(!x.isNegative(), x.getLimbs(), x.getSize());
+}
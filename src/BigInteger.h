@@ -0,0 +1,183 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#ifndef IKURA_BIGINTEGER_H
+#define IKURA_BIGINTEGER_H
+
+
+#include <stddef.h>
+#include <vector>
+
+
+namespace hnrt
+{
+    //
+    // Integer of arbitrary precision, into which Number widens the integer operations overflowing 128 bits
+    //
+    // The magnitude is held in 64-bit limbs from the lowest, following the header in one block,
+    // and the sign separately. A BigInteger is never changed once created, and is shared by
+    // reference counting among the Numbers holding it, which may be on different threads.
+    //
+    // The operations take their operands as Operand, so that an integer in 128 bits
+    // is given without being allocated as a BigInteger, and return a new BigInteger,
+    // which may be small enough for 128 bits. If the result would have more than MAX_BITS bits,
+    // NULL is returned instead. MAX_BITS leaves room for the products of the mantissas
+    // of BigReal in its largest precision, while Number keeps its integers narrower.
+    //
+    // Multiplication is done in the schoolbook method, Karatsuba's or Toom-Cook 3-way
+    // depending on the sizes of the operands, and division in Knuth's algorithm D or
+    // Burnikel and Ziegler's recursive one, which makes use of the fast multiplication.
+    // The decimal digits are converted by halves on top of them with the powers of 10 kept once computed.
+    //
+    class BigInteger
+    {
+    public:
+
+        typedef unsigned long Limb;
+
+        //
+        // Sign and magnitude of an integer of either width
+        //
+        class Operand
+        {
+        public:
+
+            Operand(__int128 value) { set(value); }
+            Operand(const BigInteger& value) { set(value); }
+            bool isNegative() const { return negative; }
+            bool isZero() const { return !size; }
+            size_t getSize() const { return size; }
+            const Limb* getLimbs() const { return limbs; }
+
+        protected:
+
+            Operand() {}
+            Operand(const Operand&) {}
+            void operator =(const Operand&) {}
+            void set(__int128 value);
+            void set(const BigInteger& value);
+
+            bool negative;
+            size_t size; // of the limbs but the leading zeros
+            const Limb* limbs;
+            Limb local[2]; // limbs of an integer in 128 bits
+        };
+
+        static const size_t MAX_BITS = 1UL << 24;
+
+        void addRef() { __sync_fetch_and_add(&refs, 1); }
+        void release() { if (!__sync_sub_and_fetch(&refs, 1)) { destroy(this); } }
+        bool isNegative() const { return negative; }
+        size_t getSize() const { return size; }
+        const Limb* getLimbs() const { return limbs; }
+
+        //
+        // Returns true with the value if it fits in 128 bits.
+        //
+        bool toInteger128(__int128& value) const;
+
+        long double toRealNumber() const;
+
+        //
+        // Returns the value as m * 2^exponent, where m is in [0.5, 1) as frexpl returns,
+        // so that a ratio of such values can be computed without overflowing.
+        //
+        static long double toRealNumber(const Operand& x, long& exponent);
+
+        //
+        // Appends the decimal digits of the absolute value.
+        //
+        void formatDecimal(std::vector<char>& buffer) const;
+
+        //
+        // Appends "0x" and the hexadecimal digits of the two's complement in the fewest 64-bit words,
+        // which Lexer reads back as the same value.
+        //
+        void formatHexadecimal(std::vector<char>& buffer) const;
+
+        //
+        // Returns the value of the given decimal digits.
+        // If it has more than MAX_BITS bits, OverflowException is thrown.
+        //
+        static BigInteger* parseDecimal(const char* s, size_t n);
+
+        //
+        // Returns the value of the given hexadecimal digits in two's complement
+        // in as many 64-bit words as the digits fill.
+        // If it has more than MAX_BITS bits, OverflowException is thrown.
+        //
+        static BigInteger* parseHexadecimal(const char* s, size_t n);
+
+        //
+        // Returns the number of the bits of the absolute value.
+        //
+        static size_t getBitLength(const Operand& x);
+
+        //
+        // Returns a new BigInteger of the given value.
+        //
+        static BigInteger* copy(const Operand& x);
+
+        static BigInteger* add(const Operand& x, const Operand& y);
+        static BigInteger* subtract(const Operand& x, const Operand& y);
+        static BigInteger* multiply(const Operand& x, const Operand& y);
+
+        //
+        // Divides x by y.
+        // If the remainder is zero, true is returned with the quotient.
+        // Otherwise, false is returned and the caller needs to divide them as real numbers.
+        // If y is zero, DivideByZeroException is thrown.
+        //
+        static bool divide(const Operand& x, const Operand& y, BigInteger*& quotient);
+
+        //
+        // Divides x by y, and returns the quotient truncated toward zero.
+        // inexact is set to true if the remainder is not zero.
+        // If y is zero, DivideByZeroException is thrown.
+        //
+        static BigInteger* divideTruncated(const Operand& x, const Operand& y, bool& inexact);
+
+        //
+        // Returns the absolute value multiplied or divided by 2^bits with the sign kept,
+        // where the bits shifted out to the right are dropped.
+        //
+        static BigInteger* shiftLeft(const Operand& x, size_t bits);
+        static BigInteger* shiftRight(const Operand& x, size_t bits);
+
+        //
+        // Returns the square root of the absolute value truncated to an integer.
+        // inexact is set to true if it is not exact.
+        //
+        static BigInteger* squareRoot(const Operand& x, bool& inexact);
+
+        //
+        // Raises x to the power of y.
+        //
+        static BigInteger* power(const Operand& x, unsigned long y);
+
+        //
+        // Raises x to the power of y that is not negative modulo z,
+        // and returns the remainder, which is not negative and less than the absolute value of z.
+        // If z is zero, DivideByZeroException is thrown.
+        //
+        static BigInteger* powerModulo(const Operand& x, const Operand& y, const Operand& z);
+
+        static BigInteger* negate(const Operand& x);
+
+    private:
+
+        BigInteger() {}
+        BigInteger(const BigInteger&) {}
+        void operator =(const BigInteger&) {}
+        static BigInteger* create(bool negative, const Limb* limbs, size_t size);
+        static void destroy(BigInteger* x);
+
+        int refs;
+        bool negative;
+        size_t size; // of the limbs but the leading zeros
+        Limb limbs[1]; // followed by the rest of the limbs
+    };
+}
+
+
+#endif //!IKURA_BIGINTEGER_H
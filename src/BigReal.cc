@@ -0,0 +1,1500 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#include <ctype.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <quadmath.h>
+#include <sched.h>
+#include <algorithm>
+#include "BigReal.h"
+#include "Exception.h"
+
+
+using namespace hnrt;
+
+
+typedef BigInteger::Operand Operand;
+typedef BigInteger::Limb Limb;
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Helpers
+//
+//////////////////////////////////////////////////////////////////////
+
+
+//
+// Pointer to a BigInteger or a BigReal holding a reference to it for the time being
+//
+template<class T>
+class Reference
+{
+public:
+
+    Reference(T* x = NULL) : p(x) {}
+    Reference(const Reference& x) : p(x.p) { if (p) { p->addRef(); } }
+    ~Reference() { if (p) { p->release(); } }
+    Reference& operator =(const Reference& x);
+    Reference& operator =(T* x) { if (p) { p->release(); } p = x; return *this; }
+    T& operator *() const { return *p; }
+    T* operator ->() const { return p; }
+    T* detach() { T* x = p; p = NULL; return x; }
+
+private:
+
+    T* p;
+};
+
+
+template<class T>
+Reference<T>& Reference<T>::operator =(const Reference& x)
+{
+    if (x.p)
+    {
+        x.p->addRef();
+    }
+    if (p)
+    {
+        p->release();
+    }
+    p = x.p;
+    return *this;
+}
+
+
+typedef Reference<BigInteger> IntegerRef;
+typedef Reference<BigReal> RealRef;
+
+
+//
+// Returns the result of BigInteger, or throws OverflowException if it is NULL as too large.
+//
+static BigInteger* check(BigInteger* x)
+{
+    if (!x)
+    {
+        throw OverflowException();
+    }
+    return x;
+}
+
+
+static bool testBit(const Operand& x, size_t i)
+{
+    size_t k = i / 64;
+    return k < x.getSize() && ((x.getLimbs()[k] >> (i % 64)) & 1);
+}
+
+
+//
+// Returns true if any of the bits below the given position is set.
+//
+static bool hasBitsBelow(const Operand& x, size_t i)
+{
+    size_t k = std::min(i / 64, x.getSize());
+    for (size_t j = 0; j < k; j++)
+    {
+        if (x.getLimbs()[j])
+        {
+            return true;
+        }
+    }
+    return k < x.getSize() && (x.getLimbs()[k] & ((1UL << (i % 64)) - 1));
+}
+
+
+static size_t getTrailingZeros(const Operand& x)
+{
+    size_t i = 0;
+    while (i < x.getSize() && !x.getLimbs()[i])
+    {
+        i++;
+    }
+    return i < x.getSize() ? i * 64 + __builtin_ctzl(x.getLimbs()[i]) : 0;
+}
+
+
+//
+// Returns the exponent of the highest bit plus one, so that |x| is in [2^(top - 1), 2^top).
+//
+static long getTop(const BigReal& x)
+{
+    return x.getExponent() + (long)BigInteger::getBitLength(x.getMantissa());
+}
+
+
+//
+// Returns x * 2^w truncated to an integer.
+//
+static BigInteger* toFixed(const BigReal& x, size_t w)
+{
+    long shift = x.getExponent() + (long)w;
+    return check(shift >= 0 ? BigInteger::shiftLeft(x.getMantissa(), shift) : BigInteger::shiftRight(x.getMantissa(), -shift));
+}
+
+
+//
+// Returns the nearest integer, where the halves are rounded away from zero.
+//
+static BigInteger* toNearestInteger(const BigReal& x)
+{
+    long exponent = x.getExponent();
+    if (exponent >= 0)
+    {
+        return check(BigInteger::shiftLeft(x.getMantissa(), exponent));
+    }
+    IntegerRef t = check(BigInteger::shiftRight(x.getMantissa(), -exponent - 1));
+    t = check(BigInteger::add(*t, x.isNegative() ? -1 : 1));
+    return check(BigInteger::shiftRight(*t, 1));
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Allocation and rounding
+//
+//////////////////////////////////////////////////////////////////////
+
+
+//
+// Returns m * 2^exponent rounded to the given precision, ties to even, with the trailing zeros
+// of the mantissa dropped. If sticky is true, the exact value is a little larger in magnitude
+// than the given one, which has two more bits than the precision at least.
+//
+BigReal* BigReal::round(const Operand& m, long exponent, size_t precision, bool sticky)
+{
+    size_t n = BigInteger::getBitLength(m);
+    IntegerRef r;
+    if (n > precision)
+    {
+        size_t shift = n - precision;
+        r = check(BigInteger::shiftRight(m, shift));
+        if (testBit(m, shift - 1) && (sticky || hasBitsBelow(m, shift - 1) || testBit(*r, 0)))
+        {
+            r = check(BigInteger::add(*r, m.isNegative() ? -1 : 1));
+        }
+        exponent += (long)shift;
+    }
+    else
+    {
+        r = check(BigInteger::copy(m));
+    }
+    size_t zeros = getTrailingZeros(*r);
+    if (zeros)
+    {
+        r = check(BigInteger::shiftRight(*r, zeros));
+        exponent += (long)zeros;
+    }
+    if (!r->getSize())
+    {
+        exponent = 0;
+    }
+    else
+    {
+        long top = exponent + (long)BigInteger::getBitLength(*r);
+        if (top > MAX_EXPONENT)
+        {
+            throw OverflowException();
+        }
+        else if (top <= -MAX_EXPONENT)
+        {
+            throw UnderflowException();
+        }
+    }
+    BigReal* x = new BigReal;
+    x->refs = 1;
+    x->mantissa = r.detach();
+    x->exponent = exponent;
+    return x;
+}
+
+
+void BigReal::destroy(BigReal* x)
+{
+    x->mantissa->release();
+    delete x;
+}
+
+
+//
+// The numerator is shifted so that the quotient has two more bits than the precision,
+// and the remainder is the sticky bit.
+//
+BigReal* BigReal::ratio(const Operand& x, const Operand& y, long exponent, size_t precision)
+{
+    if (y.isZero())
+    {
+        throw DivideByZeroException();
+    }
+    long shift = std::max((long)(precision + 2 + BigInteger::getBitLength(y)) - (long)BigInteger::getBitLength(x), 0L);
+    IntegerRef u = check(BigInteger::shiftLeft(x, shift));
+    bool inexact = false;
+    IntegerRef q = check(BigInteger::divideTruncated(*u, y, inexact));
+    return round(*q, exponent - shift, precision, inexact);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Conversion
+//
+//////////////////////////////////////////////////////////////////////
+
+
+long double BigReal::toRealNumber() const
+{
+    if (isZero())
+    {
+        return 0;
+    }
+    RealRef r = round(*mantissa, exponent, 64);
+    long top = getTop(*r);
+    if (top > LDBL_MAX_EXP)
+    {
+        return isNegative() ? -HUGE_VALL : HUGE_VALL;
+    }
+    else if (top < LDBL_MIN_EXP)
+    {
+        return 0;
+    }
+    long double value = ldexpl((long double)r->mantissa->getLimbs()[0], (int)r->exponent);
+    return isNegative() ? -value : value;
+}
+
+
+__float128 BigReal::toFloat128() const
+{
+    if (isZero())
+    {
+        return 0;
+    }
+    RealRef r = round(*mantissa, exponent, FLT128_MANT_DIG);
+    long top = getTop(*r);
+    if (top > FLT128_MAX_EXP)
+    {
+        return isNegative() ? -HUGE_VALQ : HUGE_VALQ;
+    }
+    else if (top < FLT128_MIN_EXP)
+    {
+        return 0;
+    }
+    // The mantissa of 113 bits takes two limbs at most.
+    const BigInteger& m = *r->mantissa;
+    unsigned __int128 bits = m.getLimbs()[0];
+    if (m.getSize() > 1)
+    {
+        bits |= (unsigned __int128)m.getLimbs()[1] << 64;
+    }
+    __float128 value = ldexpq((__float128)bits, (int)r->exponent);
+    return isNegative() ? -value : value;
+}
+
+
+//
+// The value is scaled by a power of 10 so that its integer part has the digits,
+// which is computed exactly and rounded half to even.
+// The exponent is estimated from the bits and corrected if the digits are one too many or too few.
+//
+long BigReal::formatDecimal(std::vector<char>& buffer, size_t digits) const
+{
+    if (isZero())
+    {
+        buffer.insert(buffer.end(), digits, '0');
+        return 0;
+    }
+    IntegerRef m = check(isNegative() ? BigInteger::negate(*mantissa) : BigInteger::copy(*mantissa));
+    // log10(2) = 0.30102999566398...
+    long top = getTop(*this);
+    long decimalExponent = (long)floor((top - 1) * 0.30102999566398);
+    for (;;)
+    {
+        long k = (long)digits - 1 - decimalExponent;
+        IntegerRef numerator = m;
+        IntegerRef denominator = check(BigInteger::copy(1));
+        IntegerRef power = check(BigInteger::power(10, (unsigned long)(k < 0 ? -k : k)));
+        if (k >= 0)
+        {
+            numerator = check(BigInteger::multiply(*numerator, *power));
+        }
+        else
+        {
+            denominator = power;
+        }
+        if (exponent >= 0)
+        {
+            numerator = check(BigInteger::shiftLeft(*numerator, exponent));
+        }
+        else
+        {
+            denominator = check(BigInteger::shiftLeft(*denominator, -exponent));
+        }
+        // The lowest bit of the quotient doubled tells if the rest is a half or more.
+        numerator = check(BigInteger::shiftLeft(*numerator, 1));
+        bool inexact = false;
+        IntegerRef q = check(BigInteger::divideTruncated(*numerator, *denominator, inexact));
+        bool half = testBit(*q, 0);
+        q = check(BigInteger::shiftRight(*q, 1));
+        if (half && (inexact || testBit(*q, 0)))
+        {
+            q = check(BigInteger::add(*q, 1));
+        }
+        std::vector<char> d;
+        q->formatDecimal(d);
+        if (d.size() > digits)
+        {
+            decimalExponent++;
+        }
+        else if (d.size() < digits)
+        {
+            decimalExponent--;
+        }
+        else
+        {
+            buffer.insert(buffer.end(), d.begin(), d.end());
+            return decimalExponent;
+        }
+    }
+}
+
+
+BigReal* BigReal::integer(const Operand& x, size_t precision)
+{
+    return round(x, 0, precision);
+}
+
+
+BigReal* BigReal::realNumber(long double x)
+{
+    int exponent = 0;
+    long double fraction = frexpl(x, &exponent);
+    unsigned long bits = (unsigned long)ldexpl(fabsl(fraction), 64);
+    return round(x < 0 ? -(__int128)bits : (__int128)bits, exponent - 64L, 64);
+}
+
+
+BigReal* BigReal::float128(__float128 x)
+{
+    int exponent = 0;
+    __float128 fraction = frexpq(x, &exponent);
+    __int128 bits = (__int128)ldexpq(fabsq(fraction), FLT128_MANT_DIG);
+    return round(x < 0 ? -bits : bits, exponent - (long)FLT128_MANT_DIG, FLT128_MANT_DIG);
+}
+
+
+//
+// The digits are read into an integer, which is multiplied or divided by the power of 10
+// the exponent and the decimal point give.
+//
+BigReal* BigReal::parseDecimal(const char* s, size_t n, size_t precision)
+{
+    std::vector<char> digits;
+    long scale = 0;
+    bool point = false;
+    size_t i = 0;
+    for (; i < n && s[i] != 'e'; i++)
+    {
+        if (isdigit((unsigned char)s[i]))
+        {
+            if (!digits.empty() || s[i] != '0')
+            {
+                digits.push_back(s[i]);
+            }
+            if (point)
+            {
+                scale++;
+            }
+        }
+        else
+        {
+            point = true;
+        }
+    }
+    long exponent = 0;
+    bool negative = false;
+    if (i < n)
+    {
+        i++;
+        if (i < n && (s[i] == '+' || s[i] == '-'))
+        {
+            negative = s[i++] == '-';
+        }
+        for (; i < n && isdigit((unsigned char)s[i]); i++)
+        {
+            if (exponent < 1000000000L)
+            {
+                exponent = exponent * 10 + (s[i] - '0');
+            }
+        }
+    }
+    if (digits.empty())
+    {
+        return integer(0, precision);
+    }
+    long k = (negative ? -exponent : exponent) - scale;
+    // The value is less than 10^(k + digits) and not less than 10^(k + digits - 1),
+    // where 2^MAX_EXPONENT < 10^315653.
+    long top = k + (long)digits.size();
+    if (top > 315654)
+    {
+        throw OverflowException();
+    }
+    else if (top < -315654)
+    {
+        throw UnderflowException();
+    }
+    IntegerRef d = BigInteger::parseDecimal(&digits[0], digits.size());
+    IntegerRef power = check(BigInteger::power(10, (unsigned long)(k < 0 ? -k : k)));
+    if (k >= 0)
+    {
+        d = check(BigInteger::multiply(*d, *power));
+        return round(*d, 0, precision);
+    }
+    return ratio(*d, *power, 0, precision);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Arithmetic operations
+//
+//////////////////////////////////////////////////////////////////////
+
+
+//
+// The operands are aligned and added exactly, unless the smaller one is entirely below
+// the rounding position of the larger one; it only tells then which side of the larger one
+// the sum is on, which is given by a unit put a bit below the rounding position instead.
+//
+BigReal* BigReal::add(const BigReal& x, const BigReal& y, size_t precision)
+{
+    if (y.isZero())
+    {
+        return round(*x.mantissa, x.exponent, precision);
+    }
+    else if (x.isZero())
+    {
+        return round(*y.mantissa, y.exponent, precision);
+    }
+    const BigReal* a = &x;
+    const BigReal* b = &y;
+    if (getTop(*a) < getTop(*b))
+    {
+        std::swap(a, b);
+    }
+    long limit = std::min(a->exponent, getTop(*a) - (long)precision - 3);
+    if (getTop(*b) < limit)
+    {
+        IntegerRef m = check(BigInteger::shiftLeft(*a->mantissa, a->exponent - limit + 2));
+        m = check(BigInteger::add(*m, b->isNegative() ? -1 : 1));
+        return round(*m, limit - 2, precision);
+    }
+    long exponent = std::min(a->exponent, b->exponent);
+    IntegerRef m1 = check(BigInteger::shiftLeft(*a->mantissa, a->exponent - exponent));
+    IntegerRef m2 = check(BigInteger::shiftLeft(*b->mantissa, b->exponent - exponent));
+    IntegerRef m = check(BigInteger::add(*m1, *m2));
+    return round(*m, exponent, precision);
+}
+
+
+BigReal* BigReal::subtract(const BigReal& x, const BigReal& y, size_t precision)
+{
+    RealRef z = negate(y);
+    return add(x, *z, precision);
+}
+
+
+BigReal* BigReal::multiply(const BigReal& x, const BigReal& y, size_t precision)
+{
+    IntegerRef m = check(BigInteger::multiply(*x.mantissa, *y.mantissa));
+    return round(*m, x.exponent + y.exponent, precision);
+}
+
+
+BigReal* BigReal::divide(const BigReal& x, const BigReal& y, size_t precision)
+{
+    return ratio(*x.mantissa, *y.mantissa, x.exponent - y.exponent, precision);
+}
+
+
+BigReal* BigReal::negate(const BigReal& x)
+{
+    IntegerRef m = check(BigInteger::negate(*x.mantissa));
+    return round(*m, x.exponent, BigInteger::getBitLength(*m));
+}
+
+
+BigReal* BigReal::abs(const BigReal& x)
+{
+    if (x.isNegative())
+    {
+        return negate(x);
+    }
+    return round(*x.mantissa, x.exponent, BigInteger::getBitLength(*x.mantissa));
+}
+
+
+//
+// The mantissa is shifted by an even number of bits so that its integer square root
+// has two more bits than the precision, and the rest is the sticky bit.
+//
+BigReal* BigReal::squareRoot(const BigReal& x, size_t precision)
+{
+    if (x.isNegative())
+    {
+        throw EvaluationInabilityException();
+    }
+    else if (x.isZero())
+    {
+        return integer(0, precision);
+    }
+    long shift = std::max((long)(2 * precision + 4) - (long)BigInteger::getBitLength(*x.mantissa), 0L);
+    if ((x.exponent - shift) & 1)
+    {
+        shift++;
+    }
+    IntegerRef u = check(BigInteger::shiftLeft(*x.mantissa, shift));
+    bool inexact = false;
+    IntegerRef s = check(BigInteger::squareRoot(*u, inexact));
+    return round(*s, (x.exponent - shift) / 2, precision, inexact);
+}
+
+
+//
+// Both are scaled down to 1 or so, so that the squares can neither overflow nor underflow.
+//
+BigReal* BigReal::hypot(const BigReal& x, const BigReal& y, size_t precision)
+{
+    if (x.isZero())
+    {
+        return abs(y);
+    }
+    else if (y.isZero())
+    {
+        return abs(x);
+    }
+    size_t w = precision + GUARD_BITS;
+    long top = std::max(getTop(x), getTop(y));
+    RealRef a = round(*x.mantissa, x.exponent - top, w);
+    RealRef b = round(*y.mantissa, y.exponent - top, w);
+    a = multiply(*a, *a, 2 * w);
+    b = multiply(*b, *b, 2 * w);
+    RealRef s = add(*a, *b, w);
+    s = squareRoot(*s, w);
+    return round(*s->mantissa, s->exponent + top, precision);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Binary splitting
+//
+// The sum of a series whose terms are in the ratios of small integers is computed by
+// binary splitting, where the terms of a range are summed up as a fraction of integers
+// from the sums of its halves, so that the large integers are multiplied only a few times
+// near the top. The halves of a long range are computed on two threads, and so on
+// until each processor this process may run on has one.
+//
+//////////////////////////////////////////////////////////////////////
+
+
+//
+// A range of fewer terms is done on one thread, as it is summed up sooner than a thread starts.
+//
+static const unsigned long PARALLEL_TERMS = 1024;
+
+
+//
+// Returns how many times the splitting forks so that each processor has a thread.
+//
+static int getForkDepth()
+{
+    static int depth = -1; // the threads racing here store the same value.
+    if (depth < 0)
+    {
+        cpu_set_t set;
+        int count = sched_getaffinity(0, sizeof(set), &set) ? 1 : CPU_COUNT(&set);
+        int d = 0;
+        while ((1 << d) < count)
+        {
+            d++;
+        }
+        depth = d;
+    }
+    return depth;
+}
+
+
+//
+// Work done on another thread, whose exception is passed to the one joining it
+//
+class Job
+{
+public:
+
+    Job() : started(false), failed(false) {}
+    virtual ~Job() {}
+
+    //
+    // Starts a thread doing the work, or does it right away if thread is false or no thread can be created.
+    //
+    void start(bool thread = true);
+
+    //
+    // Waits for the thread. As the only exception expected on the way is OverflowException,
+    // the one caught on the thread is thrown again as OverflowException.
+    //
+    void join();
+
+    //
+    // Waits for the thread, ignoring its exception; this is for the one unwinding.
+    //
+    void wait();
+
+protected:
+
+    virtual void run() = 0;
+
+private:
+
+    Job(const Job&);
+    void operator =(const Job&);
+    static void* main(void* arg);
+
+    pthread_t thread;
+    bool started;
+    bool failed;
+};
+
+
+void Job::start(bool thread)
+{
+    started = thread && !pthread_create(&this->thread, NULL, main, this);
+    if (!started)
+    {
+        run();
+    }
+}
+
+
+void Job::join()
+{
+    wait();
+    if (failed)
+    {
+        throw OverflowException();
+    }
+}
+
+
+void Job::wait()
+{
+    if (started)
+    {
+        pthread_join(thread, NULL);
+        started = false;
+    }
+}
+
+
+void* Job::main(void* arg)
+{
+    Job* job = (Job*)arg;
+    try
+    {
+        job->run();
+    }
+    catch (...)
+    {
+        job->failed = true;
+    }
+    return NULL;
+}
+
+
+//
+// Product of two integers, computed on a thread while the one starting it does the others
+//
+class MultiplyJob : public Job
+{
+public:
+
+    MultiplyJob(const BigInteger& x_, const BigInteger& y_) : x(x_), y(y_) {}
+
+    IntegerRef z;
+
+protected:
+
+    virtual void run() { z = check(BigInteger::multiply(x, y)); }
+
+private:
+
+    const BigInteger& x;
+    const BigInteger& y;
+};
+
+
+//
+// Series sum_{k} c(k) prod_{i=1}^{k} a(i) / (b(i) * 2^shift) summed up by binary splitting,
+// where the subclass gives a(i), b(i) and c(i) of each term
+//
+class Splitting
+{
+public:
+
+    Splitting(size_t shift_) : shift(shift_) {}
+    virtual ~Splitting() {}
+
+    //
+    // Computes P = a(i) ... a(j - 1), Q = b(i) ... b(j - 1), and
+    // T = sum_{k=i}^{j-1} a(i) ... a(k) * c(k) * b(k + 1) ... b(j - 1) * 2^(shift * (j - 1 - k)),
+    // so that T / (Q * 2^(shift * (j - i))) is the sum of the terms from i to j - 1 over the product
+    // of the ratios before i. P is left out unless needed, as the top one is not.
+    // The halves are computed on two threads if depth is positive and there are enough terms.
+    //
+    void split(unsigned long i, unsigned long j, IntegerRef& p, IntegerRef& q, IntegerRef& t, int depth, bool needed) const;
+
+protected:
+
+    //
+    // Returns a(i), b(i) and a(i) * c(i) to P, Q and T respectively.
+    //
+    virtual void getTerm(unsigned long i, IntegerRef& p, IntegerRef& q, IntegerRef& t) const = 0;
+
+    size_t shift;
+
+private:
+
+    Splitting(const Splitting&);
+    void operator =(const Splitting&);
+};
+
+
+//
+// Half range of the splitting done on another thread
+//
+class SplitJob : public Job
+{
+public:
+
+    SplitJob(const Splitting& splitting_, unsigned long i_, unsigned long j_, int depth_)
+        : splitting(splitting_), i(i_), j(j_), depth(depth_)
+    {
+    }
+
+    IntegerRef p;
+    IntegerRef q;
+    IntegerRef t;
+
+protected:
+
+    virtual void run() { splitting.split(i, j, p, q, t, depth, true); }
+
+private:
+
+    const Splitting& splitting;
+    unsigned long i;
+    unsigned long j;
+    int depth;
+};
+
+
+void Splitting::split(unsigned long i, unsigned long j, IntegerRef& p, IntegerRef& q, IntegerRef& t, int depth, bool needed) const
+{
+    if (j - i == 1)
+    {
+        getTerm(i, p, q, t);
+        return;
+    }
+    unsigned long m = (i + j) / 2;
+    bool parallel = depth > 0 && j - i >= PARALLEL_TERMS;
+    SplitJob left(*this, i, m, depth - 1);
+    IntegerRef p2;
+    IntegerRef q2;
+    IntegerRef t2;
+    left.start(parallel);
+    try
+    {
+        split(m, j, p2, q2, t2, depth - 1, needed);
+    }
+    catch (...)
+    {
+        left.wait();
+        throw;
+    }
+    left.join();
+    // Q is multiplied on another thread while T is.
+    MultiplyJob product(*left.q, *q2);
+    product.start(parallel);
+    try
+    {
+        IntegerRef u = check(BigInteger::multiply(*left.t, *q2));
+        if (shift)
+        {
+            u = check(BigInteger::shiftLeft(*u, shift * (j - m)));
+        }
+        IntegerRef v = check(BigInteger::multiply(*left.p, *t2));
+        t = check(BigInteger::add(*u, *v));
+        if (needed)
+        {
+            p = check(BigInteger::multiply(*left.p, *p2));
+        }
+    }
+    catch (...)
+    {
+        product.wait();
+        throw;
+    }
+    product.join();
+    q = product.z;
+}
+
+
+//
+// Series sum_{k=1}^{n} prod_{i=1}^{k} a(i) / b(i), where a(i) = numerator * (a1 * i + a0) and
+// b(i) = (b1 * i + b0) * (c1 * i + c0) * scale * 2^shift, summed up until the terms get small enough
+//
+class Series : public Splitting
+{
+public:
+
+    Series(const BigInteger& numerator_, long a1_, long a0_, long b1_, long b0_, long c1_, long c0_, long scale_, size_t shift_)
+        : Splitting(shift_), numerator(numerator_), a1(a1_), a0(a0_), b1(b1_), b0(b0_), c1(c1_), c0(c0_), scale(scale_)
+    {
+    }
+
+    //
+    // Returns the sum rounded to the given precision.
+    //
+    BigReal* sum(size_t precision) const;
+
+protected:
+
+    virtual void getTerm(unsigned long i, IntegerRef& p, IntegerRef& q, IntegerRef& t) const;
+
+private:
+
+    unsigned long getTermCount(size_t precision) const;
+
+    const BigInteger& numerator;
+    long a1;
+    long a0;
+    long b1;
+    long b0;
+    long c1;
+    long c0;
+    long scale;
+};
+
+
+//
+// Returns the number of the terms to sum up; the last one is less than 2^-(precision + 8),
+// from which the terms decrease faster than by halves.
+//
+unsigned long Series::getTermCount(size_t precision) const
+{
+    long exponent = 0;
+    long double mantissa = BigInteger::toRealNumber(numerator, exponent);
+    double bits = exponent + log2(fabs((double)mantissa)) - (double)shift;
+    double sum = 0;
+    unsigned long i = 1;
+    for (;; i++)
+    {
+        double a = fabs((double)(a1 * (long)i + a0));
+        double b = fabs((double)(b1 * (long)i + b0) * (double)(c1 * (long)i + c0) * (double)scale);
+        sum += bits + log2(a) - log2(b);
+        if (sum < -(double)precision - 8)
+        {
+            return i;
+        }
+    }
+}
+
+
+void Series::getTerm(unsigned long i, IntegerRef& p, IntegerRef& q, IntegerRef& t) const
+{
+    p = check(BigInteger::multiply(numerator, (__int128)a1 * (long)i + a0));
+    q = check(BigInteger::copy((__int128)(b1 * (long)i + b0) * (c1 * (long)i + c0) * scale));
+    t = p;
+}
+
+
+BigReal* Series::sum(size_t precision) const
+{
+    unsigned long n = getTermCount(precision);
+    IntegerRef p;
+    IntegerRef q;
+    IntegerRef t;
+    split(1, n + 1, p, q, t, getForkDepth(), false);
+    return BigReal::ratio(*t, *q, -(long)(shift * n), precision);
+}
+
+
+//
+// Returns the sum of the series multiplied by the given factor, plus 1.
+//
+static BigReal* oneSum(const Series& series, const BigReal* factor, size_t precision)
+{
+    RealRef s = series.sum(precision);
+    RealRef one = BigReal::integer(1, precision);
+    s = BigReal::add(*s, *one, precision);
+    return factor ? BigReal::multiply(*s, *factor, precision) : s.detach();
+}
+
+
+//
+// The argument is split into the chunks from the top, each of which has twice as many bits
+// as the one above and makes a series converging twice as fast; exp(x + y) = exp(x) * exp(y).
+//
+static const size_t FIRST_CHUNK_BITS = 8;
+
+
+//
+// Returns exp(r / 2^w) for |r| < 2^(w - 1) in the precision w.
+//
+static BigReal* expFixed(const BigInteger& r, size_t w)
+{
+    RealRef y = BigReal::integer(1, w);
+    IntegerRef rest = check(r.isNegative() ? BigInteger::negate(r) : BigInteger::copy(r));
+    for (size_t start = 0, length = FIRST_CHUNK_BITS; start < w && rest->getSize(); start += length, length *= 2)
+    {
+        size_t end = std::min(start + length, w);
+        IntegerRef p = check(BigInteger::shiftRight(*rest, w - end));
+        if (!p->getSize())
+        {
+            continue;
+        }
+        IntegerRef t = check(BigInteger::shiftLeft(*p, w - end));
+        rest = check(BigInteger::subtract(*rest, *t));
+        if (r.isNegative())
+        {
+            p = check(BigInteger::negate(*p));
+        }
+        // exp(p / 2^end) = 1 + sum_{k>=1} prod_{i=1}^{k} p / (i * 2^end)
+        Series series(*p, 0, 1, 1, 0, 0, 1, 1, end);
+        RealRef e = oneSum(series, NULL, w);
+        y = BigReal::multiply(*y, *e, w);
+    }
+    return y.detach();
+}
+
+
+//
+// Returns sin(r / 2^w) and cos(r / 2^w) for |r| < 2^w in the precision w, likewise
+// with sin(x + y) = sin(x) cos(y) + cos(x) sin(y) and cos(x + y) = cos(x) cos(y) - sin(x) sin(y).
+//
+static void sinCosFixed(const BigInteger& r, size_t w, RealRef& s, RealRef& c)
+{
+    s = BigReal::integer(0, w);
+    c = BigReal::integer(1, w);
+    IntegerRef rest = check(r.isNegative() ? BigInteger::negate(r) : BigInteger::copy(r));
+    for (size_t start = 0, length = FIRST_CHUNK_BITS; start < w && rest->getSize(); start += length, length *= 2)
+    {
+        size_t end = std::min(start + length, w);
+        IntegerRef p = check(BigInteger::shiftRight(*rest, w - end));
+        if (!p->getSize())
+        {
+            continue;
+        }
+        IntegerRef t = check(BigInteger::shiftLeft(*p, w - end));
+        rest = check(BigInteger::subtract(*rest, *t));
+        if (r.isNegative())
+        {
+            p = check(BigInteger::negate(*p));
+        }
+        IntegerRef square = check(BigInteger::multiply(*p, *p));
+        square = check(BigInteger::negate(*square));
+        // sin(u) = u * (1 + sum_{k>=1} prod_{i=1}^{k} -u^2 / (2i * (2i + 1)))
+        // cos(u) = 1 + sum_{k>=1} prod_{i=1}^{k} -u^2 / ((2i - 1) * 2i)
+        RealRef u = BigReal::ratio(*p, 1, -(long)end, w);
+        Series sinSeries(*square, 0, 1, 2, 0, 2, 1, 1, 2 * end);
+        Series cosSeries(*square, 0, 1, 2, -1, 2, 0, 1, 2 * end);
+        RealRef s1 = oneSum(sinSeries, &*u, w);
+        RealRef c1 = oneSum(cosSeries, NULL, w);
+        RealRef a = BigReal::multiply(*s, *c1, w);
+        RealRef b = BigReal::multiply(*c, *s1, w);
+        RealRef s2 = BigReal::add(*a, *b, w);
+        a = BigReal::multiply(*c, *c1, w);
+        b = BigReal::multiply(*s, *s1, w);
+        c = BigReal::subtract(*a, *b, w);
+        s = s2;
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Constants
+//
+//////////////////////////////////////////////////////////////////////
+
+
+//
+// Chudnovsky's series 1 / pi = (12 / 640320^(3/2)) sum_{k>=0} t(k), where
+// t(k) = (-1)^k (6k)! (13591409 + 545140134k) / ((3k)! (k!)^3 640320^(3k)), so that
+// a(k) = -(6k - 5)(2k - 1)(6k - 1), b(k) = k^3 640320^3 / 24 and c(k) = 13591409 + 545140134k.
+// Each term adds 47.11 bits or so.
+//
+class ChudnovskySeries : public Splitting
+{
+public:
+
+    ChudnovskySeries() : Splitting(0) {}
+
+protected:
+
+    virtual void getTerm(unsigned long i, IntegerRef& p, IntegerRef& q, IntegerRef& t) const;
+};
+
+
+void ChudnovskySeries::getTerm(unsigned long i, IntegerRef& p, IntegerRef& q, IntegerRef& t) const
+{
+    __int128 k = (__int128)i;
+    __int128 a = -(6 * k - 5) * (2 * k - 1) * (6 * k - 1);
+    p = check(BigInteger::copy(a));
+    q = check(BigInteger::copy(k * k * k * 10939058860032000L));
+    t = check(BigInteger::copy(a * (13591409 + 545140134 * k)));
+}
+
+
+//
+// pi = 426880 sqrt(10005) / sum_{k>=0} t(k) by Chudnovsky's formula,
+// where the sum is 13591409 + T / Q of the terms from 1.
+//
+static BigReal* computePi(size_t precision)
+{
+    size_t w = precision + 16;
+    IntegerRef p;
+    IntegerRef q;
+    IntegerRef t;
+    ChudnovskySeries().split(1, w / 47 + 2, p, q, t, getForkDepth(), false);
+    IntegerRef s = check(BigInteger::multiply(*q, 13591409));
+    s = check(BigInteger::add(*s, *t));
+    q = check(BigInteger::multiply(*q, 426880));
+    RealRef x = BigReal::ratio(*q, *s, 0, w);
+    RealRef c = BigReal::integer(10005, w);
+    c = BigReal::squareRoot(*c, w);
+    return BigReal::multiply(*x, *c, precision);
+}
+
+
+//
+// e = 1 + sum_{k>=1} prod_{i=1}^{k} 1 / i.
+//
+static BigReal* computeE(size_t precision)
+{
+    IntegerRef one = check(BigInteger::copy(1));
+    Series series(*one, 0, 1, 1, 0, 0, 1, 1, 0);
+    return oneSum(series, NULL, precision);
+}
+
+
+//
+// log 2 = 2 atanh(1/3) = (2/3) * (1 + sum_{k>=1} prod_{i=1}^{k} (2i - 1) / ((2i + 1) * 9)).
+//
+static BigReal* computeLog2(size_t precision)
+{
+    IntegerRef one = check(BigInteger::copy(1));
+    Series series(*one, 2, -1, 2, 1, 0, 1, 9, 0);
+    RealRef factor = BigReal::ratio(2, 3, 0, precision);
+    return oneSum(series, &*factor, precision);
+}
+
+
+//
+// Constant computed for the largest precision asked so far, from which the lower ones are rounded
+//
+struct Constant
+{
+    BigReal* (*compute)(size_t);
+    BigReal* value;
+    size_t precision;
+};
+
+
+static pthread_mutex_t constantsMutex = PTHREAD_MUTEX_INITIALIZER;
+static Constant piConstant = { computePi, NULL, 0 };
+static Constant eConstant = { computeE, NULL, 0 };
+static Constant log2Constant = { computeLog2, NULL, 0 };
+
+
+//
+// Returns the constant of the given precision at least, computing it again
+// if the one kept is not precise enough.
+//
+static BigReal* getConstant(Constant& constant, size_t precision)
+{
+    pthread_mutex_lock(&constantsMutex);
+    try
+    {
+        if (constant.precision < precision)
+        {
+            // 32 bits more keep the rounding to the precision asked correct but in rare cases.
+            BigReal* x = (*constant.compute)(precision + 32);
+            if (constant.value)
+            {
+                constant.value->release();
+            }
+            constant.value = x;
+            constant.precision = precision;
+        }
+    }
+    catch (...)
+    {
+        pthread_mutex_unlock(&constantsMutex);
+        throw;
+    }
+    constant.value->addRef();
+    BigReal* x = constant.value;
+    pthread_mutex_unlock(&constantsMutex);
+    return x;
+}
+
+
+BigReal* BigReal::pi(size_t precision)
+{
+    RealRef x = getConstant(piConstant, precision);
+    return round(*x->mantissa, x->exponent, precision);
+}
+
+
+BigReal* BigReal::e(size_t precision)
+{
+    RealRef x = getConstant(eConstant, precision);
+    return round(*x->mantissa, x->exponent, precision);
+}
+
+
+BigReal* BigReal::ln2(size_t precision)
+{
+    RealRef x = getConstant(log2Constant, precision);
+    return round(*x->mantissa, x->exponent, precision);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Elementary functions
+//
+//////////////////////////////////////////////////////////////////////
+
+
+//
+// x = n log 2 + r with |r| <= (log 2) / 2, and exp(x) = 2^n exp(r).
+//
+BigReal* BigReal::exp(const BigReal& x, size_t precision)
+{
+    if (x.isZero())
+    {
+        return integer(1, precision);
+    }
+    else if (getTop(x) > 21)
+    {
+        // |x| >= 2^21 > MAX_EXPONENT * log 2
+        if (x.isNegative())
+        {
+            throw UnderflowException();
+        }
+        throw OverflowException();
+    }
+    size_t w = precision + GUARD_BITS;
+    long n = (long)llroundl(x.toRealNumber() / 0.693147180559945309417232121458176568L);
+    RealRef r = round(*x.mantissa, x.exponent, w + 32);
+    if (n)
+    {
+        RealRef c = ln2(w + 32);
+        RealRef k = integer(n, w + 32);
+        c = multiply(*k, *c, w + 32);
+        r = subtract(*r, *c, w + 32);
+    }
+    IntegerRef f = toFixed(*r, w);
+    RealRef y = expFixed(*f, w);
+    return round(*y->mantissa, y->exponent + n, precision);
+}
+
+
+//
+// x = f * 2^k with f in [1/sqrt(2), sqrt(2)), and log(x) = k log 2 + log(f), where
+// y = log(f) is solved from exp(y) = f in Newton's method, y' = y + f exp(-y) - 1,
+// in which each step doubles the bits of y correct from the ones of the long double.
+// As y is as small as f - 1, the bits are counted below the point.
+//
+BigReal* BigReal::log(const BigReal& x, size_t precision)
+{
+    if (x.isZero())
+    {
+        throw OverflowException();
+    }
+    else if (x.isNegative())
+    {
+        throw EvaluationInabilityException();
+    }
+    size_t w = precision + GUARD_BITS;
+    size_t bits = BigInteger::getBitLength(*x.mantissa);
+    long k = getTop(x);
+    RealRef f = round(*x.mantissa, x.exponent - k, bits);
+    if (f->toRealNumber() < 0.70710678118654752440L)
+    {
+        k--;
+        f = round(*x.mantissa, x.exponent - k, bits);
+    }
+    RealRef one = integer(1, w);
+    RealRef d = subtract(*f, *one, bits + 2);
+    RealRef y = integer(0, w);
+    if (!d->isZero())
+    {
+        size_t lost = (size_t)std::max(-getTop(*d), 0L);
+        std::vector<size_t> steps;
+        for (size_t t = w + lost; t > 60; t = t / 2 + 8)
+        {
+            steps.push_back(t);
+        }
+        y = realNumber(logl(f->toRealNumber()));
+        while (!steps.empty())
+        {
+            size_t t = steps.back() + 8;
+            steps.pop_back();
+            RealRef z = negate(*y);
+            z = exp(*z, t);
+            z = multiply(*f, *z, t);
+            z = subtract(*z, *one, t);
+            y = add(*y, *z, t);
+        }
+    }
+    if (k)
+    {
+        RealRef c = ln2(w);
+        RealRef n = integer(k, w);
+        c = multiply(*n, *c, w);
+        y = add(*c, *y, w);
+    }
+    return round(*y->mantissa, y->exponent, precision);
+}
+
+
+BigReal* BigReal::log2(const BigReal& x, size_t precision)
+{
+    if (!x.isNegative() && BigInteger::getBitLength(*x.mantissa) == 1)
+    {
+        // The mantissa of a power of two is 1.
+        return integer(x.exponent, precision);
+    }
+    size_t w = precision + GUARD_BITS;
+    RealRef y = log(x, w);
+    RealRef c = ln2(w);
+    return divide(*y, *c, precision);
+}
+
+
+BigReal* BigReal::log10(const BigReal& x, size_t precision)
+{
+    size_t w = precision + GUARD_BITS;
+    RealRef y = log(x, w);
+    RealRef c = integer(10, w);
+    c = log(*c, w);
+    return divide(*y, *c, precision);
+}
+
+
+BigReal* BigReal::cubeRoot(const BigReal& x, size_t precision)
+{
+    if (x.isZero())
+    {
+        return integer(0, precision);
+    }
+    size_t w = precision + GUARD_BITS;
+    RealRef a = abs(x);
+    RealRef y = log(*a, w);
+    RealRef c = integer(3, w);
+    y = divide(*y, *c, w);
+    y = exp(*y, w);
+    if (x.isNegative())
+    {
+        y = negate(*y);
+    }
+    return round(*y->mantissa, y->exponent, precision);
+}
+
+
+//
+// x = n (pi / 2) + r with |r| <= pi / 4 or so, and the quadrant n mod 4 picks the signs.
+// The bits of pi / 2 are taken as many as x has above the point and more,
+// and even more if r is found to be near zero, so that r has the precision.
+//
+void BigReal::sinCos(const BigReal& x, size_t precision, BigReal*& s, BigReal*& c)
+{
+    if (x.isZero())
+    {
+        s = integer(0, precision);
+        c = integer(1, precision);
+        return;
+    }
+    long top = getTop(x);
+    if (top > (1L << 16))
+    {
+        // pi / 2 would need too many bits for x to be reduced.
+        throw EvaluationInabilityException();
+    }
+    RealRef r = round(*x.mantissa, x.exponent, BigInteger::getBitLength(*x.mantissa));
+    unsigned long quadrant = 0;
+    if (top > -1)
+    {
+        long extra = 8;
+        for (;;)
+        {
+            size_t w = precision + top + extra;
+            RealRef h = pi(w);
+            h = round(*h->mantissa, h->exponent - 1, w);
+            RealRef q = divide(x, *h, top + 8);
+            IntegerRef n = toNearestInteger(*q);
+            RealRef t = integer(*n, w);
+            t = multiply(*t, *h, w);
+            r = subtract(x, *t, w);
+            quadrant = n->getSize() ? n->getLimbs()[0] & 3 : 0;
+            if (n->isNegative())
+            {
+                quadrant = (4 - quadrant) & 3;
+            }
+            // r has the bits from 2^(top - w) or so correct.
+            if (!r->isZero() && getTop(*r) + extra >= 8)
+            {
+                break;
+            }
+            extra = r->isZero() ? extra + (long)precision : 16 - getTop(*r);
+        }
+    }
+    size_t w = precision + 8;
+    size_t scale = w + (size_t)std::max(-getTop(*r), 0L);
+    IntegerRef f = toFixed(*r, scale);
+    RealRef sr;
+    RealRef cr;
+    sinCosFixed(*f, scale, sr, cr);
+    sr = round(*sr->mantissa, sr->exponent, w);
+    cr = round(*cr->mantissa, cr->exponent, w);
+    switch (quadrant)
+    {
+    case 0:
+        s = sr.detach();
+        c = cr.detach();
+        break;
+    case 1:
+        s = cr.detach();
+        c = negate(*sr);
+        break;
+    case 2:
+        s = negate(*sr);
+        c = negate(*cr);
+        break;
+    default:
+        s = negate(*cr);
+        c = sr.detach();
+        break;
+    }
+}
+
+
+BigReal* BigReal::sin(const BigReal& x, size_t precision)
+{
+    BigReal* s = NULL;
+    BigReal* c = NULL;
+    sinCos(x, precision + GUARD_BITS, s, c);
+    RealRef y = s;
+    c->release();
+    return round(*y->mantissa, y->exponent, precision);
+}
+
+
+BigReal* BigReal::cos(const BigReal& x, size_t precision)
+{
+    BigReal* s = NULL;
+    BigReal* c = NULL;
+    sinCos(x, precision + GUARD_BITS, s, c);
+    RealRef y = c;
+    s->release();
+    return round(*y->mantissa, y->exponent, precision);
+}
+
+
+BigReal* BigReal::tan(const BigReal& x, size_t precision)
+{
+    BigReal* s = NULL;
+    BigReal* c = NULL;
+    sinCos(x, precision + GUARD_BITS, s, c);
+    RealRef s1 = s;
+    RealRef c1 = c;
+    return divide(*s1, *c1, precision);
+}
+
+
+//
+// An integer exponent that fits in long is done by repeated squaring, and the others
+// as exp(y log(x)), where the bits of the product above the point are added to the precision.
+//
+BigReal* BigReal::power(const BigReal& x, const BigReal& y, size_t precision)
+{
+    if (y.isZero())
+    {
+        return integer(1, precision);
+    }
+    else if (x.isZero())
+    {
+        if (y.isNegative())
+        {
+            throw OverflowException();
+        }
+        return integer(0, precision);
+    }
+    // The trailing zeros of the mantissa have been dropped; an integer has no bits below the point.
+    bool integral = y.exponent >= 0;
+    if (integral && getTop(y) <= 62)
+    {
+        unsigned long n = y.mantissa->getLimbs()[0] << y.exponent;
+        size_t w = precision + GUARD_BITS + 64;
+        RealRef b = round(*x.mantissa, x.exponent, w);
+        if (y.isNegative())
+        {
+            RealRef one = integer(1, w);
+            b = divide(*one, *b, w);
+        }
+        RealRef r = b;
+        for (int i = 62 - __builtin_clzl(n); i >= 0; i--)
+        {
+            r = multiply(*r, *r, w);
+            if ((n >> i) & 1)
+            {
+                r = multiply(*r, *b, w);
+            }
+        }
+        return round(*r->mantissa, r->exponent, precision);
+    }
+    else if (x.isNegative())
+    {
+        if (!integral)
+        {
+            throw EvaluationInabilityException();
+        }
+        // An integer is odd only if its mantissa is not shifted.
+        RealRef a = negate(x);
+        RealRef z = power(*a, y, precision);
+        return y.exponent ? z.detach() : negate(*z);
+    }
+    size_t w = precision + GUARD_BITS + 32;
+    RealRef z = log(x, w);
+    if (z->isZero())
+    {
+        return integer(1, precision);
+    }
+    else if (getTop(*z) + getTop(y) > 23)
+    {
+        // |y log(x)| >= 2^22
+        if (z->isNegative() != y.isNegative())
+        {
+            throw UnderflowException();
+        }
+        throw OverflowException();
+    }
+    z = multiply(y, *z, w);
+    return exp(*z, precision);
+}
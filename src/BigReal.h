@@ -0,0 +1,143 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#ifndef IKURA_BIGREAL_H
+#define IKURA_BIGREAL_H
+
+
+#include <stddef.h>
+#include <vector>
+#include "BigInteger.h"
+
+
+namespace hnrt
+{
+    //
+    // Real number of arbitrary precision, into which Number turns the real operations
+    // while the working precision is set by Number::setPrecision
+    //
+    // The value is m * 2^exponent with the integer m held in BigInteger. A BigReal is never
+    // changed once created, and is shared by reference counting as BigInteger is.
+    // Each operation takes the precision in bits, to which the result is rounded.
+    // The arithmetic operations and the square root are correctly rounded to the nearest with
+    // ties to even; the other functions are computed with GUARD_BITS more bits and then rounded,
+    // so that they are off by an ulp in the last bit at most.
+    //
+    // The elementary functions are summed up from their Taylor series by binary splitting,
+    // where the argument is split into the chunks of doubling bits (bit-burst), so that each sum
+    // costs not much more than a few multiplications in the full precision. The logarithm is
+    // solved from the exponential function in Newton's method doubling the precision each step.
+    // The long sums are split on as many threads as the processors this process may run on.
+    // pi by Chudnovsky's formula, e and log 2 are computed for the largest precision asked so far
+    // and kept for all.
+    //
+    // If the value would be 2^MAX_EXPONENT or larger, OverflowException is thrown, and
+    // if it would be less than 2^-MAX_EXPONENT, UnderflowException is thrown.
+    // The range is kept narrow enough for the decimal digits to be converted exactly in BigInteger,
+    // and the precision is up to MAX_PRECISION bits, so that the products of the mantissas fit in it.
+    //
+    class BigReal
+    {
+    public:
+
+        static const long MAX_EXPONENT = 1L << 20;
+        static const size_t GUARD_BITS = 64;
+        static const size_t MAX_PRECISION = 1UL << 22;
+
+        void addRef() { __sync_fetch_and_add(&refs, 1); }
+        void release() { if (!__sync_sub_and_fetch(&refs, 1)) { destroy(this); } }
+        bool isNegative() const { return mantissa->isNegative(); }
+        bool isZero() const { return !mantissa->getSize(); }
+        const BigInteger& getMantissa() const { return *mantissa; }
+        long getExponent() const { return exponent; }
+
+        //
+        // Returns the nearest real number, which is infinity or zero if out of the range.
+        //
+        long double toRealNumber() const;
+
+        //
+        // Returns the nearest __float128, which is infinity or zero if out of the range.
+        //
+        __float128 toFloat128() const;
+
+        //
+        // Appends the given number of the decimal digits of the absolute value rounded to the nearest,
+        // and returns the decimal exponent of the first digit.
+        //
+        long formatDecimal(std::vector<char>& buffer, size_t digits) const;
+
+        static BigReal* integer(const BigInteger::Operand& x, size_t precision);
+
+        //
+        // Returns the given finite real number exactly.
+        //
+        static BigReal* realNumber(long double x);
+        static BigReal* float128(__float128 x);
+
+        //
+        // Returns the value of the real number literal in the form Lexer::normalize gives,
+        // whose decimal point can be of any character.
+        //
+        static BigReal* parseDecimal(const char* s, size_t n, size_t precision);
+
+        static BigReal* add(const BigReal& x, const BigReal& y, size_t precision);
+        static BigReal* subtract(const BigReal& x, const BigReal& y, size_t precision);
+        static BigReal* multiply(const BigReal& x, const BigReal& y, size_t precision);
+
+        //
+        // If y is zero, DivideByZeroException is thrown.
+        //
+        static BigReal* divide(const BigReal& x, const BigReal& y, size_t precision);
+
+        //
+        // Raises x to the power of y. An integer exponent is done by repeated squaring.
+        // If x is negative and y is not an integer, EvaluationInabilityException is thrown.
+        //
+        static BigReal* power(const BigReal& x, const BigReal& y, size_t precision);
+
+        static BigReal* hypot(const BigReal& x, const BigReal& y, size_t precision);
+        static BigReal* negate(const BigReal& x);
+        static BigReal* abs(const BigReal& x);
+
+        //
+        // The functions below throw EvaluationInabilityException out of their domains
+        // as the ones of long double give NaN, and OverflowException for the logarithms of zero.
+        //
+        static BigReal* squareRoot(const BigReal& x, size_t precision);
+        static BigReal* cubeRoot(const BigReal& x, size_t precision);
+        static BigReal* exp(const BigReal& x, size_t precision);
+        static BigReal* log(const BigReal& x, size_t precision);
+        static BigReal* log2(const BigReal& x, size_t precision);
+        static BigReal* log10(const BigReal& x, size_t precision);
+        static BigReal* sin(const BigReal& x, size_t precision);
+        static BigReal* cos(const BigReal& x, size_t precision);
+        static BigReal* tan(const BigReal& x, size_t precision);
+
+        static BigReal* pi(size_t precision);
+        static BigReal* e(size_t precision);
+        static BigReal* ln2(size_t precision);
+
+        //
+        // Returns x / y * 2^exponent of the integers correctly rounded.
+        // If y is zero, DivideByZeroException is thrown.
+        //
+        static BigReal* ratio(const BigInteger::Operand& x, const BigInteger::Operand& y, long exponent, size_t precision);
+
+    private:
+
+        BigReal() {}
+        BigReal(const BigReal&) {}
+        void operator =(const BigReal&) {}
+        static BigReal* round(const BigInteger::Operand& m, long exponent, size_t precision, bool sticky = false);
+        static void sinCos(const BigReal& x, size_t precision, BigReal*& s, BigReal*& c);
+        static void destroy(BigReal* x);
+
+        int refs;
+        BigInteger* mantissa;
+        long exponent;
+    };
+}
+
+
+#endif //!IKURA_BIGREAL_H
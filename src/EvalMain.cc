@@ -0,0 +1,450 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#include <ctype.h>
+#include <libintl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "Expression.h"
+#include "Exception.h"
+#include "Program.h"
+#include "Optimizer.h"
+#include "StreamingEvaluator.h"
+#include "EvaluationContext.h"
+#include "VariableStore.h"
+#include "LocaleInfo.h"
+
+
+#define TEXTDOMAIN "ikura"
+
+
+using namespace hnrt;
+
+
+static const char* programName = "ikura-eval";
+static bool compiled = false;
+static bool optimized = false;
+static unsigned long removedCount = 0; // nodes removed by Optimizer
+static unsigned long sharedCount = 0; // subexpressions shared by Optimizer
+static unsigned long reducedCount = 0; // operations rewritten by Optimizer
+static bool perOperationSigfpe = false;
+static unsigned long repeatCount = 1;
+static long threadCount = 0; // 0 means as many as the online processors
+static double elapsedTime = 0;
+
+
+static void usage()
+{
+    fprintf(stderr, gettext("Usage: %s [-g] [-x] [-p PRECISION] [-c] [-O] [-l] [-b COUNT] [-j THREADS]\n"), programName);
+    fprintf(stderr, gettext("Reads expressions line by line from the standard input and\n"
+                            "writes the resulting values to the standard output.\n"));
+    fprintf(stderr, "  -g ... %s\n", gettext("use thousands' grouping"));
+    fprintf(stderr, "  -x ... %s\n", gettext("print integers in hexadecimal format"));
+    fprintf(stderr, "  -p ... %s\n", gettext("print real numbers in the given number of significant digits computed in that precision"));
+    fprintf(stderr, "  -c ... %s\n", gettext("evaluate expressions in the compiled form"));
+    fprintf(stderr, "  -O ... %s\n", gettext("optimize expressions and report the number of the nodes removed"));
+    fprintf(stderr, "  -l ... %s\n", gettext("use SIGFPE handler for each operation (legacy mode)"));
+    fprintf(stderr, "  -b ... %s\n", gettext("evaluate each expression the given times and report the elapsed time"));
+    fprintf(stderr, "  -j ... %s\n", gettext("evaluate expressions on the given number of threads (default: number of processors)"));
+}
+
+
+static double getTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1.0E9;
+}
+
+
+//
+// Evaluates the given expression repeatCount times and returns the last resulting value.
+//
+static Number evaluate(Expression* expr, EvaluationContext& context)
+{
+    Program* program = compiled ? new Program(expr) : NULL;
+    Number value;
+    try
+    {
+        for (unsigned long count = repeatCount; count > 0; count--)
+        {
+            value = program ? program->run(context) : expr->evaluate(context);
+        }
+    }
+    catch (...)
+    {
+        delete program;
+        throw;
+    }
+    delete program;
+    return value;
+}
+
+
+//
+// Evaluates the given expression once while parsing it, without building the tree.
+//
+static Number evaluate(const char* s, size_t n, EvaluationContext& context)
+{
+    StreamingEvaluator evaluator(s, n, context);
+    return evaluator.run();
+}
+
+
+//
+// Evaluates the given expression and appends the resulting value to the buffer.
+// If it encounters an error, Exception is thrown.
+// The tree is built only if it is compiled, optimized or evaluated more than once.
+//
+static void evaluate(const char* s, size_t n, int flags, EvaluationContext& context, std::vector<char>& buffer)
+{
+    if (!compiled && !optimized && repeatCount == 1)
+    {
+        evaluate(s, n, context).format(buffer, flags);
+        return;
+    }
+    ExpressionArena arena;
+    Expression* expr1 = Expression::parse(s, n, arena, true);
+    if (optimized)
+    {
+        Optimizer optimizer(arena);
+        expr1 = optimizer.run(expr1);
+        __sync_fetch_and_add(&removedCount, optimizer.getRemovedCount());
+        __sync_fetch_and_add(&sharedCount, optimizer.getSharedCount());
+        __sync_fetch_and_add(&reducedCount, optimizer.getReducedCount());
+    }
+    evaluate(expr1, context).format(buffer, flags);
+}
+
+
+//
+// Input line and the result of evaluating it
+//
+struct Line
+{
+    unsigned long number;
+    size_t offset; // to the text in the batch
+    size_t length; // without the line terminator and the surrounding blanks
+    bool failed;
+    std::vector<char> output;
+    Glib::ustring error;
+};
+
+
+//
+// Lines read at once
+//
+// The lines that can change variables, that is, the ones containing an assignment and,
+// while any variable has an assignment in its value, the ones referring to a name,
+// are evaluated one by one in order on the main thread.
+// The lines between them are shared among the threads, each of which evaluates them
+// in EM_READ_VIEW mode, and the results are written in order after all.
+//
+static const size_t batchSize = 1 << 14; // lines
+static const size_t blockSize = 64; // lines taken by a thread at once
+static std::vector<char> batchText;
+static std::vector<Line> batchLines;
+static size_t batchCount = 0; // number of the lines read into batchLines
+static size_t nextLine = 0; // index to the line to be taken by a thread next
+static size_t endLine = 0; // end of the lines being shared among the threads
+static int formatFlags = 0;
+
+
+static void evaluate(Line& line, EvaluationContext& context)
+{
+    line.failed = false;
+    line.output.clear();
+    if (line.length)
+    {
+        try
+        {
+            evaluate(&batchText[line.offset], line.length, formatFlags, context, line.output);
+        }
+        catch (const Exception& ex)
+        {
+            // Keep the output lines aligned with the input ones.
+            line.failed = true;
+            line.output.clear();
+            line.error = ex.getWhat();
+        }
+    }
+}
+
+
+static bool isSequential(const Line& line, bool impure)
+{
+    if (!line.length)
+    {
+        return false;
+    }
+    const char* s = &batchText[line.offset];
+    if (memchr(s, '=', line.length))
+    {
+        return true;
+    }
+    if (impure)
+    {
+        for (const char* t = s + line.length; s < t; s++)
+        {
+            int c = *s & 0xff;
+            if (isalpha(c) || c == '_' || c == '$' || c == '@')
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+static void* work(void*)
+{
+    EvaluationContext context(EM_READ_VIEW);
+    context.setPerOperationSigfpe(perOperationSigfpe);
+    while (true)
+    {
+        size_t start = __sync_fetch_and_add(&nextLine, blockSize);
+        if (start >= endLine)
+        {
+            break;
+        }
+        size_t end = start + blockSize < endLine ? start + blockSize : endLine;
+        for (size_t index = start; index < end; index++)
+        {
+            evaluate(batchLines[index], context);
+        }
+    }
+    return NULL;
+}
+
+
+//
+// Evaluates the given range of lines on as many threads as needed up to threadCount.
+// The main thread takes part in the work, too.
+//
+static void evaluateInParallel(size_t start, size_t end)
+{
+    nextLine = start;
+    endLine = end;
+    size_t wanted = (end - start + blockSize - 1) / blockSize;
+    std::vector<pthread_t> threads;
+    while (threads.size() + 1 < (size_t)threadCount && threads.size() + 1 < wanted)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, work, NULL))
+        {
+            break;
+        }
+        threads.push_back(thread);
+    }
+    work(NULL);
+    for (size_t index = 0; index < threads.size(); index++)
+    {
+        pthread_join(threads[index], NULL);
+    }
+}
+
+
+static void evaluateBatch()
+{
+    double startTime = getTime();
+    EvaluationContext context(EM_PERMANENT);
+    context.setPerOperationSigfpe(perOperationSigfpe);
+    bool impure = VariableStore::instance().hasImpure();
+    size_t start = 0;
+    while (start < batchCount)
+    {
+        size_t end = start;
+        while (end < batchCount && !isSequential(batchLines[end], impure))
+        {
+            end++;
+        }
+        if (threadCount > 1)
+        {
+            evaluateInParallel(start, end);
+        }
+        else
+        {
+            for (size_t index = start; index < end; index++)
+            {
+                evaluate(batchLines[index], context);
+            }
+        }
+        if (end < batchCount)
+        {
+            evaluate(batchLines[end++], context);
+            impure = VariableStore::instance().hasImpure();
+        }
+        start = end;
+    }
+    elapsedTime += getTime() - startTime;
+}
+
+
+//
+// Writes the results of the batch and returns the exit status.
+//
+static int writeBatch()
+{
+    int status = EXIT_SUCCESS;
+    for (size_t index = 0; index < batchCount; index++)
+    {
+        Line& line = batchLines[index];
+        if (line.failed)
+        {
+            fprintf(stderr, "%s: %lu: %s\n", programName, line.number, line.error.c_str());
+            status = EXIT_FAILURE;
+        }
+        line.output.push_back('\n');
+        fwrite(&line.output[0], 1, line.output.size(), stdout);
+    }
+    batchText.clear();
+    batchCount = 0;
+    return status;
+}
+
+
+int main(int argc, char *argv[])
+{
+    LocaleInfo::instance().init(); // initialization for internationalization
+
+    // initialization for message localization
+    bindtextdomain(TEXTDOMAIN, LocaleInfo::instance().getMessageCatalogDir(TEXTDOMAIN).c_str());
+    bind_textdomain_codeset(TEXTDOMAIN, "UTF-8");
+    textdomain(TEXTDOMAIN);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "gxp:cOlb:j:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'g':
+            formatFlags |= EF_GROUPING;
+            break;
+        case 'x':
+            formatFlags |= EF_HEXADECIMAL;
+            break;
+        case 'p':
+        {
+            // The real numbers are computed in the precision of the digits as InputBuffer::setPrecision does.
+            int digits = std::max(atoi(optarg), 0);
+            formatFlags = (formatFlags & ((1 << EF_PRECISION_SHIFT) - 1)) | (digits << EF_PRECISION_SHIFT);
+            Number::setPrecision(Number::getPrecisionForDigits(digits));
+            break;
+        }
+        case 'c':
+            compiled = true;
+            break;
+        case 'O':
+            optimized = true;
+            break;
+        case 'l':
+            perOperationSigfpe = true;
+            break;
+        case 'b':
+            repeatCount = strtoul(optarg, NULL, 10);
+            if (!repeatCount)
+            {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'j':
+            threadCount = strtol(optarg, NULL, 10);
+            if (threadCount < 1)
+            {
+                usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    if (!threadCount)
+    {
+        threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    VariableStore::instance().addDefaults();
+
+    // The results are written in large blocks rather than line by line.
+    static char outputBuffer[1 << 16];
+    setvbuf(stdout, outputBuffer, _IOFBF, sizeof(outputBuffer));
+
+    int status = EXIT_SUCCESS;
+    unsigned long lineNumber = 0;
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, stdin)) >= 0)
+    {
+        lineNumber++;
+        // strip the line terminator and the surrounding blanks
+        const char* start = line;
+        const char* end = line + length;
+        while (start < end && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+        {
+            end--;
+        }
+        while (start < end && (*start == ' ' || *start == '\t'))
+        {
+            start++;
+        }
+        if (batchLines.size() <= batchCount)
+        {
+            batchLines.resize(batchCount + 1);
+        }
+        Line& entry = batchLines[batchCount++];
+        entry.number = lineNumber;
+        entry.offset = batchText.size();
+        entry.length = end - start;
+        batchText.insert(batchText.end(), start, end);
+        if (batchCount == batchSize)
+        {
+            evaluateBatch();
+            if (writeBatch() != EXIT_SUCCESS)
+            {
+                status = EXIT_FAILURE;
+            }
+        }
+    }
+    free(line);
+    evaluateBatch();
+    if (writeBatch() != EXIT_SUCCESS)
+    {
+        status = EXIT_FAILURE;
+    }
+
+    if (repeatCount > 1)
+    {
+        fprintf(stderr, gettext("%s: %lu lines evaluated %lu times each in %.3f seconds\n"),
+                programName, lineNumber, repeatCount, elapsedTime);
+    }
+
+    if (optimized)
+    {
+        fprintf(stderr, gettext("%s: %lu nodes removed, %lu subexpressions shared and %lu operations reduced by optimization\n"),
+                programName, removedCount, sharedCount, reducedCount);
+    }
+
+    if (fflush(stdout))
+    {
+        status = EXIT_FAILURE;
+    }
+
+    return status;
+}
@@ -0,0 +1,59 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#include "EvaluationContext.h"
+#include "Exception.h"
+#include "Expression.h"
+#include "VariableStore.h"
+
+
+using namespace hnrt;
+
+
+EvaluationContext::EvaluationContext(EvaluationMode mode_)
+    : mode(mode_)
+    , inEvaluationCount(0)
+    , perOperationSigfpe(false)
+    , sigfpeCode(0)
+{
+}
+
+
+EvaluationContext::~EvaluationContext()
+{
+}
+
+
+void EvaluationContext::setInEvaluation(int slot)
+{
+    if ((size_t)slot >= inEvaluation.size())
+    {
+        inEvaluation.resize(slot + 1, false);
+    }
+    else if (inEvaluation[slot])
+    {
+        throw RecursiveVariableAccessException(VariableStore::instance().getKey(slot));
+    }
+    inEvaluation[slot] = true;
+    inEvaluationCount++;
+}
+
+
+void EvaluationContext::unsetInEvaluation(int slot)
+{
+    if (inEvaluation[slot])
+    {
+        inEvaluation[slot] = false;
+        inEvaluationCount--;
+    }
+}
+
+
+void EvaluationContext::setExpression(int slot, Expression* expr)
+{
+    if ((size_t)slot >= expressions.size())
+    {
+        expressions.resize(slot + 1, NULL);
+    }
+    expressions[slot] = expr;
+}
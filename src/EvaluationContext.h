@@ -0,0 +1,159 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#ifndef IKURA_EVALUATIONCONTEXT_H
+#define IKURA_EVALUATIONCONTEXT_H
+
+
+#include <setjmp.h>
+#include <stddef.h>
+#include <vector>
+#include "Number.h"
+#include "ExpressionArena.h"
+
+
+namespace hnrt
+{
+    class Expression;
+
+
+    //
+    // Operator waiting for the values of its operands in the tree-walking evaluator; see Expression.cc
+    //
+    struct EvaluationFrame
+    {
+        Expression* expr;
+        int index; // of the operand being evaluated
+    };
+
+
+    //
+    // Operator waiting for its right side in StreamingEvaluator
+    //
+    struct PendingOperator
+    {
+        int type; // ExpressionType
+        int slot; // variable marked in evaluation if ET_ASSIGN; -1 otherwise
+        size_t start; // offset to the string of the right side if ET_ASSIGN
+        bool chained; // true if ET_ADD or ET_SUBTRACT takes the sum on the top of the sum stack as its left side
+    };
+
+
+    enum EvaluationMode
+    {
+        EM_TRANSIENT, // assignments are evaluated but the variables are left unchanged
+        EM_PERMANENT, // assignments change the variables
+        EM_READ_VIEW, // same as EM_TRANSIENT, and the shared caches of VariableStore are not touched at all
+    };
+
+
+    //
+    // State of an evaluation in progress
+    //
+    // Everything that changes while an expression is evaluated lives here
+    // instead of in a static member, so that as many evaluations as contexts
+    // can run at the same time, one context per thread:
+    //
+    // - the floating-point error state used by SigfpeHandler,
+    // - the variables in evaluation to detect recursive references,
+    // - the stacks of the tree-walking evaluator and of StreamingEvaluator, and
+    // - the view of the variables.
+    //
+    // A context in EM_READ_VIEW mode only reads the values already evaluated in VariableStore,
+    // and parses the others into its own cache. Any number of such contexts can evaluate
+    // concurrently as long as no variable is changed in the meantime.
+    // The other modes go through the caches of VariableStore, which is for one thread at a time.
+    //
+    class EvaluationContext
+    {
+    public:
+
+        EvaluationContext(EvaluationMode mode = EM_TRANSIENT);
+        ~EvaluationContext();
+        bool isPermanent() const { return mode == EM_PERMANENT; }
+        bool isReadView() const { return mode == EM_READ_VIEW; }
+
+        bool isInEvaluation(int slot) const { return (size_t)slot < inEvaluation.size() && inEvaluation[slot]; }
+
+        //
+        // Marks the given slot as in evaluation.
+        // If it is already marked, RecursiveVariableAccessException is thrown.
+        //
+        void setInEvaluation(int slot);
+
+        //
+        // Unmarks the given slot.
+        //
+        void unsetInEvaluation(int slot);
+
+        //
+        // Returns true if any slot is marked as in evaluation.
+        //
+        bool hasInEvaluation() const { return inEvaluationCount > 0; }
+
+        //
+        // Returns the value of the given slot parsed by this context; NULL if not yet.
+        //
+        Expression* getExpression(int slot) const { return (size_t)slot < expressions.size() ? expressions[slot] : NULL; }
+
+        //
+        // Keeps the parsed value of the given slot, which is allocated from the arena of this context.
+        //
+        void setExpression(int slot, Expression* expr);
+
+        //
+        // Returns the arena of the parsed values, which are freed along with this context.
+        //
+        ExpressionArena& getArena() { return arena; }
+
+        //
+        // Returns true if each operation is to be run under SigfpeHandler (legacy mode).
+        // Otherwise the operations rely on validating their own results; see Arithmetic::validate.
+        //
+        bool isPerOperationSigfpe() const { return perOperationSigfpe; }
+        void setPerOperationSigfpe(bool value) { perOperationSigfpe = value; }
+
+        sigjmp_buf& getSigfpeEnv() { return sigfpeEnv; }
+        int getSigfpeCode() const { return sigfpeCode; }
+
+        //
+        // Returns the stacks of the tree-walking evaluator.
+        // A nested evaluation uses them above the entries of the outer one, and removes its own on return.
+        //
+        std::vector<EvaluationFrame>& getFrames() { return frames; }
+        std::vector<Number>& getValues() { return values; }
+
+        //
+        // Returns the operators of StreamingEvaluator, whose left sides are on the value stack.
+        //
+        std::vector<PendingOperator>& getOperators() { return operators; }
+
+        //
+        // Returns the sums of the ET_SUM chains in evaluation, which both evaluators keep in the same way as the values.
+        //
+        std::vector<PairwiseSum>& getSums() { return sums; }
+
+    private:
+
+        friend class SigfpeHandler;
+
+        EvaluationContext(const EvaluationContext&) {}
+        void operator =(const EvaluationContext&) {}
+
+        EvaluationMode mode;
+        std::vector<bool> inEvaluation; // indexed by slot
+        size_t inEvaluationCount; // slots marked in inEvaluation
+        std::vector<Expression*> expressions; // indexed by slot; used in EM_READ_VIEW mode
+        ExpressionArena arena; // of expressions
+        std::vector<EvaluationFrame> frames;
+        std::vector<Number> values;
+        std::vector<PendingOperator> operators;
+        std::vector<PairwiseSum> sums;
+        bool perOperationSigfpe;
+        sigjmp_buf sigfpeEnv;
+        volatile int sigfpeCode;
+    };
+}
+
+
+#endif //!IKURA_EVALUATIONCONTEXT_H
@@ -9,12 +9,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include "Expression.h"
+#include "Arithmetic.h"
 #include "Exception.h"
 #include "Parser.h"
 #include "OperatorInfo.h"
 #include "VariableStore.h"
 #include "SigfpeHandler.h"
 #include "LocaleInfo.h"
+#include "UTF8.h"
 
 
 using namespace hnrt;
@@ -27,206 +29,6 @@ using namespace hnrt;
 //////////////////////////////////////////////////////////////////////
 
 
-//
-// This helper function extracts a long value from each of the given expressions if both are ET_INTEGER.
-// If successful, true is returned and the expressions are freed.
-// Otherwise, false is returned.
-//
-static bool getIntegers(Expression* expr1, Expression* expr2, long& value1, long& value2)
-{
-    if (expr1->getType() == ET_INTEGER &&
-        expr2->getType() == ET_INTEGER)
-    {
-        value1 = ((Integer*)expr1)->getValue();
-        value2 = ((Integer*)expr2)->getValue();
-        delete expr1;
-        delete expr2;
-        return true;
-    }
-    else
-    {
-        return false;
-    }
-}
-
-
-//
-// This helper function extracts a long double value from each of the given expressions.
-// If successful, true is returned.
-// Otherwise, false is returned.
-// In either case, the given expressions are freed.
-//
-static bool getRealNumbers(Expression* expr1, Expression* expr2, long double& value1, long double& value2)
-{
-    bool retval = true;
-    switch (expr1->getType())
-    {
-    case ET_REALNUMBER:
-        value1 = ((RealNumber*)expr1)->getValue();
-        break;
-    case ET_INTEGER:
-        value1 = (long double)((Integer*)expr1)->getValue();
-        break;
-    case ET_INTEGER_MAX_PLUS_ONE:
-        value1 = (long double)((unsigned long)LONG_MAX + 1);
-        break;
-    default:
-        retval = false;
-        break;
-    }
-    switch (expr2->getType())
-    {
-    case ET_REALNUMBER:
-        value2 = ((RealNumber*)expr2)->getValue();
-        break;
-    case ET_INTEGER:
-        value2 = (long double)((Integer*)expr2)->getValue();
-        break;
-    case ET_INTEGER_MAX_PLUS_ONE:
-        value2 = (long double)((unsigned long)LONG_MAX + 1);
-        break;
-    default:
-        retval = false;
-        break;
-    }
-    delete expr1;
-    delete expr2;
-    return retval;
-}
-
-
-//
-// Integer multiplication being aware of the resulting value's overflow / underflow.
-//
-static long multiply(long value1, long value2)
-{
-    if (value1 > 1)
-    {
-        if (value2 > 1)
-        {
-            if ((unsigned long)value1 > (unsigned long)LONG_MAX / (unsigned long)value2)
-            {
-                throw OverflowException();
-            }
-        }
-        else if (value2 == 1)
-        {
-            return value1;
-        }
-        else if (value2 == 0)
-        {
-            return 0;
-        }
-        else if (value2 == -1)
-        {
-            return -value1;
-        }
-        else if (value2 == LONG_MIN)
-        {
-            throw UnderflowException();
-        }
-        else // if (LONG_MIN < value2 && value2 < -1)
-        {
-            if ((unsigned long)value1 > ((unsigned long)LONG_MAX + 1UL) / (unsigned long)(-value2))
-            {
-                throw UnderflowException();
-            }
-        }
-    }
-    else if (value1 == 1)
-    {
-        return value2;
-    }
-    else if (value1 == 0)
-    {
-        return 0;
-    }
-    else if (value1 == -1)
-    {
-        if (value2 == LONG_MIN)
-        {
-            throw OverflowException();
-        }
-    }
-    else if (value1 == LONG_MIN)
-    {
-        if (value2 > 1)
-        {
-            throw UnderflowException();
-        }
-        else if (value2 == 1)
-        {
-            return LONG_MIN;
-        }
-        else if (value2 == 0)
-        {
-            return 0;
-        }
-        else
-        {
-            throw OverflowException();
-        }
-    }
-    else // if (LONG_MIN < value1 && value1 < -1)
-    {
-        if (value2 > 1)
-        {
-            if ((unsigned long)(-value1) > ((unsigned long)LONG_MAX + 1UL) / (unsigned long)value2)
-            {
-                throw UnderflowException();
-            }
-        }
-        else if (value2 == 1)
-        {
-            return value1;
-        }
-        else if (value2 == 0)
-        {
-            return 0;
-        }
-        else if (value2 == -1)
-        {
-            return -value1;
-        }
-        else if (value2 == LONG_MIN)
-        {
-            throw OverflowException();
-        }
-        else // if (LONG_MIN < value2 && value2 < -1)
-        {
-            if ((unsigned long)(-value1) > (unsigned long)LONG_MAX / (unsigned long)(-value2))
-            {
-                throw OverflowException();
-            }
-        }
-    }
-    long value = value1 * value2;
-    return value;
-}
-
-
-//
-// This helper function checks if the given floating point number is valid or not.
-// If not, it throws an Exception accordingly.
-//
-static void validate(long double value)
-{
-    int c = fpclassify(value);
-    if (c == FP_INFINITE)
-    {
-        throw OverflowException();
-    }
-    else if (c == FP_SUBNORMAL)
-    {
-        throw UnderflowException();
-    }
-    else if (c == FP_NAN)
-    {
-        throw EvaluationInabilityException();
-    }
-}
-
-
 static void checkFpeCode(int code)
 {
     switch (code)
@@ -260,1351 +62,1184 @@ static void checkFpeCode(int code)
 
 //
 // Parses the given portion of string and returns the resulting Expression data structure.
-// The caller must free the returned data structure by delete operator when it is no longer needed.
+// The nodes are allocated from the given arena, and freed when the caller clears it.
 // If this static method encounters an error, it throws InvalidExpressionException or
 // InvalidCharExpression, the latter of which is thrown by Lexer class.
 // See Parser.cc and Lexer.cc for details.
 //
 // s .......... pointer to the string
 // n .......... length of the string in bytes
+// arena ...... where the nodes are allocated
 // complete ... true if the string is complete,
 //              which means that the parser needs to strictly check
 //              if the string represents a complete arithmetic expression.
 // 
-Expression* Expression::parse(const char *s, size_t n, bool complete)
+Expression* Expression::parse(const char *s, size_t n, ExpressionArena& arena, bool complete)
 {
-    Parser parser(s, n, complete);
+    Parser parser(s, n, arena, complete);
     return parser.run();
 }
 
 
 //////////////////////////////////////////////////////////////////////
 //
-// Add
+// Tree traversal
+//
+// The operators are formatted and evaluated by the loops below, which keep
+// the nodes in progress on an explicit stack instead of the call stack, so that a tree
+// of any depth is processed in the same order as the recursion over it would do.
 //
 //////////////////////////////////////////////////////////////////////
 
 
-void AddExpression::format(std::vector<char> &buffer, int flags)
+size_t Expression::getDepth(Expression* expr)
 {
-    left->format(buffer, flags);
-    buffer.push_back('+');
-    if (right)
+    size_t depth = 0;
+    std::vector<Expression*> nodes(1, expr);
+    std::vector<size_t> depths(1, 1);
+    std::vector<Expression**> children;
+    while (!nodes.empty())
     {
-        right->format(buffer, flags);
+        Expression* node = nodes.back();
+        size_t d = depths.back();
+        nodes.pop_back();
+        depths.pop_back();
+        if (!node)
+        {
+            continue;
+        }
+        if (depth < d)
+        {
+            depth = d;
+        }
+        children.clear();
+        node->getChildren(children);
+        for (size_t i = 0; i < children.size(); i++)
+        {
+            nodes.push_back(*children[i]);
+            depths.push_back(d + 1);
+        }
     }
+    return depth;
 }
 
 
-Expression* AddExpression::evaluate(bool permanent)
+static void appendString(std::vector<char> &buffer, const char* s, size_t n)
 {
-    Expression* expr1 = left->evaluate(permanent);
-    if (!right)
-    {
-        return expr1;
-    }
-    Expression* expr2;
-    try
-    {
-        expr2 = right->evaluate(permanent);
-    }
-    catch (...)
-    {
-        delete expr1;
-        throw;
+    size_t n1 = buffer.size();
+    buffer.resize(n1 + n);
+    memcpy(&buffer[n1], s, n);
+}
+
+
+//
+// Appends the string form of the given operator, which is followed by the operand if unary.
+//
+static void appendOperator(std::vector<char> &buffer, ExpressionType type)
+{
+    TerminalSymbol sym;
+    switch (type)
+    {
+    case ET_ADD:
+        buffer.push_back('+');
+        return;
+    case ET_SUBTRACT:
+    case ET_UNARY_MINUS:
+        buffer.push_back('-');
+        return;
+    case ET_MULTIPLY:
+        buffer.push_back('*');
+        return;
+    case ET_DIVIDE:
+        buffer.push_back('/');
+        return;
+    case ET_BLOCK:
+    case ET_INCOMPLETE_BLOCK:
+        buffer.push_back('(');
+        return;
+    case ET_HYPOT:
+        sym = SYM_HYPOT;
+        break;
+    case ET_POW:
+        sym = SYM_POW;
+        break;
+    case ET_POWMOD:
+        sym = SYM_POWMOD;
+        break;
+    case ET_ABS:
+        sym = SYM_ABS;
+        break;
+    case ET_CBRT:
+        sym = SYM_CBRT;
+        break;
+    case ET_COS:
+        sym = SYM_COS;
+        break;
+    case ET_EXP:
+        sym = SYM_EXP;
+        break;
+    case ET_LOG:
+        sym = SYM_LOG;
+        break;
+    case ET_LOG2:
+        sym = SYM_LOG2;
+        break;
+    case ET_LOG10:
+        sym = SYM_LOG10;
+        break;
+    case ET_SIN:
+        sym = SYM_SIN;
+        break;
+    case ET_SQRT:
+        sym = SYM_SQRT;
+        break;
+    default: // ET_TAN
+        sym = SYM_TAN;
+        break;
     }
-    SigfpeHandler sigfpeHandler;
-    sigfpeHandler.resetCode();
-    if (sigsetjmp(SigfpeHandler::env, 1) == 0)
-    {
-        long value1 = 0, value2 = 0;
-        if (getIntegers(expr1, expr2, value1, value2))
+    const char *op = OperatorInfo::instance().find(sym);
+    appendString(buffer, op, strlen(op));
+}
+
+
+struct FormatFrame
+{
+    Expression* expr;
+    size_t index; // of the next part to be formatted
+};
+
+
+//
+// Formats the given tree; the nodes without operators of their own are formatted by their own format.
+//
+static void formatTree(Expression* root, std::vector<char> &buffer, int flags)
+{
+    std::vector<FormatFrame> frames;
+    FormatFrame frame = { root, 0 };
+    frames.push_back(frame);
+    while (!frames.empty())
+    {
+        Expression* expr = frames.back().expr;
+        size_t index = frames.back().index++;
+        Expression* next = NULL;
+        bool done = false;
+        switch (expr->getType())
+        {
+        case ET_ADD:
+        case ET_SUBTRACT:
+        case ET_MULTIPLY:
+        case ET_DIVIDE:
+        case ET_HYPOT:
+        case ET_POW:
+        {
+            BinaryExpression* binary = (BinaryExpression*)expr;
+            if (index == 0)
+            {
+                next = binary->getLeft();
+            }
+            else if (index == 1)
+            {
+                appendOperator(buffer, expr->getType());
+                next = binary->getRight();
+            }
+            else
+            {
+                done = true;
+            }
+            break;
+        }
+        case ET_POWMOD:
         {
-            if (value2 > 0)
+            PowModExpression* powmod = (PowModExpression*)expr;
+            if (index == 0)
             {
-                if (value1 > LONG_MAX - value2)
-                {
-                    throw OverflowException();
-                }
+                next = powmod->getLeft();
             }
-            else if (value2 == 0)
+            else if (index == 1)
             {
-                // ok
+                appendOperator(buffer, ET_POW);
+                next = powmod->getRight();
             }
-            else if (value2 == LONG_MIN)
+            else if (index == 2)
             {
-                if (value1 < 0)
-                {
-                    throw UnderflowException();
-                }
+                appendOperator(buffer, ET_POWMOD);
+                next = powmod->getModulus();
             }
-            else // if (LONG_MIN < value2 && value2 < 0)
+            else
+            {
+                done = true;
+            }
+            break;
+        }
+        case ET_UNARY_MINUS:
+        case ET_BLOCK:
+        case ET_INCOMPLETE_BLOCK:
+        case ET_ABS:
+        case ET_CBRT:
+        case ET_COS:
+        case ET_EXP:
+        case ET_LOG:
+        case ET_LOG2:
+        case ET_LOG10:
+        case ET_SIN:
+        case ET_SQRT:
+        case ET_TAN:
+        {
+            UnaryExpression* unary = (UnaryExpression*)expr;
+            if (index == 0)
             {
-                if (value1 < LONG_MIN - value2)
+                appendOperator(buffer, expr->getType());
+                next = unary->getExpr();
+            }
+            else
+            {
+                if (expr->getType() == ET_BLOCK && unary->getExpr())
                 {
-                    throw UnderflowException();
+                    buffer.push_back(')');
                 }
+                done = true;
             }
-            long value = value1 + value2;
-            return new Integer(value);
+            break;
         }
-        else
+        case ET_INCOMPLETE:
         {
-            long double value1 = 0, value2 = 0;
-            if (getRealNumbers(expr1, expr2, value1, value2))
+            IncompleteExpression* incomplete = (IncompleteExpression*)expr;
+            if (index == 0)
             {
-                long double value = value1 + value2;
-                validate(value);
-                return new RealNumber(value);
+                next = incomplete->getExpr();
             }
+            else
+            {
+                incomplete->formatOperator(buffer);
+                done = true;
+            }
+            break;
         }
-    }
-    checkFpeCode(sigfpeHandler.getCode());
-    throw EvaluationInabilityException();
-}
-
-
-//////////////////////////////////////////////////////////////////////
-//
-// Subtract
-//
-//////////////////////////////////////////////////////////////////////
-
-
-void SubtractExpression::format(std::vector<char> &buffer, int flags)
-{
-    left->format(buffer, flags);
-    buffer.push_back('-');
-    if (right)
-    {
-        right->format(buffer, flags);
-    }
-}
-
-
-Expression* SubtractExpression::evaluate(bool permanent)
-{
-    Expression* expr1 = left->evaluate(permanent);
-    if (!right)
-    {
-        return expr1;
-    }
-    Expression* expr2;
-    try
-    {
-        expr2 = right->evaluate(permanent);
-    }
-    catch (...)
-    {
-        delete expr1;
-        throw;
-    }
-    SigfpeHandler sigfpeHandler;
-    sigfpeHandler.resetCode();
-    if (sigsetjmp(SigfpeHandler::env, 1) == 0)
-    {
-        long value1 = 0, value2 = 0;
-        if (getIntegers(expr1, expr2, value1, value2))
+        case ET_ASSIGN:
         {
-            if (value2 > 0)
+            AssignExpression* assign = (AssignExpression*)expr;
+            if (index == 0)
             {
-                if (value1 < LONG_MIN + value2)
-                {
-                    throw UnderflowException();
-                }
+                appendString(buffer, assign->getKey().c_str(), assign->getKey().bytes());
+                buffer.push_back('=');
+                next = assign->getExpr();
             }
-            else if (value2 == 0)
+            else
             {
-                // ok
+                done = true;
             }
-            else if (value2 == LONG_MIN)
+            break;
+        }
+        case ET_SUM:
+        case ET_PRODUCT:
+        {
+            ChainExpression* chain = (ChainExpression*)expr;
+            if (index < chain->getOperandCount())
             {
-                if (value1 >= 0)
+                if (index)
                 {
-                    throw UnderflowException();
+                    appendOperator(buffer, chain->getOperator(index));
                 }
+                next = chain->getOperand(index);
             }
-            else // if (LONG_MIN < value2 && value2 < 0)
+            else
             {
-                if (value1 > LONG_MAX + value2)
-                {
-                    throw OverflowException();
-                }
+                done = true;
             }
-            long value = value1 - value2;
-            return new Integer(value);
+            break;
         }
-        else
+        default:
+            expr->format(buffer, flags);
+            done = true;
+            break;
+        }
+        if (done)
         {
-            long double value1 = 0, value2 = 0;
-            if (getRealNumbers(expr1, expr2, value1, value2))
-            {
-                long double value = value1 - value2;
-                validate(value);
-                return new RealNumber(value);
-            }
+            frames.pop_back();
+        }
+        else if (next)
+        {
+            frame.expr = next;
+            frame.index = 0;
+            frames.push_back(frame);
         }
     }
-    checkFpeCode(sigfpeHandler.getCode());
-    throw EvaluationInabilityException();
 }
 
 
-//////////////////////////////////////////////////////////////////////
-//
-// Multiply
-//
-//////////////////////////////////////////////////////////////////////
+static const int CHAIN_ARITY = 4; // any number of operands
 
 
-void MultiplyExpression::format(std::vector<char> &buffer, int flags)
+//
+// Returns the number of the operands of the given operator that evaluateTree evaluates,
+// CHAIN_ARITY for ChainExpression, or 0 if the node is evaluated by its own evaluate.
+//
+static int getArity(ExpressionType type)
 {
-    left->format(buffer, flags);
-    buffer.push_back('*');
-    if (right)
-    {
-        right->format(buffer, flags);
+    switch (type)
+    {
+    case ET_ADD:
+    case ET_SUBTRACT:
+    case ET_MULTIPLY:
+    case ET_DIVIDE:
+    case ET_HYPOT:
+    case ET_POW:
+        return 2;
+    case ET_POWMOD:
+        return 3;
+    case ET_UNARY_MINUS:
+    case ET_BLOCK:
+    case ET_INCOMPLETE_BLOCK:
+    case ET_ABS:
+    case ET_CBRT:
+    case ET_COS:
+    case ET_EXP:
+    case ET_LOG:
+    case ET_LOG2:
+    case ET_LOG10:
+    case ET_SIN:
+    case ET_SQRT:
+    case ET_TAN:
+        return 1;
+    case ET_SUM:
+    case ET_PRODUCT:
+        return CHAIN_ARITY;
+    default:
+        return 0;
     }
 }
 
 
-Expression* MultiplyExpression::evaluate(bool permanent)
+//
+// Evaluates the given tree in post-order: the left side, the right side if any, the modulus if any, and then the operator.
+// The operands of a chain are evaluated one by one in the same way, and from the third one on,
+// those of ET_SUM are added to PairwiseSum.
+// The operators waiting for the values of their operands are kept on the stacks in the context,
+// above those of the evaluations that this one is nested in through the variables and so on.
+//
+static Number evaluateTree(Expression* root, EvaluationContext& context)
 {
-    Expression* expr1 = left->evaluate(permanent);
-    if (!right)
-    {
-        return expr1;
-    }
-    Expression* expr2;
+    std::vector<EvaluationFrame>& frames = context.getFrames();
+    std::vector<Number>& values = context.getValues();
+    std::vector<PairwiseSum>& sums = context.getSums();
+    size_t frameBottom = frames.size();
+    size_t valueBottom = values.size();
+    size_t sumBottom = sums.size();
     try
     {
-        expr2 = right->evaluate(permanent);
-    }
-    catch (...)
-    {
-        delete expr1;
-        throw;
-    }
-    SigfpeHandler sigfpeHandler;
-    sigfpeHandler.resetCode();
-    if (sigsetjmp(SigfpeHandler::env, 1) == 0)
-    {
-        long value1 = 0, value2 = 0;
-        if (getIntegers(expr1, expr2, value1, value2))
+        Expression* expr = root;
+        while (1)
         {
-            long value = multiply(value1, value2);
-            return new Integer(value);
-        }
-        else
-        {
-            long double value1 = 0, value2 = 0;
-            if (getRealNumbers(expr1, expr2, value1, value2))
+            // Goes down to the first operand to be evaluated.
+            int arity;
+            while ((arity = getArity(expr->getType())) > 0)
             {
-                long double value = value1 * value2;
-                validate(value);
-                return new RealNumber(value);
+                Expression* operand =
+                    arity == CHAIN_ARITY ? ((ChainExpression*)expr)->getOperand(0) :
+                    arity >= 2 ? ((BinaryExpression*)expr)->getLeft() :
+                    ((UnaryExpression*)expr)->getExpr();
+                if (!operand)
+                {
+                    if (expr->getType() == ET_INCOMPLETE_BLOCK)
+                    {
+                        throw EvaluationInabilityException(gettext("Incomplete block"));
+                    }
+                    throw EvaluationInabilityException();
+                }
+                EvaluationFrame frame = { expr, 0 };
+                frames.push_back(frame);
+                expr = operand;
+            }
+            values.push_back(expr->evaluate(context));
+            // Goes up applying the operators whose operands have been evaluated.
+            while (1)
+            {
+                if (frames.size() == frameBottom)
+                {
+                    Number value = values.back();
+                    values.pop_back();
+                    return value;
+                }
+                EvaluationFrame& frame = frames.back();
+                ExpressionType type = frame.expr->getType();
+                arity = getArity(type);
+                if (arity == CHAIN_ARITY)
+                {
+                    ChainExpression* chain = (ChainExpression*)frame.expr;
+                    size_t index = frame.index;
+                    if (index > 0)
+                    {
+                        Number value2 = values.back();
+                        values.pop_back();
+                        if (index == 1 || type == ET_PRODUCT)
+                        {
+                            values.back() = BinaryExpression::apply(chain->getOperator(index), values.back(), value2, context);
+                        }
+                        else
+                        {
+                            sums.back().add(value2, chain->getOperator(index) == ET_SUBTRACT);
+                        }
+                    }
+                    if (index + 1 < chain->getOperandCount())
+                    {
+                        if (index == 1 && type == ET_SUM)
+                        {
+                            sums.resize(sums.size() + 1);
+                            sums.back().start(values.back());
+                        }
+                        frame.index = (int)index + 1;
+                        expr = chain->getOperand(index + 1);
+                        break;
+                    }
+                    if (index >= 2 && type == ET_SUM)
+                    {
+                        values.back() = sums.back().getSum();
+                        sums.pop_back();
+                    }
+                }
+                else if (arity == 3)
+                {
+                    PowModExpression* powmod = (PowModExpression*)frame.expr;
+                    if (frame.index == 0)
+                    {
+                        frame.index = 1;
+                        expr = powmod->getRight();
+                        break;
+                    }
+                    else if (frame.index == 1 && powmod->getModulus())
+                    {
+                        frame.index = 2;
+                        expr = powmod->getModulus();
+                        break;
+                    }
+                    else if (frame.index == 1)
+                    {
+                        // Without the modulus, the value of the power is the value of this expression.
+                        Number value2 = values.back();
+                        values.pop_back();
+                        values.back() = BinaryExpression::apply(ET_POW, values.back(), value2, context);
+                    }
+                    else
+                    {
+                        Number value3 = values.back();
+                        values.pop_back();
+                        Number value2 = values.back();
+                        values.pop_back();
+                        values.back() = PowModExpression::apply(values.back(), value2, value3, context);
+                    }
+                }
+                else if (arity == 2)
+                {
+                    BinaryExpression* binary = (BinaryExpression*)frame.expr;
+                    if (frame.index == 0 && binary->getRight())
+                    {
+                        frame.index = 1;
+                        expr = binary->getRight();
+                        break;
+                    }
+                    else if (frame.index == 1)
+                    {
+                        Number value2 = values.back();
+                        values.pop_back();
+                        values.back() = BinaryExpression::apply(type, values.back(), value2, context);
+                    }
+                    // Otherwise the value of the left side is the value of this expression.
+                }
+                else
+                {
+                    values.back() = UnaryExpression::apply(type, values.back());
+                }
+                frames.pop_back();
             }
         }
     }
-    checkFpeCode(sigfpeHandler.getCode());
-    throw EvaluationInabilityException();
+    catch (...)
+    {
+        frames.resize(frameBottom);
+        values.resize(valueBottom);
+        sums.resize(sumBottom);
+        throw;
+    }
 }
 
 
 //////////////////////////////////////////////////////////////////////
 //
-// Divide
+// Binary Operators
 //
 //////////////////////////////////////////////////////////////////////
 
 
-void DivideExpression::format(std::vector<char> &buffer, int flags)
+void BinaryExpression::getChildren(std::vector<Expression**>& children)
 {
-    left->format(buffer, flags);
-    buffer.push_back('/');
-    if (right)
-    {
-        right->format(buffer, flags);
-    }
+    children.push_back(&left);
+    children.push_back(&right);
 }
 
 
-Expression* DivideExpression::evaluate(bool permanent)
+void BinaryExpression::format(std::vector<char> &buffer, int flags)
 {
-    Expression* expr1 = left->evaluate(permanent);
-    if (!right)
-    {
-        return expr1;
-    }
-    Expression* expr2;
-    try
-    {
-        expr2 = right->evaluate(permanent);
-    }
-    catch (...)
-    {
-        delete expr1;
-        throw;
-    }
-    SigfpeHandler sigfpeHandler;
-    long ivalue1 = 0, ivalue2 = 0;
-    long double rvalue1 = 0, rvalue2 = 0;
-    if (getIntegers(expr1, expr2, ivalue1, ivalue2))
-    {
-        if (ivalue2 == 0)
-        {
-            throw DivideByZeroException();
-        }
-        sigfpeHandler.resetCode();
-        if (sigsetjmp(SigfpeHandler::env, 1) == 0)
-        {
-            ldiv_t result = ldiv(ivalue1, ivalue2);
-            if (result.rem == 0)
-            {
-                return new Integer(result.quot);
-            }
-        }
-        else if (ivalue1 == LONG_MIN && ivalue2 == -1)
-        {
-            // this checking is needed as it is observed that
-            // SIGFPE handler may receive FPE_INTDIV (division by zero) in this case
-            throw OverflowException();
-        }
-        (void)sigfpeHandler.getCode(); // just block SIGFPE temporarily
-        rvalue1 = ivalue1;
-        rvalue2 = ivalue2;
-    }
-    else if (getRealNumbers(expr1, expr2, rvalue1, rvalue2))
-    {
-        if (rvalue2 == 0)
-        {
-            // Unless zero-check is done here, we will get FP_INFINITE.
-            throw DivideByZeroException();
-        }
-    }
-    else
-    {
-        throw EvaluationInabilityException();
-    }
-    sigfpeHandler.resetCode();
-    if (sigsetjmp(SigfpeHandler::env, 1) == 0)
-    {
-        long double value = rvalue1 / rvalue2;
-        validate(value);
-        return new RealNumber(value);
-    }
-    checkFpeCode(sigfpeHandler.getCode());
-    throw EvaluationInabilityException();
+    formatTree(this, buffer, flags);
 }
 
 
-//////////////////////////////////////////////////////////////////////
-//
-// Unary Minus
-//
-//////////////////////////////////////////////////////////////////////
-
-
-void MinusExpression::format(std::vector<char> &buffer, int flags)
+Number BinaryExpression::evaluate(EvaluationContext& context)
 {
-    buffer.push_back('-');
-    if (expr)
-    {
-        expr->format(buffer, flags);
-    }
+    return evaluateTree(this, context);
 }
 
 
-Expression* MinusExpression::evaluate(bool permanent)
+static Number operate(ExpressionType op, const Number& value1, const Number& value2)
 {
-    if (expr)
-    {
-        Expression* expr1 = expr->evaluate(permanent);
-        if (expr1->getType() == ET_INTEGER)
-        {
-            long value1 = ((Integer*)expr1)->getValue();
-            delete expr1;
-            if (value1 == LONG_MIN)
-            {
-                throw OverflowException();
-            }
-            long value = -value1;
-            return new Integer(value);
-        }
-        else if (expr1->getType() == ET_INTEGER_MAX_PLUS_ONE)
-        {
-            delete expr1;
-            return new Integer(LONG_MIN);
-        }
-        else if (expr1->getType() == ET_REALNUMBER)
-        {
-            long double value1 = ((RealNumber*)expr1)->getValue();
-            delete expr1;
-            long double value = -value1;
-            validate(value);
-            return new RealNumber(value);
-        }
-        delete expr1;
+    switch (op)
+    {
+    case ET_ADD:
+        return Number::add(value1, value2);
+    case ET_SUBTRACT:
+        return Number::subtract(value1, value2);
+    case ET_MULTIPLY:
+        return Number::multiply(value1, value2);
+    case ET_POW:
+        return Number::power(value1, value2);
+    default: // ET_DIVIDE
+        return Number::divide(value1, value2);
     }
-    throw EvaluationInabilityException();
 }
 
 
-//////////////////////////////////////////////////////////////////////
-//
-// Integer
-//
-//////////////////////////////////////////////////////////////////////
-
-
-void Integer::format(std::vector<char> &buffer, int flags)
+Number BinaryExpression::apply(ExpressionType op, const Number& value1, const Number& value2, EvaluationContext& context)
 {
-    if (string.empty())
+    if (op == ET_HYPOT)
     {
-        char tmp[64];
-        if ((flags & EF_HEXADECIMAL))
-        {
-            if (!(value & ~0xffffL))
-            {
-                sprintf(tmp, "0x%04lx", value);
-            }
-            else if (!(value & ~0xffffffffL))
-            {
-                sprintf(tmp, "0x%08lx", value);
-            }
-            else
-            {
-                sprintf(tmp, "0x%016lx", value);
-            }
-        }
-        else if ((flags & EF_GROUPING))
-        {
-            sprintf(tmp, "%'ld", value);
-        }
-        else
-        {
-            sprintf(tmp, "%ld", value);
-        }
-        size_t n1 = buffer.size();
-        size_t n2 = strlen(tmp);
-        buffer.resize(n1 + n2);
-        memcpy(&buffer[n1], tmp, n2);
+        return Number::hypot(value1, value2);
     }
-    else
+    if (!context.isPerOperationSigfpe())
+    {
+        // The operation validates its own result.
+        return operate(op, value1, value2);
+    }
+    SigfpeHandler sigfpeHandler(context);
+    sigfpeHandler.resetCode();
+    if (sigsetjmp(context.getSigfpeEnv(), 1) == 0)
     {
-        size_t n2 = string.bytes();
-        size_t n1 = buffer.size();
-        buffer.resize(n1 + n2);
-        memcpy(&buffer[n1], string.c_str(), n2);
+        return operate(op, value1, value2);
     }
+    checkFpeCode(sigfpeHandler.getCode());
+    throw EvaluationInabilityException();
 }
 
 
-Expression* Integer::evaluate(bool permanent)
+void PowModExpression::getChildren(std::vector<Expression**>& children)
 {
-    return new Integer(*this);
+    children.push_back(&left);
+    children.push_back(&right);
+    children.push_back(&modulus);
 }
 
 
-//////////////////////////////////////////////////////////////////////
-//
-// Real Number
-//
-//////////////////////////////////////////////////////////////////////
-
-
-void RealNumber::format(std::vector<char> &buffer, int flags)
+Number PowModExpression::apply(const Number& value1, const Number& value2, const Number& value3, EvaluationContext& context)
 {
-    if (string.empty())
+    if (!context.isPerOperationSigfpe())
     {
-        char tmp[64];
-        if ((flags & (EF_PRECISION10 | EF_PRECISION20)))
-        {
-            int precision = ((flags & EF_PRECISION10) ? 10 : 0) + ((flags & EF_PRECISION20) ? 20 : 0);
-            if ((flags & EF_GROUPING))
-            {
-                sprintf(tmp, "%'.*Lg", precision, value);
-            }
-            else
-            {
-                sprintf(tmp, "%.*Lg", precision, value);
-            }
-        }
-        else if ((flags & EF_GROUPING))
-        {
-            sprintf(tmp, "%'Lg", value);
-        }
-        else
-        {
-            sprintf(tmp, "%Lg", value);
-        }
-        size_t n1 = buffer.size();
-        size_t n2 = strlen(tmp);
-        buffer.resize(n1 + n2);
-        memcpy(&buffer[n1], tmp, n2);
+        // The operation validates its own result.
+        return Number::powerModulo(value1, value2, value3);
     }
-    else if ((flags & EF_PREPENDZERO) &&
-             LocaleInfo::getDecimalPoint() == (int)string[0]) // not work as expected if [] is byte oriented and decimal point is not in US-ASCII
-    {
-        size_t n2 = string.bytes();
-        size_t n1 = buffer.size();
-        buffer.resize(n1 + 1 + n2);
-        buffer[n1] = '0';
-        memcpy(&buffer[n1 + 1], string.c_str(), n2);
-    }
-    else
+    SigfpeHandler sigfpeHandler(context);
+    sigfpeHandler.resetCode();
+    if (sigsetjmp(context.getSigfpeEnv(), 1) == 0)
     {
-        size_t n2 = string.bytes();
-        size_t n1 = buffer.size();
-        buffer.resize(n1 + n2);
-        memcpy(&buffer[n1], string.c_str(), n2);
+        return Number::powerModulo(value1, value2, value3);
     }
-}
-
-
-Expression* RealNumber::evaluate(bool permanent)
-{
-    validate(value);
-    return new RealNumber(*this);
+    checkFpeCode(sigfpeHandler.getCode());
+    throw EvaluationInabilityException();
 }
 
 
 //////////////////////////////////////////////////////////////////////
 //
-// Block -- portion enclosed by parentheses
+// Unary Operators
 //
 //////////////////////////////////////////////////////////////////////
 
 
-void BlockExpression::format(std::vector<char> &buffer, int flags)
+void UnaryExpression::getChildren(std::vector<Expression**>& children)
 {
-    buffer.push_back('(');
-    if (expr)
-    {
-        expr->format(buffer, flags);
-        if (type == ET_BLOCK)
-        {
-            buffer.push_back(')');
-        }
-    }
+    children.push_back(&expr);
 }
 
 
-Expression* BlockExpression::evaluate(bool permanent)
+void UnaryExpression::format(std::vector<char> &buffer, int flags)
 {
-    if (expr)
-    {
-        return expr->evaluate(permanent);
-    }
-    else
-    {
-        throw EvaluationInabilityException(gettext("Incomplete block"));
-    }
+    formatTree(this, buffer, flags);
 }
 
 
-//////////////////////////////////////////////////////////////////////
-//
-// Incomplete
-//
-//////////////////////////////////////////////////////////////////////
-
-
-void IncompleteExpression::format(std::vector<char> &buffer, int flags)
+Number UnaryExpression::evaluate(EvaluationContext& context)
 {
-    if (expr)
-    {
-        expr->format(buffer, flags);
-    }
-    size_t n2 = string.bytes();
-    size_t n1 = buffer.size();
-    buffer.resize(n1 + n2);
-    memcpy(&buffer[n1], string.c_str(), n2);
+    return evaluateTree(this, context);
 }
 
 
-Expression* IncompleteExpression::evaluate(bool permanent)
+Number UnaryExpression::apply(ExpressionType op, const Number& value)
 {
-    throw EvaluationInabilityException(gettext("Invalid operator"));
+    switch (op)
+    {
+    case ET_UNARY_MINUS:
+        return Number::negate(value);
+    case ET_ABS:
+        return Number::abs(value);
+    case ET_CBRT:
+        return Number::cbrt(value);
+    case ET_COS:
+        return Number::cos(value);
+    case ET_EXP:
+        return Number::exp(value);
+    case ET_LOG:
+        return Number::log(value);
+    case ET_LOG2:
+        return Number::log2(value);
+    case ET_LOG10:
+        return Number::log10(value);
+    case ET_SIN:
+        return Number::sin(value);
+    case ET_SQRT:
+        return Number::sqrt(value);
+    case ET_TAN:
+        return Number::tan(value);
+    default: // ET_BLOCK, ET_INCOMPLETE_BLOCK
+        return value;
+    }
 }
 
 
 //////////////////////////////////////////////////////////////////////
 //
-// Variable
+// Integer
 //
 //////////////////////////////////////////////////////////////////////
 
 
-void Variable::format(std::vector<char> &buffer, int flags)
-{
-    size_t n2 = key.bytes();
-    size_t n1 = buffer.size();
-    buffer.resize(n1 + n2);
-    memcpy(&buffer[n1], key.c_str(), n2);
-}
-
-
-Expression* Variable::evaluate(bool permanent)
+void Integer::format(std::vector<char> &buffer, int flags)
 {
-    if (!VariableStore::instance().hasKey(key))
-    {
-        throw EvaluationInabilityException(Glib::ustring::compose(gettext("%1: Not exist"), key));
-    }
-    Glib::ustring value = VariableStore::instance().getValue(key);
-    if (value.empty())
+    if (!text)
     {
-        return new Integer(0);
+        value.format(buffer, flags);
     }
     else
     {
-        Expression* expr1 = parse(value.c_str(), value.bytes(), true);
-        try
-        {
-            VariableStore::instance().setInEvaluation(key);
-            Expression* expr2 = expr1->evaluate(permanent);
-            VariableStore::instance().unsetInEvaluation(key);
-            delete expr1;
-            return expr2;
-        }
-        catch (...)
-        {
-            VariableStore::instance().unsetInEvaluation(key);
-            delete expr1;
-            throw;
-        }
+        Lexer::normalize(text, length, buffer);
     }
 }
 
 
+Number Integer::evaluate(EvaluationContext& context)
+{
+    return value;
+}
+
+
 //////////////////////////////////////////////////////////////////////
 //
-// Assign
+// Real Number
 //
 //////////////////////////////////////////////////////////////////////
 
 
-void AssignExpression::format(std::vector<char> &buffer, int flags)
+void RealNumber::format(std::vector<char> &buffer, int flags)
 {
-    size_t n2 = key.bytes();
+    if (!text)
+    {
+        value.format(buffer, flags);
+        return;
+    }
     size_t n1 = buffer.size();
-    buffer.resize(n1 + n2 + 1);
-    memcpy(&buffer[n1], key.c_str(), n2);
-    buffer[n1 + n2] = '=';
-    if (expr)
+    Lexer::normalize(text, length, buffer);
+    if ((flags & EF_PREPENDZERO) &&
+        LocaleInfo::getDecimalPoint() == UTF8::getChar(&buffer[n1], &buffer[0] + buffer.size()))
     {
-        expr->format(buffer, flags);
+        buffer.insert(buffer.begin() + n1, '0');
     }
 }
 
 
-Expression* AssignExpression::evaluate(bool permanent)
+Number RealNumber::evaluate(EvaluationContext& context)
 {
-    if (!VariableStore::instance().hasKey(key))
-    {
-        throw EvaluationInabilityException(Glib::ustring::compose(gettext("%1: Not exist"), key));
-    }
-    try
-    {
-        VariableStore::instance().setInEvaluation(key);
-        Expression* expr2 = expr ? expr->evaluate(permanent) : new Integer(0);
-        VariableStore::instance().unsetInEvaluation(key);
-        if (permanent)
-        {
-            std::vector<char> buffer;
-            expr->format(buffer, false);
-            buffer.push_back(0);
-            VariableStore::instance().setValue(key, &buffer[0]);
-        }
-        return expr2;
-    }
-    catch (...)
+    if (value.getType() == NT_REALNUMBER)
     {
-        VariableStore::instance().unsetInEvaluation(key);
-        throw;
+        Arithmetic::validate(value.getRealNumber());
     }
+    return value;
 }
 
 
 //////////////////////////////////////////////////////////////////////
 //
-// Absolute Value
+// Incomplete
 //
 //////////////////////////////////////////////////////////////////////
 
 
-void AbsExpression::format(std::vector<char> &buffer, int flags)
+void IncompleteExpression::getChildren(std::vector<Expression**>& children)
 {
-    const char *op = OperatorInfo::instance().find(SYM_ABS);
-    size_t n2 = strlen(op);
-    size_t n1 = buffer.size();
-    buffer.resize(n1 + n2);
-    memcpy(&buffer[n1], op, n2);
-    if (expr)
-    {
-        expr->format(buffer, flags);
-    }
+    children.push_back(&expr);
 }
 
 
-Expression* AbsExpression::evaluate(bool permanent)
+void IncompleteExpression::format(std::vector<char> &buffer, int flags)
 {
-    if (expr)
-    {
-        Expression* expr1 = expr->evaluate(permanent);
-        if (expr1->getType() == ET_INTEGER)
-        {
-            long value = ((Integer*)expr1)->getValue();
-            delete expr1;
-            if (value == LONG_MIN)
-            {
-                throw OverflowException();
-            }
-            if (value < 0)
-            {
-                value *= -1;
-            }
-            return new Integer(value);
-        }
-        else if (expr1->getType() == ET_REALNUMBER)
-        {
-            long double value1 = ((RealNumber*)expr1)->getValue();
-            delete expr1;
-            long double value = fabsl(value1);
-            validate(value);
-            return new RealNumber(value);
-        }
-        else if (expr1->getType() == ET_INTEGER_MAX_PLUS_ONE)
-        {
-            delete expr1;
-            throw OverflowException();
-        }
-        delete expr1;
-    }
-    throw EvaluationInabilityException();
+    formatTree(this, buffer, flags);
+}
+
+
+void IncompleteExpression::formatOperator(std::vector<char> &buffer) const
+{
+    // The operator is complemented in the same way as Lexer did at the end of the string.
+    Lexer lexer(text, length);
+    lexer.getSym();
+    const char* s = lexer.getString();
+    appendString(buffer, s, strlen(s));
+}
+
+
+Number IncompleteExpression::evaluate(EvaluationContext& context)
+{
+    throw EvaluationInabilityException(gettext("Invalid operator"));
 }
 
 
 //////////////////////////////////////////////////////////////////////
 //
-// Cube Root
+// Variable
 //
 //////////////////////////////////////////////////////////////////////
 
 
-void CbrtExpression::format(std::vector<char> &buffer, int flags)
+const Glib::ustring& Variable::getKey() const
 {
-    const char *op = OperatorInfo::instance().find(SYM_CBRT);
-    size_t n2 = strlen(op);
-    size_t n1 = buffer.size();
-    buffer.resize(n1 + n2);
-    memcpy(&buffer[n1], op, n2);
-    if (expr)
-    {
-        expr->format(buffer, flags);
-    }
+    return key ? *key : VariableStore::instance().getKey(slot);
+}
+
+
+void Variable::format(std::vector<char> &buffer, int flags)
+{
+    const Glib::ustring& k = getKey();
+    appendString(buffer, k.c_str(), k.bytes());
 }
 
 
-Expression* CbrtExpression::evaluate(bool permanent)
+Number Variable::evaluate(EvaluationContext& context)
 {
-    if (expr)
+    // The slot is left unresolved if the expression was parsed as an incomplete one.
+    int s = slot >= 0 ? slot : VariableStore::instance().find(*key);
+    if (s < 0)
     {
-        Expression* expr1 = expr->evaluate(permanent);
-        if (expr1->getType() == ET_INTEGER)
-        {
-            long value1 = ((Integer*)expr1)->getValue();
-            delete expr1;
-            long double value = cbrtl((long double)value1);
-            validate(value);
-            return new RealNumber(value);
-        }
-        else if (expr1->getType() == ET_REALNUMBER)
-        {
-            long double value1 = ((RealNumber*)expr1)->getValue();
-            delete expr1;
-            long double value = cbrtl(value1);
-            validate(value);
-            return new RealNumber(value);
-        }
-        else if (expr1->getType() == ET_INTEGER_MAX_PLUS_ONE)
-        {
-            delete expr1;
-            throw OverflowException();
-        }
-        delete expr1;
+        throw EvaluationInabilityException(Glib::ustring::compose(gettext("%1: Not exist"), *key));
     }
-    throw EvaluationInabilityException();
+    return VariableStore::instance().evaluate(s, context);
 }
 
 
 //////////////////////////////////////////////////////////////////////
 //
-// Cosine
+// Assign
 //
 //////////////////////////////////////////////////////////////////////
 
 
-void CosExpression::format(std::vector<char> &buffer, int flags)
+const Glib::ustring& AssignExpression::getKey() const
 {
-    const char *op = OperatorInfo::instance().find(SYM_COS);
-    size_t n2 = strlen(op);
-    size_t n1 = buffer.size();
-    buffer.resize(n1 + n2);
-    memcpy(&buffer[n1], op, n2);
-    if (expr)
-    {
-        expr->format(buffer, flags);
-    }
+    return VariableStore::instance().getKey(slot);
+}
+
+
+void AssignExpression::getChildren(std::vector<Expression**>& children)
+{
+    children.push_back(&expr);
+}
+
+
+void AssignExpression::format(std::vector<char> &buffer, int flags)
+{
+    formatTree(this, buffer, flags);
 }
 
 
-Expression* CosExpression::evaluate(bool permanent)
+Number AssignExpression::evaluate(EvaluationContext& context)
 {
-    if (expr)
+    context.setInEvaluation(slot);
+    try
     {
-        Expression* expr1 = expr->evaluate(permanent);
-        if (expr1->getType() == ET_INTEGER)
+        Number value2 = expr ? expr->evaluate(context) : Number(0L);
+        context.unsetInEvaluation(slot);
+        if (context.isPermanent())
         {
-            long value1 = ((Integer*)expr1)->getValue();
-            delete expr1;
-            long double value = cosl((long double)value1);
-            validate(value);
-            return new RealNumber(value);
-        }
-        else if (expr1->getType() == ET_REALNUMBER)
-        {
-            long double value1 = ((RealNumber*)expr1)->getValue();
-            delete expr1;
-            long double value = cosl(value1);
-            validate(value);
-            return new RealNumber(value);
-        }
-        else if (expr1->getType() == ET_INTEGER_MAX_PLUS_ONE)
-        {
-            delete expr1;
-            throw OverflowException();
+            std::vector<char> buffer;
+            expr->format(buffer, false);
+            buffer.push_back(0);
+            VariableStore::instance().setValue(slot, &buffer[0]);
         }
-        delete expr1;
+        return value2;
+    }
+    catch (...)
+    {
+        context.unsetInEvaluation(slot);
+        throw;
     }
-    throw EvaluationInabilityException();
 }
 
 
 //////////////////////////////////////////////////////////////////////
 //
-// Base-e Exponential
+// Shared -- occurrence of a common subexpression
 //
 //////////////////////////////////////////////////////////////////////
 
 
-void ExpExpression::format(std::vector<char> &buffer, int flags)
+void SharedExpression::format(std::vector<char> &buffer, int flags)
 {
-    const char *op = OperatorInfo::instance().find(SYM_EXP);
-    size_t n2 = strlen(op);
-    size_t n1 = buffer.size();
-    buffer.resize(n1 + n2);
-    memcpy(&buffer[n1], op, n2);
-    if (expr)
-    {
-        expr->format(buffer, flags);
-    }
+    subexpression->expr->format(buffer, flags);
 }
 
 
-Expression* ExpExpression::evaluate(bool permanent)
+Number SharedExpression::evaluate(EvaluationContext& context)
 {
-    if (expr)
+    if (!subexpression->evaluated)
     {
-        Expression* expr1 = expr->evaluate(permanent);
-        if (expr1->getType() == ET_INTEGER)
-        {
-            long value1 = ((Integer*)expr1)->getValue();
-            delete expr1;
-            long double value = expl((long double)value1);
-            validate(value);
-            return new RealNumber(value);
-        }
-        else if (expr1->getType() == ET_REALNUMBER)
-        {
-            long double value1 = ((RealNumber*)expr1)->getValue();
-            delete expr1;
-            long double value = expl(value1);
-            validate(value);
-            return new RealNumber(value);
-        }
-        else if (expr1->getType() == ET_INTEGER_MAX_PLUS_ONE)
-        {
-            delete expr1;
-            throw OverflowException();
-        }
-        delete expr1;
+        subexpression->value = subexpression->expr->evaluate(context);
+        subexpression->evaluated = true;
     }
-    throw EvaluationInabilityException();
+    return subexpression->value;
 }
 
 
 //////////////////////////////////////////////////////////////////////
 //
-// Euclidean Distance
+// DAG -- root of a tree with common subexpressions
 //
 //////////////////////////////////////////////////////////////////////
 
 
-void HypotExpression::format(std::vector<char> &buffer, int flags)
+DagExpression::~DagExpression()
 {
-    left->format(buffer, flags);
-    const char *op = OperatorInfo::instance().find(SYM_HYPOT);
-    size_t n2 = strlen(op);
-    size_t n1 = buffer.size();
-    buffer.resize(n1 + n2);
-    memcpy(&buffer[n1], op, n2);
-    if (right)
+    for (std::vector<Subexpression*>::iterator iter = subexpressions.begin(); iter != subexpressions.end(); iter++)
     {
-        right->format(buffer, flags);
+        delete *iter;
     }
 }
 
 
-Expression* HypotExpression::evaluate(bool permanent)
+void DagExpression::getChildren(std::vector<Expression**>& children)
 {
-    Expression* expr1 = left->evaluate(permanent);
-    if (!right)
+    children.push_back(&expr);
+    for (std::vector<Subexpression*>::iterator iter = subexpressions.begin(); iter != subexpressions.end(); iter++)
     {
-        return expr1;
+        children.push_back(&(*iter)->expr);
     }
-    Expression* expr2;
-    try
-    {
-        expr2 = right->evaluate(permanent);
-    }
-    catch (...)
-    {
-        delete expr1;
-        throw;
-    }
-    long double value1 = 0, value2 = 0;
-    if (getRealNumbers(expr1, expr2, value1, value2))
-    {
-        long double value = hypotl(value1, value2);
-        validate(value);
-        return new RealNumber(value);
-    }
-    throw EvaluationInabilityException();
 }
 
 
-//////////////////////////////////////////////////////////////////////
-//
-// Log
-//
-//////////////////////////////////////////////////////////////////////
+void DagExpression::format(std::vector<char> &buffer, int flags)
+{
+    expr->format(buffer, flags);
+}
 
 
-void LogExpression::format(std::vector<char> &buffer, int flags)
+Number DagExpression::evaluate(EvaluationContext& context)
 {
-    const char *op = OperatorInfo::instance().find(SYM_LOG);
-    size_t n2 = strlen(op);
-    size_t n1 = buffer.size();
-    buffer.resize(n1 + n2);
-    memcpy(&buffer[n1], op, n2);
-    if (expr)
+    // The values of the last evaluation are stale; the variables may have been changed since then.
+    for (std::vector<Subexpression*>::iterator iter = subexpressions.begin(); iter != subexpressions.end(); iter++)
     {
-        expr->format(buffer, flags);
+        (*iter)->evaluated = false;
     }
+    return expr->evaluate(context);
 }
 
 
-Expression* LogExpression::evaluate(bool permanent)
+Subexpression* DagExpression::add(Expression* expr_)
 {
-    if (expr)
-    {
-        Expression* expr1 = expr->evaluate(permanent);
-        if (expr1->getType() == ET_INTEGER)
-        {
-            long value1 = ((Integer*)expr1)->getValue();
-            delete expr1;
-            long double value = logl((long double)value1);
-            validate(value);
-            return new RealNumber(value);
-        }
-        else if (expr1->getType() == ET_REALNUMBER)
-        {
-            long double value1 = ((RealNumber*)expr1)->getValue();
-            delete expr1;
-            long double value = logl(value1);
-            validate(value);
-            return new RealNumber(value);
-        }
-        else if (expr1->getType() == ET_INTEGER_MAX_PLUS_ONE)
-        {
-            delete expr1;
-            throw OverflowException();
-        }
-        delete expr1;
-    }
-    throw EvaluationInabilityException();
+    Subexpression* s = new Subexpression;
+    s->expr = expr_;
+    s->index = (int)subexpressions.size();
+    s->evaluated = false;
+    subexpressions.push_back(s);
+    return s;
 }
 
 
 //////////////////////////////////////////////////////////////////////
 //
-// Log2
+// Polynomial
 //
 //////////////////////////////////////////////////////////////////////
 
 
-void Log2Expression::format(std::vector<char> &buffer, int flags)
+//
+// Adds a * b to the sum. Returns false if it overflows.
+//
+static bool addProduct(unsigned long& sum, unsigned long a, unsigned long b)
 {
-    const char *op = OperatorInfo::instance().find(SYM_LOG2);
-    size_t n2 = strlen(op);
-    size_t n1 = buffer.size();
-    buffer.resize(n1 + n2);
-    memcpy(&buffer[n1], op, n2);
-    if (expr)
-    {
-        expr->format(buffer, flags);
-    }
+    unsigned long product;
+    return !__builtin_mul_overflow(a, b, &product) && !__builtin_add_overflow(sum, product, &sum);
 }
 
 
-Expression* Log2Expression::evaluate(bool permanent)
+//
+// Returns true if the polynomial and the powers of the variable up to the degree
+// fit in a long for the absolute value of the variable t.
+// As long as the sum of the absolute values of the terms fits, so do all of
+// the intermediate values of both the original expression and Horner's scheme.
+//
+static bool isIntegerSafe(const std::vector<long double>& coefficients, unsigned long t)
 {
-    if (expr)
+    unsigned long sum = 0;
+    unsigned long power = 1;
+    for (size_t i = 0; i < coefficients.size(); i++)
     {
-        Expression* expr1 = expr->evaluate(permanent);
-        if (expr1->getType() == ET_INTEGER)
+        long double c = ceill(fabsl(coefficients[i]));
+        if (c > (long double)LONG_MAX)
         {
-            long value1 = ((Integer*)expr1)->getValue();
-            delete expr1;
-            long double value = log2l((long double)value1);
-            validate(value);
-            return new RealNumber(value);
+            return false;
         }
-        else if (expr1->getType() == ET_REALNUMBER)
+        unsigned long a = c < 1 && i ? 1 : (unsigned long)c;
+        if (!addProduct(sum, a, power) || sum > (unsigned long)LONG_MAX)
         {
-            long double value1 = ((RealNumber*)expr1)->getValue();
-            delete expr1;
-            long double value = log2l(value1);
-            validate(value);
-            return new RealNumber(value);
+            return false;
         }
-        else if (expr1->getType() == ET_INTEGER_MAX_PLUS_ONE)
+        if (i + 1 < coefficients.size() && __builtin_mul_overflow(power, t, &power))
         {
-            delete expr1;
-            throw OverflowException();
+            return false;
         }
-        delete expr1;
     }
-    throw EvaluationInabilityException();
+    return true;
 }
 
 
-//////////////////////////////////////////////////////////////////////
-//
-// Log10
-//
-//////////////////////////////////////////////////////////////////////
-
-
-void Log10Expression::format(std::vector<char> &buffer, int flags)
+PolynomialExpression::PolynomialExpression(Expression* expr_, Variable* variable_, const std::vector<Number>& coefficients)
+    : Expression(ET_POLYNOMIAL)
+    , expr(expr_)
+    , variable(variable_)
+    , integral(true)
+    , integerBound(0)
+    , realLower(1)
+    , realUpper(0)
 {
-    const char *op = OperatorInfo::instance().find(SYM_LOG10);
-    size_t n2 = strlen(op);
-    size_t n1 = buffer.size();
-    buffer.resize(n1 + n2);
-    memcpy(&buffer[n1], op, n2);
-    if (expr)
+    size_t n = coefficients.size();
+    int signs[2] = { 0, 0 };
+    sameSign[0] = sameSign[1] = true;
+    for (size_t i = 0; i < n; i++)
+    {
+        realCoefficients.push_back(coefficients[i].toRealNumber());
+        integerCoefficients.push_back(coefficients[i].getType() == NT_INTEGER ? coefficients[i].getInteger() : 0);
+        if (coefficients[i].getType() != NT_INTEGER)
+        {
+            integral = false;
+        }
+        if (realCoefficients[i] != 0)
+        {
+            int sign = realCoefficients[i] < 0 ? -1 : 1;
+            for (int j = 0; j < 2; j++)
+            {
+                // the sign of the term for positive x, and then for negative x
+                int termSign = j && (i & 1) ? -sign : sign;
+                if (signs[j] && signs[j] != termSign)
+                {
+                    sameSign[j] = false;
+                }
+                signs[j] = termSign;
+            }
+        }
+    }
+    // the largest integer bound found by bisection
+    unsigned long lower = 0;
+    unsigned long upper = (unsigned long)LONG_MAX;
+    while (lower < upper)
     {
-        expr->format(buffer, flags);
+        unsigned long t = lower + (upper - lower + 1) / 2;
+        if (isIntegerSafe(realCoefficients, t))
+        {
+            lower = t;
+        }
+        else
+        {
+            upper = t - 1;
+        }
     }
-}
-
-
-Expression* Log10Expression::evaluate(bool permanent)
-{
-    if (expr)
+    integerBound = isIntegerSafe(realCoefficients, lower) ? (long)lower : -1;
+    // Keep the powers of the variable and the terms within [2^-4000, 2^4000], which is far enough
+    // from both ends of long double that no intermediate value can overflow or be subnormal;
+    // the bounds are computed with the margin of 2^10 against the rounding errors of log2l and exp2l.
+    // Zero is left out because the sign of zero could differ.
+    const long double limit = 3990;
+    long double lowerLog = -limit / (n - 1);
+    long double upperLog = limit / (n - 1);
+    for (size_t i = 0; i < n; i++)
     {
-        Expression* expr1 = expr->evaluate(permanent);
-        if (expr1->getType() == ET_INTEGER)
+        long double c = fabsl(realCoefficients[i]);
+        if (c == 0)
         {
-            long value1 = ((Integer*)expr1)->getValue();
-            delete expr1;
-            long double value = log10l((long double)value1);
-            validate(value);
-            return new RealNumber(value);
+            continue;
         }
-        else if (expr1->getType() == ET_REALNUMBER)
+        long double cLog = log2l(c);
+        if (cLog < -limit || limit < cLog)
         {
-            long double value1 = ((RealNumber*)expr1)->getValue();
-            delete expr1;
-            long double value = log10l(value1);
-            validate(value);
-            return new RealNumber(value);
+            return;
         }
-        else if (expr1->getType() == ET_INTEGER_MAX_PLUS_ONE)
+        if (i)
         {
-            delete expr1;
-            throw OverflowException();
+            long double l = (-limit - cLog) / i;
+            long double u = (limit - cLog) / i;
+            lowerLog = lowerLog < l ? l : lowerLog;
+            upperLog = u < upperLog ? u : upperLog;
         }
-        delete expr1;
     }
-    throw EvaluationInabilityException();
+    if (lowerLog <= upperLog)
+    {
+        realLower = exp2l(lowerLog);
+        realUpper = exp2l(upperLog);
+    }
 }
 
 
-//////////////////////////////////////////////////////////////////////
-//
-// Power
-//
-//////////////////////////////////////////////////////////////////////
+void PolynomialExpression::getChildren(std::vector<Expression**>& children)
+{
+    children.push_back(&expr);
+}
 
 
-void PowExpression::format(std::vector<char> &buffer, int flags)
+void PolynomialExpression::format(std::vector<char> &buffer, int flags)
 {
-    left->format(buffer, flags);
-    const char *op = OperatorInfo::instance().find(SYM_POW);
-    size_t n2 = strlen(op);
-    size_t n1 = buffer.size();
-    buffer.resize(n1 + n2);
-    memcpy(&buffer[n1], op, n2);
-    if (right)
-    {
-        right->format(buffer, flags);
-    }
+    expr->format(buffer, flags);
 }
 
 
-Expression* PowExpression::evaluate(bool permanent)
+Number PolynomialExpression::evaluate(EvaluationContext& context)
 {
-    Expression* expr1 = left->evaluate(permanent);
-    if (!right)
-    {
-        return expr1;
-    }
-    Expression* expr2;
-    try
-    {
-        expr2 = right->evaluate(permanent);
-    }
-    catch (...)
-    {
-        delete expr1;
-        throw;
-    }
-    SigfpeHandler sigfpeHandler;
-    sigfpeHandler.resetCode();
-    if (sigsetjmp(SigfpeHandler::env, 1) == 0)
+    Number x = variable->evaluate(context);
+    if (x.getType() == NT_INTEGER)
     {
-        long value1 = 0, value2 = 0;
-        if (getIntegers(expr1, expr2, value1, value2))
+        long value = x.getInteger();
+        if (-integerBound <= value && value <= integerBound)
         {
-            if (value2 >= 1)
-            {
-                if (value1 == 0)
-                {
-                    return new Integer(0);
-                }
-                else if (value1 == 1)
-                {
-                    return new Integer(1);
-                }
-                else if (value1 == -1)
-                {
-                    return new Integer((value2 & 1) ? -1 : 1);
-                }
-                else
-                {
-                    long value = 1;
-                    while (value2)
-                    {
-                        value = multiply(value, value1);
-                        value2--;
-                    }
-                    return new Integer(value);
-                }
-            }
-            else if (value2 == 0)
+            if (integral)
             {
-                return new Integer(1);
+                return Number(evaluateInteger(value));
             }
-            else
+            long double absolute = value < 0 ? -(long double)value : (long double)value;
+            if (realLower <= absolute && absolute <= realUpper && sameSign[value < 0 ? 1 : 0])
             {
-                long double value = powl((long double)value1, (long double)value2);
-                validate(value);
-                return new RealNumber(value);
+                return Number(evaluateRealNumber((long double)value));
             }
         }
-        else
+    }
+    else if (x.getType() == NT_REALNUMBER)
+    {
+        long double absolute = fabsl(x.getRealNumber());
+        if (realLower <= absolute && absolute <= realUpper && sameSign[signbit(x.getRealNumber()) ? 1 : 0])
         {
-            long double value1 = 0, value2 = 0;
-            if (getRealNumbers(expr1, expr2, value1, value2))
-            {
-                long double value = powl(value1, value2);
-                validate(value);
-                return new RealNumber(value);
-            }
+            return Number(evaluateRealNumber(x.getRealNumber()));
         }
     }
-    checkFpeCode(sigfpeHandler.getCode());
-    throw EvaluationInabilityException();
+    // The original expression throws the same exception as before, if any.
+    return expr->evaluate(context);
 }
 
 
-//////////////////////////////////////////////////////////////////////
 //
-// Sine
+// Horner's scheme
 //
-//////////////////////////////////////////////////////////////////////
-
-
-void SinExpression::format(std::vector<char> &buffer, int flags)
+long PolynomialExpression::evaluateInteger(long x) const
 {
-    const char *op = OperatorInfo::instance().find(SYM_SIN);
-    size_t n2 = strlen(op);
-    size_t n1 = buffer.size();
-    buffer.resize(n1 + n2);
-    memcpy(&buffer[n1], op, n2);
-    if (expr)
+    const long* c = &integerCoefficients[0];
+    size_t n = integerCoefficients.size();
+    long value = c[n - 1];
+    for (size_t i = n - 1; i > 0; i--)
     {
-        expr->format(buffer, flags);
+        value = value * x + c[i - 1];
     }
+    return value;
 }
 
 
-Expression* SinExpression::evaluate(bool permanent)
+//
+// Horner's scheme for the low degrees, and Estrin's scheme for the others.
+// In the latter, the terms are paired as c[0] + c[1] * x, c[2] + c[3] * x, ..., and
+// then the pairs are paired with x^2, x^4 and so on, each of which is independent of the others
+// in the same level, so that the processor can overlap them.
+//
+long double PolynomialExpression::evaluateRealNumber(long double x) const
 {
-    if (expr)
+    const long double* c = &realCoefficients[0];
+    size_t n = realCoefficients.size();
+    if (n <= 4)
     {
-        Expression* expr1 = expr->evaluate(permanent);
-        if (expr1->getType() == ET_INTEGER)
+        long double value = c[n - 1];
+        for (size_t i = n - 1; i > 0; i--)
         {
-            long value1 = ((Integer*)expr1)->getValue();
-            delete expr1;
-            long double value = sinl((long double)value1);
-            validate(value);
-            return new RealNumber(value);
+            value = value * x + c[i - 1];
         }
-        else if (expr1->getType() == ET_REALNUMBER)
+        return value;
+    }
+    long double work[MAX_DEGREE + 1];
+    size_t m = 0;
+    for (size_t i = 0; i < n; i += 2)
+    {
+        work[m++] = i + 1 < n ? c[i] + c[i + 1] * x : c[i];
+    }
+    long double power = x * x;
+    while (m > 1)
+    {
+        size_t k = 0;
+        for (size_t i = 0; i < m; i += 2)
         {
-            long double value1 = ((RealNumber*)expr1)->getValue();
-            delete expr1;
-            long double value = sinl(value1);
-            validate(value);
-            return new RealNumber(value);
+            work[k++] = i + 1 < m ? work[i] + work[i + 1] * power : work[i];
         }
-        else if (expr1->getType() == ET_INTEGER_MAX_PLUS_ONE)
+        m = k;
+        if (m > 1)
         {
-            delete expr1;
-            throw OverflowException();
+            // x^(2^k) does not exceed x^(n-1), which is in the range.
+            power *= power;
         }
-        delete expr1;
     }
-    throw EvaluationInabilityException();
+    return work[0];
 }
 
 
 //////////////////////////////////////////////////////////////////////
 //
-// Square Root
+// Chain
 //
 //////////////////////////////////////////////////////////////////////
 
 
-void SqrtExpression::format(std::vector<char> &buffer, int flags)
+ChainExpression::ChainExpression(ExpressionType type)
+    : Expression(type)
 {
-    const char *op = OperatorInfo::instance().find(SYM_SQRT);
-    size_t n2 = strlen(op);
-    size_t n1 = buffer.size();
-    buffer.resize(n1 + n2);
-    memcpy(&buffer[n1], op, n2);
-    if (expr)
-    {
-        expr->format(buffer, flags);
-    }
 }
 
 
-Expression* SqrtExpression::evaluate(bool permanent)
+void ChainExpression::getChildren(std::vector<Expression**>& children)
 {
-    if (expr)
+    for (size_t i = 0; i < operands.size(); i++)
     {
-        Expression* expr1 = expr->evaluate(permanent);
-        if (expr1->getType() == ET_INTEGER)
-        {
-            long value1 = ((Integer*)expr1)->getValue();
-            delete expr1;
-            long double value = sqrtl((long double)value1);
-            validate(value);
-            return new RealNumber(value);
-        }
-        else if (expr1->getType() == ET_REALNUMBER)
-        {
-            long double value1 = ((RealNumber*)expr1)->getValue();
-            delete expr1;
-            long double value = sqrtl(value1);
-            validate(value);
-            return new RealNumber(value);
-        }
-        else if (expr1->getType() == ET_INTEGER_MAX_PLUS_ONE)
-        {
-            delete expr1;
-            throw OverflowException();
-        }
-        delete expr1;
+        children.push_back(&operands[i]);
     }
-    throw EvaluationInabilityException();
 }
 
 
-//////////////////////////////////////////////////////////////////////
-//
-// Tangent
-//
-//////////////////////////////////////////////////////////////////////
+void ChainExpression::format(std::vector<char> &buffer, int flags)
+{
+    formatTree(this, buffer, flags);
+}
 
 
-void TanExpression::format(std::vector<char> &buffer, int flags)
+Number ChainExpression::evaluate(EvaluationContext& context)
 {
-    const char *op = OperatorInfo::instance().find(SYM_TAN);
-    size_t n2 = strlen(op);
-    size_t n1 = buffer.size();
-    buffer.resize(n1 + n2);
-    memcpy(&buffer[n1], op, n2);
-    if (expr)
-    {
-        expr->format(buffer, flags);
-    }
+    return evaluateTree(this, context);
 }
 
 
-Expression* TanExpression::evaluate(bool permanent)
+void ChainExpression::add(ExpressionType op, Expression* operand)
 {
-    if (expr)
-    {
-        Expression* expr1 = expr->evaluate(permanent);
-        if (expr1->getType() == ET_INTEGER)
-        {
-            long value1 = ((Integer*)expr1)->getValue();
-            delete expr1;
-            long double value = tanl((long double)value1);
-            validate(value);
-            return new RealNumber(value);
-        }
-        else if (expr1->getType() == ET_REALNUMBER)
-        {
-            long double value1 = ((RealNumber*)expr1)->getValue();
-            delete expr1;
-            long double value = tanl(value1);
-            validate(value);
-            return new RealNumber(value);
-        }
-        else if (expr1->getType() == ET_INTEGER_MAX_PLUS_ONE)
-        {
-            delete expr1;
-            throw OverflowException();
-        }
-        delete expr1;
-    }
-    throw EvaluationInabilityException();
+    operators.push_back(op);
+    operands.push_back(operand);
 }
@@ -7,6 +7,9 @@
 
 #include <vector>
 #include <glibmm/ustring.h>
+#include "Number.h"
+#include "EvaluationContext.h"
+#include "ExpressionArena.h"
 
 
 namespace hnrt
@@ -20,7 +23,6 @@ namespace hnrt
         ET_MULTIPLY,
         ET_DIVIDE,
         ET_UNARY_MINUS,
-        ET_INTEGER_MAX_PLUS_ONE,
         ET_BLOCK,
         ET_INCOMPLETE_BLOCK, // block missing expression or right parenthesis
         ET_INCOMPLETE, // operator missing right brace
@@ -35,9 +37,15 @@ namespace hnrt
         ET_LOG2,
         ET_LOG10,
         ET_POW,
+        ET_POWMOD, // X{pow}Y{powmod}Z
         ET_SIN,
         ET_SQRT,
         ET_TAN,
+        ET_SHARED, // occurrence of a subexpression shared in DagExpression
+        ET_DAG, // root of a tree with shared subexpressions
+        ET_POLYNOMIAL, // polynomial in one variable recognized by Optimizer
+        ET_SUM, // chain of additions and subtractions flattened by Optimizer
+        ET_PRODUCT, // chain of multiplications and divisions flattened by Optimizer
     };
 
 
@@ -46,14 +54,16 @@ namespace hnrt
         EF_GROUPING = 1, // thousands' grouping
         EF_HEXADECIMAL = 2, // integer in hexadecimal format
         EF_PREPENDZERO = 4, // prepend zero if real number begins with decimal point
-        EF_PRECISION10 = 8, // precision 10 for real number
-        EF_PRECISION20 = 16, // precision 20 for real number
+        EF_PRECISION_SHIFT = 8, // the bits from here up give the significant digits for real number; 0 for default
     };
 
 
     //
     // Base class for handling arithmetic expression
     //
+    // The nodes are allocated from ExpressionArena by new(arena), and
+    // are freed along with the other nodes of the arena instead of by delete.
+    //
     class Expression
     {
     public:
@@ -62,15 +72,42 @@ namespace hnrt
         virtual ~Expression() {}
         enum ExpressionType getType() const { return type; }
         virtual void format(std::vector<char> &buffer, int flags) = 0;
-        virtual Expression* evaluate(bool permanent) = 0;
+        virtual Number evaluate(EvaluationContext& context) = 0;
+
+        static void* operator new(size_t size, ExpressionArena& arena) { return arena.allocate(size); }
+        static void operator delete(void* p, ExpressionArena& arena) {}
+
+        //
+        // Parses the given string into a tree allocated from the given arena; see Parser.
+        // The literals in the tree refer to the string, which must be left unchanged until the arena is cleared.
+        //
+        static Expression* parse(const char *s, size_t n, ExpressionArena& arena, bool complete = false);
 
-        static Expression* parse(const char *s, size_t n, bool complete = false);
+        //
+        // Returns the number of the nodes on the longest path from the given node down to a leaf.
+        //
+        static size_t getDepth(Expression* expr);
+
+        //
+        // Depth up to which the recursive passes over a tree, Optimizer and Program, are run.
+        // A deeper tree is left as it is to the parser, the evaluator and the formatter,
+        // none of which nests the calls as deeply as the tree.
+        //
+        static const size_t MAX_PASS_DEPTH = 1000;
 
     protected:
 
         Expression() {}
         Expression(const Expression&) {}
 
+        // The nodes are never deleted one by one.
+        static void operator delete(void* p) {}
+
+        //
+        // Appends the pointers to the subexpressions of this node to the given list.
+        //
+        virtual void getChildren(std::vector<Expression**>& children) {}
+
         enum ExpressionType type;
     };
 
@@ -86,22 +123,23 @@ namespace hnrt
             : Expression(type), left(left_), right(right_)
         {
         }
-        virtual ~BinaryExpression()
-        {
-            if (left)
-            {
-                delete left;
-            }
-            if (right)
-            {
-                delete right;
-            }
-        }
+        virtual void format(std::vector<char> &buffer, int flags);
+        virtual Number evaluate(EvaluationContext& context);
+        Expression* getLeft() const { return left; }
+        Expression* getRight() const { return right; }
+
+        //
+        // Applies the given binary operator to the values of the left and right sides.
+        //
+        static Number apply(ExpressionType op, const Number& value1, const Number& value2, EvaluationContext& context);
 
     protected:
 
+        friend class Optimizer;
+
         BinaryExpression() {}
         BinaryExpression(const BinaryExpression&) {}
+        virtual void getChildren(std::vector<Expression**>& children);
 
         Expression* left;
         Expression* right;
@@ -119,18 +157,22 @@ namespace hnrt
             : Expression(type), expr(expr_)
         {
         }
-        virtual ~UnaryExpression()
-        {
-            if (expr)
-            {
-                delete expr;
-            }
-        }
+        virtual void format(std::vector<char> &buffer, int flags);
+        virtual Number evaluate(EvaluationContext& context);
+        Expression* getExpr() const { return expr; }
+
+        //
+        // Applies the given unary operator, or ET_BLOCK, to the value of the operand.
+        //
+        static Number apply(ExpressionType op, const Number& value);
 
     protected:
 
+        friend class Optimizer;
+
         UnaryExpression() {}
         UnaryExpression(const UnaryExpression&) {}
+        virtual void getChildren(std::vector<Expression**>& children);
 
         Expression* expr;
     };
@@ -144,8 +186,6 @@ namespace hnrt
             : BinaryExpression(ET_ADD, left, right)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -161,8 +201,6 @@ namespace hnrt
             : BinaryExpression(ET_SUBTRACT, left, right)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -178,8 +216,6 @@ namespace hnrt
             : BinaryExpression(ET_MULTIPLY, left, right)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -195,8 +231,6 @@ namespace hnrt
             : BinaryExpression(ET_DIVIDE, left, right)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -212,8 +246,6 @@ namespace hnrt
             : UnaryExpression(ET_UNARY_MINUS, expr)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -221,61 +253,70 @@ namespace hnrt
     };
 
 
+    //
+    // Integer literal, whose value is NT_INTEGER, NT_INTEGER128 or NT_BIGINTEGER
+    //
+    // The one of NT_BIGINTEGER holds its value until destroyed,
+    // so that it needs to be owned by the arena it is allocated from.
+    //
     class Integer : public Expression
     {
     public:
 
-        Integer(long v = 0)
-            : Expression(ET_INTEGER), value(v), string()
+        Integer(const Number& v = Number())
+            : Expression(ET_INTEGER), value(v), text(NULL), length(0)
         {
         }
-        Integer(long v, const Glib::ustring& s)
-            : Expression(ET_INTEGER), value(v), string(s)
+        Integer(const Number& v, const char* t, size_t n)
+            : Expression(ET_INTEGER), value(v), text(t), length(n)
         {
-            if (value == LONG_MIN)
-            {
-                type = ET_INTEGER_MAX_PLUS_ONE;
-            }
         }
         Integer(const Integer& other)
-            : Expression(other.type), value(other.value), string() // string is not copied to use format flag
+            : Expression(other.type), value(other.value), text(NULL), length(0) // text is not copied to use format flag
         {
         }
         virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
-        long getValue() const { return value; }
+        virtual Number evaluate(EvaluationContext& context);
+        const Number& getValue() const { return value; }
 
     protected:
 
-        long value;
-        Glib::ustring string;
+        Number value;
+        const char* text; // token in the string parsed; NULL if none
+        size_t length; // of text in bytes
     };
 
 
+    //
+    // Real number literal, whose value is NT_REALNUMBER, NT_FLOAT128 or NT_BIGREAL
+    //
+    // The one of NT_BIGREAL needs to be owned by the arena as the one of NT_BIGINTEGER does.
+    //
     class RealNumber : public Expression
     {
     public:
 
-        RealNumber(long double v = 0)
-            : Expression(ET_REALNUMBER), value(v), string()
+        RealNumber(const Number& v = Number(0.0L))
+            : Expression(ET_REALNUMBER), value(v), text(NULL), length(0)
         {
         }
-        RealNumber(long double v, const Glib::ustring& s)
-            : Expression(ET_REALNUMBER), value(v), string(s)
+        RealNumber(const Number& v, const char* t, size_t n)
+            : Expression(ET_REALNUMBER), value(v), text(t), length(n)
         {
         }
         RealNumber(const RealNumber& other)
-            : Expression(other.type), value(other.value), string() // string is not copied to use format flag
+            : Expression(other.type), value(other.value), text(NULL), length(0) // text is not copied to use format flag
         {
         }
         virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
-        long double getValue() const { return value; }
+        virtual Number evaluate(EvaluationContext& context);
+        const Number& getValue() const { return value; }
 
     protected:
 
-        long double value;
-        Glib::ustring string;
+        Number value;
+        const char* text; // token in the string parsed; NULL if none
+        size_t length; // of text in bytes
     };
 
 
@@ -287,8 +328,6 @@ namespace hnrt
             : UnaryExpression(expr ? ET_BLOCK : ET_INCOMPLETE_BLOCK, expr)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
         void setIncomplete() { type = ET_INCOMPLETE_BLOCK; }
 
     protected:
@@ -301,23 +340,33 @@ namespace hnrt
     {
     public:
 
-        IncompleteExpression(const Glib::ustring& s)
-            : Expression(ET_INCOMPLETE), expr(NULL), string(s)
+        IncompleteExpression(const char* t, size_t n)
+            : Expression(ET_INCOMPLETE), expr(NULL), text(t), length(n)
         {
         }
-        IncompleteExpression(Expression* e, const Glib::ustring& s)
-            : Expression(ET_INCOMPLETE), expr(e), string(s)
+        IncompleteExpression(Expression* e, const char* t, size_t n)
+            : Expression(ET_INCOMPLETE), expr(e), text(t), length(n)
         {
         }
         virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
+        virtual Number evaluate(EvaluationContext& context);
+        Expression* getExpr() const { return expr; }
+
+        //
+        // Appends the string form of the operator, which is read again from the string parsed.
+        //
+        void formatOperator(std::vector<char> &buffer) const;
 
     protected:
 
+        friend class Optimizer;
+
         IncompleteExpression(const IncompleteExpression&) {}
+        virtual void getChildren(std::vector<Expression**>& children);
 
         Expression* expr;
-        Glib::ustring string;
+        const char* text; // operator missing right brace, which lasts until the end of the string parsed
+        size_t length; // of text in bytes
     };
 
 
@@ -325,21 +374,32 @@ namespace hnrt
     {
     public:
 
+        Variable(int s)
+            : Expression(ET_VARIABLE), slot(s), key(NULL)
+        {
+        }
+        // unresolved one, which must be owned by the arena for the key to be deleted
         Variable(const Glib::ustring& k)
-            : Expression(ET_VARIABLE), key(k)
+            : Expression(ET_VARIABLE), slot(-1), key(new Glib::ustring(k))
         {
         }
         Variable(const Variable& other)
-            : Expression(other.type), key(other.key)
+            : Expression(other.type), slot(other.slot), key(other.key ? new Glib::ustring(*other.key) : NULL)
+        {
+        }
+        virtual ~Variable()
         {
+            delete key;
         }
         virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
-        const Glib::ustring& getKey() const { return key; }
+        virtual Number evaluate(EvaluationContext& context);
+        const Glib::ustring& getKey() const;
+        int getSlot() const { return slot; }
 
     protected:
 
-        Glib::ustring key;
+        int slot; // index into VariableStore resolved by Parser; -1 if unresolved
+        Glib::ustring* key; // if unresolved; otherwise the key is the one of the slot
     };
 
 
@@ -347,23 +407,20 @@ namespace hnrt
     {
     public:
 
-        AssignExpression(const Glib::ustring& k, Expression* e = NULL)
-            : Expression(ET_ASSIGN), key(k), expr(e)
+        AssignExpression(int s, Expression* e = NULL)
+            : Expression(ET_ASSIGN), slot(s), expr(e)
         {
         }
-        virtual ~AssignExpression()
-        {
-            if (expr)
-            {
-                delete expr;
-            }
-        }
         virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
+        virtual Number evaluate(EvaluationContext& context);
+        const Glib::ustring& getKey() const;
+        Expression* getExpr() const { return expr; }
 
     protected:
 
-        Glib::ustring key;
+        virtual void getChildren(std::vector<Expression**>& children);
+
+        int slot; // index into VariableStore resolved by Parser
         Expression* expr;
     };
 
@@ -373,11 +430,9 @@ namespace hnrt
     public:
 
         AbsExpression(Expression* expr = NULL)
-            : UnaryExpression(ET_CBRT, expr)
+            : UnaryExpression(ET_ABS, expr)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -393,8 +448,6 @@ namespace hnrt
             : UnaryExpression(ET_CBRT, expr)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -410,8 +463,6 @@ namespace hnrt
             : UnaryExpression(ET_COS, expr)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -427,8 +478,6 @@ namespace hnrt
             : UnaryExpression(ET_EXP, expr)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -444,8 +493,6 @@ namespace hnrt
             : BinaryExpression(ET_HYPOT, left, right)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -461,8 +508,6 @@ namespace hnrt
             : UnaryExpression(ET_LOG, expr)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -478,8 +523,6 @@ namespace hnrt
             : UnaryExpression(ET_LOG2, expr)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -495,8 +538,6 @@ namespace hnrt
             : UnaryExpression(ET_LOG10, expr)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -512,8 +553,6 @@ namespace hnrt
             : BinaryExpression(ET_POW, left, right)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -521,6 +560,39 @@ namespace hnrt
     };
 
 
+    //
+    // "X{pow}Y{powmod}Z"-style arithmetic expression, which is X raised to the power of Y modulo Z
+    //
+    // The left side is the base and the right side is the exponent as in PowExpression.
+    // Without the modulus, which is missing only at the end of the input not yet finished,
+    // the value is the one of PowExpression.
+    //
+    class PowModExpression : public BinaryExpression
+    {
+    public:
+
+        PowModExpression(Expression* left, Expression* right, Expression* modulus_ = NULL)
+            : BinaryExpression(ET_POWMOD, left, right), modulus(modulus_)
+        {
+        }
+        Expression* getModulus() const { return modulus; }
+
+        //
+        // Applies the operator to the values of the three operands.
+        //
+        static Number apply(const Number& value1, const Number& value2, const Number& value3, EvaluationContext& context);
+
+    protected:
+
+        friend class Optimizer;
+
+        PowModExpression(const PowModExpression&) {}
+        virtual void getChildren(std::vector<Expression**>& children);
+
+        Expression* modulus;
+    };
+
+
     class SinExpression : public UnaryExpression
     {
     public:
@@ -529,8 +601,6 @@ namespace hnrt
             : UnaryExpression(ET_SIN, expr)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -546,8 +616,6 @@ namespace hnrt
             : UnaryExpression(ET_SQRT, expr)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
@@ -563,13 +631,169 @@ namespace hnrt
             : UnaryExpression(ET_TAN, expr)
         {
         }
-        virtual void format(std::vector<char> &buffer, int flags);
-        virtual Expression* evaluate(bool permanent);
 
     protected:
 
         TanExpression(const TanExpression&) {}
     };
+
+    //
+    // Subexpression that occurs more than once in a tree rooted at DagExpression
+    //
+    struct Subexpression
+    {
+        Expression* expr;
+        int index; // in DagExpression
+        bool evaluated; // true once evaluated in the current evaluation of the tree
+        Number value; // valid if evaluated
+    };
+
+
+    //
+    // Occurrence of a shared subexpression
+    //
+    // The subexpression is evaluated at the first occurrence in each evaluation of the tree,
+    // and the value is reused at the others.
+    //
+    class SharedExpression : public Expression
+    {
+    public:
+
+        SharedExpression(Subexpression* s)
+            : Expression(ET_SHARED), subexpression(s)
+        {
+        }
+        virtual void format(std::vector<char> &buffer, int flags);
+        virtual Number evaluate(EvaluationContext& context);
+        const Subexpression* getSubexpression() const { return subexpression; }
+
+    protected:
+
+        SharedExpression(const SharedExpression&) {}
+
+        Subexpression* subexpression; // owned by DagExpression
+    };
+
+
+    //
+    // Root of a tree in which the common subexpressions are shared; see Optimizer
+    //
+    // The nodes form a directed acyclic graph, which is evaluated in the same way as the original tree.
+    // The values of the subexpressions are kept only during an evaluation.
+    //
+    class DagExpression : public UnaryExpression
+    {
+    public:
+
+        DagExpression(Expression* expr = NULL)
+            : UnaryExpression(ET_DAG, expr)
+        {
+        }
+        virtual ~DagExpression();
+        virtual void format(std::vector<char> &buffer, int flags);
+        virtual Number evaluate(EvaluationContext& context);
+
+        //
+        // Takes over the given expression as a shared subexpression.
+        //
+        Subexpression* add(Expression* expr);
+
+        size_t getSubexpressionCount() const { return subexpressions.size(); }
+
+    protected:
+
+        DagExpression(const DagExpression&) {}
+        virtual void getChildren(std::vector<Expression**>& children);
+
+        std::vector<Subexpression*> subexpressions;
+    };
+
+    //
+    // Polynomial in one variable, which is evaluated in Horner's or Estrin's scheme; see Optimizer
+    //
+    // The scheme is used only while the variable is in the range where neither the original
+    // expression nor the scheme can overflow or underflow. Otherwise the original expression is
+    // evaluated, so that the same exception is thrown as before.
+    // With integers the value is exactly the same as the original one. With real numbers the scheme
+    // is used only if all of the terms have the same sign, where the sum has no cancellation either way,
+    // so that the value differs from the original one only in the last bits of rounding.
+    //
+    class PolynomialExpression : public Expression
+    {
+    public:
+
+        //
+        // expr ........... original expression, which is taken over
+        // variable ....... the variable in expr
+        // coefficients ... indexed by degree; Integer or RealNumber values
+        //
+        PolynomialExpression(Expression* expr, Variable* variable, const std::vector<Number>& coefficients);
+        virtual void format(std::vector<char> &buffer, int flags);
+        virtual Number evaluate(EvaluationContext& context);
+        size_t getDegree() const { return realCoefficients.size() - 1; }
+
+        static const size_t MAX_DEGREE = 31;
+
+    protected:
+
+        PolynomialExpression(const PolynomialExpression&) {}
+        virtual void getChildren(std::vector<Expression**>& children);
+        long evaluateInteger(long x) const;
+        long double evaluateRealNumber(long double x) const;
+
+        Expression* expr;
+        Variable* variable;
+        std::vector<long> integerCoefficients; // valid if integral
+        std::vector<long double> realCoefficients;
+        bool integral; // true if all of the coefficients are integers
+        long integerBound; // absolute value of an integer variable up to which no integer operation overflows
+        long double realLower; // range of the absolute value of the variable
+        long double realUpper; // where no real number operation overflows or underflows
+        bool sameSign[2]; // true if all of the terms have the same sign for positive x and for negative x
+    };
+
+    //
+    // Left-deep chain of the binary operators of the same precedence held in one node
+    //
+    // "a+b-c+d" is held as the operands a, b, c and d, each with its operator, and evaluated
+    // one by one, so that a long chain neither nests the evaluation deeply nor makes a virtual call
+    // for each of the intermediate nodes.
+    // Parser builds an ET_SUM chain of three or more operands in place of the binary nodes, and
+    // the sum is PairwiseSum of the value of the first two operands and the rest of them.
+    // Optimizer flattens ET_PRODUCT, whose value is the same as that of the tree.
+    //
+    class ChainExpression : public Expression
+    {
+    public:
+
+        //
+        // type ... ET_SUM for ET_ADD and ET_SUBTRACT, or ET_PRODUCT for ET_MULTIPLY and ET_DIVIDE
+        //
+        // This must be owned by the arena, as well as DagExpression and PolynomialExpression.
+        //
+        ChainExpression(ExpressionType type);
+        virtual void format(std::vector<char> &buffer, int flags);
+        virtual Number evaluate(EvaluationContext& context);
+
+        //
+        // Appends the operand; the operator of the first one is ignored.
+        //
+        void add(ExpressionType op, Expression* operand);
+
+        size_t getOperandCount() const { return operands.size(); }
+        Expression* getOperand(size_t index) const { return operands[index]; }
+        ExpressionType getOperator(size_t index) const { return operators[index]; }
+
+    protected:
+
+        friend class Optimizer;
+
+        ChainExpression(const ChainExpression&) {}
+        virtual void getChildren(std::vector<Expression**>& children);
+
+        std::vector<Expression*> operands;
+        std::vector<ExpressionType> operators;
+    };
 }
 
 
@@ -0,0 +1,74 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#include "ExpressionArena.h"
+#include "Expression.h"
+
+
+using namespace hnrt;
+
+
+ExpressionArena::ExpressionArena()
+    : chunks(NULL)
+    , next(NULL)
+    , end(NULL)
+{
+}
+
+
+ExpressionArena::~ExpressionArena()
+{
+    clear();
+    delete[] (char*)chunks;
+}
+
+
+void ExpressionArena::clear()
+{
+    // in the reverse order of the allocation
+    for (size_t i = owned.size(); i > 0; i--)
+    {
+        owned[i - 1]->~Expression();
+    }
+    owned.clear();
+    if (!chunks)
+    {
+        return;
+    }
+    // The last chunk is kept for the next tree.
+    Chunk* chunk = chunks->next;
+    while (chunk)
+    {
+        Chunk* next1 = chunk->next;
+        delete[] (char*)chunk;
+        chunk = next1;
+    }
+    chunks->next = NULL;
+    next = (char*)chunks + HEADER_SIZE;
+}
+
+
+//
+// Allocates a new chunk for the given size, which is already aligned, and returns the memory from it.
+// Each chunk is twice as large as the last one up to MAX_CHUNK_SIZE.
+//
+void* ExpressionArena::grow(size_t size)
+{
+    size_t chunkSize = chunks ? chunks->size * 2 : MIN_CHUNK_SIZE;
+    if (chunkSize > MAX_CHUNK_SIZE)
+    {
+        chunkSize = MAX_CHUNK_SIZE;
+    }
+    if (chunkSize < HEADER_SIZE + size)
+    {
+        chunkSize = HEADER_SIZE + size;
+    }
+    Chunk* chunk = (Chunk*)new char[chunkSize];
+    chunk->next = chunks;
+    chunk->size = chunkSize;
+    chunks = chunk;
+    next = (char*)chunk + HEADER_SIZE + size;
+    end = (char*)chunk + chunkSize;
+    return (char*)chunk + HEADER_SIZE;
+}
+
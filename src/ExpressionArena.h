@@ -0,0 +1,105 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#ifndef IKURA_EXPRESSIONARENA_H
+#define IKURA_EXPRESSIONARENA_H
+
+
+#include <stddef.h>
+#include <vector>
+
+
+namespace hnrt
+{
+    class Expression;
+
+
+    //
+    // Memory from which the nodes of expression trees are allocated
+    //
+    // The nodes are carved out of large chunks one after another, and are never deleted one by one;
+    // the arena frees all of them at once when it is cleared or destroyed, so that building a tree
+    // costs no allocation per node and throwing it away costs nothing per node.
+    // A node whose destructor has something to do, one holding vectors for example,
+    // must be handed to own so that the destructor is called then.
+    //
+    // The chunk allocated last is kept by clear to be reused, so that a small tree
+    // parsed again and again into the same arena needs no allocation at all.
+    //
+    // How to use:
+    //
+    // ExpressionArena arena;
+    // Expression* expr = new(arena) Integer(1);
+    // ChainExpression* chain = arena.own(new(arena) ChainExpression(ET_SUM));
+    // ...
+    // arena.clear();
+    //
+    class ExpressionArena
+    {
+    public:
+
+        ExpressionArena();
+        ~ExpressionArena();
+
+        //
+        // Returns the memory of the given size aligned for any node.
+        //
+        void* allocate(size_t size)
+        {
+            size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+            if ((size_t)(end - next) < size)
+            {
+                return grow(size);
+            }
+            void* p = next;
+            next += size;
+            return p;
+        }
+
+        //
+        // Has the destructor of the given node allocated from this arena called when it is cleared.
+        //
+        template<class T> T* own(T* expr)
+        {
+            owned.push_back(expr);
+            return expr;
+        }
+
+        //
+        // Destroys all of the nodes allocated so far.
+        //
+        void clear();
+
+    protected:
+
+        struct Chunk
+        {
+            Chunk* next; // allocated before this one; NULL if none
+            size_t size; // in bytes including this header
+        };
+
+        union Alignment
+        {
+            long double realNumber;
+            long integer;
+            void* pointer;
+        };
+
+        static const size_t ALIGNMENT = sizeof(Alignment);
+        static const size_t HEADER_SIZE = (sizeof(Chunk) + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        static const size_t MIN_CHUNK_SIZE = 1024;
+        static const size_t MAX_CHUNK_SIZE = 65536;
+
+        ExpressionArena(const ExpressionArena&) {}
+        void operator =(const ExpressionArena&) {}
+        void* grow(size_t size);
+
+        Chunk* chunks; // allocated last; NULL if none
+        char* next; // free space in the last chunk
+        char* end; // of the last chunk
+        std::vector<Expression*> owned;
+    };
+}
+
+
+#endif //!IKURA_EXPRESSIONARENA_H
@@ -0,0 +1,745 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#include <libintl.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include "IncrementalParser.h"
+#include "Arithmetic.h"
+#include "Exception.h"
+#include "LocaleInfo.h"
+#include "StreamingEvaluator.h"
+#include "UTF8.h"
+#include "VariableStore.h"
+
+
+using namespace hnrt;
+
+
+static const int EXACT_DEPTH = 64; // innermost frames folded one by one on evaluation
+
+
+IncrementalParser::IncrementalParser()
+    : text(0)
+    , parsed(false)
+    , errorOffset(0)
+    , generation(0)
+    , sumFrame(-1)
+{
+    initial.top = -1;
+    initial.assign = -1;
+    initial.frameCount = 0;
+    initial.openBlocks = 0;
+    initial.hasOperand = false;
+    initial.operandType = ET_INCOMPLETE;
+    initial.slot = -1;
+    display.push_back('\0');
+}
+
+
+IncrementalParser::~IncrementalParser()
+{
+}
+
+
+void IncrementalParser::clear()
+{
+    tokens.clear();
+    states.clear();
+    frames.clear();
+    display.clear();
+    display.push_back('\0');
+    text = 0;
+    parsed = false;
+}
+
+
+void IncrementalParser::parse(std::vector<char>& buffer, size_t unchanged)
+{
+    std::vector<char> tail;
+    size_t start = run(buffer, buffer.size(), unchanged, tail);
+    buffer.resize(start);
+    buffer.insert(buffer.end(), tail.begin(), tail.end());
+    text = buffer.size();
+}
+
+
+void IncrementalParser::validate(const std::vector<char>& buffer, size_t size, size_t unchanged)
+{
+    std::vector<char> tail;
+    size_t start = run(buffer, size, unchanged, tail);
+    text = start + tail.size();
+}
+
+
+//
+// Parses the first size bytes of the buffer from the end of the last token that is kept,
+// and returns the offset of that end. The formatted text of the new tokens is put into tail.
+//
+size_t IncrementalParser::run(const std::vector<char>& buffer, size_t size, size_t unchanged, std::vector<char>& tail)
+{
+    // The variables may have been added or changed since the tokens were parsed.
+    unsigned long g = VariableStore::instance().getGeneration();
+    if (generation != g)
+    {
+        clear();
+        generation = g;
+    }
+    rollBack(unchanged < size ? unchanged : size);
+    size_t start = tokens.empty() ? 0 : tokens.back().offset + tokens.back().length;
+    size_t count = tokens.size();
+    size_t displayStart = display.size() - 1;
+    State state = getState();
+    try
+    {
+        Lexer lexer(size ? &buffer[0] + start : NULL, size - start);
+        int sym;
+        while ((sym = lexer.getSym()) != SYM_EOF)
+        {
+            shift(state, sym, lexer);
+            const char* string = lexer.getString();
+            Token token;
+            token.sym = sym;
+            token.offset = start + tail.size();
+            token.length = strlen(string);
+            token.displayOffset = display.size() - 1;
+            tail.insert(tail.end(), string, string + token.length);
+            display.pop_back();
+            if (sym == SYM_REALNUMBER && LocaleInfo::getDecimalPoint() == UTF8::getChar(string, string + token.length))
+            {
+                display.push_back('0');
+            }
+            display.insert(display.end(), string, string + token.length);
+            display.push_back('\0');
+            tokens.push_back(token);
+            states.push_back(state);
+        }
+    }
+    catch (...)
+    {
+        tokens.resize(count);
+        states.resize(count);
+        frames.resize(getState().frameCount);
+        display.resize(displayStart);
+        display.push_back('\0');
+        text = start;
+        parsed = false;
+        errorOffset = start + tail.size();
+        throw;
+    }
+    parsed = true;
+    return start;
+}
+
+
+//
+// Drops the tokens that do not end before the given offset.
+// As Lexer looks one character ahead, the token ending at the offset
+// might continue with the character there, so that it is dropped as well.
+//
+void IncrementalParser::rollBack(size_t unchanged)
+{
+    size_t count = tokens.size();
+    while (count && tokens[count - 1].offset + tokens[count - 1].length >= unchanged)
+    {
+        count--;
+    }
+    if (count < tokens.size())
+    {
+        display.resize(tokens[count].displayOffset);
+        display.push_back('\0');
+        tokens.resize(count);
+        states.resize(count);
+        frames.resize(getState().frameCount);
+    }
+}
+
+
+//
+// The innermost frames are folded one by one in the same way as Expression::evaluate does, and
+// the rest of them by the partial values that they keep.
+// Beyond the innermost frames, the order of additions and multiplications is therefore not kept,
+// and the last digits or the sign of zero may differ from those of Expression::evaluate.
+//
+Number IncrementalParser::evaluate()
+{
+    const State& state = getState();
+    Result result;
+    bool hasResult = state.hasOperand;
+    if (hasResult)
+    {
+        result = state.operand;
+    }
+    int index = state.top;
+    for (int depth = 0; index >= 0 && depth < EXACT_DEPTH; depth++)
+    {
+        result = combine(frames[index], hasResult ? &result : NULL);
+        hasResult = true;
+        index = frames[index].below;
+    }
+    if (index >= 0)
+    {
+        result = combinePartial(index, result);
+    }
+    if (!hasResult)
+    {
+        throw EvaluationInabilityException();
+    }
+    else if (result.failed)
+    {
+        throw Exception(result.what);
+    }
+    return result.value;
+}
+
+
+int IncrementalParser::getOpenBlockCount() const
+{
+    return getState().openBlocks;
+}
+
+
+bool IncrementalParser::getLastToken(int& sym, size_t& offset, size_t& length) const
+{
+    if (tokens.empty())
+    {
+        return false;
+    }
+    sym = tokens.back().sym;
+    offset = tokens.back().offset;
+    length = tokens.back().length;
+    return true;
+}
+
+
+//
+// Advances the given state by the given token.
+// This does what Parser::parseExpr1 to Parser::parseExpr5 do for the token,
+// and throws the same exception as they do.
+//
+void IncrementalParser::shift(State& state, int sym, const Lexer& lexer)
+{
+    if (!state.hasOperand)
+    {
+        switch (sym)
+        {
+        case SYM_INTEGER:
+            state.operand = Result();
+            state.operandType = ET_INTEGER;
+            state.operand.value = lexer.getInteger();
+            break;
+        case SYM_REALNUMBER:
+            state.operandType = ET_REALNUMBER;
+            state.operand = Result();
+            try
+            {
+                if (lexer.getRealNumber().getType() == NT_REALNUMBER)
+                {
+                    Arithmetic::validate(lexer.getRealNumber().getRealNumber());
+                }
+                state.operand.value = lexer.getRealNumber();
+            }
+            catch (const Exception& ex)
+            {
+                state.operand.failed = true;
+                state.operand.what = ex.getWhat();
+            }
+            break;
+        case SYM_IDENTIFIER:
+            state.operandType = ET_VARIABLE;
+            state.key = lexer.getString();
+            state.slot = VariableStore::instance().find(state.key);
+            state.operand = evaluateVariable(state);
+            break;
+        case SYM_INCOMPLETE_OPERATOR:
+            state.operandType = ET_INCOMPLETE;
+            state.operand = Result();
+            state.operand.failed = true;
+            state.operand.what = gettext("Invalid operator");
+            break;
+        default:
+        {
+            ExpressionType type = StreamingEvaluator::getPrefixOperator(sym);
+            if (type == ET_INCOMPLETE)
+            {
+                throw InvalidExpressionException(gettext("Invalid syntax."));
+            }
+            pushFrame(state, type);
+            if (type == ET_BLOCK)
+            {
+                state.openBlocks++;
+            }
+            return;
+        }
+        }
+        state.hasOperand = true;
+    }
+    else
+    {
+        switch (sym)
+        {
+        case SYM_POWMOD:
+        {
+            reduce(state, 4);
+            if (state.top < 0 || frames[state.top].type != ET_POW)
+            {
+                throw InvalidExpressionException(gettext("Invalid syntax."));
+            }
+            // The power is replaced with a new frame instead of being changed,
+            // as it is still in use by the states before this token.
+            Frame frame = frames[state.top];
+            frame.type = ET_POWMOD;
+            frame.exponent = state.operand;
+            state.top = frame.below;
+            state.hasOperand = false;
+            pushFrame(state, ET_POWMOD);
+            frames[state.top] = frame;
+            foldFrame(state.top);
+            break;
+        }
+        case SYM_INCOMPLETE_OPERATOR:
+            reduce(state, 3);
+            state.operandType = ET_INCOMPLETE;
+            state.operand = Result();
+            state.operand.failed = true;
+            state.operand.what = gettext("Invalid operator");
+            break;
+        case SYM_ASSIGN:
+            reduce(state, 1);
+            pushAssignFrame(state);
+            break;
+        case SYM_RPAREN:
+            reduce(state, 1);
+            while (state.top >= 0 && frames[state.top].type == ET_ASSIGN)
+            {
+                reduceFrame(state);
+            }
+            if (state.top < 0)
+            {
+                throw InvalidExpressionException(gettext("Invalid syntax."));
+            }
+            reduceFrame(state);
+            break;
+        default:
+        {
+            ExpressionType type = StreamingEvaluator::getInfixOperator(sym);
+            if (type != ET_INCOMPLETE)
+            {
+                reduce(state, StreamingEvaluator::getLevel(type));
+                if ((type == ET_ADD || type == ET_SUBTRACT) && (state.operandType == ET_ADD || state.operandType == ET_SUBTRACT))
+                {
+                    pushSumFrame(state, type);
+                    break;
+                }
+                pushFrame(state, type);
+                break;
+            }
+            else if (state.openBlocks)
+            {
+                throw InvalidExpressionException(gettext("Right parenthesis is missing."));
+            }
+            throw InvalidExpressionException(gettext("Invalid syntax."));
+        }
+        }
+    }
+}
+
+
+//
+// Pushes the operator that takes the operand, if any, as its left side.
+//
+void IncrementalParser::pushFrame(State& state, ExpressionType type)
+{
+    Frame frame;
+    frame.type = type;
+    frame.below = state.top;
+    if (state.hasOperand)
+    {
+        frame.left = state.operand;
+    }
+    frame.slot = -1;
+    frame.outer = -1;
+    frame.chained = false;
+    state.top = (int)frames.size();
+    frames.push_back(frame);
+    foldFrame(state.top);
+    state.frameCount = frames.size();
+    state.hasOperand = false;
+    state.operand = Result();
+}
+
+
+void IncrementalParser::pushAssignFrame(State& state)
+{
+    if (state.operandType != ET_VARIABLE)
+    {
+        throw InvalidExpressionException(gettext("Non variable cannot be assigned expression"));
+    }
+    else if (state.slot < 0)
+    {
+        throw InvalidExpressionException(Glib::ustring::compose(gettext("%1: Not exist"), state.key));
+    }
+    else if (state.key.length() > 1)
+    {
+        // Only variable A to Z are allowed to be changed; others are treated as read-only.
+        throw InvalidExpressionException(Glib::ustring::compose(gettext("%1: Read only"), state.key));
+    }
+    int slot = state.slot;
+    state.hasOperand = false;
+    pushFrame(state, ET_ASSIGN);
+    Frame& frame = frames[state.top];
+    frame.slot = slot;
+    frame.outer = state.assign;
+    for (int index = state.assign; index >= 0; index = frames[index].outer)
+    {
+        if (frames[index].slot == slot && !frames[index].left.failed)
+        {
+            // AssignExpression::evaluate fails to mark the variable in evaluation.
+            frame.left.failed = true;
+            frame.left.what = RecursiveVariableAccessException(VariableStore::instance().getKey(slot)).getWhat();
+            foldFrame(state.top);
+            break;
+        }
+    }
+    state.assign = state.top;
+}
+
+
+//
+// Pushes + or - that continues the chain of + and - just reduced, whose sum is
+// that of the frame reduced last with its right side added.
+//
+void IncrementalParser::pushSumFrame(State& state, ExpressionType type)
+{
+    pushFrame(state, type);
+    Frame& frame = frames[state.top];
+    const Frame& last = frames[sumFrame];
+    frame.chained = true;
+    if (frame.left.failed)
+    {
+        // The sum is never used.
+    }
+    else if (last.chained)
+    {
+        // The right side has been added to a copy already without any exception.
+        frame.sum = last.sum;
+        frame.sum.add(sumTerm, last.type == ET_SUBTRACT);
+    }
+    else
+    {
+        frame.sum.start(frame.left.value);
+    }
+}
+
+
+//
+// Reduces the operators whose precedence is not lower than the given level.
+//
+void IncrementalParser::reduce(State& state, int level)
+{
+    while (state.top >= 0 && StreamingEvaluator::getLevel(frames[state.top].type) >= level)
+    {
+        reduceFrame(state);
+    }
+}
+
+
+void IncrementalParser::reduceFrame(State& state)
+{
+    const Frame& frame = frames[state.top];
+    if ((frame.type == ET_ADD || frame.type == ET_SUBTRACT) && state.hasOperand)
+    {
+        sumFrame = state.top;
+        sumTerm = state.operand.value;
+    }
+    state.operand = combine(frame, state.hasOperand ? &state.operand : NULL);
+    state.operandType = frame.type;
+    state.hasOperand = true;
+    if (frame.type == ET_BLOCK)
+    {
+        state.openBlocks--;
+    }
+    else if (frame.type == ET_ASSIGN)
+    {
+        state.assign = frame.outer;
+    }
+    state.top = frame.below;
+}
+
+
+//
+// Folds the frames below the given one into its partial value.
+//
+void IncrementalParser::foldFrame(int index)
+{
+    Frame& frame = frames[index];
+    frame.fixed = Result();
+    frame.scaled = false;
+    frame.scale = Number();
+    frame.offset = Number();
+    frame.base = -1;
+    if (frame.below >= 0)
+    {
+        const Frame& below = frames[frame.below];
+        if (below.fixed.failed)
+        {
+            frame.fixed = below.fixed;
+            return;
+        }
+        frame.scaled = below.scaled;
+        frame.scale = below.scale;
+        frame.offset = below.offset;
+        frame.base = below.base;
+    }
+    if (frame.left.failed)
+    {
+        // The left side is evaluated before the right side.
+        frame.fixed = frame.left;
+        return;
+    }
+    else if (frame.exponent.failed)
+    {
+        frame.fixed = frame.exponent;
+        return;
+    }
+    try
+    {
+        switch (frame.type)
+        {
+        case ET_BLOCK:
+        case ET_ASSIGN:
+            // v
+            break;
+        case ET_ADD:
+        case ET_SUBTRACT:
+            // scale * (left + v) + offset, or scale * (left - v) + offset
+            if (frame.scaled)
+            {
+                Number product = StreamingEvaluator::apply(ET_MULTIPLY, frame.scale, Number(), frame.left.value, context);
+                frame.offset = StreamingEvaluator::apply(ET_ADD, product, Number(), frame.offset, context);
+            }
+            else
+            {
+                frame.scale = Number(1L);
+                frame.offset = frame.left.value;
+            }
+            if (frame.type == ET_SUBTRACT)
+            {
+                frame.scale = StreamingEvaluator::apply(ET_UNARY_MINUS, Number(), Number(), frame.scale, context);
+            }
+            frame.scaled = true;
+            break;
+        case ET_MULTIPLY:
+            // scale * (left * v) + offset
+            frame.scale = frame.scaled ? StreamingEvaluator::apply(ET_MULTIPLY, frame.scale, Number(), frame.left.value, context) : frame.left.value;
+            frame.offset = frame.scaled ? frame.offset : Number(0L);
+            frame.scaled = true;
+            break;
+        case ET_UNARY_MINUS:
+            // scale * (-v) + offset
+            frame.scale = StreamingEvaluator::apply(ET_UNARY_MINUS, Number(), Number(), frame.scaled ? frame.scale : Number(1L), context);
+            frame.offset = frame.scaled ? frame.offset : Number(0L);
+            frame.scaled = true;
+            break;
+        default:
+            frame.scaled = false;
+            frame.base = index;
+            break;
+        }
+    }
+    catch (const Exception&)
+    {
+        frame.scaled = false;
+        frame.base = index;
+    }
+}
+
+
+//
+// Returns what Expression::evaluate returns or throws for the given operator with the given right side.
+// The right side is NULL if it is missing.
+//
+IncrementalParser::Result IncrementalParser::combine(const Frame& frame, const Result* right)
+{
+    Result result;
+    switch (frame.type)
+    {
+    case ET_BLOCK:
+        if (right)
+        {
+            return *right;
+        }
+        result.failed = true;
+        result.what = gettext("Incomplete block");
+        return result;
+    case ET_ASSIGN:
+        if (frame.left.failed || !right)
+        {
+            result = frame.left;
+            result.value = Number(0L);
+            return result;
+        }
+        return *right;
+    case ET_ADD:
+    case ET_SUBTRACT:
+    case ET_MULTIPLY:
+    case ET_DIVIDE:
+    case ET_HYPOT:
+    case ET_POW:
+        if (frame.left.failed || !right)
+        {
+            return frame.left;
+        }
+        else if (right->failed)
+        {
+            return *right;
+        }
+        else if (frame.chained)
+        {
+            return sum(frame, right->value);
+        }
+        return compute(frame.type, frame.left.value, Number(), right->value);
+    case ET_POWMOD:
+        if (frame.left.failed)
+        {
+            return frame.left;
+        }
+        else if (frame.exponent.failed)
+        {
+            return frame.exponent;
+        }
+        else if (!right)
+        {
+            // The value of the power is the value of this expression.
+            return compute(ET_POW, frame.left.value, Number(), frame.exponent.value);
+        }
+        else if (right->failed)
+        {
+            return *right;
+        }
+        return compute(ET_POWMOD, frame.left.value, frame.exponent.value, right->value);
+    default: // unary operators
+        if (!right)
+        {
+            result.failed = true;
+            result.what = EvaluationInabilityException().getWhat();
+            return result;
+        }
+        else if (right->failed)
+        {
+            return *right;
+        }
+        return compute(frame.type, Number(), Number(), right->value);
+    }
+}
+
+
+//
+// Returns the value of the whole input for the given right side of the given frame
+// by the partial values that the frames keep.
+//
+IncrementalParser::Result IncrementalParser::combinePartial(int index, const Result& right)
+{
+    Result result = right;
+    while (index >= 0)
+    {
+        const Frame& frame = frames[index];
+        if (frame.fixed.failed)
+        {
+            return frame.fixed;
+        }
+        else if (result.failed)
+        {
+            // None of the frames below has its left side failed.
+            return result;
+        }
+        else if (frame.scaled)
+        {
+            result = compute(ET_MULTIPLY, frame.scale, Number(), result.value);
+            if (!result.failed)
+            {
+                result = compute(ET_ADD, result.value, Number(), frame.offset);
+            }
+        }
+        if (frame.base < 0)
+        {
+            break;
+        }
+        result = combine(frames[frame.base], &result);
+        index = frames[frame.base].below;
+    }
+    return result;
+}
+
+
+//
+// Returns the sum of the chain of the given frame with the given right side added.
+//
+IncrementalParser::Result IncrementalParser::sum(const Frame& frame, const Number& right)
+{
+    Result result;
+    try
+    {
+        PairwiseSum sum = frame.sum;
+        sum.add(right, frame.type == ET_SUBTRACT);
+        result.value = sum.getSum();
+    }
+    catch (const Exception& ex)
+    {
+        result.failed = true;
+        result.what = ex.getWhat();
+    }
+    return result;
+}
+
+
+//
+// Applies the given operator to the given values in the same way as StreamingEvaluator does.
+//
+IncrementalParser::Result IncrementalParser::compute(ExpressionType type, const Number& left, const Number& exponent, const Number& right)
+{
+    Result result;
+    try
+    {
+        result.value = StreamingEvaluator::apply(type, left, exponent, right, context);
+    }
+    catch (const Exception& ex)
+    {
+        result.failed = true;
+        result.what = ex.getWhat();
+    }
+    return result;
+}
+
+
+//
+// Evaluates the variable just shifted in the same way as Variable::evaluate does
+// within the assignments not yet reduced.
+//
+IncrementalParser::Result IncrementalParser::evaluateVariable(const State& state) const
+{
+    Result result;
+    try
+    {
+        if (state.slot < 0)
+        {
+            throw EvaluationInabilityException(Glib::ustring::compose(gettext("%1: Not exist"), state.key));
+        }
+        EvaluationContext context;
+        for (int index = state.assign; index >= 0; index = frames[index].outer)
+        {
+            if (!frames[index].left.failed)
+            {
+                context.setInEvaluation(frames[index].slot);
+            }
+        }
+        result.value = VariableStore::instance().evaluate(state.slot, context);
+    }
+    catch (const Exception& ex)
+    {
+        result.failed = true;
+        result.what = ex.getWhat();
+    }
+    return result;
+}
@@ -0,0 +1,200 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#ifndef IKURA_INCREMENTALPARSER_H
+#define IKURA_INCREMENTALPARSER_H
+
+
+#include <vector>
+#include <glibmm/ustring.h>
+#include "Expression.h"
+#include "Lexer.h"
+
+
+namespace hnrt
+{
+    //
+    // Parser for the expression being typed in
+    //
+    // This accepts the same strings as Parser does with complete set to false,
+    // but it keeps the tokens and the state of the parser after each of them,
+    // so that appending to or deleting from the end of the input re-lexes and re-parses
+    // only the tail of it, and each keystroke costs the same regardless of the length of the input.
+    //
+    // No expression tree is built. The string form of an expression is the concatenation of
+    // the strings of its tokens, and each subexpression is evaluated as soon as it is complete
+    // in the same order as Expression::evaluate does, so that the value of the whole input is
+    // obtained by folding the operators still waiting for their right side.
+    // The precedence and the operators of the symbols, and the application of an operator to
+    // its values, are those of StreamingEvaluator, and a chain of + and - is summed up by PairwiseSum
+    // as well.
+    // Each operator keeps the partial value of the input folded down to it when it is pushed, so that
+    // only the innermost operators are folded on each keystroke however deeply the input is nested;
+    // see Frame.
+    //
+    class IncrementalParser
+    {
+    public:
+
+        IncrementalParser();
+        ~IncrementalParser();
+
+        //
+        // Forgets the tokens parsed so far.
+        //
+        void clear();
+
+        //
+        // Parses the given buffer, reusing the tokens that end before the given offset, and
+        // rewrites the rest of the buffer into the form that Expression::format produces.
+        // The caller tells by the offset how much of the buffer is unchanged since the last call.
+        // If it encounters an error, it throws the same exception as Parser does and
+        // the buffer is left unchanged.
+        //
+        void parse(std::vector<char>& buffer, size_t unchanged);
+
+        //
+        // Parses the first given number of bytes of the buffer in the same way as parse,
+        // but the buffer is left as it is.
+        // This tells whether a prefix of the input is valid as Parser would do.
+        //
+        void validate(const std::vector<char>& buffer, size_t size, size_t unchanged);
+
+        //
+        // Returns true if the last call to parse succeeded for the buffer of the given size.
+        //
+        bool isParsed(size_t size) const { return parsed && text == size; }
+
+        //
+        // Returns the offset of the token in error if the last call to parse failed.
+        //
+        size_t getErrorOffset() const { return errorOffset; }
+
+        //
+        // Returns the input formatted with EF_PREPENDZERO (null-terminated).
+        //
+        const char* getDisplayText() const { return &display[0]; }
+
+        //
+        // Returns the value of the input in the same way as Expression::evaluate
+        // in EM_TRANSIENT mode does.
+        //
+        Number evaluate();
+
+        //
+        // Returns the number of the left parentheses not yet closed.
+        //
+        int getOpenBlockCount() const;
+
+        //
+        // Returns the last token. If no token is there, false is returned.
+        //
+        bool getLastToken(int& sym, size_t& offset, size_t& length) const;
+
+    protected:
+
+        //
+        // Value of a subexpression or the error that its evaluation throws
+        //
+        struct Result
+        {
+            bool failed;
+            Number value;
+            Glib::ustring what;
+
+            Result() : failed(false) {}
+        };
+
+        //
+        // Operator waiting for its right side
+        //
+        struct Frame
+        {
+            ExpressionType type; // binary or unary operator, ET_BLOCK, or ET_ASSIGN
+            int below; // index to the frame below; -1 if none
+            Result left; // left side of binary operator; failed if ET_ASSIGN is recursive
+            Result exponent; // if ET_POWMOD
+            int slot; // variable to be assigned if ET_ASSIGN
+            int outer; // index to the enclosing ET_ASSIGN frame if ET_ASSIGN; -1 if none
+
+            //
+            // If ET_ADD or ET_SUBTRACT continues a chain of + and -, which Parser builds into ChainExpression,
+            // chained is true and sum is that of the chain before the right side, whose value is left.
+            //
+            bool chained;
+            PairwiseSum sum;
+
+            //
+            // Partial value of the input folded down from this frame when it is pushed, that is,
+            // the value of the whole input as a function of the right side v of this frame:
+            // fixed if it fails whatever v is; otherwise scale * v + offset, or v itself if not scaled,
+            // folded from the frame at base down to the bottom, where base is -1 if none.
+            // Only the operators that keep it linear in v are folded into scale and offset;
+            // any other operator is the base of itself.
+            //
+            Result fixed;
+            bool scaled;
+            Number scale;
+            Number offset;
+            int base;
+        };
+
+        //
+        // State of the parser after a token
+        //
+        struct State
+        {
+            int top; // index to the innermost frame; -1 if none
+            int assign; // index to the innermost ET_ASSIGN frame; -1 if none
+            size_t frameCount; // frames in use
+            int openBlocks;
+            bool hasOperand; // true if the last token completed an operand
+            ExpressionType operandType;
+            Glib::ustring key; // if operandType is ET_VARIABLE
+            int slot; // if operandType is ET_VARIABLE
+            Result operand;
+        };
+
+        struct Token
+        {
+            int sym;
+            size_t offset; // in the formatted text
+            size_t length;
+            size_t displayOffset; // in the text formatted with EF_PREPENDZERO
+        };
+
+        IncrementalParser(const IncrementalParser&) {}
+        void operator =(const IncrementalParser&) {}
+        size_t run(const std::vector<char>& buffer, size_t size, size_t unchanged, std::vector<char>& tail);
+        void rollBack(size_t unchanged);
+        const State& getState() const { return states.empty() ? initial : states.back(); }
+        void shift(State& state, int sym, const Lexer& lexer);
+        void pushFrame(State& state, ExpressionType type);
+        void pushAssignFrame(State& state);
+        void pushSumFrame(State& state, ExpressionType type);
+        void reduce(State& state, int level);
+        void reduceFrame(State& state);
+        void foldFrame(int index);
+        Result combine(const Frame& frame, const Result* right);
+        Result combinePartial(int index, const Result& right);
+        Result compute(ExpressionType type, const Number& left, const Number& exponent, const Number& right);
+        Result sum(const Frame& frame, const Number& right);
+        Result evaluateVariable(const State& state) const;
+
+        std::vector<Token> tokens;
+        std::vector<State> states; // indexed by token
+        std::vector<Frame> frames;
+        State initial;
+        std::vector<char> display; // null-terminated
+        size_t text; // length of the formatted text
+        bool parsed;
+        size_t errorOffset;
+        unsigned long generation; // of VariableStore when the tokens were parsed
+        int sumFrame; // ET_ADD or ET_SUBTRACT frame reduced last
+        Number sumTerm; // right side of sumFrame
+        EvaluationContext context; // of the operators applied
+    };
+}
+
+
+#endif //!IKURA_INCREMENTALPARSER_H
@@ -9,6 +9,7 @@
 #include "Lexer.h"
 #include "LocaleInfo.h"
 #include "UTF8.h"
+#include "VariableStore.h"
 
 
 using namespace hnrt;
@@ -22,6 +23,8 @@ static const char arithmeticOperators[] = "+-*/";
 
 InputBuffer::InputBuffer()
     : validSize(0)
+    , unchangedSize(0)
+    , pasteLexer(NULL)
     , justEvaluated(false)
     , formatFlags(EF_GROUPING)
 {
@@ -30,6 +33,7 @@ InputBuffer::InputBuffer()
 
 InputBuffer::~InputBuffer()
 {
+    delete pasteLexer;
 }
 
 
@@ -65,40 +69,24 @@ void InputBuffer::setHexadecimal(bool value)
 
 int InputBuffer::getPrecision() const
 {
-    int precision = 0;
-    if ((formatFlags & EF_PRECISION10))
-    {
-        precision += 10;
-    }
-    if ((formatFlags & EF_PRECISION20))
-    {
-        precision += 20;
-    }
-    return precision;
+    return formatFlags >> EF_PRECISION_SHIFT;
 }
 
 
+//
+// The working precision of real numbers follows the digits to be displayed,
+// and the values of the variables are computed again in it.
+//
 void InputBuffer::setPrecision(int value)
 {
     if (getPrecision() != value)
     {
-        if (value < 10)
-        {
-            formatFlags &= ~(EF_PRECISION10 | EF_PRECISION20);
-        }
-        else if (value < 20)
-        {
-            formatFlags &= ~EF_PRECISION20;
-            formatFlags |= EF_PRECISION10;
-        }
-        else if (value < 30)
-        {
-            formatFlags &= ~EF_PRECISION10;
-            formatFlags |= EF_PRECISION20;
-        }
-        else
+        formatFlags = (formatFlags & ((1 << EF_PRECISION_SHIFT) - 1)) | (value << EF_PRECISION_SHIFT);
+        size_t bits = Number::getPrecisionForDigits(value);
+        if (Number::getPrecision() != bits)
         {
-            formatFlags |= EF_PRECISION10 | EF_PRECISION20;
+            Number::setPrecision(bits);
+            VariableStore::instance().invalidate();
         }
     }
 }
@@ -106,8 +94,10 @@ void InputBuffer::setPrecision(int value)
 
 void InputBuffer::clear()
 {
+    endPutString();
     SUPER::clear();
     validSize = 0;
+    unchangedSize = 0;
     justEvaluated = false;
     sigTextChange.emit("0");
     sigTooltipChange.emit(gettext("Please enter expression"));
@@ -117,12 +107,14 @@ void InputBuffer::clear()
 
 void InputBuffer::assign(const char *s)
 {
+    endPutString();
     size_t lastSize = SUPER::size();
     if (lastSize)
     {
         SUPER::clear();
     }
     validSize = 0;
+    unchangedSize = 0;
     justEvaluated = false;
     putString(s);
     if (!SUPER::size() && lastSize)
@@ -136,12 +128,14 @@ void InputBuffer::assign(const char *s)
 
 void InputBuffer::putChar(int c)
 {
+    cancelPutString();
     if (!(c & ~0x7F) && strchr(arithmeticOperators, c))
     {
         if (validSize && !(at(validSize - 1) & ~0x7F) && strchr(arithmeticOperators, at(validSize - 1)))
         {
             validSize--;
             at(validSize) = c;
+            setUnchangedSize(validSize);
         }
         else
         {
@@ -175,65 +169,161 @@ void InputBuffer::putChar(int c)
 
 void InputBuffer::putString(const char* s)
 {
+    beginPutString(s);
+    while (continuePutString(~(size_t)0))
+    {
+        continue;
+    }
+}
+
+
+//
+// Starts putting the given string.
+// The string is taken in chunks by continuePutString, so that
+// a large one can be put without blocking the main loop for long.
+//
+void InputBuffer::beginPutString(const char* s)
+{
+    cancelPutString();
+    pasteText.assign(s, s + strlen(s));
+    pasteLexer = new Lexer(pasteText.size() ? &pasteText[0] : NULL, pasteText.size());
+}
+
+
+//
+// Puts the tokens of the string given to beginPutString
+// until at least the given number of bytes are added to the input.
+// As with typing, the input is cut before the first token that makes it invalid,
+// and the rest of the string is discarded.
+// Returns true if the string is not yet finished.
+//
+bool InputBuffer::continuePutString(size_t size)
+{
+    if (!pasteLexer)
+    {
+        return false;
+    }
     size_t lastSize = SUPER::size();
+    size_t limit = size < ~(size_t)0 - lastSize ? lastSize + size : ~(size_t)0;
+    std::vector<size_t> tokenEnds;
+    bool more = true;
     try
     {
-        Lexer lexer(s, strlen(s));
-        int sym = lexer.getSym();
-        while (sym != SYM_EOF)
+        while (1)
         {
-            const char* t = lexer.getString();
-            size_t n = strlen(t);
-            size_t curSize = lastSize + n;
-            resize(curSize);
-            memcpy(&SUPER::at(lastSize), t, n);
-            try
+            int sym = pasteLexer->getSym();
+            if (sym == SYM_EOF)
             {
-                Expression *expr = Expression::parse(*this, curSize);
-                delete expr;
+                more = false;
+                break;
             }
-            catch (...)
+            const char* t = pasteLexer->getString();
+            insert(end(), t, t + strlen(t));
+            tokenEnds.push_back(SUPER::size());
+            // An identifier is not left at the end of a chunk
+            // because it would be complemented there.
+            if (SUPER::size() >= limit && sym != SYM_IDENTIFIER)
             {
-                resize(lastSize);
                 break;
             }
-            lastSize = curSize;
-            sym = lexer.getSym();
         }
     }
     catch (...)
     {
+        more = false;
+    }
+    if (SUPER::size() > lastSize)
+    {
+        try
+        {
+            // Parsing all the tokens at once keeps the whole string taken in time linear in its length.
+            parser.parse(*this, unchangedSize);
+            unchangedSize = SUPER::size();
+        }
+        catch (...)
+        {
+            // Some token is not acceptable. Try the tokens one by one as putChar would do,
+            // and keep the ones before it.
+            size_t n = lastSize;
+            for (size_t i = 0; i < tokenEnds.size(); i++)
+            {
+                try
+                {
+                    parser.validate(*this, tokenEnds[i], i ? tokenEnds[i - 1] : unchangedSize);
+                }
+                catch (...)
+                {
+                    break;
+                }
+                n = tokenEnds[i];
+            }
+            resize(n);
+            setUnchangedSize(lastSize);
+            more = false;
+        }
     }
-    if (validSize != lastSize)
+    if (more)
     {
         parse();
     }
+    if (!more)
+    {
+        cancelPutString();
+    }
+    return more;
+}
+
+
+//
+// Stops putting the string given to beginPutString.
+// The tokens already put are left in the input.
+//
+void InputBuffer::cancelPutString()
+{
+    if (pasteLexer)
+    {
+        endPutString();
+        if (validSize != SUPER::size())
+        {
+            parse();
+        }
+    }
 }
 
 
+//
+// Discards the string given to beginPutString.
+//
+void InputBuffer::endPutString()
+{
+    delete pasteLexer;
+    pasteLexer = NULL;
+    pasteText.clear();
+}
+
+
+//
+// Parses the input and updates the text and the tooltip.
+// Only the part of the input after unchangedSize is re-parsed;
+// see IncrementalParser.
+//
 void InputBuffer::parse()
 {
-    Glib::ustring tooltip;
     try
     {
         justEvaluated = false;
-        Expression *expr = Expression::parse(*this, SUPER::size());
+        parser.parse(*this, unchangedSize);
         bool first = !validSize;
-        SUPER::clear();
-        expr->format(*this, 0);
         validSize = SUPER::size();
-        std::vector<char> buffer;
-        expr->format(buffer, formatFlags | EF_PREPENDZERO);
-        buffer.push_back('\0');
-        sigTextChange.emit(&buffer[0]);
+        unchangedSize = validSize;
+        sigTextChange.emit(parser.getDisplayText());
         try
         {
-            Expression *expr2 = expr->evaluate(false);
-            buffer.clear();
-            expr2->format(buffer, formatFlags);
+            Number value = parser.evaluate();
+            std::vector<char> buffer;
+            value.format(buffer, formatFlags);
             buffer.push_back('\0');
             sigTooltipChange.emit(&buffer[0]);
-            delete expr2;
         }
         catch (const Exception& ex)
         {
@@ -243,58 +333,60 @@ void InputBuffer::parse()
         {
             sigFirstChar.emit();
         }
-        delete expr;
     }
     catch (const OverflowException& ex)
     {
         sigOverflow.emit();
         resize(validSize);
+        setUnchangedSize(validSize);
     }
     catch (const UnderflowException& ex)
     {
         sigUnderflow.emit();
         resize(validSize);
+        setUnchangedSize(validSize);
     }
     catch (const Exception& ex)
     {
         sigInvalidChar.emit();
         resize(validSize);
+        setUnchangedSize(validSize);
     }
 }
 
 
 void InputBuffer::evaluate()
 {
+    cancelPutString();
     try
     {
         size_t n = SUPER::size();
+        bool parsed = parser.isParsed(n) && unchangedSize == n;
         // delete the operator at the end of input if it is there
         if (n && strchr(arithmeticOperators, at(n - 1)))
         {
             n--;
             resize(n);
+            setUnchangedSize(n);
         }
         // complement the right parentheses if necessary
         if (n)
         {
-            int nL = UTF8::count(*this, n, '(');
-            int nR = UTF8::count(*this, n, ')');
-            while (nL > nR)
+            // the parser has counted the blocks left open as the input was typed in
+            int nOpen = parsed ? parser.getOpenBlockCount() : UTF8::count(*this, n, '(') - UTF8::count(*this, n, ')');
+            while (nOpen > 0)
             {
                 push_back(')');
-                nR++;
+                nOpen--;
             }
         }
-        Expression *expr1 = Expression::parse(*this, SUPER::size(), true);
+        Expression *expr1 = Expression::parse(*this, SUPER::size(), arena, true);
         try
         {
-            if (expr1->getType() == ET_INTEGER_MAX_PLUS_ONE)
-            {
-                throw OverflowException();
-            }
-            Expression *expr2 = expr1->evaluate(true);
+            EvaluationContext context(EM_PERMANENT);
+            Number value = expr1->evaluate(context);
             std::vector<char> buffer2;
-            expr2->format(buffer2, formatFlags);
+            value.format(buffer2, formatFlags);
             buffer2.push_back('\0');
             sigTextChange.emit(&buffer2[0]);
             std::vector<char> buffer;
@@ -302,13 +394,13 @@ void InputBuffer::evaluate()
             buffer.push_back('\0');
             sigTooltipChange.emit(&buffer[0]);
             SUPER::clear();
-            expr2->format(*this, formatFlags & ~EF_GROUPING);
+            unchangedSize = 0;
+            value.format(*this, formatFlags & ~EF_GROUPING);
             validSize = SUPER::size();
             justEvaluated = true;
             buffer2 = *this;
             buffer2.push_back('\0');
             sigEvaluated.emit(&buffer[0], &buffer2[0]);
-            delete expr2;
         }
         catch (const DivideByZeroException& ex)
         {
@@ -334,10 +426,11 @@ void InputBuffer::evaluate()
         {
             g_printerr("BUG@%s(%d)\n", __FILE__, __LINE__);
         }
-        delete expr1;
+        arena.clear();
     }
     catch (...)
     {
+        arena.clear();
         sigIncompleteExpression.emit();
     }
 }
@@ -345,42 +438,51 @@ void InputBuffer::evaluate()
 
 void InputBuffer::deleteLastChar()
 {
+    cancelPutString();
     if (SUPER::size())
     {
-        validSize = 0;
-        Lexer lexer(&SUPER::at(0), SUPER::size());
         int sym, lastSym;
-        size_t length;
-        try
-        {
-            sym = lexer.getSym();
-        }
-        catch (...)
+        size_t offset, length;
+        if (parser.isParsed(SUPER::size()) && unchangedSize == SUPER::size() && parser.getLastToken(lastSym, offset, length))
         {
-            goto done;
+            // the parser keeps the tokens of the input
+            validSize = offset;
         }
-        if (sym == SYM_EOF)
-        {
-            // no chance, but just in case
-            goto done;
-        }
-        while (1)
+        else
         {
-            lastSym = sym;
-            length = strlen(lexer.getString());
+            validSize = 0;
+            Lexer lexer(&SUPER::at(0), SUPER::size());
             try
             {
                 sym = lexer.getSym();
             }
             catch (...)
             {
-                break;
+                goto done;
             }
             if (sym == SYM_EOF)
             {
-                break;
+                // no chance, but just in case
+                goto done;
+            }
+            while (1)
+            {
+                lastSym = sym;
+                length = strlen(lexer.getString());
+                try
+                {
+                    sym = lexer.getSym();
+                }
+                catch (...)
+                {
+                    break;
+                }
+                if (sym == SYM_EOF)
+                {
+                    break;
+                }
+                validSize += length;
             }
-            validSize += length;
         }
         if (lastSym == SYM_INTEGER ||
             lastSym == SYM_REALNUMBER ||
@@ -392,6 +494,7 @@ void InputBuffer::deleteLastChar()
         if (validSize)
         {
             resize(validSize);
+            setUnchangedSize(validSize);
             parse();
         }
         else
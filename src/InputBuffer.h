@@ -7,6 +7,7 @@
 
 #include <vector>
 #include <sigc++/sigc++.h>
+#include "IncrementalParser.h"
 
 
 namespace hnrt
@@ -34,6 +35,10 @@ namespace hnrt
         InputBuffer &operator =(const char *s) { assign(s); return *this; }
         void putChar(int c);
         void putString(const char* s);
+        void beginPutString(const char* s);
+        bool continuePutString(size_t size);
+        void cancelPutString();
+        bool isPuttingString() const { return pasteLexer ? true : false; }
         void parse();
         void evaluate();
         void deleteLastChar();
@@ -53,8 +58,15 @@ namespace hnrt
     protected:
 
         InputBuffer(const InputBuffer&) {}
+        void setUnchangedSize(size_t value) { if (unchangedSize > value) unchangedSize = value; }
+        void endPutString();
 
         size_t validSize; // this is the size of the valid input; updated after successful parsing.
+        size_t unchangedSize; // this is the size of the input left unchanged since parser saw it last.
+        IncrementalParser parser;
+        ExpressionArena arena; // of the tree parsed by evaluate
+        std::vector<char> pasteText; // string being put by continuePutString
+        Lexer* pasteLexer; // reading pasteText; NULL if no string is being put
         bool justEvaluated; // set to true right after equal was received.
         int formatFlags;
         sigc::signal<void, const char*> sigTextChange;
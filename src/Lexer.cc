@@ -5,8 +5,10 @@
 #include <errno.h>
 #include <limits.h>
 #include <math.h>
+#include <quadmath.h>
 #include <stdlib.h>
 #include "Lexer.h"
+#include "Arithmetic.h"
 #include "Exception.h"
 #include "OperatorInfo.h"
 #include "VariableStore.h"
@@ -14,6 +16,10 @@
 #include "UTF8.h"
 
 
+static const unsigned __int128 UINT128_MAX = ~(unsigned __int128)0;
+static const unsigned __int128 INT128_MAX = UINT128_MAX >> 1;
+
+
 // It is observed that some of isw* functions behave unexpectedly.
 // As such, I decided to use is* functions, instead.
 // To do that, I need to check if the value is of US ASCII first.
@@ -35,8 +41,12 @@ using namespace hnrt;
 Lexer::Lexer(const char *s, size_t n)
     : next(s)
     , stop(s + n)
+    , current(s)
     , c(0)
-    , v()
+    , text(s)
+    , length(0)
+    , integer()
+    , realNumber(0.0L)
     , buf()
 {
     c = getChar();
@@ -49,6 +59,7 @@ Lexer::Lexer(const char *s, size_t n)
 //
 int Lexer::getChar()
 {
+    current = next;
     if (next < stop)
     {
         int c = UTF8::getChar(next, stop, &next);
@@ -75,95 +86,52 @@ int Lexer::getSym()
 {
     int sym;
     buf.clear();
+    text = current;
     if (c == 0)
     {
         sym = SYM_EOF;
     }
     else if (IS_USASCII(c) && isdigit(c))
     {
-        buf.push_back(c);
+        // The digits are read in place; only a real number is copied for strtold.
+        unsigned __int128 value = c - '0';
+        bool overflow = false;
         c = getChar();
-        if (buf[0] == '0' && parseHexadecimal())
+        if (value == 0 && parseHexadecimal())
         {
             sym = SYM_INTEGER;
-            buf.push_back('\0');
-            if (&buf[2]) // check the character next to "0x"
-            {
-                errno = 0;
-                unsigned long value = strtoul(&buf[2], NULL, 16);
-                if (errno == ERANGE)
-                {
-                    throw OverflowException();
-                }
-                v.integer = (long)value;
-            }
-            else
-            {
-                v.integer = 0;
-            }
             goto done;
         }
         while (IS_USASCII(c) && isdigit(c))
         {
-            buf.push_back(c);
+            if (value > (INT128_MAX - (c - '0')) / 10)
+            {
+                overflow = true;
+            }
+            value = value * 10 + (c - '0');
             c = getChar();
         }
+        const char* end = current;
         if (parseDecimalFractionPart() || parseExponentPart())
         {
             sym = SYM_REALNUMBER;
-            buf.push_back('\0');
-            errno = 0;
-            v.realNumber = strtold(&buf[0], NULL);
-            if (errno == ERANGE)
-            {
-                if (v.realNumber == HUGE_VALL)
-                {
-                    throw OverflowException();
-                }
-                else
-                {
-                    throw UnderflowException();
-                }
-            }
+            parseRealNumber();
         }
         else
         {
             sym = SYM_INTEGER;
-            buf.push_back('\0');
-            errno = 0;
-            unsigned long value = strtoul(&buf[0], NULL, 10);
-            if (errno == ERANGE || value > 9223372036854775808UL)
-            {
-                throw OverflowException();
-            }
-            // note: 9223372036854775808UL must with a minus sign. Otherwise, take it as a overflow case.
-            v.integer = (long)value;
+            integer = overflow ? Number::bigInteger(BigInteger::parseDecimal(text, end - text)) : Number::integer128((__int128)value);
         }
     }
     else if (parseDecimalFractionPart())
     {
         sym = SYM_REALNUMBER;
-        buf.push_back('\0');
-        errno = 0;
-        v.realNumber = strtold(&buf[0], NULL);
-        if (errno == ERANGE)
-        {
-            if (v.realNumber == HUGE_VALL)
-            {
-                throw OverflowException();
-            }
-            else
-            {
-                throw UnderflowException();
-            }
-        }
+        parseRealNumber();
     }
     else if (c == '+' || c == '-' || c == '*' || c == '/')
     {
         sym = c;
-        buf.push_back(c);
         c = getChar();
-        buf.push_back('\0');
         if (c == '+' || c == '-' || c == '*' || c == '/')
         {
             throw InvalidCharException();
@@ -172,9 +140,7 @@ int Lexer::getSym()
     else if (c == '(' || c == ')')
     {
         sym = c;
-        buf.push_back(c);
         c = getChar();
-        buf.push_back('\0');
     }
     else if (c == '{')
     {
@@ -247,20 +213,60 @@ int Lexer::getSym()
     }
     else if (c == '=')
     {
-        buf.push_back(c);
         c = getChar();
         sym = SYM_ASSIGN;
-        buf.push_back('\0');
     }
     else
     {
         throw InvalidCharException();
     }
 done:
+    length = current - text;
     return sym;
 }
 
 
+//
+// Returns the string form of the current token (null-terminated).
+// The token read in place is copied into the buffer on the first call.
+//
+const char* Lexer::getString() const
+{
+    if (buf.empty())
+    {
+        normalize(text, length, buf);
+        buf.push_back('\0');
+    }
+    return &buf[0];
+}
+
+
+//
+// Appends the string form of the given number or single-character token to the buffer, in which
+// the letters are in lower case, the exponent symbol is 'e', and the rest is as it is.
+//
+void Lexer::normalize(const char* s, size_t n, std::vector<char>& buffer)
+{
+    const char* stop = s + n;
+    while (s < stop)
+    {
+        int c = UTF8::getChar(s, stop, &s);
+        if (c == SYM_E)
+        {
+            buffer.push_back('e');
+        }
+        else if (IS_USASCII(c))
+        {
+            buffer.push_back(tolower(c));
+        }
+        else
+        {
+            UTF8::pushBack(buffer, c);
+        }
+    }
+}
+
+
 //
 // Tries to parse the decimal fraction part of a real number
 // and returns true if successful, false if it does nothing.
@@ -270,11 +276,9 @@ bool Lexer::parseDecimalFractionPart()
 {
     if (c == LocaleInfo::getDecimalPoint())
     {
-        UTF8::pushBack(buf, c);
         c = getChar();
         while (IS_USASCII(c) && isdigit(c))
         {
-            buf.push_back(c);
             c = getChar();
         }
         parseExponentPart();
@@ -293,18 +297,15 @@ bool Lexer::parseExponentPart()
 {
     if (c == L'E' || c == L'e' || c == SYM_E)
     {
-        buf.push_back('e');
         c = getChar();
         if (c == L'+' || c == L'-')
         {
-            buf.push_back(c);
             c = getChar();
         }
         if (IS_USASCII(c) && isdigit(c))
         {
             do
             {
-                buf.push_back(c);
                 c = getChar();
             }
             while (IS_USASCII(c) && isdigit(c));
@@ -322,19 +323,26 @@ bool Lexer::parseExponentPart()
 //
 // Tries to parse a hexadecimal integer which begins with X or x.
 // and returns true if successful, false if it does nothing.
-// If encounters an error, it throws InvalidCharException.
+// The value is set to the token; "0x" alone is taken as zero.
+// Up to 16 digits are taken as a long in two's complement, up to 32 as a 128-bit integer,
+// and more as a BigInteger of as many 64-bit words as they fill,
+// so that the digits of Number::format read back the same value.
+// If encounters an error, it throws InvalidCharException or OverflowException.
 //
 bool Lexer::parseHexadecimal()
 {
     if (c == L'X' || c == L'x')
     {
-        buf.push_back('x');
+        unsigned __int128 value = 0;
+        int digits = 0;
         c = getChar();
+        const char* start = current;
         if (IS_USASCII(c) && isxdigit(c))
         {
             do
             {
-                buf.push_back(tolower(c));
+                value = (value << 4) | (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+                digits++;
                 c = getChar();
             }
             while (IS_USASCII(c) && isxdigit(c));
@@ -347,7 +355,58 @@ bool Lexer::parseHexadecimal()
         {
             throw InvalidCharException();
         }
+        if (digits > 32)
+        {
+            integer = Number::bigInteger(BigInteger::parseHexadecimal(start, current - start));
+        }
+        else
+        {
+            integer = Number::integer128(digits > 16 ? (__int128)value : (long)(unsigned long)value);
+        }
         return true;
     }
     return false;
 }
+
+
+//
+// Converts the real number just read with strtold, or with strtoflt128 or into BigReal
+// while the working precision is set.
+// If it is out of range, it throws OverflowException or UnderflowException.
+//
+void Lexer::parseRealNumber()
+{
+    normalize(text, current - text, buf);
+    buf.push_back('\0');
+    if (Number::isFloat128())
+    {
+        errno = 0;
+        __float128 value = strtoflt128(&buf[0], NULL);
+        realNumber = Number::float128(value);
+        if (errno == ERANGE && value == 0)
+        {
+            throw UnderflowException();
+        }
+        Arithmetic::validate(value);
+        return;
+    }
+    else if (Number::getPrecision())
+    {
+        realNumber = Number::bigReal(BigReal::parseDecimal(&buf[0], buf.size() - 1, Number::getPrecision()));
+        return;
+    }
+    errno = 0;
+    long double value = strtold(&buf[0], NULL);
+    realNumber = Number(value);
+    if (errno == ERANGE)
+    {
+        if (value == HUGE_VALL)
+        {
+            throw OverflowException();
+        }
+        else
+        {
+            throw UnderflowException();
+        }
+    }
+}
@@ -6,6 +6,7 @@
 
 
 #include <vector>
+#include "Number.h"
 #include "TerminalSymbol.h"
 
 
@@ -20,9 +21,22 @@ namespace hnrt
 
         Lexer(const char *s, size_t n);
         int getSym();
-        long getInteger() const { return v.integer; }
-        long double getRealNumber() const { return v.realNumber; }
-        const char *getString() const { return &buf[0]; }
+        const Number& getInteger() const { return integer; }
+        const Number& getRealNumber() const { return realNumber; }
+        const char *getString() const;
+
+        //
+        // Returns the current token in the string being read, which is not null-terminated.
+        // An identifier or an operator in braces may differ from its string form,
+        // as it is converted into upper or lower case and complemented at the end of the string.
+        //
+        const char *getText() const { return text; }
+        size_t getTextLength() const { return length; }
+
+        //
+        // Appends the string form of the number or the single-character token in the given text.
+        //
+        static void normalize(const char* s, size_t n, std::vector<char>& buffer);
 
     protected:
 
@@ -31,16 +45,17 @@ namespace hnrt
         bool parseDecimalFractionPart();
         bool parseExponentPart();
         bool parseHexadecimal();
+        void parseRealNumber();
 
         const char *next;
         const char *stop;
+        const char *current; // position of c
         int c;
-        union TokenValue
-        {
-            long integer;
-            long double realNumber;
-        } v;
-        std::vector<char> buf;
+        const char *text; // of the current token
+        size_t length; // of text in bytes
+        Number integer; // of SYM_INTEGER
+        Number realNumber; // of SYM_REALNUMBER; NT_FLOAT128 or NT_BIGREAL while the working precision is set
+        mutable std::vector<char> buf; // string form of the current token; empty until it is needed
     };
 }
 
@@ -9,6 +9,7 @@
 #include "OperatorInfo.h"
 #include "LocaleInfo.h"
 #include "UTF8.h"
+#include "Exception.h"
 
 
 //
@@ -18,6 +19,7 @@
 #define XK_Tab          0xff09
 #define XK_Clear        0xff0b
 #define XK_Return       0xff0d  /* Return, enter */
+#define XK_Escape       0xff1b
 #define XK_Delete       0xffff  /* Delete, rubout */
 #define XK_Left         0xff51  /* Move left, left arrow */
 #define XK_Up           0xff52  /* Move up, up arrow */
@@ -150,6 +152,8 @@ MainWindow::MainWindow()
                      sigc::bind<guint>(sigc::mem_fun(*this, &MainWindow::onInput), SYM_LOG10));
     actionGroup->add(Gtk::Action::create("Pow", gettext("X{pow}Y ...X raised to the power of Y")),
                      sigc::bind<guint>(sigc::mem_fun(*this, &MainWindow::onInput), SYM_POW));
+    actionGroup->add(Gtk::Action::create("PowMod", gettext("X{pow}Y{powmod}Z ...X raised to the power of Y modulo Z")),
+                     sigc::bind<guint>(sigc::mem_fun(*this, &MainWindow::onInput), SYM_POWMOD));
     actionGroup->add(Gtk::Action::create("Sin", gettext("{sin}X ...sine of X")),
                      sigc::bind<guint>(sigc::mem_fun(*this, &MainWindow::onInput), SYM_SIN));
     actionGroup->add(Gtk::Action::create("Sqrt", gettext("{sqrt}X ...square root of X")),
@@ -178,6 +182,15 @@ MainWindow::MainWindow()
     precision20Action = Gtk::RadioAction::create(precisionGroup, "Precision20", gettext("Precision _20 display"));
     actionGroup->add(precision20Action,
                      sigc::bind<int>(sigc::mem_fun(*this, &MainWindow::onPrecisionChanged), 20));
+    precision50Action = Gtk::RadioAction::create(precisionGroup, "Precision50", gettext("Precision _50 display"));
+    actionGroup->add(precision50Action,
+                     sigc::bind<int>(sigc::mem_fun(*this, &MainWindow::onPrecisionChanged), 50));
+    precision100Action = Gtk::RadioAction::create(precisionGroup, "Precision100", gettext("Precision 1_00 display"));
+    actionGroup->add(precision100Action,
+                     sigc::bind<int>(sigc::mem_fun(*this, &MainWindow::onPrecisionChanged), 100));
+    precision1000Action = Gtk::RadioAction::create(precisionGroup, "Precision1000", gettext("_Precision 1000 display"));
+    actionGroup->add(precision1000Action,
+                     sigc::bind<int>(sigc::mem_fun(*this, &MainWindow::onPrecisionChanged), 1000));
     switch (input.getPrecision())
     {
     case 10:
@@ -186,6 +199,15 @@ MainWindow::MainWindow()
     case 20:
         precision20Action->set_active(true);
         break;
+    case 50:
+        precision50Action->set_active(true);
+        break;
+    case 100:
+        precision100Action->set_active(true);
+        break;
+    case 1000:
+        precision1000Action->set_active(true);
+        break;
     default:
         noPrecisionAction->set_active(true);
         break;
@@ -215,6 +237,7 @@ MainWindow::MainWindow()
         "    <menu name='Edit' action='Edit'>"
         "      <menu name='Insert' action='Insert'>"
         "        <menuitem name='Pow' action='Pow'/>"
+        "        <menuitem name='PowMod' action='PowMod'/>"
         "        <menuitem name='Sqrt' action='Sqrt'/>"
         "        <menuitem name='Cbrt' action='Cbrt'/>"
         "        <menuitem name='Abs' action='Abs'/>"
@@ -243,6 +266,9 @@ MainWindow::MainWindow()
         "      <menuitem name='NoPrecision' action='NoPrecision'/>"
         "      <menuitem name='Precision10' action='Precision10'/>"
         "      <menuitem name='Precision20' action='Precision20'/>"
+        "      <menuitem name='Precision50' action='Precision50'/>"
+        "      <menuitem name='Precision100' action='Precision100'/>"
+        "      <menuitem name='Precision1000' action='Precision1000'/>"
         "      <separator/>"
         "      <menuitem name='ZoomIn' action='ZoomIn'/>"
         "      <menuitem name='ZoomOut' action='ZoomOut'/>"
@@ -398,25 +424,7 @@ MainWindow::MainWindow()
     history.signalContentsChange().connect(sigc::mem_fun(*this, &MainWindow::onHistoryChange));
     history.signalIndexChange().connect(sigc::mem_fun(*this, &MainWindow::onHistoryChange));
 
-    VariableStore& vars = VariableStore::instance();
-    for (int c = 'A'; c <= 'Z'; c++)
-    {
-        char key[2];
-        key[0] = c;
-        key[1] = 0;
-        vars.add(key);
-    }
-    vars.add("PI", "3.1415926535897932384626433832795029");
-    vars.add("E$", "2.7182818284590452353602874713526625");
-    vars.add("SHRT_MIN", "-32768");
-    vars.add("SHRT_MAX", "32767");
-    vars.add("USHRT_MAX", "65535");
-    vars.add("INT_MIN", "-2147483648");
-    vars.add("INT_MAX", "2147483647");
-    vars.add("UINT_MAX", "4294967295");
-    vars.add("LONG_MIN", "-9223372036854775808");
-    vars.add("LONG_MAX", "9223372036854775807");
-    vars.periodToDecimalPoint();
+    VariableStore::instance().addDefaults();
 
     variableDialog.signal_response().connect(sigc::mem_fun(*this, &MainWindow::onVariableDialogResponse));
 
@@ -549,6 +557,24 @@ void MainWindow::onPrecisionChanged(int precision)
             return;
         }
         break;
+    case 50:
+        if (!precision50Action->get_active())
+        {
+            return;
+        }
+        break;
+    case 100:
+        if (!precision100Action->get_active())
+        {
+            return;
+        }
+        break;
+    case 1000:
+        if (!precision1000Action->get_active())
+        {
+            return;
+        }
+        break;
     default:
         return;
     }
@@ -727,6 +753,9 @@ void MainWindow::onInput(guint key)
     case XK_BackSpace:
         input.deleteLastChar();
         break;
+    case XK_Escape:
+        input.cancelPutString();
+        break;
     case XK_Left:
     case XK_KP_Left:
     case XK_KP_Prior:
@@ -770,6 +799,7 @@ void MainWindow::onInput(guint key)
     case SYM_LOG2:
     case SYM_LOG10:
     case SYM_POW:
+    case SYM_POWMOD:
     case SYM_SIN:
     case SYM_SQRT:
     case SYM_TAN:
@@ -927,7 +957,14 @@ void MainWindow::onVariableDialogResponse(int response)
         const Glib::ustring& key = variableDialog.getSelected();
         if (!key.empty() && key.length() == 1) // only A to Z can be copied; others are treated as read-only.
         {
-            VariableStore::instance().setValue(key, Glib::ustring(input, input.size()));
+            try
+            {
+                VariableStore::instance().setValue(key, Glib::ustring(input, input.size()));
+            }
+            catch (const RecursiveVariableAccessException& ex)
+            {
+                onRecursiveVariableAccess(ex.getKey().c_str());
+            }
         }
         break;
     }
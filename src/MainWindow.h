@@ -66,6 +66,7 @@ namespace hnrt
         void onClipboardClear();
         void onClipboardReceived(const Gtk::SelectionData& selectionData);
         void onClipboardReceivedTargets(const Glib::StringArrayHandle& targetsArray);
+        bool onPasteIdle();
         void updatePasteStatus();
         void updateCopyStatus();
 
@@ -77,6 +78,9 @@ namespace hnrt
         Glib::RefPtr<Gtk::RadioAction> noPrecisionAction;
         Glib::RefPtr<Gtk::RadioAction> precision10Action;
         Glib::RefPtr<Gtk::RadioAction> precision20Action;
+        Glib::RefPtr<Gtk::RadioAction> precision50Action;
+        Glib::RefPtr<Gtk::RadioAction> precision100Action;
+        Glib::RefPtr<Gtk::RadioAction> precision1000Action;
         Gtk::HBox numberDisplayBox;
         NumberDisplay numberDisplay;
         Gtk::Table buttonTable;
@@ -106,6 +110,7 @@ namespace hnrt
         guint keyval;
 
         Glib::ustring clipboardStore;
+        sigc::connection pasteConnection;
 
         Glib::ustring appDisplayName;
         Glib::RefPtr<Gdk::Pixbuf> appIcon;
@@ -13,6 +13,12 @@ using namespace hnrt;
 static const char UTF8_STRING[] = "UTF8_STRING";
 
 
+//
+// Number of bytes put into the input at a time while pasting
+//
+static const size_t PASTE_CHUNK_SIZE = 65536;
+
+
 void MainWindow::onCopy()
 {
     Glib::RefPtr<Gtk::Clipboard> clipboard = Gtk::Clipboard::get();
@@ -69,11 +75,27 @@ void MainWindow::onClipboardReceived(const Gtk::SelectionData& selectionData)
     if (target == UTF8_STRING)
     {
         Glib::ustring clipboardData = selectionData.get_data_as_string();
-        input.putString(clipboardData.c_str());
+        pasteConnection.disconnect();
+        input.beginPutString(clipboardData.c_str());
+        if (input.continuePutString(PASTE_CHUNK_SIZE))
+        {
+            // a large text is taken in chunks so as to keep the window responsive
+            pasteConnection = Glib::signal_idle().connect(sigc::mem_fun(*this, &MainWindow::onPasteIdle));
+        }
     }
 }
 
 
+//
+// Puts the next chunk of the text being pasted.
+// Any input in the meantime stops the paste.
+//
+bool MainWindow::onPasteIdle()
+{
+    return input.continuePutString(PASTE_CHUNK_SIZE);
+}
+
+
 void MainWindow::onClipboardReceivedTargets(const Glib::StringArrayHandle& targetsArray)
 {
     std::list<std::string> targets = targetsArray;
@@ -0,0 +1,1094 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#include <float.h>
+#include <locale.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "Number.h"
+#include "Arithmetic.h"
+#include "Exception.h"
+#include "Expression.h"
+
+
+using namespace hnrt;
+
+
+size_t Number::precision = 0;
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Conversion
+//
+//////////////////////////////////////////////////////////////////////
+
+
+long double Number::toRealNumber() const
+{
+    switch (type)
+    {
+    case NT_INTEGER:
+        return (long double)value.integer;
+    case NT_INTEGER128:
+        return (long double)value.integer128;
+    case NT_BIGINTEGER:
+        return value.bigInteger->toRealNumber();
+    case NT_BIGREAL:
+        return value.bigReal->toRealNumber();
+    case NT_FLOAT128:
+        return (long double)value.float128;
+    default:
+        return value.realNumber;
+    }
+}
+
+
+Number Number::bigInteger(BigInteger* v)
+{
+    if (!v)
+    {
+        throw OverflowException();
+    }
+    else if (BigInteger::getBitLength(*v) > MAX_INTEGER_BITS)
+    {
+        v->release();
+        throw OverflowException();
+    }
+    __int128 value;
+    if (v->toInteger128(value))
+    {
+        v->release();
+        return integer128(value);
+    }
+    Number x;
+    x.type = NT_BIGINTEGER;
+    x.value.bigInteger = v;
+    return x;
+}
+
+
+Number Number::bigReal(BigReal* v)
+{
+    if (isFloat128())
+    {
+        __float128 value = v->toFloat128();
+        bool zero = v->isZero();
+        v->release();
+        if (value == 0 && !zero)
+        {
+            throw UnderflowException();
+        }
+        Arithmetic::validate(value);
+        return float128(value);
+    }
+    Number x;
+    x.type = NT_BIGREAL;
+    x.value.bigReal = v;
+    return x;
+}
+
+
+Number Number::float128(__float128 v)
+{
+    Number x;
+    x.type = NT_FLOAT128;
+    x.value.float128 = v;
+    return x;
+}
+
+
+//
+// The digits take log2(10) < 3.322 bits each, and the bits more keep the rounding errors
+// of the operations out of them, up to the largest precision of BigReal.
+// The ones __float128 has enough bits for are done in it, which is much quicker than BigReal.
+//
+size_t Number::getPrecisionForDigits(int digits)
+{
+    if (digits <= LDBL_DIG)
+    {
+        return 0;
+    }
+    size_t bits = ((size_t)digits * 3322 + 999) / 1000 + 16;
+    if (bits <= FLOAT128_BITS)
+    {
+        return FLOAT128_BITS;
+    }
+    return bits < BigReal::MAX_PRECISION ? bits : BigReal::MAX_PRECISION;
+}
+
+
+//
+// Returns the working precision, or the one of long double if it is not set,
+// for NT_BIGREAL values left from before it was reset.
+//
+static size_t getBits()
+{
+    return Number::getPrecision() ? Number::getPrecision() : LDBL_MANT_DIG;
+}
+
+
+//
+// Operand of BigInteger taken from an integer of any type
+//
+class IntegerOperand : public BigInteger::Operand
+{
+public:
+
+    IntegerOperand(const Number& x)
+    {
+        if (x.getType() == NT_BIGINTEGER)
+        {
+            set(x.getBigInteger());
+        }
+        else
+        {
+            set(x.getInteger128());
+        }
+    }
+};
+
+
+//
+// BigReal taken from a number of any type in the working precision
+//
+class RealOperand
+{
+public:
+
+    RealOperand(const Number& x)
+    {
+        switch (x.getType())
+        {
+        case NT_REALNUMBER:
+            value = BigReal::realNumber(x.getRealNumber());
+            break;
+        case NT_BIGREAL:
+            value = const_cast<BigReal*>(&x.getBigReal());
+            value->addRef();
+            break;
+        case NT_FLOAT128:
+            value = BigReal::float128(x.getFloat128());
+            break;
+        default:
+            value = BigReal::integer(IntegerOperand(x), getBits());
+            break;
+        }
+    }
+    ~RealOperand() { value->release(); }
+    operator const BigReal&() const { return *value; }
+
+private:
+
+    RealOperand(const RealOperand&) {}
+    void operator =(const RealOperand&) {}
+
+    BigReal* value;
+};
+
+
+__float128 Number::toFloat128() const
+{
+    switch (type)
+    {
+    case NT_INTEGER:
+        return (__float128)value.integer;
+    case NT_INTEGER128:
+        return (__float128)value.integer128;
+    case NT_BIGINTEGER:
+    {
+        // It is rounded once from the integer itself instead of from long double.
+        BigReal* x = BigReal::integer(IntegerOperand(*this), FLOAT128_BITS);
+        __float128 v = x->toFloat128();
+        x->release();
+        return v;
+    }
+    case NT_BIGREAL:
+        return value.bigReal->toFloat128();
+    case NT_FLOAT128:
+        return value.float128;
+    default:
+        return value.realNumber;
+    }
+}
+
+
+//
+// Appends the given decimal digits of an integer with the thousands' separators of
+// the current locale if grouping is true, in the same way as printf does for long.
+//
+static void appendDigits(std::vector<char>& buffer, bool negative, const char* d, size_t n, bool grouping)
+{
+    if (negative)
+    {
+        buffer.push_back('-');
+    }
+    const struct lconv* lc = grouping ? localeconv() : NULL;
+    const char* sep = lc ? lc->thousands_sep : "";
+    const char* group = lc ? lc->grouping : "";
+    if (!*sep || !*group)
+    {
+        buffer.insert(buffer.end(), d, d + n);
+        return;
+    }
+    // The sizes of the groups from the right; the last one is repeated.
+    std::vector<size_t> ends;
+    size_t end = n;
+    size_t size = (unsigned char)*group;
+    while (size && size != CHAR_MAX && end > size)
+    {
+        end -= size;
+        ends.push_back(end);
+        if (group[1])
+        {
+            size = (unsigned char)*++group;
+        }
+    }
+    size_t sepLength = strlen(sep);
+    size_t start = 0;
+    while (!ends.empty())
+    {
+        end = ends.back();
+        ends.pop_back();
+        buffer.insert(buffer.end(), d + start, d + end);
+        buffer.insert(buffer.end(), sep, sep + sepLength);
+        start = end;
+    }
+    buffer.insert(buffer.end(), d + start, d + n);
+}
+
+
+//
+// Appends the real number in the same way as printf does with %Lg of the given precision,
+// which is 6 if it is 0.
+//
+static void appendRealNumber(std::vector<char>& buffer, const BigReal& x, int precision, bool grouping)
+{
+    size_t n = precision ? precision : 6;
+    std::vector<char> d;
+    long exponent = x.formatDecimal(d, n);
+    // The trailing zeros are removed.
+    while (n > 1 && d[n - 1] == '0')
+    {
+        n--;
+    }
+    const char* point = localeconv()->decimal_point;
+    size_t pointLength = strlen(point);
+    if (exponent < -4 || exponent >= (precision ? precision : 6))
+    {
+        appendDigits(buffer, x.isNegative(), &d[0], 1, false);
+        if (n > 1)
+        {
+            buffer.insert(buffer.end(), point, point + pointLength);
+            buffer.insert(buffer.end(), d.begin() + 1, d.begin() + n);
+        }
+        char tmp[32];
+        sprintf(tmp, "e%+03ld", exponent);
+        buffer.insert(buffer.end(), tmp, tmp + strlen(tmp));
+    }
+    else if (exponent >= 0)
+    {
+        appendDigits(buffer, x.isNegative(), &d[0], exponent + 1, grouping);
+        if (n > (size_t)exponent + 1)
+        {
+            buffer.insert(buffer.end(), point, point + pointLength);
+            buffer.insert(buffer.end(), d.begin() + exponent + 1, d.begin() + n);
+        }
+    }
+    else
+    {
+        appendDigits(buffer, x.isNegative(), "0", 1, false);
+        buffer.insert(buffer.end(), point, point + pointLength);
+        buffer.insert(buffer.end(), -exponent - 1, '0');
+        buffer.insert(buffer.end(), d.begin(), d.begin() + n);
+    }
+}
+
+
+void Number::format(std::vector<char> &buffer, int flags) const
+{
+    char tmp[256];
+    if (type == NT_BIGREAL)
+    {
+        appendRealNumber(buffer, *value.bigReal, flags >> EF_PRECISION_SHIFT, (flags & EF_GROUPING) ? true : false);
+        return;
+    }
+    else if (type == NT_BIGINTEGER)
+    {
+        if ((flags & EF_HEXADECIMAL))
+        {
+            value.bigInteger->formatHexadecimal(buffer);
+        }
+        else
+        {
+            std::vector<char> digits;
+            value.bigInteger->formatDecimal(digits);
+            appendDigits(buffer, value.bigInteger->isNegative(), &digits[0], digits.size(), (flags & EF_GROUPING) ? true : false);
+        }
+        return;
+    }
+    else if (type == NT_INTEGER128)
+    {
+        __int128 value = this->value.integer128;
+        if ((flags & EF_HEXADECIMAL))
+        {
+            // two's complement in 128 bits, which is 64 bits wider than the one of long
+            sprintf(tmp, "0x%016lx%016lx", (unsigned long)((unsigned __int128)value >> 64), (unsigned long)value);
+        }
+        else
+        {
+            unsigned __int128 magnitude = value < 0 ? -(unsigned __int128)value : (unsigned __int128)value;
+            char* d = tmp + sizeof(tmp);
+            do
+            {
+                *--d = (char)('0' + (int)(magnitude % 10));
+                magnitude /= 10;
+            }
+            while (magnitude);
+            appendDigits(buffer, value < 0, d, tmp + sizeof(tmp) - d, (flags & EF_GROUPING) ? true : false);
+            return;
+        }
+    }
+    else if (type == NT_INTEGER)
+    {
+        long value = this->value.integer;
+        if ((flags & EF_HEXADECIMAL))
+        {
+            if (!(value & ~0xffffL))
+            {
+                sprintf(tmp, "0x%04lx", value);
+            }
+            else if (!(value & ~0xffffffffL))
+            {
+                sprintf(tmp, "0x%08lx", value);
+            }
+            else
+            {
+                sprintf(tmp, "0x%016lx", value);
+            }
+        }
+        else if ((flags & EF_GROUPING))
+        {
+            sprintf(tmp, "%'ld", value);
+        }
+        else
+        {
+            sprintf(tmp, "%ld", value);
+        }
+    }
+    else if (type == NT_FLOAT128)
+    {
+        __float128 value = this->value.float128;
+        int precision = flags >> EF_PRECISION_SHIFT;
+        if (precision)
+        {
+            // No more digits than these are needed to tell the values of __float128 apart.
+            precision = std::min(precision, 36);
+            if ((flags & EF_GROUPING))
+            {
+                quadmath_snprintf(tmp, sizeof(tmp), "%'.*Qg", precision, value);
+            }
+            else
+            {
+                quadmath_snprintf(tmp, sizeof(tmp), "%.*Qg", precision, value);
+            }
+        }
+        else if ((flags & EF_GROUPING))
+        {
+            quadmath_snprintf(tmp, sizeof(tmp), "%'Qg", value);
+        }
+        else
+        {
+            quadmath_snprintf(tmp, sizeof(tmp), "%Qg", value);
+        }
+    }
+    else
+    {
+        long double value = this->value.realNumber;
+        int precision = flags >> EF_PRECISION_SHIFT;
+        if (precision)
+        {
+            // No more digits than these are needed to tell the values of long double apart.
+            precision = std::min(precision, 21);
+            if ((flags & EF_GROUPING))
+            {
+                sprintf(tmp, "%'.*Lg", precision, value);
+            }
+            else
+            {
+                sprintf(tmp, "%.*Lg", precision, value);
+            }
+        }
+        else if ((flags & EF_GROUPING))
+        {
+            sprintf(tmp, "%'Lg", value);
+        }
+        else
+        {
+            sprintf(tmp, "%Lg", value);
+        }
+    }
+    size_t n1 = buffer.size();
+    size_t n2 = strlen(tmp);
+    buffer.resize(n1 + n2);
+    memcpy(&buffer[n1], tmp, n2);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Binary operations
+//
+// The function suffixed with II handles a pair of integers of long,
+// the one suffixed with WW handles the other pairs of integers in 128 bits,
+// the one suffixed with BB handles the pairs of integers either of which is NT_BIGINTEGER,
+// the one suffixed with XX handles the pairs either of which is NT_BIGREAL,
+// the one suffixed with FF handles the other pairs either of which is NT_FLOAT128, and
+// the one suffixed with RR handles the other pairs as real numbers, or in FF or XX while
+// the working precision is set.
+// The operations on long that overflow are done again in 128 bits,
+// and the ones in 128 bits that overflow are done in BigInteger.
+//
+//////////////////////////////////////////////////////////////////////
+
+
+static Number addXX(const Number& x, const Number& y)
+{
+    return Number::bigReal(BigReal::add(RealOperand(x), RealOperand(y), getBits()));
+}
+
+
+static Number addFF(const Number& x, const Number& y)
+{
+    __float128 value = x.toFloat128() + y.toFloat128();
+    Arithmetic::validate(value);
+    return Number::float128(value);
+}
+
+
+static Number addRR(const Number& x, const Number& y)
+{
+    if (Number::getPrecision())
+    {
+        return Number::isFloat128() ? addFF(x, y) : addXX(x, y);
+    }
+    long double value = x.toRealNumber() + y.toRealNumber();
+    Arithmetic::validate(value);
+    return Number(value);
+}
+
+
+static Number addII(const Number& x, const Number& y)
+{
+    long value;
+    if (__builtin_add_overflow(x.getInteger(), y.getInteger(), &value))
+    {
+        return Number::integer128((__int128)x.getInteger() + y.getInteger());
+    }
+    return Number(value);
+}
+
+
+static Number addBB(const Number& x, const Number& y)
+{
+    return Number::bigInteger(BigInteger::add(IntegerOperand(x), IntegerOperand(y)));
+}
+
+
+static Number addWW(const Number& x, const Number& y)
+{
+    __int128 value;
+    if (!Arithmetic::add(x.getInteger128(), y.getInteger128(), value))
+    {
+        return addBB(x, y);
+    }
+    return Number::integer128(value);
+}
+
+
+static Number subtractXX(const Number& x, const Number& y)
+{
+    return Number::bigReal(BigReal::subtract(RealOperand(x), RealOperand(y), getBits()));
+}
+
+
+static Number subtractFF(const Number& x, const Number& y)
+{
+    __float128 value = x.toFloat128() - y.toFloat128();
+    Arithmetic::validate(value);
+    return Number::float128(value);
+}
+
+
+static Number subtractRR(const Number& x, const Number& y)
+{
+    if (Number::getPrecision())
+    {
+        return Number::isFloat128() ? subtractFF(x, y) : subtractXX(x, y);
+    }
+    long double value = x.toRealNumber() - y.toRealNumber();
+    Arithmetic::validate(value);
+    return Number(value);
+}
+
+
+static Number subtractII(const Number& x, const Number& y)
+{
+    long value;
+    if (__builtin_sub_overflow(x.getInteger(), y.getInteger(), &value))
+    {
+        return Number::integer128((__int128)x.getInteger() - y.getInteger());
+    }
+    return Number(value);
+}
+
+
+static Number subtractBB(const Number& x, const Number& y)
+{
+    return Number::bigInteger(BigInteger::subtract(IntegerOperand(x), IntegerOperand(y)));
+}
+
+
+static Number subtractWW(const Number& x, const Number& y)
+{
+    __int128 value;
+    if (!Arithmetic::subtract(x.getInteger128(), y.getInteger128(), value))
+    {
+        return subtractBB(x, y);
+    }
+    return Number::integer128(value);
+}
+
+
+static Number multiplyXX(const Number& x, const Number& y)
+{
+    return Number::bigReal(BigReal::multiply(RealOperand(x), RealOperand(y), getBits()));
+}
+
+
+static Number multiplyFF(const Number& x, const Number& y)
+{
+    __float128 value = x.toFloat128() * y.toFloat128();
+    Arithmetic::validate(value);
+    return Number::float128(value);
+}
+
+
+static Number multiplyRR(const Number& x, const Number& y)
+{
+    if (Number::getPrecision())
+    {
+        return Number::isFloat128() ? multiplyFF(x, y) : multiplyXX(x, y);
+    }
+    long double value = x.toRealNumber() * y.toRealNumber();
+    Arithmetic::validate(value);
+    return Number(value);
+}
+
+
+static Number multiplyII(const Number& x, const Number& y)
+{
+    long value;
+    if (__builtin_mul_overflow(x.getInteger(), y.getInteger(), &value))
+    {
+        // The product of two longs always fits in 128 bits.
+        return Number::integer128((__int128)x.getInteger() * y.getInteger());
+    }
+    return Number(value);
+}
+
+
+static Number multiplyBB(const Number& x, const Number& y)
+{
+    return Number::bigInteger(BigInteger::multiply(IntegerOperand(x), IntegerOperand(y)));
+}
+
+
+static Number multiplyWW(const Number& x, const Number& y)
+{
+    __int128 value;
+    if (!Arithmetic::multiply(x.getInteger128(), y.getInteger128(), value))
+    {
+        return multiplyBB(x, y);
+    }
+    return Number::integer128(value);
+}
+
+
+static Number divideXX(const Number& x, const Number& y)
+{
+    return Number::bigReal(BigReal::divide(RealOperand(x), RealOperand(y), getBits()));
+}
+
+
+static Number divideFF(const Number& x, const Number& y)
+{
+    __float128 value2 = y.toFloat128();
+    if (value2 == 0)
+    {
+        throw DivideByZeroException();
+    }
+    __float128 value = x.toFloat128() / value2;
+    Arithmetic::validate(value);
+    return Number::float128(value);
+}
+
+
+static Number divideRR(const Number& x, const Number& y)
+{
+    if (Number::getPrecision())
+    {
+        return Number::isFloat128() ? divideFF(x, y) : divideXX(x, y);
+    }
+    long double value2 = y.toRealNumber();
+    if (value2 == 0)
+    {
+        // Unless zero-check is done here, we will get FP_INFINITE.
+        throw DivideByZeroException();
+    }
+    long double value = x.toRealNumber() / value2;
+    Arithmetic::validate(value);
+    return Number(value);
+}
+
+
+static Number divideII(const Number& x, const Number& y)
+{
+    long value1 = x.getInteger();
+    long value2 = y.getInteger();
+    if (value2 == 0)
+    {
+        throw DivideByZeroException();
+    }
+    else if (value2 == -1)
+    {
+        // LONG_MIN / -1 traps on the processor.
+        return Number::integer128(-(__int128)value1);
+    }
+    else if (value1 % value2)
+    {
+        return divideRR(x, y);
+    }
+    return Number(value1 / value2);
+}
+
+
+//
+// The quotient that is not an integer is computed from the mantissas and the exponents,
+// as the operands themselves could be out of the range of real numbers.
+//
+static Number divideBB(const Number& x, const Number& y)
+{
+    IntegerOperand operand1(x);
+    IntegerOperand operand2(y);
+    BigInteger* quotient = NULL;
+    if (!BigInteger::divide(operand1, operand2, quotient))
+    {
+        if (Number::getPrecision())
+        {
+            return divideXX(x, y);
+        }
+        long exponent1;
+        long exponent2;
+        long double mantissa1 = BigInteger::toRealNumber(operand1, exponent1);
+        long double mantissa2 = BigInteger::toRealNumber(operand2, exponent2);
+        long double value = ldexpl(mantissa1 / mantissa2, (int)(exponent1 - exponent2));
+        Arithmetic::validate(value);
+        return Number(value);
+    }
+    return Number::bigInteger(quotient);
+}
+
+
+static Number divideWW(const Number& x, const Number& y)
+{
+    __int128 quotient = 0;
+    if (!Arithmetic::divide(x.getInteger128(), y.getInteger128(), quotient))
+    {
+        // The minimum divided by -1 is the only quotient out of 128 bits.
+        return y.getInteger128() == -1 ? divideBB(x, y) : divideRR(x, y);
+    }
+    return Number::integer128(quotient);
+}
+
+
+static Number powerXX(const Number& x, const Number& y)
+{
+    return Number::bigReal(BigReal::power(RealOperand(x), RealOperand(y), getBits()));
+}
+
+
+static Number powerFF(const Number& x, const Number& y)
+{
+    __float128 value = powq(x.toFloat128(), y.toFloat128());
+    Arithmetic::validate(value);
+    return Number::float128(value);
+}
+
+
+static Number powerRR(const Number& x, const Number& y)
+{
+    if (Number::getPrecision())
+    {
+        return Number::isFloat128() ? powerFF(x, y) : powerXX(x, y);
+    }
+    long double value = powl(x.toRealNumber(), y.toRealNumber());
+    Arithmetic::validate(value);
+    return Number(value);
+}
+
+
+static bool isNegative(const Number& x)
+{
+    switch (x.getType())
+    {
+    case NT_INTEGER:
+        return x.getInteger() < 0;
+    case NT_INTEGER128:
+        return x.getInteger128() < 0;
+    case NT_BIGINTEGER:
+        return x.getBigInteger().isNegative();
+    case NT_BIGREAL:
+        return x.getBigReal().isNegative();
+    case NT_FLOAT128:
+        return x.getFloat128() < 0;
+    default:
+        return x.getRealNumber() < 0;
+    }
+}
+
+
+//
+// A negative exponent gives a real number.
+// As the base other than 0, 1 and -1 has two bits at least, the exponent out of 128 bits
+// or more than MAX_INTEGER_BITS gives the power too large for Number, which overflows.
+//
+static Number powerBB(const Number& x, const Number& y)
+{
+    if (isNegative(y))
+    {
+        return powerRR(x, y);
+    }
+    IntegerOperand base(x);
+    if (base.getSize() == 1 && base.getLimbs()[0] == 1)
+    {
+        // The parity of the exponent is the one of its lowest limb.
+        IntegerOperand exponent(y);
+        return Number(base.isNegative() && (exponent.getLimbs()[0] & 1) ? -1L : 1L);
+    }
+    if (y.getType() == NT_BIGINTEGER || y.getInteger128() > (__int128)Number::MAX_INTEGER_BITS)
+    {
+        return base.isZero() ? Number(0L) : powerRR(x, y);
+    }
+    unsigned long exponent = (unsigned long)y.getInteger128();
+    size_t bits = BigInteger::getBitLength(base);
+    if (exponent && bits > 1 && (bits - 1) > (Number::MAX_INTEGER_BITS - 1) / exponent)
+    {
+        // The power would be computed only to be refused.
+        throw OverflowException();
+    }
+    return Number::bigInteger(BigInteger::power(base, exponent));
+}
+
+
+//
+// Also for a pair of integers of long; a negative exponent gives a real number.
+//
+static Number powerWW(const Number& x, const Number& y)
+{
+    __int128 value;
+    if (y.getInteger128() < 0)
+    {
+        return powerRR(x, y);
+    }
+    else if (!Arithmetic::power(x.getInteger128(), y.getInteger128(), value))
+    {
+        return powerBB(x, y);
+    }
+    return Number::integer128(value);
+}
+
+
+// rows: left-hand side type, columns: right-hand side type, both in the order of NumberType
+
+
+const Number::BinaryOperation Number::addTable[NT_COUNT][NT_COUNT] =
+{
+    { addII, addRR, addWW, addBB, addXX, addFF },
+    { addRR, addRR, addRR, addRR, addXX, addFF },
+    { addWW, addRR, addWW, addBB, addXX, addFF },
+    { addBB, addRR, addBB, addBB, addXX, addFF },
+    { addXX, addXX, addXX, addXX, addXX, addXX },
+    { addFF, addFF, addFF, addFF, addXX, addFF },
+};
+
+
+const Number::BinaryOperation Number::subtractTable[NT_COUNT][NT_COUNT] =
+{
+    { subtractII, subtractRR, subtractWW, subtractBB, subtractXX, subtractFF },
+    { subtractRR, subtractRR, subtractRR, subtractRR, subtractXX, subtractFF },
+    { subtractWW, subtractRR, subtractWW, subtractBB, subtractXX, subtractFF },
+    { subtractBB, subtractRR, subtractBB, subtractBB, subtractXX, subtractFF },
+    { subtractXX, subtractXX, subtractXX, subtractXX, subtractXX, subtractXX },
+    { subtractFF, subtractFF, subtractFF, subtractFF, subtractXX, subtractFF },
+};
+
+
+const Number::BinaryOperation Number::multiplyTable[NT_COUNT][NT_COUNT] =
+{
+    { multiplyII, multiplyRR, multiplyWW, multiplyBB, multiplyXX, multiplyFF },
+    { multiplyRR, multiplyRR, multiplyRR, multiplyRR, multiplyXX, multiplyFF },
+    { multiplyWW, multiplyRR, multiplyWW, multiplyBB, multiplyXX, multiplyFF },
+    { multiplyBB, multiplyRR, multiplyBB, multiplyBB, multiplyXX, multiplyFF },
+    { multiplyXX, multiplyXX, multiplyXX, multiplyXX, multiplyXX, multiplyXX },
+    { multiplyFF, multiplyFF, multiplyFF, multiplyFF, multiplyXX, multiplyFF },
+};
+
+
+const Number::BinaryOperation Number::divideTable[NT_COUNT][NT_COUNT] =
+{
+    { divideII, divideRR, divideWW, divideBB, divideXX, divideFF },
+    { divideRR, divideRR, divideRR, divideRR, divideXX, divideFF },
+    { divideWW, divideRR, divideWW, divideBB, divideXX, divideFF },
+    { divideBB, divideRR, divideBB, divideBB, divideXX, divideFF },
+    { divideXX, divideXX, divideXX, divideXX, divideXX, divideXX },
+    { divideFF, divideFF, divideFF, divideFF, divideXX, divideFF },
+};
+
+
+const Number::BinaryOperation Number::powerTable[NT_COUNT][NT_COUNT] =
+{
+    { powerWW, powerRR, powerWW, powerBB, powerXX, powerFF },
+    { powerRR, powerRR, powerRR, powerRR, powerXX, powerFF },
+    { powerWW, powerRR, powerWW, powerBB, powerXX, powerFF },
+    { powerBB, powerRR, powerBB, powerBB, powerXX, powerFF },
+    { powerXX, powerXX, powerXX, powerXX, powerXX, powerXX },
+    { powerFF, powerFF, powerFF, powerFF, powerXX, powerFF },
+};
+
+
+Number Number::hypot(const Number& x, const Number& y)
+{
+    if ((precision && !isFloat128()) || x.type == NT_BIGREAL || y.type == NT_BIGREAL)
+    {
+        return bigReal(BigReal::hypot(RealOperand(x), RealOperand(y), getBits()));
+    }
+    else if (precision || x.type == NT_FLOAT128 || y.type == NT_FLOAT128)
+    {
+        __float128 value = hypotq(x.toFloat128(), y.toFloat128());
+        Arithmetic::validate(value);
+        return float128(value);
+    }
+    long double value = hypotl(x.toRealNumber(), y.toRealNumber());
+    Arithmetic::validate(value);
+    return Number(value);
+}
+
+
+Number Number::powerModulo(const Number& x, const Number& y, const Number& z)
+{
+    if (x.type != NT_REALNUMBER && y.type != NT_REALNUMBER && z.type != NT_REALNUMBER &&
+        x.type != NT_BIGREAL && y.type != NT_BIGREAL && z.type != NT_BIGREAL &&
+        x.type != NT_FLOAT128 && y.type != NT_FLOAT128 && z.type != NT_FLOAT128 && !isNegative(y))
+    {
+        if (x.type == NT_BIGINTEGER || y.type == NT_BIGINTEGER || z.type == NT_BIGINTEGER)
+        {
+            return bigInteger(BigInteger::powerModulo(IntegerOperand(x), IntegerOperand(y), IntegerOperand(z)));
+        }
+        return integer128(Arithmetic::powerModulo(x.getInteger128(), y.getInteger128(), z.getInteger128()));
+    }
+    long double modulus = fabsl(z.toRealNumber());
+    if (modulus == 0)
+    {
+        throw DivideByZeroException();
+    }
+    // The remainder is made not negative as the one of integers is.
+    long double value = fmodl(powl(x.toRealNumber(), y.toRealNumber()), modulus);
+    if (value < 0)
+    {
+        value += modulus;
+    }
+    Arithmetic::validate(value);
+    if (precision)
+    {
+        // It is computed in long double anyway as it is hardly of any use with non-integers.
+        return bigReal(BigReal::realNumber(value));
+    }
+    return Number(value);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Unary operations
+//
+//////////////////////////////////////////////////////////////////////
+
+
+Number Number::negate(const Number& x)
+{
+    switch (x.type)
+    {
+    case NT_INTEGER:
+        // -LONG_MIN is out of the range of long.
+        return integer128(-(__int128)x.value.integer);
+    case NT_INTEGER128:
+    {
+        __int128 value;
+        if (!Arithmetic::subtract(0, x.value.integer128, value))
+        {
+            // -INT128_MIN is out of 128 bits.
+            return bigInteger(BigInteger::negate(IntegerOperand(x)));
+        }
+        return integer128(value);
+    }
+    case NT_BIGINTEGER:
+        return bigInteger(BigInteger::negate(IntegerOperand(x)));
+    case NT_BIGREAL:
+        return bigReal(BigReal::negate(*x.value.bigReal));
+    case NT_FLOAT128:
+        return float128(-x.value.float128);
+    default:
+    {
+        long double value = -x.value.realNumber;
+        Arithmetic::validate(value);
+        return Number(value);
+    }
+    }
+}
+
+
+Number Number::abs(const Number& x)
+{
+    switch (x.type)
+    {
+    case NT_INTEGER:
+    case NT_INTEGER128:
+    case NT_BIGINTEGER:
+        return isNegative(x) ? negate(x) : x;
+    case NT_BIGREAL:
+        return bigReal(BigReal::abs(*x.value.bigReal));
+    case NT_FLOAT128:
+        return float128(fabsq(x.value.float128));
+    default:
+    {
+        long double value = fabsl(x.value.realNumber);
+        Arithmetic::validate(value);
+        return Number(value);
+    }
+    }
+}
+
+
+Number Number::apply(RealFunction function, Float128Function float128Function, BigRealFunction bigRealFunction, const Number& x)
+{
+    if ((precision && !isFloat128()) || x.type == NT_BIGREAL)
+    {
+        return bigReal((*bigRealFunction)(RealOperand(x), getBits()));
+    }
+    else if (precision || x.type == NT_FLOAT128)
+    {
+        __float128 value = (*float128Function)(x.toFloat128());
+        Arithmetic::validate(value);
+        return float128(value);
+    }
+    long double value = (*function)(x.toRealNumber());
+    Arithmetic::validate(value);
+    return Number(value);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Pairwise summation
+//
+//////////////////////////////////////////////////////////////////////
+
+
+void PairwiseSum::start(const Number& sum_)
+{
+    if (isPairwise(sum_))
+    {
+        start(sum_.getRealNumber());
+    }
+    else
+    {
+        partial.clear();
+        sum = sum_;
+        count = 0;
+    }
+}
+
+
+void PairwiseSum::start(long double sum_)
+{
+    partial.clear();
+    block = sum_;
+    count = 1;
+}
+
+
+void PairwiseSum::add(const Number& term, bool negative)
+{
+    if (!count)
+    {
+        sum = negative ? Number::subtract(sum, term) : Number::add(sum, term);
+        start(sum);
+        return;
+    }
+    if (term.getType() == NT_BIGREAL || term.getType() == NT_FLOAT128)
+    {
+        // The terms of the working precision are added in the usual way.
+        sum = getSum();
+        count = 0;
+        add(term, negative);
+        return;
+    }
+    add(negative ? -term.toRealNumber() : term.toRealNumber());
+}
+
+
+void PairwiseSum::add(long double term)
+{
+    unsigned long index = count % BLOCK_SIZE;
+    block = index ? block + term : term;
+    Arithmetic::validate(block);
+    if (index == BLOCK_SIZE - 1)
+    {
+        // Like a binary counter, the carries merge the levels of the same size.
+        long double value = block;
+        for (unsigned long k = count / BLOCK_SIZE; k & 1; k >>= 1)
+        {
+            value = partial.back() + value;
+            Arithmetic::validate(value);
+            partial.pop_back();
+        }
+        partial.push_back(value);
+    }
+    count++;
+}
+
+
+Number PairwiseSum::getSum() const
+{
+    if (!count)
+    {
+        return sum;
+    }
+    return Number(getRealSum());
+}
+
+
+long double PairwiseSum::getRealSum() const
+{
+    size_t i = partial.size();
+    long double value = count % BLOCK_SIZE ? block : partial[--i];
+    while (i > 0)
+    {
+        value = partial[--i] + value;
+        Arithmetic::validate(value);
+    }
+    return value;
+}
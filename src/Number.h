@@ -0,0 +1,299 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#ifndef IKURA_NUMBER_H
+#define IKURA_NUMBER_H
+
+
+#include <limits.h>
+#include <math.h>
+#include <quadmath.h>
+#include <vector>
+#include "BigInteger.h"
+#include "BigReal.h"
+
+
+namespace hnrt
+{
+    enum NumberType
+    {
+        NT_INTEGER,
+        NT_REALNUMBER,
+        NT_INTEGER128, // integer out of the range of long, which fits in 128 bits
+        NT_BIGINTEGER, // integer out of the range of 128 bits
+        NT_BIGREAL, // real number of the working precision
+        NT_FLOAT128, // real number of the working precision of __float128
+        NT_COUNT,
+    };
+
+
+    //
+    // Resulting value of evaluating arithmetic expression
+    //
+    // This is a small value type that is returned and passed by value,
+    // so that evaluation needs no heap allocation for intermediate values.
+    // Binary operations are dispatched through the static table
+    // indexed by the types of the left-hand side and the right-hand side.
+    //
+    // An integer operation whose result overflows long is done again in 128 bits, and
+    // the result is kept exactly as NT_INTEGER128; the one overflowing 128 bits as well
+    // is done again in BigInteger, which is shared by the copies of NT_BIGINTEGER, and
+    // only the one having more than MAX_INTEGER_BITS bits is done as a real number.
+    // An integer is NT_INTEGER128 only if it is out of the range of long, and
+    // NT_BIGINTEGER only if it is out of the range of 128 bits.
+    //
+    // While the working precision is set by setPrecision, the real operations are done in BigReal
+    // of that precision instead of long double, whose results are NT_BIGREAL shared as NT_BIGINTEGER is.
+    // The precision of FLOAT128_BITS is the exception, in which they are done in __float128 of
+    // libquadmath instead, whose results are NT_FLOAT128 held by value as the ones of long double are.
+    //
+    class Number
+    {
+    public:
+
+        typedef Number (*BinaryOperation)(const Number&, const Number&);
+        typedef long double (*RealFunction)(long double);
+        typedef __float128 (*Float128Function)(__float128);
+        typedef BigReal* (*BigRealFunction)(const BigReal&, size_t);
+
+        //
+        // Integers of more bits overflow, so that an interactive operation on them stays quick,
+        // while BigInteger can be wider for the mantissas of BigReal.
+        //
+        static const size_t MAX_INTEGER_BITS = 1UL << 22;
+
+        static const size_t FLOAT128_BITS = FLT128_MANT_DIG;
+
+        Number() : type(NT_INTEGER) { value.integer = 0; }
+        Number(long v) : type(NT_INTEGER) { value.integer = v; }
+        Number(long double v) : type(NT_REALNUMBER) { value.realNumber = v; }
+        Number(const Number& x) : type(x.type), value(x.value) { addRef(); }
+        ~Number() { release(); }
+        Number& operator =(const Number& x);
+        NumberType getType() const { return type; }
+        long getInteger() const { return value.integer; }
+        long double getRealNumber() const { return value.realNumber; }
+        __float128 getFloat128() const { return value.float128; }
+        const BigInteger& getBigInteger() const { return *value.bigInteger; }
+        const BigReal& getBigReal() const { return *value.bigReal; }
+
+        //
+        // Returns the value of NT_INTEGER or NT_INTEGER128 in 128 bits.
+        //
+        __int128 getInteger128() const { return type == NT_INTEGER ? value.integer : value.integer128; }
+
+        //
+        // Returns the value as a real number.
+        //
+        long double toRealNumber() const;
+
+        //
+        // Returns the value as __float128.
+        //
+        __float128 toFloat128() const;
+
+        //
+        // Appends the string representation to the buffer according to ExpressionFormat flags.
+        //
+        void format(std::vector<char> &buffer, int flags) const;
+
+        //
+        // Returns the given integer, which is NT_INTEGER if it is in the range of long.
+        //
+        static Number integer128(__int128 v);
+
+        //
+        // Returns the given integer, which is taken over, in the narrowest type.
+        // If it is NULL or has more than MAX_INTEGER_BITS bits, OverflowException is thrown.
+        //
+        static Number bigInteger(BigInteger* v);
+
+        //
+        // Returns the given real number, which is taken over.
+        // While the working precision is FLOAT128_BITS, it is turned into NT_FLOAT128;
+        // if it is out of the range, OverflowException or UnderflowException is thrown.
+        //
+        static Number bigReal(BigReal* v);
+
+        static Number float128(__float128 v);
+
+        //
+        // Sets the precision in bits of the real operations done in BigReal, or in __float128
+        // if it is FLOAT128_BITS, or 0 to do them in long double.
+        // It is set before evaluating for all the threads.
+        //
+        static void setPrecision(size_t bits) { precision = bits; }
+        static size_t getPrecision() { return precision; }
+        static bool isFloat128() { return precision == FLOAT128_BITS; }
+
+        //
+        // Returns the working precision for printing real numbers in the given number of
+        // significant digits, which is 0 if long double has enough digits,
+        // and FLOAT128_BITS if __float128 has.
+        //
+        static size_t getPrecisionForDigits(int digits);
+
+        static Number add(const Number& x, const Number& y) { return addTable[x.type][y.type](x, y); }
+        static Number subtract(const Number& x, const Number& y) { return subtractTable[x.type][y.type](x, y); }
+        static Number multiply(const Number& x, const Number& y) { return multiplyTable[x.type][y.type](x, y); }
+        static Number divide(const Number& x, const Number& y) { return divideTable[x.type][y.type](x, y); }
+        static Number power(const Number& x, const Number& y) { return powerTable[x.type][y.type](x, y); }
+        static Number hypot(const Number& x, const Number& y);
+
+        //
+        // Raises x to the power of y modulo z; see Arithmetic::powerModulo.
+        // Unless all of them are integers and y is not negative, it is computed as real numbers.
+        //
+        static Number powerModulo(const Number& x, const Number& y, const Number& z);
+
+        static Number negate(const Number& x);
+        static Number abs(const Number& x);
+        static Number sqrt(const Number& x) { return apply(sqrtl, sqrtq, BigReal::squareRoot, x); }
+        static Number cbrt(const Number& x) { return apply(cbrtl, cbrtq, BigReal::cubeRoot, x); }
+        static Number exp(const Number& x) { return apply(expl, expq, BigReal::exp, x); }
+        static Number log(const Number& x) { return apply(logl, logq, BigReal::log, x); }
+        static Number log2(const Number& x) { return apply(log2l, log2q, BigReal::log2, x); }
+        static Number log10(const Number& x) { return apply(log10l, log10q, BigReal::log10, x); }
+        static Number sin(const Number& x) { return apply(sinl, sinq, BigReal::sin, x); }
+        static Number cos(const Number& x) { return apply(cosl, cosq, BigReal::cos, x); }
+        static Number tan(const Number& x) { return apply(tanl, tanq, BigReal::tan, x); }
+
+    private:
+
+        //
+        // Applies the real function to the value and validates the result,
+        // or the one of __float128 or BigReal while the working precision is set.
+        //
+        static Number apply(RealFunction function, Float128Function float128Function, BigRealFunction bigRealFunction, const Number& x);
+
+        void addRef() const;
+        void release() const;
+
+        static const BinaryOperation addTable[NT_COUNT][NT_COUNT];
+        static const BinaryOperation subtractTable[NT_COUNT][NT_COUNT];
+        static const BinaryOperation multiplyTable[NT_COUNT][NT_COUNT];
+        static const BinaryOperation divideTable[NT_COUNT][NT_COUNT];
+        static const BinaryOperation powerTable[NT_COUNT][NT_COUNT];
+        static size_t precision;
+
+        NumberType type;
+        union
+        {
+            long integer;
+            long double realNumber;
+            __float128 float128;
+            __int128 integer128;
+            BigInteger* bigInteger;
+            BigReal* bigReal;
+        } value;
+    };
+
+
+    inline void Number::addRef() const
+    {
+        if (type == NT_BIGINTEGER)
+        {
+            value.bigInteger->addRef();
+        }
+        else if (type == NT_BIGREAL)
+        {
+            value.bigReal->addRef();
+        }
+    }
+
+
+    inline void Number::release() const
+    {
+        if (type == NT_BIGINTEGER)
+        {
+            value.bigInteger->release();
+        }
+        else if (type == NT_BIGREAL)
+        {
+            value.bigReal->release();
+        }
+    }
+
+
+    inline Number& Number::operator =(const Number& x)
+    {
+        x.addRef();
+        release();
+        type = x.type;
+        value = x.value;
+        return *this;
+    }
+
+
+    inline Number Number::integer128(__int128 v)
+    {
+        Number x;
+        if (v == (long)v)
+        {
+            x.value.integer = (long)v;
+        }
+        else
+        {
+            x.type = NT_INTEGER128;
+            x.value.integer128 = v;
+        }
+        return x;
+    }
+
+
+    //
+    // Sum of the operands of an ET_SUM chain, which every evaluator of the chain uses
+    // so that they all give the same value
+    //
+    // The sum of the first two operands is given to start. While the sum is not a real number,
+    // the terms are added in the usual way. Once it is, it is taken as the first term, and
+    // the rest are summed up pairwise, whose rounding error grows with log n instead of n:
+    // in blocks of BLOCK_SIZE in the usual way, and then the sums of the blocks pairwise,
+    // which keeps most of the additions free of branches.
+    // Each addition throws in the same way as Number::add, so that the sum of a chain of up to
+    // BLOCK_SIZE + 1 operands is exactly the usual one.
+    //
+    class PairwiseSum
+    {
+    public:
+
+        PairwiseSum() : count(0) {}
+
+        //
+        // Starts the sum with the given one of the first two operands.
+        //
+        void start(const Number& sum);
+
+        //
+        // Adds the term, which is subtracted if negative is true.
+        //
+        void add(const Number& term, bool negative);
+
+        Number getSum() const;
+
+        //
+        // Starts, adds to and returns the sum summed up pairwise, given its value
+        // as a real number; see isPairwise.
+        //
+        void start(long double sum);
+        void add(long double term);
+        long double getRealSum() const;
+
+        //
+        // Returns true if the terms added to the given sum are summed up pairwise.
+        //
+        static bool isPairwise(const Number& sum) { return sum.getType() == NT_REALNUMBER && !Number::getPrecision(); }
+
+        static const unsigned long BLOCK_SIZE = 16;
+
+    private:
+
+        Number sum; // while the terms are not summed up pairwise
+        long double block; // sum of the terms of the current block
+        std::vector<long double> partial; // sum of 2^k blocks at each level, which gets smaller upward
+        unsigned long count; // of the terms summed up pairwise
+    };
+}
+
+
+#endif //!IKURA_NUMBER_H
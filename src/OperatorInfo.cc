@@ -28,6 +28,7 @@ OperatorInfo::OperatorInfo()
     insert(OperatorMapEntry("{log2}", SYM_LOG2));
     insert(OperatorMapEntry("{log10}", SYM_LOG10));
     insert(OperatorMapEntry("{pow}", SYM_POW));
+    insert(OperatorMapEntry("{powmod}", SYM_POWMOD));
     insert(OperatorMapEntry("{sin}", SYM_SIN));
     insert(OperatorMapEntry("{sqrt}", SYM_SQRT));
     insert(OperatorMapEntry("{tan}", SYM_TAN));
@@ -73,10 +74,13 @@ const char *OperatorInfo::find(TerminalSymbol sym) const
 
 //
 // Tries to complement the given string (not null-terminated) with the existing operators.
+// If the candidates share the shortest of them but its closing brace,
+// as {pow} and {powmod} do, it is completed to the shortest one.
 //
 void OperatorInfo::Complement(std::vector<char> &buffer) const
 {
     std::vector<const char *> match;
+    const char *shortest = NULL;
     size_t n = ~0;
     for (OperatorMap::const_iterator iter = OperatorMap::begin(); iter != OperatorMap::end(); iter++)
     {
@@ -88,6 +92,7 @@ void OperatorInfo::Complement(std::vector<char> &buffer) const
             if (n > m)
             {
                 n = m;
+                shortest = s;
             }
         }
     }
@@ -98,18 +103,18 @@ void OperatorInfo::Complement(std::vector<char> &buffer) const
     }
     else if (match.size() > 1)
     {
-        const char *s = match[0];
-        for (size_t i = buffer.size(); i < n; i++)
+        for (size_t i = buffer.size(); i + 1 < n; i++)
         {
-            for (size_t j = 1; j < match.size(); j++)
+            for (size_t j = 0; j < match.size(); j++)
             {
                 const char *t = match[j];
-                if (t[i] != s[i])
+                if (t[i] != shortest[i])
                 {
                     return;
                 }
             }
-            buffer.push_back(s[i]);
+            buffer.push_back(shortest[i]);
         }
+        buffer.push_back(shortest[n - 1]);
     }
 }
@@ -51,6 +51,8 @@ namespace hnrt
 
         //
         // Tries to complement the given string (not null-terminated) with the existing operators.
+        // If the candidates share the shortest of them but its closing brace,
+        // as {pow} and {powmod} do, it is completed to the shortest one.
         //
         void Complement(std::vector<char> &buffer) const;
 
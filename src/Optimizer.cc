@@ -0,0 +1,1068 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#include <limits.h>
+#include <math.h>
+#include "Optimizer.h"
+#include "Exception.h"
+#include "VariableStore.h"
+
+
+using namespace hnrt;
+
+
+//
+// arena ... of the tree to be optimized, where the new nodes are allocated
+//
+Optimizer::Optimizer(ExpressionArena& arena_)
+    : arena(arena_)
+    , removedCount(0)
+    , sharedCount(0)
+    , reducedCount(0)
+{
+}
+
+
+Optimizer::~Optimizer()
+{
+}
+
+
+Expression* Optimizer::run(Expression* expr)
+{
+    expr = flatten(expr);
+    if (Expression::getDepth(expr) > Expression::MAX_PASS_DEPTH)
+    {
+        // The other passes recurse as deeply as the tree.
+        return expr;
+    }
+    return share(reduce(fold(expr)));
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Flattening
+//
+//////////////////////////////////////////////////////////////////////
+
+
+//
+// Flattens the left-deep chains of three or more operands of * and / into ChainExpression.
+// The nodes are visited top-down through a list of the operands yet to be flattened,
+// and the left sides of a chain are followed by a loop, so that neither deep nesting
+// nor a long chain nests the calls here, and the latter does not in the later passes either.
+//
+Expression* Optimizer::flatten(Expression* expr)
+{
+    std::vector<Expression**> pending(1, &expr);
+    std::vector<BinaryExpression*> spine;
+    OperandList operands;
+    while (!pending.empty())
+    {
+        Expression** slot = pending.back();
+        pending.pop_back();
+        ExpressionType chainType = getChainType((*slot)->getType());
+        Expression* first = *slot;
+        spine.clear();
+        while (chainType != ET_INTEGER && getChainType(first->getType()) == chainType && ((BinaryExpression*)first)->right)
+        {
+            spine.push_back((BinaryExpression*)first);
+            first = ((BinaryExpression*)first)->left;
+        }
+        if (spine.size() >= 2)
+        {
+            ChainExpression* chain = arena.own(new(arena) ChainExpression(chainType));
+            chain->add(chainType, first);
+            for (size_t i = spine.size(); i > 0; i--)
+            {
+                BinaryExpression* binary = spine[i - 1];
+                chain->add(binary->getType(), binary->right);
+            }
+            *slot = chain;
+        }
+        size_t n = getOperands(*slot, operands);
+        pending.insert(pending.end(), operands.begin(), operands.begin() + n);
+    }
+    return expr;
+}
+
+
+//
+// Returns ET_PRODUCT for the operator that can be chained; otherwise ET_INTEGER.
+// Those of ET_SUM are built by Parser already.
+//
+ExpressionType Optimizer::getChainType(ExpressionType type)
+{
+    switch (type)
+    {
+    case ET_MULTIPLY:
+    case ET_DIVIDE:
+        return ET_PRODUCT;
+    default:
+        return ET_INTEGER;
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Constant folding
+//
+//////////////////////////////////////////////////////////////////////
+
+
+//
+// Folds the constant subexpressions of the given expression bottom-up,
+// and then the expression itself if all of its operands have become literals.
+//
+Expression* Optimizer::fold(Expression* expr)
+{
+    switch (expr->getType())
+    {
+    case ET_ADD:
+    case ET_SUBTRACT:
+    case ET_MULTIPLY:
+    case ET_DIVIDE:
+    case ET_HYPOT:
+    case ET_POW:
+        return foldBinary((BinaryExpression*)expr);
+    case ET_POWMOD:
+        return foldPowMod((PowModExpression*)expr);
+    case ET_UNARY_MINUS:
+    case ET_BLOCK:
+    case ET_INCOMPLETE_BLOCK:
+    case ET_ABS:
+    case ET_CBRT:
+    case ET_COS:
+    case ET_EXP:
+    case ET_LOG:
+    case ET_LOG2:
+    case ET_LOG10:
+    case ET_SIN:
+    case ET_SQRT:
+    case ET_TAN:
+        return foldUnary((UnaryExpression*)expr);
+    case ET_SUM:
+    case ET_PRODUCT:
+        return foldChain((ChainExpression*)expr);
+    case ET_ASSIGN:
+        // The right side is left as it is because it is formatted into the value of the variable.
+        return expr;
+    case ET_INCOMPLETE:
+    {
+        IncompleteExpression* incomplete = (IncompleteExpression*)expr;
+        if (incomplete->expr)
+        {
+            incomplete->expr = fold(incomplete->expr);
+        }
+        return expr;
+    }
+    default: // ET_INTEGER, ET_REALNUMBER, ET_VARIABLE
+        return expr;
+    }
+}
+
+
+Expression* Optimizer::foldBinary(BinaryExpression* expr)
+{
+    expr->left = fold(expr->left);
+    if (!expr->right)
+    {
+        // the value of the left side is the value of this expression.
+        return isLiteral(expr->left) ? replace(expr, 1) : expr;
+    }
+    expr->right = fold(expr->right);
+    return isLiteral(expr->left) && isLiteral(expr->right) ? replace(expr, 2) : expr;
+}
+
+
+Expression* Optimizer::foldPowMod(PowModExpression* expr)
+{
+    expr->left = fold(expr->left);
+    expr->right = fold(expr->right);
+    if (!expr->modulus)
+    {
+        // the value of the power is the value of this expression.
+        return isLiteral(expr->left) && isLiteral(expr->right) ? replace(expr, 2) : expr;
+    }
+    expr->modulus = fold(expr->modulus);
+    return isLiteral(expr->left) && isLiteral(expr->right) && isLiteral(expr->modulus) ? replace(expr, 3) : expr;
+}
+
+
+Expression* Optimizer::foldUnary(UnaryExpression* expr)
+{
+    if (!expr->expr)
+    {
+        // this throws an exception when evaluated.
+        return expr;
+    }
+    expr->expr = fold(expr->expr);
+    return isLiteral(expr->expr) ? replace(expr, 1) : expr;
+}
+
+
+//
+// Folds the operands of the given chain, and then its leading literals in the same way as
+// the left-deep tree would be folded. If all of them are folded, the resulting literal is returned.
+// The leading literals of ET_SUM of more operands than PairwiseSum adds in the usual way are folded
+// only while they are not real numbers summed up pairwise, which would change the terms that
+// PairwiseSum starts with; see isPairwiseLiteral.
+//
+Expression* Optimizer::foldChain(ChainExpression* expr)
+{
+    std::vector<Expression*>& operands = expr->operands;
+    bool constant = true;
+    for (size_t i = 0; i < operands.size(); i++)
+    {
+        operands[i] = fold(operands[i]);
+        constant = constant && isLiteral(operands[i]);
+    }
+    if (constant && expr->type == ET_SUM)
+    {
+        Expression* literal = replace(expr, operands.size());
+        if (literal != expr)
+        {
+            return literal;
+        }
+    }
+    bool pairwise = expr->type == ET_SUM && operands.size() > PairwiseSum::BLOCK_SIZE + 1;
+    size_t folded = 0;
+    while (folded + 1 < operands.size() && isLiteral(operands[0]) && isLiteral(operands[folded + 1])
+        && (!pairwise || (!isPairwiseLiteral(operands[0]) && !isPairwiseLiteral(operands[folded + 1]))))
+    {
+        BinaryExpression* head;
+        switch (expr->operators[folded + 1])
+        {
+        case ET_ADD:
+            head = new(arena) AddExpression(operands[0], operands[folded + 1]);
+            break;
+        case ET_SUBTRACT:
+            head = new(arena) SubtractExpression(operands[0], operands[folded + 1]);
+            break;
+        case ET_MULTIPLY:
+            head = new(arena) MultiplyExpression(operands[0], operands[folded + 1]);
+            break;
+        default:
+            head = new(arena) DivideExpression(operands[0], operands[folded + 1]);
+            break;
+        }
+        Expression* literal = replace(head, 2);
+        if (literal == head)
+        {
+            break;
+        }
+        operands[0] = literal;
+        folded++;
+    }
+    operands.erase(operands.begin() + 1, operands.begin() + 1 + folded);
+    expr->operators.erase(expr->operators.begin() + 1, expr->operators.begin() + 1 + folded);
+    if (operands.size() == 1)
+    {
+        return operands[0];
+    }
+    return expr;
+}
+
+
+//
+// Replaces the given expression with the literal of its value.
+// If the evaluation throws, or the value cannot be held by a literal as it is,
+// the expression is returned as is.
+//
+// count ... number of the operands, which are all literals
+//
+Expression* Optimizer::replace(Expression* expr, size_t count)
+{
+    Number value;
+    try
+    {
+        value = expr->evaluate(context);
+    }
+    catch (const Exception& ex)
+    {
+        return expr;
+    }
+    Expression* literal;
+    if (value.getType() == NT_REALNUMBER)
+    {
+        // RealNumber::evaluate would throw for them.
+        int c = fpclassify(value.getRealNumber());
+        if (c == FP_INFINITE || c == FP_SUBNORMAL || c == FP_NAN)
+        {
+            return expr;
+        }
+        literal = new(arena) RealNumber(value);
+    }
+    else if (value.getType() == NT_BIGREAL)
+    {
+        literal = arena.own(new(arena) RealNumber(value));
+    }
+    else if (value.getType() == NT_FLOAT128)
+    {
+        literal = new(arena) RealNumber(value);
+    }
+    else
+    {
+        literal = new(arena) Integer(value);
+        if (value.getType() == NT_BIGINTEGER)
+        {
+            arena.own(literal);
+        }
+    }
+    removedCount += count;
+    return literal;
+}
+
+
+bool Optimizer::isLiteral(const Expression* expr)
+{
+    switch (expr->getType())
+    {
+    case ET_INTEGER:
+    case ET_REALNUMBER:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+//
+// Returns true if the given literal is a real number that PairwiseSum sums up pairwise.
+// A sum of literals neither of which is such is an integer or not summed up pairwise either.
+//
+bool Optimizer::isPairwiseLiteral(const Expression* expr)
+{
+    return expr->getType() == ET_REALNUMBER && PairwiseSum::isPairwise(((const RealNumber*)expr)->getValue());
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Strength reduction
+//
+//////////////////////////////////////////////////////////////////////
+
+
+//
+// Rewrites the operations of the given tree into cheaper ones top-down, and returns the resulting tree.
+//
+Expression* Optimizer::reduce(Expression* expr)
+{
+    if (expr->getType() == ET_POW)
+    {
+        Expression* square = getSquare(expr);
+        if (square)
+        {
+            reducedCount++;
+            return square;
+        }
+    }
+    if (expr->getType() == ET_ADD || expr->getType() == ET_SUBTRACT || expr->getType() == ET_SUM || expr->getType() == ET_POW)
+    {
+        Expression* polynomial = reducePolynomial(expr);
+        if (polynomial)
+        {
+            return polynomial;
+        }
+    }
+    OperandList operands;
+    size_t n = getOperands(expr, operands);
+    for (size_t i = 0; i < n; i++)
+    {
+        *operands[i] = reduce(*operands[i]);
+    }
+    if (n == 2 && expr->getType() == ET_DIVIDE)
+    {
+        Expression* reciprocal = getReciprocal(*operands[1]);
+        if (reciprocal)
+        {
+            BinaryExpression* binary = (BinaryExpression*)expr;
+            reducedCount++;
+            return new(arena) MultiplyExpression(binary->left, reciprocal);
+        }
+    }
+    else if (expr->getType() == ET_PRODUCT)
+    {
+        ChainExpression* chain = (ChainExpression*)expr;
+        for (size_t i = 1; i < n; i++)
+        {
+            Expression* reciprocal = chain->operators[i] == ET_DIVIDE ? getReciprocal(chain->operands[i]) : NULL;
+            if (reciprocal)
+            {
+                chain->operands[i] = reciprocal;
+                chain->operators[i] = ET_MULTIPLY;
+                reducedCount++;
+            }
+        }
+    }
+    return expr;
+}
+
+
+//
+// Returns the literal of 1/c for the divisor c if x/c can be rewritten into x*(1/c),
+// that is, c is a real power of two with the normal reciprocal,
+// where both give exactly the same results including the floating-point exceptions.
+// Integer divisors are left as they are since the quotient of integers is an integer only if exact.
+// Otherwise NULL is returned.
+//
+Expression* Optimizer::getReciprocal(const Expression* divisor)
+{
+    if (divisor->getType() != ET_REALNUMBER)
+    {
+        return NULL;
+    }
+    if (((const RealNumber*)divisor)->getValue().getType() != NT_REALNUMBER)
+    {
+        return NULL;
+    }
+    long double value = ((const RealNumber*)divisor)->getValue().getRealNumber();
+    int exponent = 0;
+    if (fabsl(frexpl(value, &exponent)) != 0.5L)
+    {
+        return NULL;
+    }
+    long double reciprocal = 1 / value;
+    if (fpclassify(reciprocal) != FP_NORMAL)
+    {
+        return NULL;
+    }
+    return new(arena) RealNumber(Number(reciprocal));
+}
+
+
+//
+// Returns x*x for x{pow}2 of a pure variable x, which gives exactly the same results
+// including the floating-point exceptions, as powl rounds the square only once as well.
+// While the working precision is set, it is left as it is because BigReal rounds the power
+// from the wider one. Otherwise NULL is returned.
+//
+Expression* Optimizer::getSquare(Expression* expr)
+{
+    BinaryExpression* binary = (BinaryExpression*)expr;
+    if (Number::getPrecision() || !binary->right || binary->right->getType() != ET_INTEGER)
+    {
+        return NULL;
+    }
+    const Number& exponent = ((Integer*)binary->right)->getValue();
+    if (exponent.getType() != NT_INTEGER || exponent.getInteger() != 2)
+    {
+        return NULL;
+    }
+    Expression* base = binary->left;
+    while (base->getType() == ET_BLOCK)
+    {
+        base = ((UnaryExpression*)base)->expr;
+    }
+    if (base->getType() != ET_VARIABLE)
+    {
+        return NULL;
+    }
+    int slot = ((Variable*)base)->getSlot();
+    if (slot < 0 || !VariableStore::instance().isPure(slot))
+    {
+        return NULL;
+    }
+    return new(arena) MultiplyExpression(base, new(arena) Variable(slot));
+}
+
+
+//
+// Rewrites the given sum into PolynomialExpression if it is a polynomial of degree 2 or higher
+// in one pure variable, each term of which is a literal coefficient times a power of the variable.
+// The coefficients of the same degree must not appear twice, and a coefficient must be exact;
+// a product of two real literals, which would be rounded, is not accepted.
+//
+// x{pow}3 alone, and x{pow}2 that getSquare leaves, are rewritten as well, into the multiplications
+// by Horner's scheme, which give the same results as powl for these exponents but not for the higher ones.
+// x{pow}3 is not simply rewritten into x*x*x because x*x can underflow where the cube rounds to zero,
+// which PolynomialExpression leaves to the original expression.
+//
+// Returns NULL if it is not such a polynomial.
+//
+Expression* Optimizer::reducePolynomial(Expression* expr)
+{
+    Variable* variable = NULL;
+    std::vector<Number> coefficients;
+    std::vector<bool> present;
+    if (!addTerms(expr, false, variable, coefficients, present) || !variable || coefficients.size() < 3
+        || (expr->getType() == ET_POW && coefficients.size() > 4))
+    {
+        return NULL;
+    }
+    reducedCount++;
+    return arena.own(new(arena) PolynomialExpression(expr, variable, coefficients));
+}
+
+
+bool Optimizer::addTerms(Expression* expr, bool negative, Variable*& variable, std::vector<Number>& coefficients, std::vector<bool>& present)
+{
+    switch (expr->getType())
+    {
+    case ET_ADD:
+    case ET_SUBTRACT:
+    {
+        BinaryExpression* binary = (BinaryExpression*)expr;
+        return binary->right
+            && addTerms(binary->left, negative, variable, coefficients, present)
+            && addTerms(binary->right, expr->getType() == ET_SUBTRACT ? !negative : negative, variable, coefficients, present);
+    }
+    case ET_SUM:
+    {
+        ChainExpression* chain = (ChainExpression*)expr;
+        for (size_t i = 0; i < chain->operands.size(); i++)
+        {
+            if (!addTerms(chain->operands[i], i && chain->operators[i] == ET_SUBTRACT ? !negative : negative, variable, coefficients, present))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    case ET_BLOCK:
+        return addTerms(((UnaryExpression*)expr)->expr, negative, variable, coefficients, present);
+    default:
+        break;
+    }
+    Number coefficient;
+    size_t degree = 0;
+    if (!getTerm(expr, variable, coefficient, degree))
+    {
+        return false;
+    }
+    if (negative)
+    {
+        if (coefficient.getType() == NT_INTEGER)
+        {
+            coefficient = Number(-coefficient.getInteger());
+        }
+        else
+        {
+            coefficient = Number(-coefficient.getRealNumber());
+        }
+    }
+    if (coefficients.size() <= degree)
+    {
+        coefficients.resize(degree + 1, Number(0L));
+        present.resize(degree + 1, false);
+    }
+    if (present[degree])
+    {
+        return false;
+    }
+    present[degree] = true;
+    coefficients[degree] = coefficient;
+    return true;
+}
+
+
+//
+// Gets the coefficient and the degree of the given term.
+// The coefficient is an integer in (LONG_MIN, LONG_MAX] or a non-zero normal real number.
+//
+bool Optimizer::getTerm(Expression* expr, Variable*& variable, Number& coefficient, size_t& degree)
+{
+    switch (expr->getType())
+    {
+    case ET_INTEGER:
+    {
+        const Number& value = ((Integer*)expr)->getValue();
+        if (value.getType() != NT_INTEGER || value.getInteger() == LONG_MIN)
+        {
+            return false;
+        }
+        coefficient = value;
+        degree = 0;
+        return true;
+    }
+    case ET_REALNUMBER:
+    {
+        const Number& value = ((RealNumber*)expr)->getValue();
+        if (value.getType() != NT_REALNUMBER || fpclassify(value.getRealNumber()) != FP_NORMAL)
+        {
+            // the sign of zero could differ, and the polynomial is evaluated in long double.
+            return false;
+        }
+        coefficient = value;
+        degree = 0;
+        return true;
+    }
+    case ET_VARIABLE:
+    {
+        int slot = ((Variable*)expr)->getSlot();
+        if (slot < 0 || !VariableStore::instance().isPure(slot) || (variable && variable->getSlot() != slot))
+        {
+            return false;
+        }
+        if (!variable)
+        {
+            variable = (Variable*)expr;
+        }
+        coefficient = Number(1L);
+        degree = 1;
+        return true;
+    }
+    case ET_UNARY_MINUS:
+    case ET_BLOCK:
+    {
+        Expression* operand = ((UnaryExpression*)expr)->expr;
+        if (!getTerm(operand, variable, coefficient, degree))
+        {
+            return false;
+        }
+        if (expr->getType() == ET_UNARY_MINUS)
+        {
+            if (coefficient.getType() == NT_INTEGER)
+            {
+                coefficient = Number(-coefficient.getInteger());
+            }
+            else
+            {
+                coefficient = Number(-coefficient.getRealNumber());
+            }
+        }
+        return true;
+    }
+    case ET_MULTIPLY:
+    {
+        BinaryExpression* binary = (BinaryExpression*)expr;
+        Number c2;
+        size_t d2 = 0;
+        return binary->right
+            && getTerm(binary->left, variable, coefficient, degree)
+            && getTerm(binary->right, variable, c2, d2)
+            && multiplyTerms(coefficient, degree, c2, d2);
+    }
+    case ET_PRODUCT:
+    {
+        ChainExpression* chain = (ChainExpression*)expr;
+        if (!getTerm(chain->operands[0], variable, coefficient, degree))
+        {
+            return false;
+        }
+        for (size_t i = 1; i < chain->operands.size(); i++)
+        {
+            Number c2;
+            size_t d2 = 0;
+            if (chain->operators[i] != ET_MULTIPLY
+                || !getTerm(chain->operands[i], variable, c2, d2)
+                || !multiplyTerms(coefficient, degree, c2, d2))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    case ET_POW:
+    {
+        BinaryExpression* binary = (BinaryExpression*)expr;
+        if (!binary->right || binary->right->getType() != ET_INTEGER)
+        {
+            return false;
+        }
+        const Number& exponent = ((Integer*)binary->right)->getValue();
+        // x{pow}0 is an integer or a real number depending on x.
+        if (exponent.getType() != NT_INTEGER || exponent.getInteger() < 1 || (long)PolynomialExpression::MAX_DEGREE < exponent.getInteger())
+        {
+            return false;
+        }
+        Expression* base = binary->left;
+        while (base->getType() == ET_BLOCK)
+        {
+            base = ((UnaryExpression*)base)->expr;
+        }
+        if (base->getType() != ET_VARIABLE || !getTerm(base, variable, coefficient, degree))
+        {
+            return false;
+        }
+        degree = (size_t)exponent.getInteger();
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+
+//
+// Multiplies the term by the other one.
+// The coefficients are multiplied only if the product is exact.
+//
+bool Optimizer::multiplyTerms(Number& coefficient, size_t& degree, const Number& coefficient2, size_t degree2)
+{
+    degree += degree2;
+    if (degree > PolynomialExpression::MAX_DEGREE)
+    {
+        return false;
+    }
+    if (coefficient.getType() == NT_INTEGER && coefficient2.getType() == NT_INTEGER)
+    {
+        long product;
+        if (__builtin_mul_overflow(coefficient.getInteger(), coefficient2.getInteger(), &product) || product == LONG_MIN)
+        {
+            return false;
+        }
+        coefficient = Number(product);
+    }
+    else if (coefficient.getType() == NT_INTEGER && (coefficient.getInteger() == 1 || coefficient.getInteger() == -1))
+    {
+        coefficient = Number(coefficient.getInteger() * coefficient2.getRealNumber());
+    }
+    else if (coefficient2.getType() == NT_INTEGER && (coefficient2.getInteger() == 1 || coefficient2.getInteger() == -1))
+    {
+        coefficient = Number(coefficient.getRealNumber() * coefficient2.getInteger());
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Common subexpression elimination
+//
+//////////////////////////////////////////////////////////////////////
+
+
+//
+// Shares the common subexpressions of the given tree in DagExpression.
+// The nodes are numbered bottom-up so that the structurally equal ones get the same number,
+// and then replaced top-down, so that the inside of a shared subexpression is counted only once.
+// If nothing is shared, the given tree is returned as is.
+//
+Expression* Optimizer::share(Expression* expr)
+{
+    signatures.clear();
+    numbers.clear();
+    number(expr, isStable(expr));
+    occurrences.assign(signatures.size(), 0);
+    std::vector<bool> seen(signatures.size(), false);
+    count(expr, seen);
+    size_t n = 0;
+    while (n < occurrences.size() && occurrences[n] < 2)
+    {
+        n++;
+    }
+    if (n == occurrences.size())
+    {
+        return expr;
+    }
+    subexpressions.assign(signatures.size(), NULL);
+    DagExpression* dag = arena.own(new(arena) DagExpression);
+    dag->expr = link(expr, dag);
+    return dag;
+}
+
+
+//
+// Numbers the given expression and its operands, and returns the number.
+// The same number is given to structurally equal ones.
+// If the expression cannot be shared, -1 is returned.
+//
+int Optimizer::number(Expression* expr, bool stable)
+{
+    Signature sig;
+    sig.type = expr->getType();
+    sig.left = -1;
+    sig.right = -1;
+    sig.modulus = -1;
+    sig.integer = 0;
+    sig.realNumber = 0;
+    sig.slot = -1;
+    OperandList operands;
+    size_t n = getOperands(expr, operands);
+    if (expr->getType() == ET_SUM || expr->getType() == ET_PRODUCT)
+    {
+        // The chains themselves are not shared, while their operands can be.
+        for (size_t i = 0; i < n; i++)
+        {
+            number(*operands[i], stable);
+        }
+        return -1;
+    }
+    if (n > 0)
+    {
+        sig.left = number(*operands[0], stable);
+    }
+    if (n > 1)
+    {
+        sig.right = number(*operands[1], stable);
+    }
+    if (n > 2)
+    {
+        sig.modulus = number(*operands[2], stable);
+    }
+    if ((n > 0 && sig.left < 0) || (n > 1 && sig.right < 0) || (n > 2 && sig.modulus < 0))
+    {
+        return -1;
+    }
+    switch (expr->getType())
+    {
+    case ET_INTEGER:
+        if (((Integer*)expr)->getValue().getType() == NT_BIGINTEGER)
+        {
+            // It is not worth comparing the limbs.
+            return -1;
+        }
+        sig.integer = ((Integer*)expr)->getValue().getInteger128();
+        break;
+    case ET_REALNUMBER:
+        if (((RealNumber*)expr)->getValue().getType() != NT_REALNUMBER)
+        {
+            return -1;
+        }
+        sig.realNumber = ((RealNumber*)expr)->getValue().getRealNumber();
+        break;
+    case ET_VARIABLE:
+        if (!stable)
+        {
+            return -1;
+        }
+        sig.slot = ((Variable*)expr)->getSlot();
+        break;
+    default:
+        if (!n)
+        {
+            // assignment, incomplete expression, or operator missing its operand
+            return -1;
+        }
+        break;
+    }
+    int exponent = 0;
+    long double mantissa = frexpl(sig.realNumber, &exponent);
+    size_t h = (size_t)sig.type;
+    h = h * 31 + (size_t)(sig.left + 1);
+    h = h * 31 + (size_t)(sig.right + 1);
+    h = h * 31 + (size_t)(sig.modulus + 1);
+    h = h * 31 + (size_t)sig.integer + (size_t)(sig.integer >> 64);
+    h = h * 31 + (size_t)(long long)(mantissa * 9007199254740992.0L) + (size_t)exponent;
+    h = h * 31 + (size_t)(sig.slot + 1);
+    sig.hash = h;
+    int value = (int)signatures.size();
+    std::pair<SignatureMap::iterator, bool> result = signatures.insert(SignatureMap::value_type(sig, value));
+    value = result.first->second;
+    if (n)
+    {
+        // only the subexpressions with operators are worth sharing.
+        numbers[expr] = value;
+    }
+    return value;
+}
+
+
+//
+// Counts the occurrences of each number that remain after sharing.
+// The inside of the second and later occurrences is not counted because they are removed.
+//
+void Optimizer::count(Expression* expr, std::vector<bool>& seen)
+{
+    NumberMap::const_iterator iter = numbers.find(expr);
+    if (iter != numbers.end())
+    {
+        occurrences[iter->second]++;
+        if (seen[iter->second])
+        {
+            return;
+        }
+        seen[iter->second] = true;
+    }
+    OperandList operands;
+    size_t n = getOperands(expr, operands);
+    for (size_t i = 0; i < n; i++)
+    {
+        count(*operands[i], seen);
+    }
+}
+
+
+//
+// Replaces the occurrences of the subexpressions occurring more than once with SharedExpression.
+// The first occurrence is taken over by the given DagExpression, and the others are dropped.
+// Returns the expression that replaces the given one.
+//
+Expression* Optimizer::link(Expression* expr, DagExpression* dag)
+{
+    NumberMap::const_iterator iter = numbers.find(expr);
+    int value = iter != numbers.end() && occurrences[iter->second] > 1 ? iter->second : -1;
+    if (value >= 0 && subexpressions[value])
+    {
+        removedCount += getSize(expr) - 1;
+        return new(arena) SharedExpression(subexpressions[value]);
+    }
+    OperandList operands;
+    size_t n = getOperands(expr, operands);
+    for (size_t i = 0; i < n; i++)
+    {
+        *operands[i] = link(*operands[i], dag);
+    }
+    if (value >= 0)
+    {
+        subexpressions[value] = dag->add(expr);
+        sharedCount++;
+        return new(arena) SharedExpression(subexpressions[value]);
+    }
+    return expr;
+}
+
+
+//
+// Returns true if no variable can change while the given tree is evaluated,
+// that is, it has no assignment and refers to no impure variable.
+//
+bool Optimizer::isStable(Expression* expr)
+{
+    switch (expr->getType())
+    {
+    case ET_ASSIGN:
+        return false;
+    case ET_VARIABLE:
+    {
+        int slot = ((Variable*)expr)->getSlot();
+        return slot >= 0 && VariableStore::instance().isPure(slot);
+    }
+    default:
+        break;
+    }
+    OperandList operands;
+    size_t n = getOperands(expr, operands);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!isStable(*operands[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+size_t Optimizer::getSize(Expression* expr)
+{
+    size_t size = 1;
+    OperandList operands;
+    size_t n = getOperands(expr, operands);
+    for (size_t i = 0; i < n; i++)
+    {
+        size += getSize(*operands[i]);
+    }
+    return size;
+}
+
+
+//
+// Gets the pointers to the operands of the given expression, and returns the number of them.
+// The insides of assignments and incomplete expressions are not looked into;
+// Program hands them over to the tree-walking evaluator, which knows nothing of sharing.
+//
+size_t Optimizer::getOperands(Expression* expr, OperandList& operands)
+{
+    operands.clear();
+    switch (expr->getType())
+    {
+    case ET_ADD:
+    case ET_SUBTRACT:
+    case ET_MULTIPLY:
+    case ET_DIVIDE:
+    case ET_HYPOT:
+    case ET_POW:
+    {
+        BinaryExpression* binary = (BinaryExpression*)expr;
+        operands.push_back(&binary->left);
+        if (binary->right)
+        {
+            operands.push_back(&binary->right);
+        }
+        break;
+    }
+    case ET_POWMOD:
+    {
+        PowModExpression* powmod = (PowModExpression*)expr;
+        operands.push_back(&powmod->left);
+        operands.push_back(&powmod->right);
+        if (powmod->modulus)
+        {
+            operands.push_back(&powmod->modulus);
+        }
+        break;
+    }
+    case ET_SUM:
+    case ET_PRODUCT:
+    {
+        ChainExpression* chain = (ChainExpression*)expr;
+        for (size_t i = 0; i < chain->operands.size(); i++)
+        {
+            operands.push_back(&chain->operands[i]);
+        }
+        break;
+    }
+    case ET_UNARY_MINUS:
+    case ET_BLOCK:
+    case ET_INCOMPLETE_BLOCK:
+    case ET_ABS:
+    case ET_CBRT:
+    case ET_COS:
+    case ET_EXP:
+    case ET_LOG:
+    case ET_LOG2:
+    case ET_LOG10:
+    case ET_SIN:
+    case ET_SQRT:
+    case ET_TAN:
+    {
+        UnaryExpression* unary = (UnaryExpression*)expr;
+        if (unary->expr)
+        {
+            operands.push_back(&unary->expr);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return operands.size();
+}
+
+
+bool Optimizer::SignatureLessThan::operator ()(const Signature& a, const Signature& b) const
+{
+    if (a.hash != b.hash)
+    {
+        return a.hash < b.hash;
+    }
+    if (a.type != b.type)
+    {
+        return a.type < b.type;
+    }
+    if (a.left != b.left)
+    {
+        return a.left < b.left;
+    }
+    if (a.right != b.right)
+    {
+        return a.right < b.right;
+    }
+    if (a.modulus != b.modulus)
+    {
+        return a.modulus < b.modulus;
+    }
+    if (a.integer != b.integer)
+    {
+        return a.integer < b.integer;
+    }
+    if (a.realNumber != b.realNumber)
+    {
+        return a.realNumber < b.realNumber;
+    }
+    if (signbit(a.realNumber) != signbit(b.realNumber))
+    {
+        // 0 and -0
+        return signbit(b.realNumber) != 0;
+    }
+    return a.slot < b.slot;
+}
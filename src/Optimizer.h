@@ -0,0 +1,144 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#ifndef IKURA_OPTIMIZER_H
+#define IKURA_OPTIMIZER_H
+
+
+#include <stddef.h>
+#include <map>
+#include <vector>
+#include "Expression.h"
+
+
+namespace hnrt
+{
+    //
+    // Optimization pass over the expression tree built by Parser
+    //
+    // First the left-deep chains of * and / are flattened into ChainExpression,
+    // as Parser builds those of + and - already.
+    //
+    // Every subexpression free of variables is folded into a literal holding its value,
+    // so that it is not evaluated again each time the tree is.
+    // A subexpression is folded only if evaluating it succeeds;
+    // otherwise it is left as it is to throw at run time as before.
+    //
+    // Then the subexpressions that occur more than once are shared in DagExpression,
+    // so that each of them is evaluated only once per evaluation.
+    // Two subexpressions are the same if they are structurally equal, that is, they have the same types,
+    // literal values and variable slots at the same positions; see Signature.
+    // As long as the tree has no assignment and all of its variables are pure,
+    // the variables cannot change during the evaluation and thus any subexpression can be shared.
+    // Otherwise only the ones free of variables are shared.
+    //
+    // Before sharing, the operations are rewritten into cheaper ones giving the same results:
+    // division by a real power of two into multiplication by its reciprocal, x{pow}2 into x*x, and
+    // a sum of the terms c*x{pow}k in one variable and x{pow}3 into PolynomialExpression.
+    //
+    // The string form of the resulting tree differs from the original one,
+    // so that a tree to be formatted must not be optimized.
+    // The right side of an assignment, which is formatted into the value of the variable, is left as it is.
+    //
+    // The passes but flattening recurse as deeply as the tree, so that a tree still deeper than
+    // Expression::MAX_PASS_DEPTH after flattening is not optimized any further.
+    //
+    class Optimizer
+    {
+    public:
+
+        Optimizer(ExpressionArena& arena);
+        ~Optimizer();
+
+        //
+        // Optimizes the given tree and returns the resulting one.
+        // The given tree is taken over; the returned one is either the same or a new one.
+        // The nodes removed from the tree are left in the arena, and the new ones are allocated from it.
+        //
+        Expression* run(Expression* expr);
+
+        //
+        // Returns the number of the nodes removed so far.
+        //
+        size_t getRemovedCount() const { return removedCount; }
+
+        //
+        // Returns the number of the subexpressions shared so far.
+        //
+        size_t getSharedCount() const { return sharedCount; }
+
+        //
+        // Returns the number of the operations rewritten so far.
+        //
+        size_t getReducedCount() const { return reducedCount; }
+
+    protected:
+
+        //
+        // Structural identity of a node, by which the equal subexpressions are found
+        //
+        struct Signature
+        {
+            size_t hash; // of the rest, which is compared first
+            int type;
+            int left; // value number of the left side or the operand; -1 if none
+            int right; // value number of the right side; -1 if none
+            int modulus; // value number of the modulus of PowModExpression; -1 if none
+            __int128 integer; // value of Integer
+            long double realNumber; // value of RealNumber
+            int slot; // of Variable
+        };
+
+        class SignatureLessThan
+        {
+        public:
+
+            bool operator ()(const Signature&, const Signature&) const;
+        };
+
+        typedef std::map<Signature, int, SignatureLessThan> SignatureMap;
+        typedef std::map<const Expression*, int> NumberMap;
+        typedef std::vector<Expression**> OperandList;
+
+
+        Optimizer(const Optimizer& other) : arena(other.arena) {}
+        void operator =(const Optimizer&) {}
+        Expression* flatten(Expression* expr);
+        static ExpressionType getChainType(ExpressionType type);
+        Expression* fold(Expression* expr);
+        Expression* foldBinary(BinaryExpression* expr);
+        Expression* foldPowMod(PowModExpression* expr);
+        Expression* foldUnary(UnaryExpression* expr);
+        Expression* foldChain(ChainExpression* expr);
+        Expression* replace(Expression* expr, size_t count);
+        static bool isLiteral(const Expression* expr);
+        static bool isPairwiseLiteral(const Expression* expr);
+        Expression* reduce(Expression* expr);
+        Expression* getReciprocal(const Expression* divisor);
+        Expression* getSquare(Expression* expr);
+        Expression* reducePolynomial(Expression* expr);
+        bool addTerms(Expression* expr, bool negative, Variable*& variable, std::vector<Number>& coefficients, std::vector<bool>& present);
+        static bool getTerm(Expression* expr, Variable*& variable, Number& coefficient, size_t& degree);
+        static bool multiplyTerms(Number& coefficient, size_t& degree, const Number& coefficient2, size_t degree2);
+        Expression* share(Expression* expr);
+        int number(Expression* expr, bool stable);
+        void count(Expression* expr, std::vector<bool>& seen);
+        Expression* link(Expression* expr, DagExpression* dag);
+        static bool isStable(Expression* expr);
+        static size_t getSize(Expression* expr);
+        static size_t getOperands(Expression* expr, OperandList& operands);
+
+        ExpressionArena& arena;
+        EvaluationContext context;
+        size_t removedCount;
+        size_t sharedCount;
+        size_t reducedCount;
+        SignatureMap signatures;
+        NumberMap numbers; // value number of each node; -1 if it cannot be shared
+        std::vector<int> occurrences; // indexed by value number
+        std::vector<Subexpression*> subexpressions; // indexed by value number
+    };
+}
+
+
+#endif //!IKURA_OPTIMIZER_H
@@ -10,17 +10,48 @@
 using namespace hnrt;
 
 
+//
+// Returns the precedence of the given operator waiting for its right side.
+// ET_BLOCK and ET_ASSIGN are not reduced by any binary operator.
+//
+static int getLevel(ExpressionType type)
+{
+    switch (type)
+    {
+    case ET_BLOCK:
+    case ET_ASSIGN:
+        return 0;
+    case ET_ADD:
+    case ET_SUBTRACT:
+        return 1;
+    case ET_MULTIPLY:
+    case ET_DIVIDE:
+        return 2;
+    case ET_HYPOT:
+    case ET_POW:
+    case ET_POWMOD:
+        return 3;
+    default: // unary operators
+        return 4;
+    }
+}
+
+
 //
 // s .......... pointer to string to parse
 // n .......... length of string in bytes
+// arena ...... where the nodes are allocated
 // complete ... true if the string is complete,
 //              which means the parser needs to strictly check
 //              if the string represents a complete arithmetic expression.
 //
-Parser::Parser(const char* s, size_t n, bool complete_)
+Parser::Parser(const char* s, size_t n, ExpressionArena& arena_, bool complete_)
     : lexer(s, n)
+    , arena(arena_)
     , complete(complete_)
     , sym(0)
+    , operand(NULL)
+    , openBlocks(0)
 {
     sym = lexer.getSym();
 }
@@ -29,8 +60,11 @@ Parser::Parser(const char* s, size_t n, bool complete_)
 // unused...just to make the compiler happy.
 Parser::Parser(const Parser& other)
     : lexer(NULL, 0)
+    , arena(other.arena)
     , complete(false)
     , sym(0)
+    , operand(NULL)
+    , openBlocks(0)
 {
 }
 
@@ -43,281 +77,353 @@ Parser::Parser(const Parser& other)
 //
 Expression* Parser::run()
 {
-    Expression* expr = parseExpr1();
-    if (sym == SYM_EOF)
-    {
-        return expr;
-    }
-    else
-    {
-        delete expr;
-        throw InvalidExpressionException(gettext("Invalid syntax."));
-    }
-}
-
-
-//
-// Parses variable = expression.
-//
-Expression* Parser::parseExpr1()
-{
-    Expression* expr = parseExpr2();
-    try
-    {
-        if (sym == SYM_ASSIGN)
-        {
-            if (expr->getType() == ET_VARIABLE)
-            {
-                Glib::ustring key = ((Variable *)expr)->getKey();
-                if (!VariableStore::instance().hasKey(key))
-                {
-                    throw InvalidExpressionException(Glib::ustring::compose(gettext("%1: Not exist"), key));
-                }
-                else if (key.length() > 1)
-                {
-                    // Only variable A to Z are allowed to be changed; others are treated as read-only.
-                    throw InvalidExpressionException(Glib::ustring::compose(gettext("%1: Read only"), key));
-                }
-                sym = lexer.getSym();
-                delete expr;
-                expr = NULL;
-                expr = new AssignExpression(key, parseExpr1());
-            }
-            else
-            {
-                throw InvalidExpressionException(gettext("Non variable cannot be assigned expression"));
-            }
-        }
-        return expr;
-    }
-    catch (...)
-    {
-        delete expr;
-        throw;
-    }
-}
-
-
-//
-// Parses expression {+|-} expression.
-//
-Expression* Parser::parseExpr2()
-{
-    Expression* expr = parseExpr3();
-    try
-    {
-        while (1)
-        {
-            switch (sym)
-            {
-            case SYM_PLUS:
-                sym = lexer.getSym();
-                expr = new AddExpression(expr, parseExpr3());
-                break;
-            case SYM_MINUS:
-                sym = lexer.getSym();
-                expr = new SubtractExpression(expr, parseExpr3());
-                break;
-            default:
-                return expr;
-            }
-        }
-    }
-    catch (...)
+    while (sym != SYM_EOF)
     {
-        delete expr;
-        throw;
+        shift();
+        sym = lexer.getSym();
     }
-}
-
-
-//
-// Parses expression {*|/} expression.
-//
-Expression* Parser::parseExpr3()
-{
-    Expression* expr = parseExpr4();
-    try
+    if (complete)
     {
-        while (1)
+        if (!operand)
         {
-            switch (sym)
-            {
-            case SYM_MULTIPLY:
-                sym = lexer.getSym();
-                expr = new MultiplyExpression(expr, parseExpr4());
-                break;
-            case SYM_DIVIDE:
-                sym = lexer.getSym();
-                expr = new DivideExpression(expr, parseExpr4());
-                break;
-            default:
-                return expr;
-            }
+            throw InvalidExpressionException(gettext("Invalid syntax."));
         }
-    }
-    catch (...)
-    {
-        delete expr;
-        throw;
-    }
-}
-
-
-//
-// Parses custom binary operator expression
-//
-Expression* Parser::parseExpr4()
-{
-    Expression* expr = parseExpr5();
-    try
-    {
-        while (1)
+        else if (openBlocks)
         {
-            switch (sym)
-            {
-            case SYM_HYPOT:
-                sym = lexer.getSym();
-                expr = new HypotExpression(expr, parseExpr5());
-                break;
-            case SYM_POW:
-                sym = lexer.getSym();
-                expr = new PowExpression(expr, parseExpr5());
-                break;
-            case SYM_INCOMPLETE_OPERATOR:
-                if (!complete)
-                {
-                    expr = new IncompleteExpression(expr, lexer.getString());
-                    sym = lexer.getSym();
-                    break;
-                }
-                //FALLTHROUGH
-            default:
-                return expr;
-            }
+            throw InvalidExpressionException(gettext("Right parenthesis is missing."));
         }
     }
-    catch (...)
-    {
-        delete expr;
-        throw;
-    }
+    // Otherwise the input is not yet finished; the operators missing their right sides get NULL.
+    reduce(0);
+    Expression* expr = operand;
+    operand = NULL;
+    return expr;
 }
 
 
 //
-// Parses a number, a unary operator, or a block enclosed by a pair of parentheses.
+// Advances the parser by the current token, which is consumed by the caller.
 //
-Expression* Parser::parseExpr5()
+void Parser::shift()
 {
-    Expression* expr = NULL;
-    try
+    if (!operand)
     {
         switch (sym)
         {
         case SYM_INTEGER:
-            expr = new Integer(lexer.getInteger(), lexer.getString());
-            sym = lexer.getSym();
+            operand = new(arena) Integer(lexer.getInteger(), lexer.getText(), lexer.getTextLength());
+            if (lexer.getInteger().getType() == NT_BIGINTEGER)
+            {
+                arena.own(operand);
+            }
             break;
         case SYM_REALNUMBER:
-            expr = new RealNumber(lexer.getRealNumber(), lexer.getString());
-            sym = lexer.getSym();
+            operand = new(arena) RealNumber(lexer.getRealNumber(), lexer.getText(), lexer.getTextLength());
+            if (lexer.getRealNumber().getType() == NT_BIGREAL)
+            {
+                arena.own(operand);
+            }
             break;
-        case SYM_LPAREN:
-            sym = lexer.getSym();
-            expr = new BlockExpression(parseExpr1());
-            if (sym == SYM_RPAREN)
+        case SYM_IDENTIFIER:
+        {
+            Glib::ustring key = lexer.getString();
+            int slot = VariableStore::instance().find(key);
+            if (slot >= 0)
             {
-                sym = lexer.getSym();
+                operand = new(arena) Variable(slot);
             }
-            else if (complete || sym != SYM_EOF)
+            else if (complete)
             {
-                throw InvalidExpressionException(gettext("Right parenthesis is missing."));
+                throw InvalidExpressionException(Glib::ustring::compose(gettext("%1: Not exist"), key));
             }
             else
             {
-                ((BlockExpression*)expr)->setIncomplete();
+                operand = arena.own(new(arena) Variable(key));
             }
             break;
-        case SYM_MINUS:
-            sym = lexer.getSym();
-            expr = new MinusExpression(parseExpr5());
-            break;
-        case SYM_IDENTIFIER:
-            expr = new Variable(lexer.getString());
-            if (complete && !VariableStore::instance().hasKey(((Variable*)expr)->getKey()))
+        }
+        case SYM_INCOMPLETE_OPERATOR:
+            if (complete)
             {
-                throw InvalidExpressionException(Glib::ustring::compose(gettext("%1: Not exist"), ((Variable*)expr)->getKey()));
+                throw InvalidExpressionException(gettext("Invalid syntax."));
             }
-            sym = lexer.getSym();
+            operand = new(arena) IncompleteExpression(lexer.getText(), lexer.getTextLength());
+            break;
+        case SYM_LPAREN:
+            pushFrame(ET_BLOCK);
+            openBlocks++;
+            break;
+        case SYM_MINUS:
+            pushFrame(ET_UNARY_MINUS);
             break;
         case SYM_ABS:
-            sym = lexer.getSym();
-            expr = new AbsExpression(parseExpr5());
+            pushFrame(ET_ABS);
             break;
         case SYM_CBRT:
-            sym = lexer.getSym();
-            expr = new CbrtExpression(parseExpr5());
+            pushFrame(ET_CBRT);
             break;
         case SYM_COS:
-            sym = lexer.getSym();
-            expr = new CosExpression(parseExpr5());
+            pushFrame(ET_COS);
             break;
         case SYM_EXP:
-            sym = lexer.getSym();
-            expr = new ExpExpression(parseExpr5());
+            pushFrame(ET_EXP);
             break;
         case SYM_LOG:
-            sym = lexer.getSym();
-            expr = new LogExpression(parseExpr5());
+            pushFrame(ET_LOG);
             break;
         case SYM_LOG2:
-            sym = lexer.getSym();
-            expr = new Log2Expression(parseExpr5());
+            pushFrame(ET_LOG2);
             break;
         case SYM_LOG10:
-            sym = lexer.getSym();
-            expr = new Log10Expression(parseExpr5());
+            pushFrame(ET_LOG10);
             break;
         case SYM_SIN:
-            sym = lexer.getSym();
-            expr = new SinExpression(parseExpr5());
+            pushFrame(ET_SIN);
             break;
         case SYM_SQRT:
-            sym = lexer.getSym();
-            expr = new SqrtExpression(parseExpr5());
+            pushFrame(ET_SQRT);
             break;
         case SYM_TAN:
-            sym = lexer.getSym();
-            expr = new TanExpression(parseExpr5());
+            pushFrame(ET_TAN);
             break;
         default:
-            if (complete)
+            throw InvalidExpressionException(gettext("Invalid syntax."));
+        }
+    }
+    else
+    {
+        switch (sym)
+        {
+        case SYM_PLUS:
+            reduce(1);
+            pushFrame(ET_ADD);
+            break;
+        case SYM_MINUS:
+            reduce(1);
+            pushFrame(ET_SUBTRACT);
+            break;
+        case SYM_MULTIPLY:
+            reduce(2);
+            pushFrame(ET_MULTIPLY);
+            break;
+        case SYM_DIVIDE:
+            reduce(2);
+            pushFrame(ET_DIVIDE);
+            break;
+        case SYM_HYPOT:
+            reduce(3);
+            pushFrame(ET_HYPOT);
+            break;
+        case SYM_POW:
+            reduce(3);
+            pushFrame(ET_POW);
+            break;
+        case SYM_POWMOD:
+            reduce(4);
+            if (frames.empty() || frames.back().type != ET_POW)
             {
                 throw InvalidExpressionException(gettext("Invalid syntax."));
             }
-            switch (sym)
+            // The power waiting for its right side takes the operand as the exponent, and waits for the modulus.
+            frames.back().type = ET_POWMOD;
+            frames.back().exponent = operand;
+            operand = NULL;
+            break;
+        case SYM_ASSIGN:
+            reduce(1);
+            pushAssignFrame();
+            break;
+        case SYM_RPAREN:
+            reduce(1);
+            while (!frames.empty() && frames.back().type == ET_ASSIGN)
+            {
+                reduceFrame();
+            }
+            if (frames.empty())
             {
-            case SYM_EOF:
-                // This is allowed if complete is false, which means that input is not yet finished.
-                break;
-            case SYM_INCOMPLETE_OPERATOR:
-                expr = new IncompleteExpression(lexer.getString());
-                sym = lexer.getSym();
-                break;
-            default:
                 throw InvalidExpressionException(gettext("Invalid syntax."));
             }
+            reduceFrame();
             break;
+        case SYM_INCOMPLETE_OPERATOR:
+            if (!complete)
+            {
+                reduce(3);
+                operand = new(arena) IncompleteExpression(operand, lexer.getText(), lexer.getTextLength());
+                break;
+            }
+            //FALLTHROUGH
+        default:
+            if (openBlocks)
+            {
+                throw InvalidExpressionException(gettext("Right parenthesis is missing."));
+            }
+            throw InvalidExpressionException(gettext("Invalid syntax."));
         }
-        return expr;
     }
-    catch (...)
+}
+
+
+//
+// Pushes the operator that takes the operand, if any, as its left side.
+//
+void Parser::pushFrame(ExpressionType type)
+{
+    Frame frame;
+    frame.type = type;
+    frame.left = operand;
+    frame.exponent = NULL;
+    frame.slot = -1;
+    frames.push_back(frame);
+    operand = NULL;
+}
+
+
+void Parser::pushAssignFrame()
+{
+    if (operand->getType() != ET_VARIABLE)
+    {
+        throw InvalidExpressionException(gettext("Non variable cannot be assigned expression"));
+    }
+    Frame frame;
+    frame.type = ET_ASSIGN;
+    frame.left = NULL;
+    frame.exponent = NULL;
+    frame.slot = ((Variable*)operand)->getSlot();
+    const Glib::ustring& key = ((Variable*)operand)->getKey();
+    if (frame.slot < 0)
+    {
+        throw InvalidExpressionException(Glib::ustring::compose(gettext("%1: Not exist"), key));
+    }
+    else if (key.length() > 1)
+    {
+        // Only variable A to Z are allowed to be changed; others are treated as read-only.
+        throw InvalidExpressionException(Glib::ustring::compose(gettext("%1: Read only"), key));
+    }
+    frames.push_back(frame);
+    operand = NULL;
+}
+
+
+//
+// Reduces the operators whose precedence is not lower than the given level.
+//
+void Parser::reduce(int level)
+{
+    while (!frames.empty() && getLevel(frames.back().type) >= level)
+    {
+        reduceFrame();
+    }
+}
+
+
+//
+// Builds the innermost operator with the operand as its right side, which may be NULL
+// only at the end of the input that is not yet finished.
+//
+void Parser::reduceFrame()
+{
+    const Frame& frame = frames.back();
+    Expression* expr;
+    switch (frame.type)
     {
-        if (expr)
+    case ET_ADD:
+    case ET_SUBTRACT:
+        expr = reduceSum(frame);
+        break;
+    case ET_MULTIPLY:
+        expr = new(arena) MultiplyExpression(frame.left, operand);
+        break;
+    case ET_DIVIDE:
+        expr = new(arena) DivideExpression(frame.left, operand);
+        break;
+    case ET_HYPOT:
+        expr = new(arena) HypotExpression(frame.left, operand);
+        break;
+    case ET_POW:
+        expr = new(arena) PowExpression(frame.left, operand);
+        break;
+    case ET_POWMOD:
+        expr = new(arena) PowModExpression(frame.left, frame.exponent, operand);
+        break;
+    case ET_BLOCK:
+        expr = new(arena) BlockExpression(operand);
+        if (sym != SYM_RPAREN)
         {
-            delete expr;
+            // left open at the end of the input
+            ((BlockExpression*)expr)->setIncomplete();
         }
-        throw;
+        openBlocks--;
+        break;
+    case ET_ASSIGN:
+        expr = new(arena) AssignExpression(frame.slot, operand);
+        break;
+    case ET_UNARY_MINUS:
+        expr = new(arena) MinusExpression(operand);
+        break;
+    case ET_ABS:
+        expr = new(arena) AbsExpression(operand);
+        break;
+    case ET_CBRT:
+        expr = new(arena) CbrtExpression(operand);
+        break;
+    case ET_COS:
+        expr = new(arena) CosExpression(operand);
+        break;
+    case ET_EXP:
+        expr = new(arena) ExpExpression(operand);
+        break;
+    case ET_LOG:
+        expr = new(arena) LogExpression(operand);
+        break;
+    case ET_LOG2:
+        expr = new(arena) Log2Expression(operand);
+        break;
+    case ET_LOG10:
+        expr = new(arena) Log10Expression(operand);
+        break;
+    case ET_SIN:
+        expr = new(arena) SinExpression(operand);
+        break;
+    case ET_SQRT:
+        expr = new(arena) SqrtExpression(operand);
+        break;
+    default: // ET_TAN
+        expr = new(arena) TanExpression(operand);
+        break;
+    }
+    frames.pop_back();
+    operand = expr;
+}
+
+
+//
+// Builds + or - of the frame with the operand as its right side.
+// The third and later operands of a chain of them are appended to ChainExpression,
+// which is summed up in a different way from the binary nodes; see PairwiseSum.
+//
+Expression* Parser::reduceSum(const Frame& frame)
+{
+    if (operand && frame.left->getType() == ET_SUM)
+    {
+        ((ChainExpression*)frame.left)->add(frame.type, operand);
+        return frame.left;
+    }
+    else if (operand && (frame.left->getType() == ET_ADD || frame.left->getType() == ET_SUBTRACT) && ((BinaryExpression*)frame.left)->getRight())
+    {
+        BinaryExpression* binary = (BinaryExpression*)frame.left;
+        ChainExpression* chain = arena.own(new(arena) ChainExpression(ET_SUM));
+        chain->add(ET_ADD, binary->getLeft());
+        chain->add(binary->getType(), binary->getRight());
+        chain->add(frame.type, operand);
+        return chain;
+    }
+    else if (frame.type == ET_ADD)
+    {
+        return new(arena) AddExpression(frame.left, operand);
+    }
+    else
+    {
+        return new(arena) SubtractExpression(frame.left, operand);
     }
 }
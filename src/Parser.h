@@ -5,6 +5,8 @@
 #define IKURA_PARSER_H
 
 
+#include <vector>
+#include <glibmm/ustring.h>
 #include "Expression.h"
 #include "Lexer.h"
 
@@ -14,25 +16,55 @@ namespace hnrt
     //
     // Parser for arithmetic expression represented in string form
     //
+    // The grammar is as follows, where the binary operators of the same level are left-associative:
+    //
+    //   expr1 = expr2 [ "=" expr1 ]               (the left side must be a variable)
+    //   expr2 = expr3 { ( "+" | "-" ) expr3 }
+    //   expr3 = expr4 { ( "*" | "/" ) expr4 }
+    //   expr4 = expr5 { hypot expr5 | pow expr5 [ powmod expr5 ] }
+    //   expr5 = number | variable | "(" expr1 ")" | ( "-" | function ) expr5
+    //
+    // A chain of three or more operands of + and - is built into ChainExpression instead of the binary nodes.
+    //
+    // The operators waiting for their right sides are kept on an explicit stack and reduced by precedence,
+    // in the same way as IncrementalParser does, instead of on the call stack of recursive descent,
+    // so that the nesting of the input is limited only by the memory.
+    //
     class Parser
     {
     public:
 
-        Parser(const char* s, size_t n, bool complete = false);
+        Parser(const char* s, size_t n, ExpressionArena& arena, bool complete = false);
         Expression* run();
 
     protected:
 
+        //
+        // Operator waiting for its right side
+        //
+        struct Frame
+        {
+            ExpressionType type; // binary or unary operator, ET_BLOCK, or ET_ASSIGN
+            Expression* left; // left side of binary operator; NULL otherwise
+            Expression* exponent; // if ET_POWMOD; NULL otherwise
+            int slot; // variable to be assigned if ET_ASSIGN
+        };
+
         Parser(const Parser&);
-        Expression* parseExpr1();
-        Expression* parseExpr2();
-        Expression* parseExpr3();
-        Expression* parseExpr4();
-        Expression* parseExpr5();
+        void shift();
+        void pushFrame(ExpressionType type);
+        void pushAssignFrame();
+        void reduce(int level);
+        void reduceFrame();
+        Expression* reduceSum(const Frame& frame);
 
         Lexer lexer;
+        ExpressionArena& arena; // where the nodes are allocated
         bool complete;
         int sym;
+        std::vector<Frame> frames;
+        Expression* operand; // subexpression completed last; NULL if the last token did not complete any
+        int openBlocks;
     };
 }
 
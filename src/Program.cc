@@ -0,0 +1,611 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#include <math.h>
+#include "Program.h"
+#include "Arithmetic.h"
+#include "Exception.h"
+
+
+using namespace hnrt;
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Compiler
+//
+//////////////////////////////////////////////////////////////////////
+
+
+Program::Program(Expression* expr)
+    : root(expr)
+    , typed(!Number::getPrecision())
+    , sumDepth(0)
+    , result(-1)
+{
+    if (Expression::getDepth(expr) > Expression::MAX_PASS_DEPTH)
+    {
+        // The compiler recurses as deeply as the tree.
+        result = toNumber(compileFallback(expr));
+    }
+    else
+    {
+        result = toNumber(compile(expr));
+    }
+}
+
+
+Program::~Program()
+{
+}
+
+
+//
+// Compiles the given expression and returns the register that receives the value.
+//
+Program::Register Program::compile(Expression* expr)
+{
+    switch (expr->getType())
+    {
+    case ET_INTEGER:
+    {
+        Register target = addRegister(RT_NUMBER);
+        registers[target.index] = ((Integer*)expr)->getValue();
+        target.literal = true;
+        return target;
+    }
+    case ET_REALNUMBER:
+    {
+        const Number& value = ((RealNumber*)expr)->getValue();
+        int c = value.getType() == NT_REALNUMBER ? fpclassify(value.getRealNumber()) : FP_NORMAL;
+        if (c == FP_INFINITE || c == FP_SUBNORMAL || c == FP_NAN)
+        {
+            // let the tree-walking evaluator throw the exception in the right order
+            return compileFallback(expr);
+        }
+        Register target;
+        if (typed && value.getType() == NT_REALNUMBER)
+        {
+            target = addRegister(RT_REALNUMBER);
+            reals[target.index] = value.getRealNumber();
+        }
+        else
+        {
+            target = addRegister(RT_NUMBER);
+            registers[target.index] = value;
+        }
+        target.literal = true;
+        return target;
+    }
+    case ET_ADD:
+        return compileBinary(OP_ADD, (BinaryExpression*)expr);
+    case ET_SUBTRACT:
+        return compileBinary(OP_SUBTRACT, (BinaryExpression*)expr);
+    case ET_MULTIPLY:
+        return compileBinary(OP_MULTIPLY, (BinaryExpression*)expr);
+    case ET_DIVIDE:
+        return compileBinary(OP_DIVIDE, (BinaryExpression*)expr);
+    case ET_POW:
+        return compileBinary(OP_POW, (BinaryExpression*)expr);
+    case ET_POWMOD:
+        return compilePowMod((PowModExpression*)expr);
+    case ET_HYPOT:
+        return compileBinary(OP_HYPOT, (BinaryExpression*)expr);
+    case ET_UNARY_MINUS:
+        return compileUnary(OP_MINUS, (UnaryExpression*)expr);
+    case ET_ABS:
+        return compileUnary(OP_ABS, (UnaryExpression*)expr);
+    case ET_CBRT:
+        return compileUnary(OP_CBRT, (UnaryExpression*)expr);
+    case ET_COS:
+        return compileUnary(OP_COS, (UnaryExpression*)expr);
+    case ET_EXP:
+        return compileUnary(OP_EXP, (UnaryExpression*)expr);
+    case ET_LOG:
+        return compileUnary(OP_LOG, (UnaryExpression*)expr);
+    case ET_LOG2:
+        return compileUnary(OP_LOG2, (UnaryExpression*)expr);
+    case ET_LOG10:
+        return compileUnary(OP_LOG10, (UnaryExpression*)expr);
+    case ET_SIN:
+        return compileUnary(OP_SIN, (UnaryExpression*)expr);
+    case ET_SQRT:
+        return compileUnary(OP_SQRT, (UnaryExpression*)expr);
+    case ET_TAN:
+        return compileUnary(OP_TAN, (UnaryExpression*)expr);
+    case ET_BLOCK:
+        return compile(((BlockExpression*)expr)->getExpr());
+    case ET_INCOMPLETE_BLOCK:
+        if (((BlockExpression*)expr)->getExpr())
+        {
+            return compile(((BlockExpression*)expr)->getExpr());
+        }
+        return compileFallback(expr);
+    case ET_SUM:
+    case ET_PRODUCT:
+        return compileChain((ChainExpression*)expr);
+    case ET_DAG:
+    {
+        Register none = { RT_NUMBER, -1, false };
+        shared.assign(((DagExpression*)expr)->getSubexpressionCount(), none);
+        return compile(((DagExpression*)expr)->getExpr());
+    }
+    case ET_SHARED:
+    {
+        // The code is emitted at the first occurrence, which is the first to run, too.
+        const Subexpression* s = ((SharedExpression*)expr)->getSubexpression();
+        if (shared[s->index].index < 0)
+        {
+            Register target = compile(s->expr);
+            shared[s->index] = target;
+        }
+        return shared[s->index];
+    }
+    default: // ET_INCOMPLETE, ET_VARIABLE, ET_ASSIGN
+        return compileFallback(expr);
+    }
+}
+
+
+Program::Register Program::compileBinary(int code, BinaryExpression* expr)
+{
+    Register source1 = compile(expr->getLeft());
+    if (!expr->getRight())
+    {
+        // the value of the left side is the value of this expression.
+        return source1;
+    }
+    Register source2 = compile(expr->getRight());
+    return compileOperation(code, source1, source2);
+}
+
+
+//
+// Emits the binary operation on the given registers, which is done on the real registers
+// if either of them is RT_REALNUMBER or it is OP_HYPOT.
+//
+Program::Register Program::compileOperation(int code, Register source1, Register source2)
+{
+    if (typed && (source1.type == RT_REALNUMBER || source2.type == RT_REALNUMBER || code == OP_HYPOT))
+    {
+        int index1 = toRealNumber(source1);
+        int index2 = toRealNumber(source2);
+        Register target = addRegister(RT_REALNUMBER);
+        switch (code)
+        {
+        case OP_ADD:
+            emit(OP_REAL_ADD, target.index, index1, index2);
+            break;
+        case OP_SUBTRACT:
+            emit(OP_REAL_SUBTRACT, target.index, index1, index2);
+            break;
+        case OP_MULTIPLY:
+            emit(OP_REAL_MULTIPLY, target.index, index1, index2);
+            break;
+        case OP_DIVIDE:
+            emit(OP_REAL_DIVIDE, target.index, index1, index2);
+            break;
+        case OP_POW:
+            emit(OP_REAL_POW, target.index, index1, index2);
+            break;
+        default:
+            emit(OP_REAL_HYPOT, target.index, index1, index2);
+            break;
+        }
+        return target;
+    }
+    int index1 = toNumber(source1);
+    int index2 = toNumber(source2);
+    Register target = addRegister(RT_NUMBER);
+    emit(code, target.index, index1, index2);
+    return target;
+}
+
+
+//
+// The real functions give a real number whatever the operand is, and so do
+// the negation and the absolute value of a real number.
+//
+Program::Register Program::compileUnary(int code, UnaryExpression* expr)
+{
+    if (!expr->getExpr())
+    {
+        // let the tree-walking evaluator throw the exception
+        return compileFallback(expr);
+    }
+    Register source = compile(expr->getExpr());
+    if (typed && (source.type == RT_REALNUMBER || (code != OP_MINUS && code != OP_ABS)))
+    {
+        int index = toRealNumber(source);
+        Register target = addRegister(RT_REALNUMBER);
+        switch (code)
+        {
+        case OP_MINUS:
+            emit(OP_REAL_MINUS, target.index, index, -1);
+            break;
+        case OP_ABS:
+            emit(OP_REAL_ABS, target.index, index, -1);
+            break;
+        default:
+            emit(OP_REAL_FUNCTION, target.index, index, code);
+            break;
+        }
+        return target;
+    }
+    int index = toNumber(source);
+    Register target = addRegister(RT_NUMBER);
+    emit(code, target.index, index, -1);
+    return target;
+}
+
+
+Program::Register Program::compilePowMod(PowModExpression* expr)
+{
+    if (!expr->getModulus())
+    {
+        // the value of the power is the value of this expression.
+        return compileBinary(OP_POW, expr);
+    }
+    Register source1 = compile(expr->getLeft());
+    Register exponent = compile(expr->getRight());
+    Register modulus = compile(expr->getModulus());
+    int index1 = toNumber(source1);
+    int index2 = toNumber(exponent);
+    int index3 = toNumber(modulus);
+    Register target = addRegister(RT_NUMBER);
+    emit(OP_POWMOD, target.index, index1, (int)terms.size());
+    terms.push_back(index2);
+    terms.push_back(index3);
+    return target;
+}
+
+
+//
+// The first two operands of ET_SUM are added by OP_ADD or OP_SUBTRACT, and the rest to
+// the PairwiseSum of the nesting level of the chain, on the real registers
+// if the sum of the first two is RT_REALNUMBER.
+//
+Program::Register Program::compileChain(ChainExpression* expr)
+{
+    Register target = compile(expr->getOperand(0));
+    bool summing = expr->getType() == ET_SUM && expr->getOperandCount() > 2;
+    int slot = summing ? sumDepth++ : -1;
+    if (sums.size() < (size_t)sumDepth)
+    {
+        sums.resize(sumDepth);
+    }
+    for (size_t i = 1; i < expr->getOperandCount(); i++)
+    {
+        Register source = compile(expr->getOperand(i));
+        bool negative = expr->getOperator(i) == ET_SUBTRACT;
+        if (summing && i >= 2)
+        {
+            if (target.type == RT_REALNUMBER)
+            {
+                int index = toRealNumber(source);
+                emit(negative ? OP_REAL_SUM_SUBTRACT : OP_REAL_SUM_ADD, index, index, slot);
+            }
+            else
+            {
+                int index = toNumber(source);
+                emit(negative ? OP_SUM_SUBTRACT : OP_SUM_ADD, index, index, slot);
+            }
+            continue;
+        }
+        switch (expr->getOperator(i))
+        {
+        case ET_ADD:
+            target = compileOperation(OP_ADD, target, source);
+            break;
+        case ET_SUBTRACT:
+            target = compileOperation(OP_SUBTRACT, target, source);
+            break;
+        case ET_MULTIPLY:
+            target = compileOperation(OP_MULTIPLY, target, source);
+            break;
+        default:
+            target = compileOperation(OP_DIVIDE, target, source);
+            break;
+        }
+        if (summing)
+        {
+            emit(target.type == RT_REALNUMBER ? OP_REAL_SUM_START : OP_SUM_START, target.index, target.index, slot);
+        }
+    }
+    if (summing)
+    {
+        bool real = target.type == RT_REALNUMBER;
+        target = addRegister(target.type);
+        emit(real ? OP_REAL_SUM_END : OP_SUM_END, target.index, -1, slot);
+        sumDepth--;
+    }
+    return target;
+}
+
+
+Program::Register Program::compileFallback(Expression* expr)
+{
+    Register target = addRegister(RT_NUMBER);
+    emit(OP_EVALUATE, target.index, -1, (int)expressions.size());
+    expressions.push_back(expr);
+    return target;
+}
+
+
+//
+// Returns the register of Number that has the value of the given register.
+//
+int Program::toNumber(Register source)
+{
+    if (source.type == RT_NUMBER)
+    {
+        return source.index;
+    }
+    else if (source.literal)
+    {
+        registers[source.index] = reals[source.index];
+        return source.index;
+    }
+    Register target = addRegister(RT_NUMBER);
+    emit(OP_BOX, target.index, source.index, -1);
+    return target.index;
+}
+
+
+//
+// Returns the real register that has the value of the given register as a real number.
+//
+int Program::toRealNumber(Register source)
+{
+    if (source.type == RT_REALNUMBER)
+    {
+        return source.index;
+    }
+    else if (source.literal)
+    {
+        reals[source.index] = registers[source.index].toRealNumber();
+        return source.index;
+    }
+    Register target = addRegister(RT_REALNUMBER);
+    emit(OP_UNBOX, target.index, source.index, -1);
+    return target.index;
+}
+
+
+//
+// Adds a register, whose index is to both registers and reals
+// so that the interpreter can take either of them without checking the index.
+//
+Program::Register Program::addRegister(RegisterType type)
+{
+    registers.push_back(Number());
+    reals.push_back(0);
+    Register target = { type, (int)registers.size() - 1, false };
+    return target;
+}
+
+
+void Program::emit(int code_, int target, int source1, int source2)
+{
+    Instruction i;
+    i.code = code_;
+    i.target = target;
+    i.source1 = source1;
+    i.source2 = source2;
+    code.push_back(i);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Interpreter
+//
+//////////////////////////////////////////////////////////////////////
+
+
+//
+// Returns the given real number after validating it in the same way as the real operations of Number do.
+// The usual one is checked inline.
+//
+static inline long double validated(long double value)
+{
+    int c = fpclassify(value);
+    if (c != FP_NORMAL && c != FP_ZERO)
+    {
+        Arithmetic::validate(value);
+    }
+    return value;
+}
+
+
+//
+// Returns true if both of the values are NT_INTEGER.
+//
+static inline bool isInteger(const Number& x, const Number& y)
+{
+    return x.getType() == NT_INTEGER && y.getType() == NT_INTEGER;
+}
+
+
+//
+// Real functions of OP_REAL_FUNCTION in the order of OP_CBRT to OP_TAN
+//
+static const Number::RealFunction realFunctions[] =
+{
+    cbrtl,
+    cosl,
+    expl,
+    logl,
+    log2l,
+    log10l,
+    sinl,
+    sqrtl,
+    tanl,
+};
+
+
+//
+// Runs the program and returns the resulting value in the same way as Expression::evaluate does.
+// No SIGFPE handler is needed here because the only operations that trap,
+// integer division by zero and LONG_MIN / -1, are checked by Number::divide beforehand,
+// and the former by Number::powerModulo as well.
+// The operations on two NT_INTEGERs that do not overflow are done inline.
+//
+Number Program::run(EvaluationContext& context)
+{
+    if (typed && Number::getPrecision())
+    {
+        // The real registers cannot hold the real numbers of the working precision.
+        return root->evaluate(context);
+    }
+    Number* r = &registers[0];
+    long double* x = &reals[0];
+    const Instruction* i = code.empty() ? NULL : &code[0];
+    const Instruction* stop = i + code.size();
+    for (; i < stop; i++)
+    {
+        Number& t = r[i->target];
+        const Number& s1 = r[i->source1 < 0 ? 0 : i->source1];
+        const Number& s2 = r[i->source2 < 0 ? 0 : i->source2];
+        long value;
+        switch (i->code)
+        {
+        case OP_ADD:
+            if (isInteger(s1, s2) && !__builtin_add_overflow(s1.getInteger(), s2.getInteger(), &value))
+            {
+                t = Number(value);
+                break;
+            }
+            t = Number::add(s1, s2);
+            break;
+        case OP_SUBTRACT:
+            if (isInteger(s1, s2) && !__builtin_sub_overflow(s1.getInteger(), s2.getInteger(), &value))
+            {
+                t = Number(value);
+                break;
+            }
+            t = Number::subtract(s1, s2);
+            break;
+        case OP_MULTIPLY:
+            if (isInteger(s1, s2) && !__builtin_mul_overflow(s1.getInteger(), s2.getInteger(), &value))
+            {
+                t = Number(value);
+                break;
+            }
+            t = Number::multiply(s1, s2);
+            break;
+        case OP_DIVIDE:
+            t = Number::divide(s1, s2);
+            break;
+        case OP_POW:
+            t = Number::power(s1, s2);
+            break;
+        case OP_POWMOD:
+            t = Number::powerModulo(s1, r[terms[i->source2]], r[terms[i->source2 + 1]]);
+            break;
+        case OP_HYPOT:
+            t = Number::hypot(s1, s2);
+            break;
+        case OP_MINUS:
+            t = Number::negate(s1);
+            break;
+        case OP_ABS:
+            t = Number::abs(s1);
+            break;
+        case OP_CBRT:
+            t = Number::cbrt(s1);
+            break;
+        case OP_COS:
+            t = Number::cos(s1);
+            break;
+        case OP_EXP:
+            t = Number::exp(s1);
+            break;
+        case OP_LOG:
+            t = Number::log(s1);
+            break;
+        case OP_LOG2:
+            t = Number::log2(s1);
+            break;
+        case OP_LOG10:
+            t = Number::log10(s1);
+            break;
+        case OP_SIN:
+            t = Number::sin(s1);
+            break;
+        case OP_SQRT:
+            t = Number::sqrt(s1);
+            break;
+        case OP_TAN:
+            t = Number::tan(s1);
+            break;
+        case OP_EVALUATE:
+            t = expressions[i->source2]->evaluate(context);
+            break;
+        case OP_SUM_START:
+            sums[i->source2].start(s1);
+            break;
+        case OP_SUM_ADD:
+            sums[i->source2].add(s1, false);
+            break;
+        case OP_SUM_SUBTRACT:
+            sums[i->source2].add(s1, true);
+            break;
+        case OP_SUM_END:
+            t = sums[i->source2].getSum();
+            break;
+        case OP_BOX:
+            t = Number(x[i->source1]);
+            break;
+        case OP_UNBOX:
+            x[i->target] = s1.getType() == NT_REALNUMBER ? s1.getRealNumber() : s1.toRealNumber();
+            break;
+        case OP_REAL_ADD:
+            x[i->target] = validated(x[i->source1] + x[i->source2]);
+            break;
+        case OP_REAL_SUBTRACT:
+            x[i->target] = validated(x[i->source1] - x[i->source2]);
+            break;
+        case OP_REAL_MULTIPLY:
+            x[i->target] = validated(x[i->source1] * x[i->source2]);
+            break;
+        case OP_REAL_DIVIDE:
+            if (x[i->source2] == 0)
+            {
+                throw DivideByZeroException();
+            }
+            x[i->target] = validated(x[i->source1] / x[i->source2]);
+            break;
+        case OP_REAL_POW:
+            x[i->target] = validated(powl(x[i->source1], x[i->source2]));
+            break;
+        case OP_REAL_HYPOT:
+            x[i->target] = validated(hypotl(x[i->source1], x[i->source2]));
+            break;
+        case OP_REAL_MINUS:
+            x[i->target] = validated(-x[i->source1]);
+            break;
+        case OP_REAL_ABS:
+            x[i->target] = validated(fabsl(x[i->source1]));
+            break;
+        case OP_REAL_FUNCTION:
+            x[i->target] = validated(realFunctions[i->source2 - OP_CBRT](x[i->source1]));
+            break;
+        case OP_REAL_SUM_START:
+            sums[i->source2].start(x[i->source1]);
+            break;
+        case OP_REAL_SUM_ADD:
+            sums[i->source2].add(x[i->source1]);
+            break;
+        case OP_REAL_SUM_SUBTRACT:
+            sums[i->source2].add(-x[i->source1]);
+            break;
+        case OP_REAL_SUM_END:
+            x[i->target] = sums[i->source2].getRealSum();
+            break;
+        default:
+            throw EvaluationInabilityException();
+        }
+    }
+    return r[result];
+}
@@ -0,0 +1,147 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#ifndef IKURA_PROGRAM_H
+#define IKURA_PROGRAM_H
+
+
+#include <vector>
+#include "Expression.h"
+
+
+namespace hnrt
+{
+    enum OperationCode
+    {
+        OP_ADD,
+        OP_SUBTRACT,
+        OP_MULTIPLY,
+        OP_DIVIDE,
+        OP_POW,
+        OP_POWMOD, // takes the exponent and the modulus from terms; see PowModExpression
+        OP_HYPOT,
+        OP_MINUS,
+        OP_ABS,
+        OP_CBRT,
+        OP_COS,
+        OP_EXP,
+        OP_LOG,
+        OP_LOG2,
+        OP_LOG10,
+        OP_SIN,
+        OP_SQRT,
+        OP_TAN,
+        OP_EVALUATE, // evaluates the expression by the tree-walking evaluator
+        OP_SUM_START, // starts the sum of ET_SUM with the first two operands; see PairwiseSum
+        OP_SUM_ADD, // adds the operand to the sum
+        OP_SUM_SUBTRACT, // subtracts the operand from the sum
+        OP_SUM_END, // loads the sum
+        OP_BOX, // loads the real register into the register
+        OP_UNBOX, // loads the register into the real register as a real number
+        OP_REAL_ADD, // the following ones take and give the real registers
+        OP_REAL_SUBTRACT,
+        OP_REAL_MULTIPLY,
+        OP_REAL_DIVIDE,
+        OP_REAL_POW,
+        OP_REAL_HYPOT,
+        OP_REAL_MINUS,
+        OP_REAL_ABS,
+        OP_REAL_FUNCTION, // applies the function of source2, one of OP_CBRT to OP_TAN
+        OP_REAL_SUM_START,
+        OP_REAL_SUM_ADD,
+        OP_REAL_SUM_SUBTRACT,
+        OP_REAL_SUM_END,
+    };
+
+
+    enum RegisterType
+    {
+        RT_NUMBER,
+        RT_REALNUMBER,
+    };
+
+
+    //
+    // Compiled form of an arithmetic expression
+    //
+    // The expression tree is lowered into a sequence of register-based instructions.
+    // Literals are loaded into the registers once at compile time,
+    // so that the interpreter loop allocates nothing while running.
+    // Variables, assignments and incomplete expressions are handed over to
+    // the tree-walking evaluator, which means that the given expression tree
+    // must outlive the program.
+    // A subexpression shared in DagExpression is compiled once, and its register is
+    // read by all of the occurrences.
+    // A tree deeper than Expression::MAX_PASS_DEPTH is handed over to the evaluator as a whole.
+    //
+    // While the working precision of real numbers is not set, every real number is NT_REALNUMBER,
+    // and an operation on a real number or a real function gives one whatever the other operand is.
+    // Such a value is typed as RT_REALNUMBER at compile time and kept in the real registers of
+    // long double, which OP_REAL_* operate on without looking at the types of the operands.
+    // The other values, including those of the variables and those of the integer operations,
+    // which can overflow into NT_INTEGER128, are kept in the registers of Number.
+    //
+    class Program
+    {
+    public:
+
+        Program(Expression* expr);
+        ~Program();
+
+        //
+        // Runs the program and returns the resulting value in the same way as Expression::evaluate does.
+        // The registers and the sums are rewritten while running, so that a program must not run on two threads at once.
+        // If the working precision has been set since it was compiled, the tree is evaluated instead.
+        //
+        Number run(EvaluationContext& context);
+
+        size_t getInstructionCount() const { return code.size(); }
+        size_t getRegisterCount() const { return registers.size(); }
+
+    protected:
+
+        struct Instruction
+        {
+            int code;
+            int target;
+            int source1;
+            int source2; // index to expressions if code is OP_EVALUATE, to terms if OP_POWMOD, to sums if OP_SUM_* or OP_REAL_SUM_*, or the code of the function if OP_REAL_FUNCTION
+        };
+
+        struct Register
+        {
+            RegisterType type;
+            int index; // to both registers and reals; see addRegister
+            bool literal; // true if loaded at compile time
+        };
+
+        Program(const Program&) {}
+        void operator =(const Program&) {}
+        Register compile(Expression* expr);
+        Register compileBinary(int code, BinaryExpression* expr);
+        Register compileOperation(int code, Register source1, Register source2);
+        Register compileUnary(int code, UnaryExpression* expr);
+        Register compilePowMod(PowModExpression* expr);
+        Register compileChain(ChainExpression* expr);
+        Register compileFallback(Expression* expr);
+        int toNumber(Register source);
+        int toRealNumber(Register source);
+        Register addRegister(RegisterType type);
+        void emit(int code, int target, int source1, int source2);
+
+        Expression* root;
+        bool typed; // true if compiled while the working precision is not set
+        std::vector<Instruction> code;
+        std::vector<Number> registers;
+        std::vector<long double> reals;
+        std::vector<Expression*> expressions;
+        std::vector<int> terms; // registers of the exponent and the modulus of OP_POWMOD
+        std::vector<PairwiseSum> sums; // for each nesting level of ET_SUM chains
+        int sumDepth; // nesting level of the chain being compiled
+        std::vector<Register> shared; // for each subexpression of DagExpression; its index is -1 if not yet compiled
+        int result;
+    };
+}
+
+
+#endif //!IKURA_PROGRAM_H
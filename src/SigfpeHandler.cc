@@ -10,11 +10,15 @@
 using namespace hnrt;
 
 
-sigjmp_buf SigfpeHandler::env;
-volatile int SigfpeHandler::code;
+__thread EvaluationContext* SigfpeHandler::current;
+pthread_mutex_t SigfpeHandler::mutex = PTHREAD_MUTEX_INITIALIZER;
+int SigfpeHandler::installed;
+struct sigaction SigfpeHandler::saOld;
 
 
-SigfpeHandler::SigfpeHandler()
+SigfpeHandler::SigfpeHandler(EvaluationContext& context_)
+    : context(context_)
+    , previous(current)
 {
     // First, block SIGFPE to prevent from being interrupted unexpectedly
     sigemptyset(&ssFpe);
@@ -26,26 +30,41 @@ SigfpeHandler::SigfpeHandler()
         g_printerr("Error: pthread_sigcmask failed: %s\n", strerror(rc));
     }
 
-    // Then, install my handler for SIGFPE
-    memset(&saFpe, 0, sizeof(saFpe));
-    saFpe.sa_sigaction = handler;
-    sigfillset(&saFpe.sa_mask);
-    saFpe.sa_flags = SA_SIGINFO;
-    memset(&saOld, 0, sizeof(saOld));
-    if (sigaction(SIGFPE, &saFpe, &saOld))
+    // Then, install my handler for SIGFPE unless another thread has done so
+    pthread_mutex_lock(&mutex);
+    if (!installed++)
     {
-        g_printerr("Error: sigaction failed: %s\n", strerror(errno));
+        struct sigaction saFpe;
+        memset(&saFpe, 0, sizeof(saFpe));
+        saFpe.sa_sigaction = handler;
+        sigfillset(&saFpe.sa_mask);
+        saFpe.sa_flags = SA_SIGINFO;
+        memset(&saOld, 0, sizeof(saOld));
+        if (sigaction(SIGFPE, &saFpe, &saOld))
+        {
+            g_printerr("Error: sigaction failed: %s\n", strerror(errno));
+        }
     }
+    pthread_mutex_unlock(&mutex);
+
+    current = &context;
 }
 
 
 SigfpeHandler::~SigfpeHandler()
 {
-    // First, restore the old handler setting for SIGFPE
-    if (sigaction(SIGFPE, &saOld, NULL))
+    current = previous;
+
+    // First, restore the old handler setting for SIGFPE if no other thread needs mine
+    pthread_mutex_lock(&mutex);
+    if (!--installed)
     {
-        g_printerr("Error: sigaction failed: %s\n", strerror(errno));
+        if (sigaction(SIGFPE, &saOld, NULL))
+        {
+            g_printerr("Error: sigaction failed: %s\n", strerror(errno));
+        }
     }
+    pthread_mutex_unlock(&mutex);
 
     // Then, restore the old signal mask setting for this thread
     int rc = pthread_sigmask(SIG_SETMASK, &ssOld, NULL);
@@ -58,7 +77,7 @@ SigfpeHandler::~SigfpeHandler()
 
 void SigfpeHandler::resetCode()
 {
-    code = 0;
+    context.sigfpeCode = 0;
 
     // Unblock SIGFPE for the next sigsetjmp call
     int rc = pthread_sigmask(SIG_UNBLOCK, &ssFpe, NULL);
@@ -78,7 +97,7 @@ int SigfpeHandler::getCode()
         g_printerr("Error: pthread_sigcmask failed: %s\n", strerror(rc));
     }
 
-    return code;
+    return context.sigfpeCode;
 }
 
 
@@ -86,9 +105,9 @@ void SigfpeHandler::handler(int no, siginfo_t *si, void *uc)
 {
     (void)uc; // unused
 
-    if (no == SIGFPE)
+    if (no == SIGFPE && current)
     {
-        code = si->si_code;
-        siglongjmp(env, 1);
+        current->sigfpeCode = si->si_code;
+        siglongjmp(current->sigfpeEnv, 1);
     }
 }
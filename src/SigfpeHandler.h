@@ -5,8 +5,10 @@
 #define IKURA_SIGFPEHANDLER_H
 
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
+#include "EvaluationContext.h"
 
 
 namespace hnrt
@@ -16,10 +18,10 @@ namespace hnrt
     //
     // How to use:
     //
-    // SigfpeHandler handler;
+    // SigfpeHandler handler(context);
     // ...
     // handler.resetCode(); // SIGFPE unblocked
-    // if (sigsetjmp(SigfpeHandler::env, 1) == 0)
+    // if (sigsetjmp(context.getSigfpeEnv(), 1) == 0)
     // {
     //   do some arithmetic operation;
     // }
@@ -39,13 +41,16 @@ namespace hnrt
     //     break;
     // }
     //
+    // The jump buffer and the code are kept in the given context,
+    // which the signal handler finds through the thread-local pointer to it.
+    // The signal handler itself is process-wide; it is installed by the first instance
+    // and the old one is restored by the last instance on any thread.
+    //
     class SigfpeHandler
     {
     public:
 
-        static sigjmp_buf env;
-
-        SigfpeHandler();
+        SigfpeHandler(EvaluationContext& context);
         ~SigfpeHandler();
         void resetCode();
         int getCode();
@@ -54,14 +59,17 @@ namespace hnrt
 
         static void handler(int no, siginfo_t *si, void *uc);
 
-        SigfpeHandler(const SigfpeHandler&) {}
+        SigfpeHandler(const SigfpeHandler& other) : context(other.context) {}
 
-        static volatile int code;
+        static __thread EvaluationContext* current;
+        static pthread_mutex_t mutex;
+        static int installed; // number of instances alive
+        static struct sigaction saOld;
 
+        EvaluationContext& context;
+        EvaluationContext* previous;
         sigset_t ssFpe;
         sigset_t ssOld;
-        struct sigaction saFpe;
-        struct sigaction saOld;
     };
 }
 
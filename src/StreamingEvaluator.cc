@@ -0,0 +1,679 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#include <libintl.h>
+#include <limits.h>
+#include <string.h>
+#include "StreamingEvaluator.h"
+#include "Arithmetic.h"
+#include "Exception.h"
+#include "VariableStore.h"
+
+
+using namespace hnrt;
+
+
+//
+// Exception to be rethrown at the end of the input
+//
+class StreamingEvaluator::Failure
+{
+public:
+
+    virtual ~Failure() {}
+    virtual void raise() const = 0;
+};
+
+
+template<class T>
+class StreamingEvaluator::FailureOf : public StreamingEvaluator::Failure
+{
+public:
+
+    FailureOf(const T& exception_) : exception(exception_) {}
+    virtual void raise() const { throw exception; }
+
+private:
+
+    T exception;
+};
+
+
+//
+// s .......... pointer to string to evaluate
+// n .......... length of string in bytes
+// context .... context of the evaluation
+//
+StreamingEvaluator::StreamingEvaluator(const char* s_, size_t n_, EvaluationContext& context_)
+    : s(s_)
+    , n(n_)
+    , context(context_)
+    , lexer(NULL)
+    , skipping(false)
+    , operatorBottom(0)
+    , valueBottom(0)
+    , sumBottom(0)
+    , hasOperand(false)
+    , operandType(ET_INCOMPLETE)
+    , operand()
+    , summing(false)
+    , variable(-1)
+    , openBlocks(0)
+    , assignments(0)
+    , text()
+    , failure(NULL)
+{
+}
+
+
+StreamingEvaluator::~StreamingEvaluator()
+{
+    delete failure;
+}
+
+
+Number StreamingEvaluator::run()
+{
+    if (context.isPermanent() && (memchr(s, '=', n) || VariableStore::instance().hasImpure()))
+    {
+        // The variables must be left unchanged if the string turns out to be invalid.
+        run(false);
+    }
+    return run(true);
+}
+
+
+//
+// Parses the string through, evaluating it unless told otherwise.
+//
+Number StreamingEvaluator::run(bool evaluating)
+{
+    Lexer lexer_(s, n);
+    lexer = &lexer_;
+    skipping = !evaluating;
+    hasOperand = false;
+    operandType = ET_INCOMPLETE;
+    operand = Number();
+    summing = false;
+    variable = -1;
+    openBlocks = 0;
+    assignments = 0;
+    text.clear();
+    operatorBottom = context.getOperators().size();
+    valueBottom = context.getValues().size();
+    sumBottom = context.getSums().size();
+    try
+    {
+        int sym;
+        while ((sym = lexer_.getSym()) != SYM_EOF)
+        {
+            shift(sym);
+            if (assignments)
+            {
+                // The string form of the right side of an assignment is the value of the variable.
+                const char* string = lexer_.getString();
+                text.insert(text.end(), string, string + strlen(string));
+            }
+        }
+        if (!hasOperand)
+        {
+            throw InvalidExpressionException(gettext("Invalid syntax."));
+        }
+        else if (openBlocks)
+        {
+            throw InvalidExpressionException(gettext("Right parenthesis is missing."));
+        }
+        evaluateVariable();
+        reduce(0);
+        takeSum();
+    }
+    catch (...)
+    {
+        clear();
+        throw;
+    }
+    lexer = NULL;
+    if (failure)
+    {
+        failure->raise();
+    }
+    return operand;
+}
+
+
+//
+// Advances the evaluator by the given token in the same way as Parser::shift does.
+//
+void StreamingEvaluator::shift(int sym)
+{
+    if (!hasOperand)
+    {
+        switch (sym)
+        {
+        case SYM_INTEGER:
+            operandType = ET_INTEGER;
+            operand = lexer->getInteger();
+            break;
+        case SYM_REALNUMBER:
+            operandType = ET_REALNUMBER;
+            if (!skipping)
+            {
+                try
+                {
+                    if (lexer->getRealNumber().getType() == NT_REALNUMBER)
+                    {
+                        Arithmetic::validate(lexer->getRealNumber().getRealNumber());
+                    }
+                    operand = lexer->getRealNumber();
+                }
+                catch (const Exception&)
+                {
+                    fail();
+                }
+            }
+            break;
+        case SYM_IDENTIFIER:
+            variable = VariableStore::instance().find(lexer->getString());
+            if (variable < 0)
+            {
+                throw InvalidExpressionException(Glib::ustring::compose(gettext("%1: Not exist"), lexer->getString()));
+            }
+            // It is not evaluated until it turns out not to be assigned.
+            operandType = ET_VARIABLE;
+            break;
+        default: // prefix operators, or invalid including SYM_INCOMPLETE_OPERATOR
+        {
+            ExpressionType type = getPrefixOperator(sym);
+            if (type == ET_INCOMPLETE)
+            {
+                throw InvalidExpressionException(gettext("Invalid syntax."));
+            }
+            pushOperator(type);
+            if (type == ET_BLOCK)
+            {
+                openBlocks++;
+            }
+            return;
+        }
+        }
+        hasOperand = true;
+    }
+    else
+    {
+        std::vector<PendingOperator>& operators = context.getOperators();
+        switch (sym)
+        {
+        case SYM_POWMOD:
+            reduce(4);
+            if (operators.size() == operatorBottom || operators.back().type != ET_POW)
+            {
+                throw InvalidExpressionException(gettext("Invalid syntax."));
+            }
+            // The power waits for the modulus with the exponent on the value stack above the base.
+            evaluateVariable();
+            takeSum();
+            context.getValues().push_back(operand);
+            operators.back().type = ET_POWMOD;
+            hasOperand = false;
+            break;
+        case SYM_ASSIGN:
+            reduce(1);
+            pushAssignOperator();
+            break;
+        case SYM_RPAREN:
+            reduce(1);
+            while (operators.size() > operatorBottom && operators.back().type == ET_ASSIGN)
+            {
+                reduceOperator();
+            }
+            if (operators.size() == operatorBottom)
+            {
+                throw InvalidExpressionException(gettext("Invalid syntax."));
+            }
+            reduceOperator();
+            break;
+        default:
+        {
+            ExpressionType type = getInfixOperator(sym);
+            if (type != ET_INCOMPLETE)
+            {
+                reduce(getLevel(type));
+                pushOperator(type);
+                break;
+            }
+            else if (openBlocks)
+            {
+                throw InvalidExpressionException(gettext("Right parenthesis is missing."));
+            }
+            throw InvalidExpressionException(gettext("Invalid syntax."));
+        }
+        }
+    }
+}
+
+
+//
+// Evaluates the variable shifted last if it is not yet.
+//
+void StreamingEvaluator::evaluateVariable()
+{
+    if (variable < 0)
+    {
+        return;
+    }
+    if (!skipping)
+    {
+        try
+        {
+            operand = VariableStore::instance().evaluate(variable, context);
+        }
+        catch (const Exception&)
+        {
+            fail();
+        }
+    }
+    variable = -1;
+}
+
+
+//
+// Pushes the operator that takes the operand, if any, as its left side.
+// + or - after a sum of two or more operands takes the sum on the top of the sum stack
+// instead, which is started with the operand if it is not yet, as ChainExpression is.
+//
+void StreamingEvaluator::pushOperator(ExpressionType type)
+{
+    PendingOperator op = { type, -1, 0, false };
+    if (hasOperand)
+    {
+        evaluateVariable();
+        if ((type == ET_ADD || type == ET_SUBTRACT) && (operandType == ET_ADD || operandType == ET_SUBTRACT))
+        {
+            if (!summing)
+            {
+                std::vector<PairwiseSum>& sums = context.getSums();
+                sums.resize(sums.size() + 1);
+                if (!skipping)
+                {
+                    sums.back().start(operand);
+                }
+            }
+            summing = false;
+            op.chained = true;
+        }
+        else
+        {
+            takeSum();
+            context.getValues().push_back(operand);
+        }
+    }
+    context.getOperators().push_back(op);
+    hasOperand = false;
+}
+
+
+void StreamingEvaluator::pushAssignOperator()
+{
+    if (operandType != ET_VARIABLE)
+    {
+        throw InvalidExpressionException(gettext("Non variable cannot be assigned expression"));
+    }
+    const Glib::ustring& key = VariableStore::instance().getKey(variable);
+    if (key.length() > 1)
+    {
+        // Only variable A to Z are allowed to be changed; others are treated as read-only.
+        throw InvalidExpressionException(Glib::ustring::compose(gettext("%1: Read only"), key));
+    }
+    if (!assignments)
+    {
+        text.clear();
+    }
+    // The right side follows "=", which is appended to the text after this.
+    PendingOperator op = { ET_ASSIGN, -1, text.size() + 1, false };
+    if (!skipping)
+    {
+        try
+        {
+            // as AssignExpression::evaluate does
+            context.setInEvaluation(variable);
+            op.slot = variable;
+        }
+        catch (const Exception&)
+        {
+            fail();
+        }
+    }
+    context.getOperators().push_back(op);
+    assignments++;
+    variable = -1;
+    hasOperand = false;
+}
+
+
+//
+// Replaces the operand with the sum on the top of the sum stack if it is the sum not yet taken out.
+//
+void StreamingEvaluator::takeSum()
+{
+    if (!summing)
+    {
+        return;
+    }
+    std::vector<PairwiseSum>& sums = context.getSums();
+    if (!skipping)
+    {
+        try
+        {
+            operand = sums.back().getSum();
+        }
+        catch (const Exception&)
+        {
+            fail();
+        }
+    }
+    sums.pop_back();
+    summing = false;
+}
+
+
+//
+// Reduces the operators whose precedence is not lower than the given level.
+//
+void StreamingEvaluator::reduce(int level)
+{
+    std::vector<PendingOperator>& operators = context.getOperators();
+    while (operators.size() > operatorBottom && getLevel(operators.back().type) >= level)
+    {
+        reduceOperator();
+    }
+}
+
+
+//
+// Applies the innermost operator to its left side, if any, and the operand.
+//
+void StreamingEvaluator::reduceOperator()
+{
+    evaluateVariable();
+    takeSum();
+    std::vector<PendingOperator>& operators = context.getOperators();
+    PendingOperator op = operators.back();
+    operators.pop_back();
+    ExpressionType type = (ExpressionType)op.type;
+    if (op.chained)
+    {
+        // The sum is taken out when the operand is used next unless + or - continues it.
+        if (!skipping)
+        {
+            try
+            {
+                context.getSums().back().add(operand, type == ET_SUBTRACT);
+            }
+            catch (const Exception&)
+            {
+                fail();
+            }
+        }
+        summing = true;
+        operandType = type;
+        hasOperand = true;
+        return;
+    }
+    switch (type)
+    {
+    case ET_BLOCK:
+        openBlocks--;
+        break;
+    case ET_ASSIGN:
+        assignments--;
+        if (op.slot >= 0)
+        {
+            context.unsetInEvaluation(op.slot);
+            if (context.isPermanent())
+            {
+                try
+                {
+                    VariableStore::instance().setValue(op.slot, std::string(text.begin() + op.start, text.end()));
+                }
+                catch (const Exception&)
+                {
+                    fail();
+                }
+            }
+        }
+        break;
+    case ET_ADD:
+    case ET_SUBTRACT:
+    case ET_MULTIPLY:
+    case ET_DIVIDE:
+    case ET_HYPOT:
+    case ET_POW:
+    {
+        std::vector<Number>& values = context.getValues();
+        Number left = values.back();
+        values.pop_back();
+        if (!skipping)
+        {
+            try
+            {
+                operand = apply(type, left, Number(), operand, context);
+            }
+            catch (const Exception&)
+            {
+                fail();
+            }
+        }
+        break;
+    }
+    case ET_POWMOD:
+    {
+        std::vector<Number>& values = context.getValues();
+        Number exponent = values.back();
+        values.pop_back();
+        Number base = values.back();
+        values.pop_back();
+        if (!skipping)
+        {
+            try
+            {
+                operand = apply(type, base, exponent, operand, context);
+            }
+            catch (const Exception&)
+            {
+                fail();
+            }
+        }
+        break;
+    }
+    default: // unary operators
+        if (!skipping)
+        {
+            try
+            {
+                operand = apply(type, Number(), Number(), operand, context);
+            }
+            catch (const Exception&)
+            {
+                fail();
+            }
+        }
+        break;
+    }
+    operandType = type;
+    hasOperand = true;
+}
+
+
+int StreamingEvaluator::getLevel(int type)
+{
+    switch (type)
+    {
+    case ET_BLOCK:
+    case ET_ASSIGN:
+        return 0;
+    case ET_ADD:
+    case ET_SUBTRACT:
+        return 1;
+    case ET_MULTIPLY:
+    case ET_DIVIDE:
+        return 2;
+    case ET_HYPOT:
+    case ET_POW:
+    case ET_POWMOD:
+        return 3;
+    default: // unary operators
+        return 4;
+    }
+}
+
+
+ExpressionType StreamingEvaluator::getPrefixOperator(int sym)
+{
+    switch (sym)
+    {
+    case SYM_LPAREN:
+        return ET_BLOCK;
+    case SYM_MINUS:
+        return ET_UNARY_MINUS;
+    case SYM_ABS:
+        return ET_ABS;
+    case SYM_CBRT:
+        return ET_CBRT;
+    case SYM_COS:
+        return ET_COS;
+    case SYM_EXP:
+        return ET_EXP;
+    case SYM_LOG:
+        return ET_LOG;
+    case SYM_LOG2:
+        return ET_LOG2;
+    case SYM_LOG10:
+        return ET_LOG10;
+    case SYM_SIN:
+        return ET_SIN;
+    case SYM_SQRT:
+        return ET_SQRT;
+    case SYM_TAN:
+        return ET_TAN;
+    default:
+        return ET_INCOMPLETE;
+    }
+}
+
+
+ExpressionType StreamingEvaluator::getInfixOperator(int sym)
+{
+    switch (sym)
+    {
+    case SYM_PLUS:
+        return ET_ADD;
+    case SYM_MINUS:
+        return ET_SUBTRACT;
+    case SYM_MULTIPLY:
+        return ET_MULTIPLY;
+    case SYM_DIVIDE:
+        return ET_DIVIDE;
+    case SYM_HYPOT:
+        return ET_HYPOT;
+    case SYM_POW:
+        return ET_POW;
+    default:
+        return ET_INCOMPLETE;
+    }
+}
+
+
+Number StreamingEvaluator::apply(int type, const Number& left, const Number& exponent, const Number& right, EvaluationContext& context)
+{
+    switch (type)
+    {
+    case ET_ADD:
+    case ET_SUBTRACT:
+    case ET_MULTIPLY:
+    case ET_DIVIDE:
+    case ET_HYPOT:
+    case ET_POW:
+        return BinaryExpression::apply((ExpressionType)type, left, right, context);
+    case ET_POWMOD:
+        return PowModExpression::apply(left, exponent, right, context);
+    default: // unary operators
+        return UnaryExpression::apply((ExpressionType)type, right);
+    }
+}
+
+
+//
+// Keeps the exception being handled, and stops evaluating the rest of the input
+// as Expression::evaluate would not go any further.
+// This must be called in a handler of Exception.
+//
+void StreamingEvaluator::fail()
+{
+    try
+    {
+        throw;
+    }
+    catch (const RecursiveVariableAccessException& ex)
+    {
+        failure = new FailureOf<RecursiveVariableAccessException>(ex);
+    }
+    catch (const DivideByZeroException& ex)
+    {
+        failure = new FailureOf<DivideByZeroException>(ex);
+    }
+    catch (const OverflowException& ex)
+    {
+        failure = new FailureOf<OverflowException>(ex);
+    }
+    catch (const UnderflowException& ex)
+    {
+        failure = new FailureOf<UnderflowException>(ex);
+    }
+    catch (const EvaluationInabilityException& ex)
+    {
+        failure = new FailureOf<EvaluationInabilityException>(ex);
+    }
+    catch (const InvalidExpressionException& ex)
+    {
+        failure = new FailureOf<InvalidExpressionException>(ex);
+    }
+    catch (const InvalidCharException& ex)
+    {
+        failure = new FailureOf<InvalidCharException>(ex);
+    }
+    catch (const Exception& ex)
+    {
+        failure = new FailureOf<Exception>(ex);
+    }
+    skipping = true;
+    // The assignments in evaluation are abandoned.
+    std::vector<PendingOperator>& operators = context.getOperators();
+    for (size_t index = operatorBottom; index < operators.size(); index++)
+    {
+        if (operators[index].type == ET_ASSIGN && operators[index].slot >= 0)
+        {
+            context.unsetInEvaluation(operators[index].slot);
+            operators[index].slot = -1;
+        }
+    }
+}
+
+
+//
+// Removes what this evaluation has left in the context.
+//
+void StreamingEvaluator::clear()
+{
+    std::vector<PendingOperator>& operators = context.getOperators();
+    for (size_t index = operatorBottom; index < operators.size(); index++)
+    {
+        if (operators[index].type == ET_ASSIGN && operators[index].slot >= 0)
+        {
+            context.unsetInEvaluation(operators[index].slot);
+        }
+    }
+    operators.resize(operatorBottom);
+    context.getValues().resize(valueBottom);
+    context.getSums().resize(sumBottom);
+    lexer = NULL;
+}
@@ -0,0 +1,121 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#ifndef IKURA_STREAMINGEVALUATOR_H
+#define IKURA_STREAMINGEVALUATOR_H
+
+
+#include <vector>
+#include "Expression.h"
+#include "Lexer.h"
+
+
+namespace hnrt
+{
+    //
+    // Evaluator of a complete expression in string form that builds no expression tree
+    //
+    // This accepts the same strings as Parser does with complete set to true, and
+    // each subexpression is evaluated as soon as the parser reduces it, in the same order as
+    // Expression::evaluate does, so that the value and the exception are the same as those of
+    // parsing the string into a tree and evaluating it once.
+    // The left sides of the operators waiting for their right sides are kept on the value stack, and
+    // the operators on the operator stack, both of which are in EvaluationContext and reused.
+    // A chain of three or more operands of + and - is summed up on the sum stack in the same way
+    // as ChainExpression, which Parser builds for it.
+    //
+    // The exception thrown by an evaluation is kept until the end of the input,
+    // as the tree is not evaluated at all if the string turns out to be invalid.
+    // For the same reason, if the evaluation can change the variables,
+    // the string is parsed once without evaluation before.
+    //
+    // How to use:
+    //
+    // StreamingEvaluator evaluator(s, n, context);
+    // Number value = evaluator.run();
+    //
+    class StreamingEvaluator
+    {
+    public:
+
+        StreamingEvaluator(const char* s, size_t n, EvaluationContext& context);
+        ~StreamingEvaluator();
+
+        //
+        // Evaluates the string given to the constructor and returns the resulting value.
+        // If the string is invalid, it throws the same exception as Parser does;
+        // otherwise it throws the same exception as Expression::evaluate does, if any.
+        //
+        Number run();
+
+        //
+        // The rules below are shared with IncrementalParser, which evaluates the input being typed in,
+        // so that the two cannot disagree on how an expression is parsed or what value it has.
+        //
+
+        //
+        // Returns the precedence of the given operator waiting for its right side.
+        // ET_BLOCK and ET_ASSIGN are not reduced by any binary operator.
+        //
+        static int getLevel(int type);
+
+        //
+        // Returns the unary operator or ET_BLOCK that the given symbol puts before an operand;
+        // ET_INCOMPLETE if the symbol does not.
+        //
+        static ExpressionType getPrefixOperator(int sym);
+
+        //
+        // Returns the binary operator that the given symbol puts after an operand;
+        // ET_INCOMPLETE if the symbol does not.
+        // SYM_POWMOD is not one of them, as it turns the power before it into ET_POWMOD.
+        //
+        static ExpressionType getInfixOperator(int sym);
+
+        //
+        // Applies the given operator to the given values and returns the resulting value,
+        // throwing the same exception as Expression::evaluate does.
+        // A unary operator is applied to right only, and the exponent is used only by ET_POWMOD.
+        //
+        static Number apply(int type, const Number& left, const Number& exponent, const Number& right, EvaluationContext& context);
+
+    protected:
+
+        class Failure;
+        template<class T> class FailureOf;
+
+        StreamingEvaluator(const StreamingEvaluator&);
+        void operator =(const StreamingEvaluator&);
+        Number run(bool evaluating);
+        void shift(int sym);
+        void evaluateVariable();
+        void pushOperator(ExpressionType type);
+        void pushAssignOperator();
+        void reduce(int level);
+        void reduceOperator();
+        void takeSum();
+        void fail();
+        void clear();
+
+        const char* s;
+        size_t n;
+        EvaluationContext& context;
+        Lexer* lexer;
+        bool skipping; // true while no evaluation is to be done
+        size_t operatorBottom; // of the operator stack in the context
+        size_t valueBottom; // of the value stack in the context
+        size_t sumBottom; // of the sum stack in the context
+        bool hasOperand; // true if the last token completed an operand
+        ExpressionType operandType;
+        Number operand;
+        bool summing; // true if the operand is to be replaced with the sum on the top of the sum stack
+        int variable; // slot of the variable not yet evaluated if operandType is ET_VARIABLE
+        int openBlocks;
+        int assignments; // operators of ET_ASSIGN on the stack
+        std::vector<char> text; // string form of the input since the outermost assignment
+        Failure* failure; // of the first evaluation that failed; NULL if none
+    };
+}
+
+
+#endif //!IKURA_STREAMINGEVALUATOR_H
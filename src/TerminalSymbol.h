@@ -35,6 +35,7 @@ namespace hnrt
         SYM_SIN,
         SYM_SQRT,
         SYM_TAN,
+        SYM_POWMOD,
     };
 }
 
@@ -0,0 +1,146 @@
+// Copyright (C) 2014-2017 Hideaki Narita
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "InputBuffer.h"
+#include "LocaleInfo.h"
+#include "OperatorInfo.h"
+#include "VariableStore.h"
+
+
+using namespace hnrt;
+
+
+static const char* programName = "ikura-test";
+static int failureCount = 0;
+static std::string tooltip; // last one emitted by InputBuffer
+static std::string recursiveKey; // last one emitted by InputBuffer
+
+
+static void expect(const char* name, const std::string& actual, const char* expected)
+{
+    if (actual != expected)
+    {
+        fprintf(stderr, "%s: %s: expected \"%s\" but got \"%s\"\n", programName, name, expected, actual.c_str());
+        failureCount++;
+    }
+}
+
+
+static void onTooltipChange(const char* s)
+{
+    tooltip = s;
+}
+
+
+static void onRecursiveVariableAccess(const char* key)
+{
+    recursiveKey = key;
+}
+
+
+static std::string complement(const char* s)
+{
+    std::vector<char> buffer(s, s + strlen(s));
+    OperatorInfo::instance().Complement(buffer);
+    return std::string(buffer.begin(), buffer.end());
+}
+
+
+//
+// An operator is completed to the shortest one that the others begin with but its closing brace.
+//
+static void testOperatorCompletion()
+{
+    expect("complement {p", complement("{p"), "{pow}");
+    expect("complement {pow", complement("{pow"), "{pow}");
+    expect("complement {powm", complement("{powm"), "{powmod}");
+    expect("complement {lo", complement("{lo"), "{log}");
+    expect("complement {log1", complement("{log1"), "{log10}");
+    expect("complement {s", complement("{s"), "{s");
+
+    InputBuffer input;
+    input.signalTooltipChange().connect(sigc::ptr_fun(&onTooltipChange));
+    input.assign("A=2");
+    input.evaluate();
+    input.assign("B=8");
+    input.evaluate();
+    input.assign("B/A{p");
+    expect("B/A{p", tooltip, "4");
+    input.putChar('3');
+    expect("B/A{p3", tooltip, "1");
+}
+
+
+//
+// The cached value of a variable does not hide the recursive reference
+// from the preview of an assignment.
+//
+static void testRecursiveCachedVariable()
+{
+    InputBuffer input;
+    input.signalTooltipChange().connect(sigc::ptr_fun(&onTooltipChange));
+    input.signalRecursiveVariableAccess().connect(sigc::ptr_fun(&onRecursiveVariableAccess));
+    input.assign("A=0");
+    input.evaluate();
+    input.assign("B=A+1");
+    input.evaluate();
+    input.assign("A=B");
+    expect("A=B preview", tooltip, "A: Recursively referenced");
+    recursiveKey.clear();
+    input.evaluate();
+    expect("A=B evaluation", recursiveKey, "A");
+    input.assign("B");
+    expect("B", tooltip, "1");
+}
+
+
+//
+// The input nested deeper than the frames folded one by one on each keystroke
+// is previewed by the partial values kept in the frames.
+//
+static void testDeepNesting()
+{
+    InputBuffer input;
+    input.signalTooltipChange().connect(sigc::ptr_fun(&onTooltipChange));
+    std::string s;
+    for (int i = 0; i < 100; i++)
+    {
+        s += "(2*";
+    }
+    input.assign((s + "3").c_str());
+    expect("(2*...3", tooltip, "3802951800684688204490109616128");
+    input.assign((s + "(").c_str());
+    expect("(2*...(", tooltip, "Incomplete block");
+    input.assign(("(1/0+" + s + "3").c_str());
+    expect("(1/0+(2*...3", tooltip, "Division by zero");
+    s.clear();
+    for (int i = 0; i < 200; i++)
+    {
+        s += "(1.5*";
+    }
+    input.assign((s + "2").c_str());
+    expect("(1.5*...2", tooltip, "3.30584e+35");
+}
+
+
+int main(int argc, char *argv[])
+{
+    LocaleInfo::instance().init();
+    VariableStore::instance().addDefaults();
+
+    testOperatorCompletion();
+    testRecursiveCachedVariable();
+    testDeepNesting();
+
+    if (failureCount)
+    {
+        fprintf(stderr, "%s: %d failed\n", programName, failureCount);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -2,9 +2,14 @@
 
 
 #include <string.h>
+#include <algorithm>
 #include "VariableStore.h"
 #include "Exception.h"
+#include "Expression.h"
+#include "Lexer.h"
 #include "LocaleInfo.h"
+#include "Optimizer.h"
+#include "Program.h"
 
 
 using namespace hnrt;
@@ -15,7 +20,44 @@ VariableStore VariableStore::singleton;
 
 bool VariableKeyLessThan::operator ()(const Glib::ustring& a, const Glib::ustring& b) const
 {
-    return a < b;
+    return strcmp(a.c_str(), b.c_str()) < 0;
+}
+
+
+VariableStore::~VariableStore()
+{
+    for (size_t slot = 0; slot < slots.size(); slot++)
+    {
+        invalidateCache(slot);
+        delete slots[slot].arena;
+    }
+}
+
+
+//
+// Adds the variables A to Z and the built-in read-only constants.
+// periodToDecimalPoint is called at the end of this method.
+//
+void VariableStore::addDefaults()
+{
+    for (int c = 'A'; c <= 'Z'; c++)
+    {
+        char key[2];
+        key[0] = c;
+        key[1] = 0;
+        add(key);
+    }
+    add("PI", "3.1415926535897932384626433832795029", BigReal::pi);
+    add("E$", "2.7182818284590452353602874713526625", BigReal::e);
+    add("SHRT_MIN", "-32768");
+    add("SHRT_MAX", "32767");
+    add("USHRT_MAX", "65535");
+    add("INT_MIN", "-2147483648");
+    add("INT_MAX", "2147483647");
+    add("UINT_MAX", "4294967295");
+    add("LONG_MIN", "-9223372036854775808");
+    add("LONG_MAX", "9223372036854775807");
+    periodToDecimalPoint();
 }
 
 
@@ -29,25 +71,59 @@ void VariableStore::periodToDecimalPoint()
     {
         return;
     }
-    for (VariableMap::iterator iter = VariableMap::begin(); iter != VariableMap::end(); iter++)
+    for (size_t slot = 0; slot < slots.size(); slot++)
     {
-        const Glib::ustring& key = iter->first;
-        Glib::ustring& value = iter->second;
+        const Glib::ustring& value = slots[slot].value;
         ssize_t i = value.find('.');
         if (i == -1)
         {
             continue;
         }
-        value = LocaleInfo::periodToDecimalPointString(value);
-        sigChange.emit(key.c_str(), value.c_str());
+        change(slot, LocaleInfo::periodToDecimalPointString(value));
+    }
+}
+
+
+//
+// Returns the slot index of the given variable.
+// If not found, -1 is returned.
+//
+int VariableStore::find(const Glib::ustring& key) const
+{
+    VariableIndexMap::const_iterator iter = index.find(key);
+    if (iter != index.end() && slots[iter->second].defined)
+    {
+        return iter->second;
     }
+    return -1;
 }
 
 
-bool VariableStore::hasKey(const Glib::ustring& key) const
+//
+// Returns the slot index of the given key.
+// If not found, a new slot is allocated, which is left undefined.
+//
+int VariableStore::intern(const Glib::ustring& key)
 {
-    VariableMap::const_iterator iter = VariableMap::find(key);
-    return iter != VariableMap::end();
+    VariableIndexMap::const_iterator iter = index.find(key);
+    if (iter != index.end())
+    {
+        return iter->second;
+    }
+    int slot = (int)slots.size();
+    slots.push_back(VariableSlot());
+    VariableSlot& v = slots.back();
+    v.key = key;
+    v.defined = false;
+    v.expr = NULL;
+    v.arena = NULL;
+    v.program = NULL;
+    v.valid = false;
+    v.pure = true;
+    v.constant = NULL;
+    v.mark = 0;
+    index.insert(VariableIndexMapEntry(key, slot));
+    return slot;
 }
 
 
@@ -55,115 +131,471 @@ bool VariableStore::hasKey(const Glib::ustring& key) const
 // Searchs the map for the given key and
 // returns the value associated with it.
 // If not found, an empty string is returned.
-// If the given key is in evaluation, RecursiveVariableAccessException is thrown.
 //
 Glib::ustring VariableStore::getValue(const Glib::ustring& key) const
 {
-    if (isInEvaluation(key))
-    {
-        throw RecursiveVariableAccessException(key);
-    }
-    Glib::ustring value;
-    VariableMap::const_iterator iter = VariableMap::find(key);
-    if (iter != VariableMap::end())
+    int slot = find(key);
+    if (slot < 0)
     {
-        value = iter->second;
+        return Glib::ustring();
     }
-    return value;
+    return slots[slot].value;
 }
 
 
+//
+// Changes the value of the given variable.
+// The variables depending on it are recomputed and
+// signalChange is emitted once for each of the affected variables.
+// If the value refers to the given variable directly or indirectly,
+// RecursiveVariableAccessException is thrown and nothing is changed.
+//
 void VariableStore::setValue(const Glib::ustring& key, const Glib::ustring& value)
 {
-    VariableMap::iterator iter = VariableMap::find(key);
-    if (iter != VariableMap::end())
+    int slot = find(key);
+    if (slot >= 0)
     {
-        iter->second = value;
-        sigChange.emit(key.c_str(), value.c_str());
+        change(slot, value);
     }
 }
 
 
+void VariableStore::setValue(int slot, const Glib::ustring& value)
+{
+    change(slot, value);
+}
+
+
 void VariableStore::add(const Glib::ustring& key)
 {
-    VariableMap::iterator iter = VariableMap::find(key);
-    if (iter == VariableMap::end())
+    if (find(key) < 0)
     {
-        Glib::ustring value;
-        VariableMap::insert(VariableMapEntry(key, value));
-        sigAdd.emit(key.c_str(), value.c_str());
+        int slot = intern(key);
+        slots[slot].defined = true;
+        generation++;
+        sigAdd.emit(key.c_str(), slots[slot].value.c_str());
     }
 }
 
 
 void VariableStore::add(const Glib::ustring& key, const Glib::ustring& value)
 {
-    VariableMap::iterator iter = VariableMap::find(key);
-    if (iter != VariableMap::end())
+    int slot = find(key);
+    if (slot >= 0)
     {
-        iter->second = value;
-        sigChange.emit(key.c_str(), value.c_str());
+        change(slot, value);
     }
     else
     {
-        VariableMap::insert(VariableMapEntry(key, value));
+        slot = intern(key);
+        std::vector<int> references;
+        getReferences(value, references);
+        checkCycle(slot, references);
+        VariableSlot& v = slots[slot];
+        v.defined = true;
+        v.value = value;
+        setDependencies(slot, references);
+        generation++;
+        // The values referring to the new variable could not be evaluated so far.
+        std::vector<int> affected;
+        getAffected(slot, affected);
+        recompute(affected);
         sigAdd.emit(key.c_str(), value.c_str());
     }
 }
 
 
-bool VariableStore::isInEvaluation(const Glib::ustring& key) const
+void VariableStore::add(const Glib::ustring& key, const Glib::ustring& value, BigReal* (*constant)(size_t))
+{
+    // The slot is made ahead, so that the value is not evaluated without the function.
+    slots[intern(key)].constant = constant;
+    add(key, value);
+}
+
+
+void VariableStore::change(int slot, const Glib::ustring& value)
+{
+    std::vector<int> references;
+    getReferences(value, references);
+    checkCycle(slot, references);
+    invalidateCache(slot); // the parsed form refers to the old value.
+    slots[slot].value = value;
+    setDependencies(slot, references);
+    generation++;
+    std::vector<int> affected;
+    getAffected(slot, affected);
+    recompute(affected);
+    for (std::vector<int>::const_iterator i = affected.begin(); i != affected.end(); i++)
+    {
+        const VariableSlot& v = slots[*i];
+        sigChange.emit(v.key.c_str(), v.value.c_str());
+    }
+}
+
+
+//
+// Collects the slots of the names referred to by the given value.
+// The names need not exist yet; they are linked once they are added.
+//
+void VariableStore::getReferences(const Glib::ustring& value, std::vector<int>& references)
 {
-    VariableKeySet::const_iterator iter = inEvaluation.find(key);
-    return iter != inEvaluation.end();
+    try
+    {
+        Lexer lexer(value.c_str(), value.bytes());
+        int sym;
+        while ((sym = lexer.getSym()) != SYM_EOF)
+        {
+            if (sym == SYM_IDENTIFIER)
+            {
+                references.push_back(intern(lexer.getString()));
+            }
+        }
+    }
+    catch (const Exception&)
+    {
+        // The value cannot be evaluated anyway.
+    }
+    std::sort(references.begin(), references.end());
+    references.erase(std::unique(references.begin(), references.end()), references.end());
 }
 
 
 //
-// Adds the given key to inEvaluation set.
-// If the same key is already in this set, RecursiveVariableAccessException is thrown.
+// Throws RecursiveVariableAccessException if the given slot is reachable from the references.
 //
-void VariableStore::setInEvaluation(const Glib::ustring& key)
+void VariableStore::checkCycle(int slot, const std::vector<int>& references)
+{
+    traversal++;
+    std::vector<int> stack(references);
+    while (!stack.empty())
+    {
+        int next = stack.back();
+        stack.pop_back();
+        if (next == slot)
+        {
+            throw RecursiveVariableAccessException(slots[slot].key);
+        }
+        VariableSlot& v = slots[next];
+        if (v.mark == traversal)
+        {
+            continue;
+        }
+        v.mark = traversal;
+        stack.insert(stack.end(), v.dependencies.begin(), v.dependencies.end());
+    }
+}
+
+
+void VariableStore::setDependencies(int slot, const std::vector<int>& references)
 {
-    if (isInEvaluation(key))
+    std::vector<int>& current = slots[slot].dependencies;
+    for (std::vector<int>::const_iterator iter = current.begin(); iter != current.end(); iter++)
+    {
+        std::vector<int>& dependents = slots[*iter].dependents;
+        dependents.erase(std::remove(dependents.begin(), dependents.end(), slot), dependents.end());
+    }
+    current = references;
+    for (std::vector<int>::const_iterator iter = current.begin(); iter != current.end(); iter++)
     {
-        throw RecursiveVariableAccessException(key);
+        slots[*iter].dependents.push_back(slot);
     }
-    inEvaluation.insert(key);
 }
 
 
 //
-// Removes the given key from inEvaluation set.
+// Returns the given slot and the ones depending on it in topological order.
+// The dependents are walked depth-first with an explicit stack of slots and
+// the index of the next dependent to visit, as a long chain of variables
+// would overflow the call stack otherwise.
 //
-void VariableStore::unsetInEvaluation(const Glib::ustring& key)
+void VariableStore::getAffected(int slot, std::vector<int>& affected)
 {
-    VariableKeySet::iterator iter = inEvaluation.find(key);
-    if (iter != inEvaluation.end())
+    traversal++;
+    std::vector<std::pair<int, size_t> > stack;
+    slots[slot].mark = traversal;
+    stack.push_back(std::pair<int, size_t>(slot, 0));
+    while (!stack.empty())
     {
-        inEvaluation.erase(iter);
+        std::pair<int, size_t>& top = stack.back();
+        const std::vector<int>& dependents = slots[top.first].dependents;
+        if (top.second == dependents.size())
+        {
+            affected.push_back(top.first);
+            stack.pop_back();
+            continue;
+        }
+        int next = dependents[top.second++];
+        VariableSlot& v = slots[next];
+        if (v.mark == traversal)
+        {
+            continue;
+        }
+        v.mark = traversal;
+        stack.push_back(std::pair<int, size_t>(next, 0));
     }
+    std::reverse(affected.begin(), affected.end());
+}
+
+
+//
+// Marks the evaluated values of the given slots out of date and
+// evaluates them again in the given order so that reading them costs only a lookup.
+// The value that cannot be evaluated now is left out of date.
+// As the given order is topological, the purity of each slot is also determined
+// from the ones it depends on in the same pass.
+//
+void VariableStore::recompute(const std::vector<int>& affected)
+{
+    for (std::vector<int>::const_iterator iter = affected.begin(); iter != affected.end(); iter++)
+    {
+        VariableSlot& v = slots[*iter];
+        bool pure = v.pure;
+        v.valid = false;
+        v.pure = v.value.find('=') == Glib::ustring::npos;
+        for (std::vector<int>::const_iterator dep = v.dependencies.begin(); v.pure && dep != v.dependencies.end(); dep++)
+        {
+            v.pure = slots[*dep].pure;
+        }
+        if (pure && !v.pure)
+        {
+            // Optimizer may have shared the variables in the parsed form, which is no longer allowed.
+            invalidateCache(*iter);
+        }
+    }
+    EvaluationContext context;
+    for (std::vector<int>::const_iterator iter = affected.begin(); iter != affected.end(); iter++)
+    {
+        if (!slots[*iter].defined || !slots[*iter].pure || isComputed(*iter))
+        {
+            // The constant is computed on demand, as it takes long in a high precision.
+            continue;
+        }
+        try
+        {
+            evaluate(*iter, context);
+        }
+        catch (const Exception&)
+        {
+        }
+    }
+}
+
+
+bool VariableStore::hasImpure() const
+{
+    for (size_t slot = 0; slot < slots.size(); slot++)
+    {
+        if (slots[slot].defined && !slots[slot].pure)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+//
+// Evaluates the value of the variable in the given slot.
+// The value string is parsed and compiled only once until it is changed, and
+// the resulting value is reused until the variable or one it depends on is changed.
+// In EM_READ_VIEW mode, nothing in this object is changed; see EvaluationContext.
+//
+Number VariableStore::evaluate(int slot, EvaluationContext& context)
+{
+    VariableSlot& v = slots[slot];
+    if (context.isInEvaluation(slot))
+    {
+        throw RecursiveVariableAccessException(v.key);
+    }
+    if (context.isReadView())
+    {
+        return evaluateInView(slot, context);
+    }
+    if (v.value.empty())
+    {
+        return Number(0L);
+    }
+    if (v.valid)
+    {
+        checkInEvaluation(slot, context);
+        return v.result;
+    }
+    if (isComputed(slot))
+    {
+        v.result = Number::bigReal((*v.constant)(Number::getPrecision()));
+        v.valid = true;
+        return v.result;
+    }
+    if (!v.program)
+    {
+        if (!v.arena)
+        {
+            v.arena = new ExpressionArena;
+        }
+        try
+        {
+            // the tree is only evaluated, so that it can be optimized.
+            Expression* expr = Optimizer(*v.arena).run(Expression::parse(v.value.c_str(), v.value.bytes(), *v.arena, true));
+            v.program = new Program(expr);
+            v.expr = expr;
+        }
+        catch (...)
+        {
+            v.arena->clear();
+            throw;
+        }
+    }
+    Number value;
+    context.setInEvaluation(slot);
+    try
+    {
+        value = v.program->run(context);
+    }
+    catch (...)
+    {
+        context.unsetInEvaluation(slot);
+        throw;
+    }
+    context.unsetInEvaluation(slot);
+    if (v.pure)
+    {
+        v.result = value;
+        v.valid = true;
+    }
+    return value;
+}
+
+
+//
+// Evaluates the value of the variable in the given slot only reading this object.
+// The value already evaluated is returned as is, and the others are parsed into the context,
+// which can be done on any thread as long as no variable is changed.
+//
+Number VariableStore::evaluateInView(int slot, EvaluationContext& context) const
+{
+    const VariableSlot& v = slots[slot];
+    if (v.value.empty())
+    {
+        return Number(0L);
+    }
+    if (v.valid)
+    {
+        checkInEvaluation(slot, context);
+        return v.result;
+    }
+    if (isComputed(slot))
+    {
+        // BigReal keeps the one computed for all the threads.
+        return Number::bigReal((*v.constant)(Number::getPrecision()));
+    }
+    Expression* expr = context.getExpression(slot);
+    if (!expr)
+    {
+        ExpressionArena& arena = context.getArena();
+        expr = Optimizer(arena).run(Expression::parse(v.value.c_str(), v.value.bytes(), arena, true));
+        context.setExpression(slot, expr);
+    }
+    Number value;
+    context.setInEvaluation(slot);
+    try
+    {
+        value = expr->evaluate(context);
+    }
+    catch (...)
+    {
+        context.unsetInEvaluation(slot);
+        throw;
+    }
+    context.unsetInEvaluation(slot);
+    return value;
+}
+
+
+//
+// Throws RecursiveVariableAccessException if a slot in evaluation is reachable from the given slot,
+// as evaluating its value again would do. This keeps the cached value of the slot
+// from hiding a recursive reference, e.g. A=B after B=A+1.
+// The visited slots are not marked in the slots but locally, as this runs in EM_READ_VIEW mode too.
+//
+void VariableStore::checkInEvaluation(int slot, const EvaluationContext& context) const
+{
+    if (!context.hasInEvaluation())
+    {
+        return;
+    }
+    std::vector<bool> visited(slots.size(), false);
+    std::vector<int> stack(slots[slot].dependencies);
+    while (!stack.empty())
+    {
+        int next = stack.back();
+        stack.pop_back();
+        if (context.isInEvaluation(next))
+        {
+            throw RecursiveVariableAccessException(slots[next].key);
+        }
+        if (visited[next])
+        {
+            continue;
+        }
+        visited[next] = true;
+        const std::vector<int>& dependencies = slots[next].dependencies;
+        stack.insert(stack.end(), dependencies.begin(), dependencies.end());
+    }
+}
+
+
+//
+// Discards the parsed form of the given slot.
+//
+void VariableStore::invalidateCache(int slot)
+{
+    VariableSlot& v = slots[slot];
+    delete v.program;
+    v.program = NULL;
+    v.expr = NULL;
+    if (v.arena)
+    {
+        v.arena->clear();
+    }
+    v.valid = false;
+}
+
+
+void VariableStore::invalidate()
+{
+    for (size_t slot = 0; slot < slots.size(); slot++)
+    {
+        invalidateCache(slot);
+    }
+    generation++;
 }
 
 
 //
 // Tries to complement the given string (not null-terminated) with the existing operators.
+// As the keys are ordered by their bytes, the candidates are found next to each other.
 //
 void VariableStore::Complement(std::vector<char> &buffer) const
 {
     std::vector<const char *> match;
     size_t n = ~0;
-    for (VariableMap::const_iterator iter = VariableMap::begin(); iter != VariableMap::end(); iter++)
+    Glib::ustring prefix(std::string(&buffer[0], buffer.size()));
+    for (VariableIndexMap::const_iterator iter = index.lower_bound(prefix); iter != index.end(); iter++)
     {
         const char *s = iter->first.c_str();
-        if (!strncmp(s, &buffer[0], buffer.size()))
+        if (strncmp(s, &buffer[0], buffer.size()))
         {
-            match.push_back(s);
-            size_t m = strlen(s);
-            if (n > m)
-            {
-                n = m;
-            }
+            break;
+        }
+        if (!slots[iter->second].defined)
+        {
+            continue;
+        }
+        match.push_back(s);
+        size_t m = strlen(s);
+        if (n > m)
+        {
+            n = m;
         }
     }
     if (match.size() == 1)
@@ -5,15 +5,21 @@
 #define IKURA_VARIABLESTORE_H
 
 
+#include <deque>
 #include <map>
-#include <set>
 #include <vector>
 #include <glibmm/ustring.h>
 #include <sigc++/sigc++.h>
+#include "Number.h"
+#include "EvaluationContext.h"
 
 
 namespace hnrt
 {
+    //
+    // Orders variable keys by their bytes.
+    // Unlike Glib::ustring::operator <, this does not go through locale collation.
+    //
     class VariableKeyLessThan
     {
     public:
@@ -22,21 +28,54 @@ namespace hnrt
     };
 
 
-    typedef std::map<Glib::ustring, Glib::ustring, VariableKeyLessThan> VariableMap;
-    typedef std::pair<Glib::ustring, Glib::ustring> VariableMapEntry;
-    typedef std::set<Glib::ustring, VariableKeyLessThan> VariableKeySet;
+    typedef std::map<Glib::ustring, int, VariableKeyLessThan> VariableIndexMap;
+    typedef std::pair<Glib::ustring, int> VariableIndexMapEntry;
+
+
+    class Expression;
+    class Program;
+
+
+    //
+    // Variable interned into an integer slot
+    //
+    struct VariableSlot
+    {
+        Glib::ustring key;
+        Glib::ustring value;
+        bool defined; // false if the key is only referred to by the value of another variable
+        Expression* expr; // parsed form of value; NULL until it is evaluated
+        ExpressionArena* arena; // of expr; NULL until it is first parsed
+        Program* program; // compiled form of expr
+        bool valid; // true if result is up to date
+        bool pure; // true if neither value nor the values it depends on contain an assignment
+        Number result;
+        BigReal* (*constant)(size_t); // computes the built-in constant in the working precision; NULL otherwise
+        std::vector<int> dependencies; // slots that value refers to
+        std::vector<int> dependents; // slots whose values refer to this one
+        unsigned long mark; // traversal generation that visited this slot last
+    };
 
 
     //
     // Variable name-to-value mapping singleton class
     //
-    class VariableStore : public VariableMap
+    // Each key is interned into a slot once, and the slot index is what
+    // Parser stores in Variable and AssignExpression,
+    // so that the evaluation does not need to look up the key.
+    //
+    class VariableStore
     {
     public:
 
         static VariableStore &instance() { return singleton; }
 
-        virtual ~VariableStore() {}
+        virtual ~VariableStore();
+
+        //
+        // Adds the variables A to Z and the built-in read-only constants.
+        //
+        void addDefaults();
 
         //
         // Call this method once default values were added.
@@ -44,33 +83,73 @@ namespace hnrt
         //
         void periodToDecimalPoint();
 
-        bool hasKey(const Glib::ustring& key) const;
+        bool hasKey(const Glib::ustring& key) const { return find(key) >= 0; }
+
+        //
+        // Returns the slot index of the given variable.
+        // If not found, -1 is returned.
+        //
+        int find(const Glib::ustring& key) const;
+
+        const Glib::ustring& getKey(int slot) const { return slots[slot].key; }
 
         //
         // Searchs the map for the given key and
         // returns the value associated with it.
         // If not found, an empty string is returned.
-        // If the given key is in evaluation, RecursiveVariableAccessException is thrown.
         //
         Glib::ustring getValue(const Glib::ustring& key) const;
 
+        //
+        // Changes the value of the given variable.
+        // The variables depending on it are recomputed and
+        // signalChange is emitted once for each of the affected variables.
+        // If the value refers to the given variable directly or indirectly,
+        // RecursiveVariableAccessException is thrown and nothing is changed.
+        //
         void setValue(const Glib::ustring& key, const Glib::ustring& value);
+        void setValue(int slot, const Glib::ustring& value);
 
         void add(const Glib::ustring& key);
         void add(const Glib::ustring& key, const Glib::ustring& value);
 
-        bool isInEvaluation(const Glib::ustring& key) const;
+        //
+        // Adds the built-in constant, whose value is given by the function in the working precision
+        // of Number if set, or parsed from the given string otherwise.
+        //
+        void add(const Glib::ustring& key, const Glib::ustring& value, BigReal* (*constant)(size_t));
+
+        //
+        // Evaluates the value of the variable in the given slot.
+        // The value string is parsed and compiled only once until it is changed, and
+        // the resulting value is reused until the variable or one it depends on is changed.
+        // In EM_READ_VIEW mode, nothing in this object is changed; see EvaluationContext.
+        //
+        Number evaluate(int slot, EvaluationContext& context);
+
+        //
+        // Returns true if evaluating the given slot has no side effect,
+        // that is, neither its value nor the ones it depends on contain an assignment.
+        // Only the value of such a variable can be cached.
+        //
+        bool isPure(int slot) const { return slots[slot].pure; }
+
+        //
+        // Returns true if any variable is not pure.
+        //
+        bool hasImpure() const;
 
         //
-        // Adds the given key to inEvaluation set.
-        // If the same key is already in this set, RecursiveVariableAccessException is thrown.
+        // Returns the number of times the variables were added or changed so far.
+        // The caller can tell if what it derived from the variables is still up to date.
         //
-        void setInEvaluation(const Glib::ustring& key);
+        unsigned long getGeneration() const { return generation; }
 
         //
-        // Removes the given key from inEvaluation set.
+        // Drops the expressions parsed and the values evaluated so far, as they depend on
+        // the working precision of real numbers, which has just been changed.
         //
-        void unsetInEvaluation(const Glib::ustring& key);
+        void invalidate();
 
         //
         // Tries to complement the given string (not null-terminated) with the existing operators.
@@ -84,10 +163,24 @@ namespace hnrt
 
         static VariableStore singleton;
 
-        VariableStore() {}
+        VariableStore() : traversal(0), generation(0) {}
         VariableStore(const VariableStore &) {}
-
-        VariableKeySet inEvaluation;
+        int intern(const Glib::ustring& key);
+        void change(int slot, const Glib::ustring& value);
+        void getReferences(const Glib::ustring& value, std::vector<int>& references);
+        void checkCycle(int slot, const std::vector<int>& references);
+        void setDependencies(int slot, const std::vector<int>& references);
+        void getAffected(int slot, std::vector<int>& affected);
+        void recompute(const std::vector<int>& affected);
+        Number evaluateInView(int slot, EvaluationContext& context) const;
+        void checkInEvaluation(int slot, const EvaluationContext& context) const;
+        bool isComputed(int slot) const { return slots[slot].constant && Number::getPrecision(); }
+        void invalidateCache(int slot);
+
+        std::deque<VariableSlot> slots;
+        VariableIndexMap index;
+        unsigned long traversal; // generation of the graph traversal
+        unsigned long generation; // incremented whenever a variable is added or changed
         sigc::signal<void, const char*, const char*> sigAdd;
         sigc::signal<void, const char*, const char*> sigChange;
     };